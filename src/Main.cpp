@@ -40,6 +40,7 @@
 #include "imgui_impl_opengl3.h"
 
 #include "Loader.h"
+#include "AsyncSceneLoader.h"
 #include "boyTestScene.h"
 #include "ajaxTestScene.h"
 #include "cornellTestScene.h"
@@ -60,6 +61,7 @@ using namespace GLSLPT;
 Scene* scene       = nullptr;
 Renderer* renderer = nullptr;
 RenderOptions	renderOptions;
+AsyncSceneLoader sceneLoader;
 
 std::vector<string> sceneFiles;
 
@@ -115,6 +117,31 @@ bool InitRenderer()
     return true;
 }
 
+// The previous scene is rendered until the loader is done, only the GL upload happens here
+void SwapInLoadedScene(GLFWwindow* window)
+{
+    if (!sceneLoader.IsFinished())
+        return;
+
+    RenderOptions loadedOptions;
+    Scene *loaded = sceneLoader.Take(loadedOptions);
+    if (loaded == nullptr)
+        return;
+
+    delete renderer;
+    renderer = nullptr;
+    delete scene;
+
+    scene = loaded;
+    renderOptions = loadedOptions;
+    scene->renderOptions = renderOptions;
+    selectedInstance = 0;
+
+    glfwRestoreWindow(window);
+    glfwSetWindowSize(window, renderOptions.resolution.x, renderOptions.resolution.y);
+    InitRenderer();
+}
+
 // TODO: Fix occassional crashes when saving screenshot
 void SaveFrame(const std::string filename)
 {
@@ -236,6 +263,7 @@ void EditTransform(const float* view, const float* projection, float* matrix)
 void MainLoop(GLFWwindow* window) {
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
+        SwapInLoadedScene(window);
 
         // Start the Dear ImGui frame
         ImGui_ImplOpenGL3_NewFrame();
@@ -263,10 +291,27 @@ void MainLoop(GLFWwindow* window) {
             }
 
             if (ImGui::Combo("Scene", &sampleSceneIndex, scenes.data(), scenes.size())) {
-                LoadScene(sceneFiles[sampleSceneIndex]);
-                glfwRestoreWindow(window);
-                glfwSetWindowSize(window, renderOptions.resolution.x, renderOptions.resolution.y);
-                InitRenderer();
+                sceneLoader.Start(sceneFiles[sampleSceneIndex], renderOptions);
+            }
+
+            if (sceneLoader.IsLoading()) {
+                const LoadProgress &progress = sceneLoader.Progress();
+                LoadStage stage = progress.GetStage();
+                int done = progress.GetDone();
+                int total = progress.GetTotal();
+
+                char overlay[64];
+                if (total > 0)
+                    snprintf(overlay, sizeof(overlay), "%s %d/%d", LoadProgress::StageName(stage), done, total);
+                else
+                    snprintf(overlay, sizeof(overlay), "%s", LoadProgress::StageName(stage));
+
+                // Stages without a count show how far through the stages the load is
+                float fraction = total > 0 ? float(done) / total : float(stage) / LoadStageDone;
+                ImGui::Text("Loading %s", sceneLoader.Filename().c_str());
+                ImGui::ProgressBar(fraction, ImVec2(-1, 0), overlay);
+                if (ImGui::Button("Cancel Loading"))
+                    sceneLoader.Cancel();
             }
 
             bool optionsChanged = false;
@@ -429,6 +474,9 @@ void MainLoop(GLFWwindow* window) {
             const std::string arg(argv[i]);
             if (arg == "-s" || arg == "--scene") {
                 sceneFile = argv[++i];
+            } else if (arg == "-c" || arg == "--asset-cache") {
+                // Megabytes of meshes, textures and HDRs kept for reuse across scene switches
+                AssetCache::Instance().SetCapacity(size_t(atoi(argv[++i])) * 1024 * 1024);
             } else if (arg[0] == '-') {
                 printf("Unknown option %s \n'", arg.c_str());
                 exit(0);
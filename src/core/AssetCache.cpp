@@ -0,0 +1,191 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "AssetCache.h"
+#include "Hash.h"
+
+namespace GLSLPT
+{
+    namespace
+    {
+        // Keeps assets of different types apart when their keys happen to match
+        int AssetType(const Mesh *) { return 0; }
+        int AssetType(const Texture *) { return 1; }
+        int AssetType(const HDRData *) { return 2; }
+
+        size_t AssetBytes(const Mesh *mesh)
+        {
+            return (mesh->verticesUVX.size() + mesh->normalsUVY.size()) * sizeof(Vec4) +
+                (mesh->indices.size() + mesh->bvh->GetNumIndices()) * sizeof(int) +
+                mesh->bvh->GetNodeCount() * sizeof(RadeonRays::Bvh::FlatNode);
+        }
+
+        size_t AssetBytes(const Texture *texture)
+        {
+            return texture->LevelBytes();
+        }
+
+        size_t AssetBytes(const HDRData *hdr)
+        {
+            return hdr->RadianceBytes() + hdr->SamplingBytes();
+        }
+
+        template <typename T>
+        void Destroy(void *asset)
+        {
+            delete (T *)asset;
+        }
+    }
+
+    AssetCache &AssetCache::Instance()
+    {
+        // Never destroyed, scenes held by other globals may still release into it at exit
+        static AssetCache *cache = new AssetCache;
+        return *cache;
+    }
+
+    void AssetCache::SetCapacity(size_t newCapacity)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        capacity = newCapacity;
+        evict(capacity);
+    }
+
+    void AssetCache::Trim()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        evict(0);
+    }
+
+    size_t AssetCache::Bytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return bytes;
+    }
+
+    int AssetCache::NumAssets()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+    template <typename T>
+    T *AssetCache::acquire(uint64_t key)
+    {
+        int type = AssetType((T *)nullptr);
+        key = Hash::Bytes(&type, sizeof(type), key);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it == entries.end())
+            return nullptr;
+
+        Entry &entry = it->second;
+        if (entry.refs++ == 0)
+            lru.erase(entry.lruPosition);
+
+        return (T *)entry.asset;
+    }
+
+    template <typename T>
+    T *AssetCache::add(uint64_t key, T *asset)
+    {
+        int type = AssetType(asset);
+        key = Hash::Bytes(&type, sizeof(type), key);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end())
+        {
+            // Loaded by another scene in the meantime
+            Entry &entry = it->second;
+            if (entry.refs++ == 0)
+                lru.erase(entry.lruPosition);
+
+            delete asset;
+            return (T *)entry.asset;
+        }
+
+        Entry entry;
+        entry.asset = asset;
+        entry.destroy = Destroy<T>;
+        entry.bytes = AssetBytes(asset);
+        entry.refs = 1;
+        entries[key] = entry;
+        keys[asset] = key;
+        bytes += entry.bytes;
+
+        evict(capacity);
+        return asset;
+    }
+
+    template <typename T>
+    void AssetCache::release(T *asset)
+    {
+        if (asset == nullptr)
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = keys.find(asset);
+        if (it == keys.end())
+        {
+            delete asset;
+            return;
+        }
+
+        Entry &entry = entries[it->second];
+        if (--entry.refs == 0)
+        {
+            lru.push_front(it->second);
+            entry.lruPosition = lru.begin();
+            evict(capacity);
+        }
+    }
+
+    void AssetCache::evict(size_t limit)
+    {
+        while (bytes > limit && !lru.empty())
+        {
+            auto it = entries.find(lru.back());
+            lru.pop_back();
+
+            Entry &entry = it->second;
+            keys.erase(entry.asset);
+            entry.destroy(entry.asset);
+            bytes -= entry.bytes;
+            entries.erase(it);
+        }
+    }
+
+    Mesh *AssetCache::AcquireMesh(uint64_t key) { return acquire<Mesh>(key); }
+    Texture *AssetCache::AcquireTexture(uint64_t key) { return acquire<Texture>(key); }
+    HDRData *AssetCache::AcquireHDR(uint64_t key) { return acquire<HDRData>(key); }
+
+    Mesh *AssetCache::AddMesh(uint64_t key, Mesh *mesh) { return add(key, mesh); }
+    Texture *AssetCache::AddTexture(uint64_t key, Texture *texture) { return add(key, texture); }
+    HDRData *AssetCache::AddHDR(uint64_t key, HDRData *hdr) { return add(key, hdr); }
+
+    void AssetCache::Release(Mesh *mesh) { release(mesh); }
+    void AssetCache::Release(Texture *texture) { release(texture); }
+    void AssetCache::Release(HDRData *hdr) { release(hdr); }
+}
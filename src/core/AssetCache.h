@@ -0,0 +1,106 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "hdrloader.h"
+#include "Mesh.h"
+#include "Texture.h"
+
+namespace GLSLPT
+{
+    // Keeps loaded meshes with their BVH, textures and environment maps alive across
+    // scenes so a scene sharing assets with an earlier one doesn't load them again.
+    // Scenes hold a reference to every asset they took from or added to the cache and
+    // release it when they are deleted. Released assets stay until the cache grows past
+    // its capacity, then the least recently released are deleted first. Assets still
+    // referenced are never deleted, even if they alone exceed the capacity.
+    // Keys include the file contents and everything that changes how an asset is
+    // imported. Safe to use from the loading threads
+    class AssetCache
+    {
+    public:
+        static AssetCache &Instance();
+
+        void SetCapacity(size_t bytes);
+        size_t Capacity() const { return capacity; }
+
+        // The asset stored under key with a reference taken, or nullptr
+        Mesh *AcquireMesh(uint64_t key);
+        Texture *AcquireTexture(uint64_t key);
+        HDRData *AcquireHDR(uint64_t key);
+
+        // Stores a loaded asset with a reference taken for the caller. If the key is
+        // already taken the asset is deleted and the stored one returned instead
+        Mesh *AddMesh(uint64_t key, Mesh *mesh);
+        Texture *AddTexture(uint64_t key, Texture *texture);
+        HDRData *AddHDR(uint64_t key, HDRData *hdr);
+
+        // Gives back a reference. Assets that were never added are deleted right away
+        void Release(Mesh *mesh);
+        void Release(Texture *texture);
+        void Release(HDRData *hdr);
+
+        // Deletes every asset that isn't referenced
+        void Trim();
+
+        // Held by referenced and released assets together
+        size_t Bytes();
+        int NumAssets();
+
+    private:
+        AssetCache() : capacity(kDefaultCapacity), bytes(0) {}
+        AssetCache(const AssetCache&) = delete;
+        AssetCache& operator = (const AssetCache&) = delete;
+
+        static const size_t kDefaultCapacity = size_t(1024) * 1024 * 1024;
+
+        struct Entry
+        {
+            void *asset;
+            void (*destroy)(void *asset);
+            size_t bytes;
+            int refs;
+            std::list<uint64_t>::iterator lruPosition;
+        };
+
+        template <typename T> T *acquire(uint64_t key);
+        template <typename T> T *add(uint64_t key, T *asset);
+        template <typename T> void release(T *asset);
+        void evict(size_t limit);
+
+        std::mutex mutex;
+        std::unordered_map<uint64_t, Entry> entries;
+        std::unordered_map<const void *, uint64_t> keys;
+
+        // Keys of the unreferenced assets, most recently released first
+        std::list<uint64_t> lru;
+
+        size_t capacity;
+        size_t bytes;
+    };
+}
@@ -0,0 +1,326 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "BlockCompression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace GLSLPT
+{
+    namespace BlockCompression
+    {
+        namespace
+        {
+            void LoadBlock(const unsigned char *rgb, int pitch, float texels[16][3])
+            {
+                for (int y = 0; y < 4; y++)
+                {
+                    for (int x = 0; x < 4; x++)
+                    {
+                        for (int c = 0; c < 3; c++)
+                            texels[y * 4 + x][c] = rgb[y * pitch + x * 3 + c];
+                    }
+                }
+            }
+
+            // Fits a line through the block colours along their principal axis and
+            // returns the two extreme points of the projections as endpoints
+            void FitEndpoints(const float texels[16][3], float e0[3], float e1[3])
+            {
+                float mean[3] = { 0.0f, 0.0f, 0.0f };
+                for (int i = 0; i < 16; i++)
+                {
+                    for (int c = 0; c < 3; c++)
+                        mean[c] += texels[i][c] * (1.0f / 16.0f);
+                }
+
+                float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+                for (int i = 0; i < 16; i++)
+                {
+                    float d[3] = { texels[i][0] - mean[0], texels[i][1] - mean[1], texels[i][2] - mean[2] };
+                    cov[0] += d[0] * d[0];
+                    cov[1] += d[0] * d[1];
+                    cov[2] += d[0] * d[2];
+                    cov[3] += d[1] * d[1];
+                    cov[4] += d[1] * d[2];
+                    cov[5] += d[2] * d[2];
+                }
+
+                // A few power iterations are plenty for a 3x3 covariance
+                float axis[3] = { 1.0f, 1.0f, 1.0f };
+                for (int iter = 0; iter < 8; iter++)
+                {
+                    float next[3] = {
+                        cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                        cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                        cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2] };
+                    float len = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+                    if (len < 1e-6f)
+                        break;
+                    for (int c = 0; c < 3; c++)
+                        axis[c] = next[c] / len;
+                }
+
+                float minT = 1e30f;
+                float maxT = -1e30f;
+                for (int i = 0; i < 16; i++)
+                {
+                    float t = (texels[i][0] - mean[0]) * axis[0] + (texels[i][1] - mean[1]) * axis[1] + (texels[i][2] - mean[2]) * axis[2];
+                    minT = std::min(minT, t);
+                    maxT = std::max(maxT, t);
+                }
+
+                for (int c = 0; c < 3; c++)
+                {
+                    e0[c] = std::min(std::max(mean[c] + axis[c] * minT, 0.0f), 255.0f);
+                    e1[c] = std::min(std::max(mean[c] + axis[c] * maxT, 0.0f), 255.0f);
+                }
+            }
+
+            // Picks the closest palette entry for every texel, returns the total squared error
+            float AssignIndices(const float texels[16][3], const float palette[][3], int paletteSize, int indices[16])
+            {
+                float error = 0.0f;
+                for (int i = 0; i < 16; i++)
+                {
+                    float best = 1e30f;
+                    for (int p = 0; p < paletteSize; p++)
+                    {
+                        float dr = texels[i][0] - palette[p][0];
+                        float dg = texels[i][1] - palette[p][1];
+                        float db = texels[i][2] - palette[p][2];
+                        float d = dr * dr + dg * dg + db * db;
+                        if (d < best)
+                        {
+                            best = d;
+                            indices[i] = p;
+                        }
+                    }
+                    error += best;
+                }
+                return error;
+            }
+
+            uint16_t To565(const float c[3])
+            {
+                int r = (int)std::round(c[0] * 31.0f / 255.0f);
+                int g = (int)std::round(c[1] * 63.0f / 255.0f);
+                int b = (int)std::round(c[2] * 31.0f / 255.0f);
+                return (uint16_t)((r << 11) | (g << 5) | b);
+            }
+
+            void From565(uint16_t v, float c[3])
+            {
+                int r = (v >> 11) & 31;
+                int g = (v >> 5) & 63;
+                int b = v & 31;
+                c[0] = (float)((r << 3) | (r >> 2));
+                c[1] = (float)((g << 2) | (g >> 4));
+                c[2] = (float)((b << 3) | (b >> 2));
+            }
+
+            void EncodeBC4(const unsigned char *rgb, int pitch, int channel, unsigned char *block)
+            {
+                int values[16];
+                int lo = 255;
+                int hi = 0;
+                for (int i = 0; i < 16; i++)
+                {
+                    values[i] = rgb[(i / 4) * pitch + (i % 4) * 3 + channel];
+                    lo = std::min(lo, values[i]);
+                    hi = std::max(hi, values[i]);
+                }
+
+                // Eight value mode needs the first endpoint to be the larger one
+                block[0] = (unsigned char)hi;
+                block[1] = (unsigned char)lo;
+
+                uint64_t bits = 0;
+                if (hi > lo)
+                {
+                    for (int i = 0; i < 16; i++)
+                    {
+                        // Rank 0 is the high endpoint and 7 the low one, which are stored
+                        // as indices 0 and 1 with the interpolated values after them
+                        int rank = (int)std::round((hi - values[i]) * 7.0f / (hi - lo));
+                        int index = rank == 0 ? 0 : rank == 7 ? 1 : rank + 1;
+                        bits |= (uint64_t)index << (3 * i);
+                    }
+                }
+
+                for (int i = 0; i < 6; i++)
+                    block[2 + i] = (unsigned char)(bits >> (8 * i));
+            }
+
+            // Little endian bit writer for BC7 blocks
+            struct BitWriter
+            {
+                unsigned char *data;
+                int pos;
+
+                void Write(uint32_t value, int count)
+                {
+                    for (int i = 0; i < count; i++, pos++)
+                    {
+                        if (value & (1u << i))
+                            data[pos >> 3] |= (unsigned char)(1u << (pos & 7));
+                    }
+                }
+            };
+
+            const int kBC7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+            // Quantizes an endpoint to seven bits plus a shared p-bit, keeping the p-bit
+            // that reproduces the colour best
+            void QuantizeBC7Endpoint(const float e[3], int q[3], int &pbit)
+            {
+                float bestError = 1e30f;
+                for (int p = 0; p < 2; p++)
+                {
+                    int candidate[3];
+                    float error = 0.0f;
+                    for (int c = 0; c < 3; c++)
+                    {
+                        candidate[c] = std::min(std::max((int)std::round((e[c] - p) * 0.5f), 0), 127);
+                        float d = e[c] - (float)((candidate[c] << 1) | p);
+                        error += d * d;
+                    }
+
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        pbit = p;
+                        memcpy(q, candidate, sizeof(candidate));
+                    }
+                }
+            }
+        }
+
+        void EncodeBC1(const unsigned char *rgb, int pitch, unsigned char *block)
+        {
+            float texels[16][3];
+            LoadBlock(rgb, pitch, texels);
+
+            float e0[3], e1[3];
+            FitEndpoints(texels, e0, e1);
+
+            uint16_t c0 = To565(e1);
+            uint16_t c1 = To565(e0);
+
+            // Four colour mode requires c0 > c1
+            if (c0 < c1)
+                std::swap(c0, c1);
+
+            int indices[16] = { 0 };
+            if (c0 != c1)
+            {
+                float palette[4][3];
+                From565(c0, palette[0]);
+                From565(c1, palette[1]);
+                for (int c = 0; c < 3; c++)
+                {
+                    palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+                    palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+                }
+                AssignIndices(texels, palette, 4, indices);
+            }
+
+            uint32_t bits = 0;
+            for (int i = 0; i < 16; i++)
+                bits |= (uint32_t)indices[i] << (2 * i);
+
+            block[0] = (unsigned char)(c0 & 0xFF);
+            block[1] = (unsigned char)(c0 >> 8);
+            block[2] = (unsigned char)(c1 & 0xFF);
+            block[3] = (unsigned char)(c1 >> 8);
+            for (int i = 0; i < 4; i++)
+                block[4 + i] = (unsigned char)(bits >> (8 * i));
+        }
+
+        void EncodeBC5(const unsigned char *rgb, int pitch, unsigned char *block)
+        {
+            EncodeBC4(rgb, pitch, 0, block);
+            EncodeBC4(rgb, pitch, 1, block + 8);
+        }
+
+        void EncodeBC7(const unsigned char *rgb, int pitch, unsigned char *block)
+        {
+            float texels[16][3];
+            LoadBlock(rgb, pitch, texels);
+
+            float e[2][3];
+            FitEndpoints(texels, e[0], e[1]);
+
+            int q[2][3];
+            int pbit[2];
+            QuantizeBC7Endpoint(e[0], q[0], pbit[0]);
+            QuantizeBC7Endpoint(e[1], q[1], pbit[1]);
+
+            float palette[16][3];
+            for (int i = 0; i < 16; i++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    int a = (q[0][c] << 1) | pbit[0];
+                    int b = (q[1][c] << 1) | pbit[1];
+                    palette[i][c] = (float)(((64 - kBC7Weights4[i]) * a + kBC7Weights4[i] * b + 32) >> 6);
+                }
+            }
+
+            int indices[16];
+            AssignIndices(texels, palette, 16, indices);
+
+            // The first index is stored without its top bit, so it has to be below 8
+            if (indices[0] >= 8)
+            {
+                for (int c = 0; c < 3; c++)
+                    std::swap(q[0][c], q[1][c]);
+                std::swap(pbit[0], pbit[1]);
+                for (int i = 0; i < 16; i++)
+                    indices[i] = 15 - indices[i];
+            }
+
+            memset(block, 0, 16);
+            BitWriter writer = { block, 0 };
+            writer.Write(1u << 6, 7);
+            for (int c = 0; c < 3; c++)
+            {
+                writer.Write(q[0][c], 7);
+                writer.Write(q[1][c], 7);
+            }
+
+            // Alpha is unused, keep it opaque
+            writer.Write(127, 7);
+            writer.Write(127, 7);
+            writer.Write(pbit[0], 1);
+            writer.Write(pbit[1], 1);
+
+            writer.Write(indices[0], 3);
+            for (int i = 1; i < 16; i++)
+                writer.Write(indices[i], 4);
+        }
+    }
+}
@@ -0,0 +1,41 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+namespace GLSLPT
+{
+    // CPU encoders for 4x4 texel blocks. Each takes the top left texel of a block
+    // in an RGB8 image with the given row pitch in bytes and writes one block
+    namespace BlockCompression
+    {
+        // 8 bytes, RGB 5:6:5 endpoints with two bit indices
+        void EncodeBC1(const unsigned char *rgb, int pitch, unsigned char *block);
+
+        // 16 bytes, two independent BC4 channels taken from red and green
+        void EncodeBC5(const unsigned char *rgb, int pitch, unsigned char *block);
+
+        // 16 bytes, mode 6 only: one subset with 7 bit endpoints, p-bits and four bit indices
+        void EncodeBC7(const unsigned char *rgb, int pitch, unsigned char *block);
+    }
+}
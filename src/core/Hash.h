@@ -0,0 +1,156 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "MappedFile.h"
+
+namespace GLSLPT
+{
+    // Fast non-cryptographic 64 bit hash (xxHash64 style), used to
+    // detect identical file contents and to key on-disk caches
+    namespace Hash
+    {
+        static const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+        static const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+        static const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+        static const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+        static const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+        inline uint64_t Rotl(uint64_t x, int r)
+        {
+            return (x << r) | (x >> (64 - r));
+        }
+
+        inline uint64_t Read64(const unsigned char* p)
+        {
+            uint64_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        inline uint32_t Read32(const unsigned char* p)
+        {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        inline uint64_t Round(uint64_t acc, uint64_t input)
+        {
+            acc += input * kPrime2;
+            acc = Rotl(acc, 31);
+            return acc * kPrime1;
+        }
+
+        inline uint64_t Merge(uint64_t acc, uint64_t val)
+        {
+            acc ^= Round(0, val);
+            return acc * kPrime1 + kPrime4;
+        }
+
+        inline uint64_t Bytes(const void* buffer, size_t len, uint64_t seed = 0)
+        {
+            const unsigned char* p = (const unsigned char*)buffer;
+            const unsigned char* end = p + len;
+            uint64_t h;
+
+            if (len >= 32)
+            {
+                uint64_t v1 = seed + kPrime1 + kPrime2;
+                uint64_t v2 = seed + kPrime2;
+                uint64_t v3 = seed;
+                uint64_t v4 = seed - kPrime1;
+
+                const unsigned char* limit = end - 32;
+                do
+                {
+                    v1 = Round(v1, Read64(p));      p += 8;
+                    v2 = Round(v2, Read64(p));      p += 8;
+                    v3 = Round(v3, Read64(p));      p += 8;
+                    v4 = Round(v4, Read64(p));      p += 8;
+                } while (p <= limit);
+
+                h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+                h = Merge(h, v1);
+                h = Merge(h, v2);
+                h = Merge(h, v3);
+                h = Merge(h, v4);
+            }
+            else
+                h = seed + kPrime5;
+
+            h += (uint64_t)len;
+
+            while (p + 8 <= end)
+            {
+                h ^= Round(0, Read64(p));
+                h = Rotl(h, 27) * kPrime1 + kPrime4;
+                p += 8;
+            }
+
+            if (p + 4 <= end)
+            {
+                h ^= (uint64_t)Read32(p) * kPrime1;
+                h = Rotl(h, 23) * kPrime2 + kPrime3;
+                p += 4;
+            }
+
+            while (p < end)
+            {
+                h ^= (*p) * kPrime5;
+                h = Rotl(h, 11) * kPrime1;
+                p++;
+            }
+
+            h ^= h >> 33;
+            h *= kPrime2;
+            h ^= h >> 29;
+            h *= kPrime3;
+            h ^= h >> 32;
+
+            return h;
+        }
+
+        inline uint64_t String(const std::string& str, uint64_t seed = 0)
+        {
+            return Bytes(str.data(), str.size(), seed);
+        }
+
+        // Hashes the contents of a file. Returns false if it can't be read
+        inline bool File(const std::string& filename, uint64_t& hash, uint64_t& size)
+        {
+            MappedFile file;
+            if (!file.Open(filename))
+                return false;
+
+            hash = Bytes(file.Data(), file.Size());
+            size = file.Size();
+            return true;
+        }
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <atomic>
+
+namespace GLSLPT
+{
+    enum LoadStage
+    {
+        LoadStageParse,   // Reading the scene file
+        LoadStageCache,   // Restoring the scene cache
+        LoadStageAssets,  // Meshes, their BVHs, textures and the HDR, counted one by one
+        LoadStageBVH,     // Top level BVH
+        LoadStageFlatten, // Flattening the BVHs and copying the scene arrays
+        LoadStageDone
+    };
+
+    // Written by a scene that loads on a worker thread and read by the thread that
+    // waits for it. Any thread may cancel, loading then stops at the next asset or stage
+    class LoadProgress
+    {
+    public:
+        LoadProgress() : stage(LoadStageParse), done(0), total(0), cancelled(false) {}
+
+        void SetStage(LoadStage newStage, int newTotal = 0)
+        {
+            done = 0;
+            total = newTotal;
+            stage = newStage;
+        }
+
+        void Advance() { done++; }
+        void Cancel() { cancelled = true; }
+        void Reset()
+        {
+            SetStage(LoadStageParse);
+            cancelled = false;
+        }
+
+        LoadStage GetStage() const { return stage; }
+        int GetDone() const { return done; }
+        int GetTotal() const { return total; }
+        bool IsCancelled() const { return cancelled; }
+
+        static const char *StageName(LoadStage stage)
+        {
+            switch (stage)
+            {
+            case LoadStageParse:   return "Parsing";
+            case LoadStageCache:   return "Reading cache";
+            case LoadStageAssets:  return "Loading assets";
+            case LoadStageBVH:     return "Building scene BVH";
+            case LoadStageFlatten: return "Flattening BVH";
+            default:               return "Done";
+            }
+        }
+
+    private:
+        std::atomic<LoadStage> stage;
+        std::atomic<int> done;
+        std::atomic<int> total;
+        std::atomic<bool> cancelled;
+    };
+}
@@ -0,0 +1,178 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "MappedFile.h"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN 1
+#include <Windows.h>
+#undef min
+#undef max
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace GLSLPT
+{
+    MappedFile::MappedFile()
+        : data(nullptr)
+        , size(0)
+#if defined(_WIN32)
+        , fileHandle(INVALID_HANDLE_VALUE)
+        , mappingHandle(nullptr)
+#endif
+    {
+    }
+
+#if defined(_WIN32)
+    bool MappedFile::Open(const std::string &filename)
+    {
+        Close();
+
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize))
+        {
+            CloseHandle(file);
+            return false;
+        }
+
+        fileHandle = file;
+        size = (size_t)fileSize.QuadPart;
+
+        // Zero sized files cannot be mapped but are still valid
+        if (size == 0)
+            return true;
+
+        mappingHandle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mappingHandle == nullptr)
+        {
+            Close();
+            return false;
+        }
+
+        data = (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        if (data == nullptr)
+        {
+            Close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if (data != nullptr)
+            UnmapViewOfFile(data);
+        if (mappingHandle != nullptr)
+            CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(fileHandle);
+
+        data = nullptr;
+        size = 0;
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+    }
+
+    void MappedFile::Discard(size_t offset, size_t length) const
+    {
+        if (data == nullptr || offset >= size)
+            return;
+
+        // Unlocking pages that were never locked removes them from the working set
+        VirtualUnlock((void*)(data + offset), std::min(length, size - offset));
+    }
+#else
+    bool MappedFile::Open(const std::string &filename)
+    {
+        Close();
+
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        size = (size_t)st.st_size;
+
+        // Zero sized files cannot be mapped but are still valid
+        if (size == 0)
+        {
+            close(fd);
+            return true;
+        }
+
+        void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (ptr == MAP_FAILED)
+        {
+            size = 0;
+            return false;
+        }
+
+        madvise(ptr, size, MADV_SEQUENTIAL);
+        data = (const unsigned char*)ptr;
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if (data != nullptr)
+            munmap((void*)data, size);
+
+        data = nullptr;
+        size = 0;
+    }
+
+    void MappedFile::Discard(size_t offset, size_t length) const
+    {
+        if (data == nullptr || offset >= size)
+            return;
+
+        // Only whole pages inside the range are dropped
+        size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        size_t begin = (offset + pageSize - 1) & ~(pageSize - 1);
+        size_t end = std::min(offset + length, size) & ~(pageSize - 1);
+
+        if (end > begin)
+            madvise((void*)(data + begin), end - begin, MADV_DONTNEED);
+    }
+#endif
+}
@@ -26,13 +26,66 @@
 #include <tiny_obj_loader.h>
 
 #include "Mesh.h"
+#include "ObjLoader.h"
+#include "GltfLoader.h"
+#include "PlyLoader.h"
+#include "PtMeshLoader.h"
+#include "linear_bvh.h"
 #include <iostream>
 
 namespace GLSLPT
 {
+    RadeonRays::Bvh *CreateBvh(BvhBuilder builder, bool topLevel)
+    {
+        // Instances cost more to enter than triangles
+        float traversalCost = topLevel ? 10.0f : 2.0f;
+
+        // Mesh leaves of up to 4 triangles give about as many nodes as the SBVH
+        if (builder == BvhBuilderLbvh || builder == BvhBuilderHlbvh)
+            return new RadeonRays::LinearBvh(traversalCost, topLevel ? 1 : 4, builder == BvhBuilderHlbvh);
+
+        if (builder == BvhBuilderSbvh && !topLevel)
+            return new RadeonRays::SplitBvh(2.0f, 64, 0, 0.001f, 0);
+
+        return new RadeonRays::Bvh(traversalCost, 64, false);
+    }
+
     bool Mesh::LoadFromFile(const std::string &filename)
     {
         name = filename;
+
+        if (IsGltfAsset(filename))
+        {
+            if (LoadGltfMesh(filename, verticesUVX, normalsUVY, indices))
+                return true;
+
+            printf("Unable to load model\n");
+            return false;
+        }
+
+        // Precompiled meshes also restore the BVH
+        if (filename.size() > 7 && filename.compare(filename.size() - 7, 7, ".ptmesh") == 0)
+        {
+            if (LoadPtMesh(filename, *this))
+                return true;
+
+            printf("Unable to load model\n");
+            return false;
+        }
+
+        if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".ply") == 0)
+        {
+            if (LoadPly(filename, verticesUVX, normalsUVY, indices))
+                return true;
+
+            printf("Unable to load model\n");
+            return false;
+        }
+
+        // Native parser handles the common subset, everything else goes through tinyobj
+        if (LoadObjFast(filename, verticesUVX, normalsUVY, indices))
+            return true;
+
         tinyobj::attrib_t attrib;
         std::vector<tinyobj::shape_t> shapes;
         std::vector<tinyobj::material_t> materials;
@@ -45,62 +98,104 @@ namespace GLSLPT
             return false;
         }
 
-        // Loop over shapes
-        for (size_t s = 0; s < shapes.size(); s++) 
+        // Gather the corners of all shapes, faces are already triangulated
+        std::vector<ObjCorner> corners;
+        for (size_t s = 0; s < shapes.size(); s++)
+        {
+            for (size_t i = 0; i < shapes[s].mesh.indices.size(); i++)
+            {
+                tinyobj::index_t idx = shapes[s].mesh.indices[i];
+                corners.push_back(ObjCorner{ idx.vertex_index, idx.texcoord_index, idx.normal_index });
+            }
+        }
+
+        // Share vertices between corners with the same position, normal and uv
+        std::vector<ObjCorner> uniqueCorners;
+        WeldObjCorners(corners, indices, uniqueCorners);
+
+        for (size_t i = 0; i < uniqueCorners.size(); i++)
         {
-            // Loop over faces(polygon)
-            size_t index_offset = 0;
+            const ObjCorner &idx = uniqueCorners[i];
+            tinyobj::real_t vx = attrib.vertices[3 * idx.v + 0];
+            tinyobj::real_t vy = attrib.vertices[3 * idx.v + 1];
+            tinyobj::real_t vz = attrib.vertices[3 * idx.v + 2];
+            tinyobj::real_t nx = attrib.normals[3 * idx.vn + 0];
+            tinyobj::real_t ny = attrib.normals[3 * idx.vn + 1];
+            tinyobj::real_t nz = attrib.normals[3 * idx.vn + 2];
 
-            for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) 
+            tinyobj::real_t tx, ty;
+
+            // temporary fix
+            if (!attrib.texcoords.empty())
+            {
+                tx = attrib.texcoords[2 * idx.vt + 0];
+                ty = attrib.texcoords[2 * idx.vt + 1];
+            }
+            else
             {
-                int fv = shapes[s].mesh.num_face_vertices[f];
-                // Loop over vertices in the face.
-                for (size_t v = 0; v < fv; v++)
-                {
-                    // access to vertex
-                    tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-                    tinyobj::real_t vx = attrib.vertices[3 * idx.vertex_index + 0];
-                    tinyobj::real_t vy = attrib.vertices[3 * idx.vertex_index + 1];
-                    tinyobj::real_t vz = attrib.vertices[3 * idx.vertex_index + 2];
-                    tinyobj::real_t nx = attrib.normals[3 * idx.normal_index + 0];
-                    tinyobj::real_t ny = attrib.normals[3 * idx.normal_index + 1];
-                    tinyobj::real_t nz = attrib.normals[3 * idx.normal_index + 2];
-
-                    tinyobj::real_t tx, ty;
-                    
-                    // temporary fix
-                    if (!attrib.texcoords.empty())
-                    {
-                        tx = attrib.texcoords[2 * idx.texcoord_index + 0];
-                        ty = attrib.texcoords[2 * idx.texcoord_index + 1];
-                    }
-                    else
-                    {
-                        tx = ty = 0;
-                    }
-
-                    verticesUVX.push_back(Vec4(vx, vy, vz, tx));
-                    normalsUVY.push_back(Vec4(nx, ny, nz, ty));
-                }
-    
-                index_offset += fv;
+                tx = ty = 0;
             }
+
+            verticesUVX.push_back(Vec4(vx, vy, vz, tx));
+            normalsUVY.push_back(Vec4(nx, ny, nz, ty));
         }
 
         return true;
     }
 
+    void Mesh::Quantize()
+    {
+        if (verticesUVX.empty())
+            return;
+
+        Vec3 bmin = Vec3(verticesUVX[0]);
+        Vec3 bmax = bmin;
+        for (size_t i = 1; i < verticesUVX.size(); i++)
+        {
+            bmin = Vec3::Min(bmin, Vec3(verticesUVX[i]));
+            bmax = Vec3::Max(bmax, Vec3(verticesUVX[i]));
+        }
+
+        // Flat axes get a minimum extent so the grid stays invertible and
+        // normals aren't squashed too much by the non uniform scale
+        Vec3 extent = bmax - bmin;
+        float minExtent = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f)) / 256.0f;
+        Vec3 scale = Vec3::Max(extent, Vec3(minExtent, minExtent, minExtent)) * (1.0f / 65535.0f);
+
+        #pragma omp parallel for
+        for (int i = 0; i < verticesUVX.size(); i++)
+        {
+            Vec4 &v = verticesUVX[i];
+            v.x = Math::Clamp(std::round((v.x - bmin.x) / scale.x), 0.0f, 65535.0f);
+            v.y = Math::Clamp(std::round((v.y - bmin.y) / scale.y), 0.0f, 65535.0f);
+            v.z = Math::Clamp(std::round((v.z - bmin.z) / scale.z), 0.0f, 65535.0f);
+
+            // Normals go through the inverse transpose of the grid to mesh mapping
+            Vec4 &n = normalsUVY[i];
+            Vec3 gridNormal = Vec3(n.x * scale.x, n.y * scale.y, n.z * scale.z);
+            float len = Vec3::Length(gridNormal);
+            if (len > 0.0f)
+                gridNormal = gridNormal * (1.0f / len);
+
+            n.x = gridNormal.x;
+            n.y = gridNormal.y;
+            n.z = gridNormal.z;
+        }
+
+        dequantize = Mat4::Scale(scale) * Mat4::Translate(bmin);
+    }
+
     void Mesh::BuildBVH()
     {
-        const int numTris = verticesUVX.size() / 3;
+        const int numTris = indices.size() / 3;
         std::vector<RadeonRays::bbox> bounds(numTris);
 
         #pragma omp parallel for
         for (int i = 0; i < numTris; ++i)
         {
-            const Vec3 v1 = Vec3(verticesUVX[i * 3 + 0]);
-            const Vec3 v2 = Vec3(verticesUVX[i * 3 + 1]);
-            const Vec3 v3 = Vec3(verticesUVX[i * 3 + 2]);
+            const Vec3 v1 = Vec3(verticesUVX[indices[i * 3 + 0]]);
+            const Vec3 v2 = Vec3(verticesUVX[indices[i * 3 + 1]]);
+            const Vec3 v3 = Vec3(verticesUVX[indices[i * 3 + 2]]);
 
             bounds[i].grow(v1);
             bounds[i].grow(v2);
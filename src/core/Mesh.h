@@ -29,23 +29,43 @@
 
 namespace GLSLPT
 {    
+    // How a mesh BVH or the TLAS is built
+    enum BvhBuilder
+    {
+        BvhBuilderSbvh,     // SAH with spatial splits, slowest to build and fastest to trace. Meshes only
+        BvhBuilderMidpoint, // Splits at the middle of the centroids, the TLAS default
+        BvhBuilderLbvh,     // Morton code order, builds millions of triangles in well under a second
+        BvhBuilderHlbvh     // Morton code clusters joined by binned SAH, a little slower than LBVH
+    };
+
+    // Unbuilt BVH for builder. Top level BVHs keep one instance per leaf and can't
+    // use spatial splits, Sbvh gives them Midpoint
+    RadeonRays::Bvh *CreateBvh(BvhBuilder builder, bool topLevel);
+
     class Mesh
     {
     public:
-        Mesh()
+        Mesh(BvhBuilder builder = BvhBuilderSbvh)
+            : bvhBuilder(builder)
         { 
-            bvh = new RadeonRays::SplitBvh(2.0f, 64, 0, 0.001f, 0); 
-            //bvh = new RadeonRays::Bvh(2.0f, 64, false);
+            bvh = CreateBvh(builder, false);
         }
         ~Mesh() { delete bvh; }
 
         void BuildBVH();
         bool LoadFromFile(const std::string& filename);
+
+        // Snaps positions to a 16 bit grid spanning the mesh bounds. Positions and
+        // normals are left in grid space and dequantize maps them back to mesh space
+        void Quantize();
         
         std::vector<Vec4> verticesUVX; // Vertex Data + x coord of uv 
         std::vector<Vec4> normalsUVY;  // Normal Data + y coord of uv
+        std::vector<int> indices;      // Three per triangle into the vertex data
+        Mat4 dequantize;               // Identity unless the mesh is quantized
 
         RadeonRays::Bvh *bvh;
+        BvhBuilder bvhBuilder;
         std::string name;
     };
 
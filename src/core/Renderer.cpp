@@ -26,9 +26,61 @@
 #include "Renderer.h"
 #include "ShaderIncludes.h"
 #include "Scene.h"
+#include <algorithm>
+
+// S3TC and BPTC are core in GL 4.2 / widely available but not exposed by our glad build
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
 
 namespace GLSLPT
 {
+    // sRGB arrays are decoded to linear by the hardware before filtering
+    static GLenum InternalFormat(TextureFormat format, bool srgb)
+    {
+        switch (format)
+        {
+        case TextureFormatBC1: return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case TextureFormatBC5: return GL_COMPRESSED_RG_RGTC2;
+        case TextureFormatBC7: return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+        case TextureFormatRG8: return GL_RG8;
+        case TextureFormatR8:  return GL_R8;
+        default:               return srgb ? GL_SRGB8 : GL_RGB8;
+        }
+    }
+
+    static GLenum PixelFormat(TextureFormat format)
+    {
+        switch (format)
+        {
+        case TextureFormatRG8: return GL_RG;
+        case TextureFormatR8:  return GL_RED;
+        default:               return GL_RGB;
+        }
+    }
+
+    // Lookup tables wrap into rows once they outgrow this width. FetchRect in the shaders relies on it
+    static const int kTableWidth = 4096;
+
+    static void UploadTable(const std::vector<Vec4> &entries)
+    {
+        int width = entries.size() < kTableWidth ? (int)entries.size() : kTableWidth;
+        int rows = (entries.size() + kTableWidth - 1) / kTableWidth;
+
+        std::vector<Vec4> texels(entries);
+        texels.resize((size_t)width * rows, Vec4(0.0f, 0.0f, 0.0f, 0.0f));
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, rows, 0, GL_RGBA, GL_FLOAT, &texels[0]);
+    }
+
     Program *LoadShaders(const ShaderInclude::ShaderSource& vertShaderObj, const ShaderInclude::ShaderSource& fragShaderObj)
     {
         std::vector<Shader> shaders;
@@ -45,7 +97,9 @@ namespace GLSLPT
         , materialsTex(0)
         , transformsTex(0)
         , lightsTex(0)
-        , textureMapsArrayTex(0)
+        , textureArrayTex()
+        , textureRectsTex(0)
+        , pageTableOffset(0)
         , hdrTex(0)
         , hdrMarginalDistTex(0)
         , hdrConditionalDistTex(0)
@@ -78,7 +132,8 @@ namespace GLSLPT
         glDeleteTextures(1, &materialsTex);
         glDeleteTextures(1, &transformsTex);
         glDeleteTextures(1, &lightsTex);
-        glDeleteTextures(1, &textureMapsArrayTex);
+        glDeleteTextures(TextureAtlas::kMaxArrays, textureArrayTex);
+        glDeleteTextures(1, &textureRectsTex);
         glDeleteTextures(1, &hdrTex);
         glDeleteTextures(1, &hdrMarginalDistTex);
         glDeleteTextures(1, &hdrConditionalDistTex);
@@ -101,12 +156,13 @@ namespace GLSLPT
         quad = new Quad();
 
         //Create Buffer and Texture for BVH Tree
+        const RadeonRays::BvhTranslator &translator = scene->bvhTranslator;
         glGenBuffers(1, &BVHBuffer);
         glBindBuffer(GL_TEXTURE_BUFFER, BVHBuffer);
-        glBufferData(GL_TEXTURE_BUFFER, sizeof(RadeonRays::BvhTranslator::Node) * scene->bvhTranslator.nodes.size(), &scene->bvhTranslator.nodes[0], GL_STATIC_DRAW);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(uint32_t) * translator.packedNodes.size(), &translator.packedNodes[0], GL_STATIC_DRAW);
         glGenTextures(1, &BVHTex);
         glBindTexture(GL_TEXTURE_BUFFER, BVHTex);
-        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32F, BVHBuffer);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, BVHBuffer);
 
         //Create Buffer and Texture for VertexIndices
         glGenBuffers(1, &vertexIndicesBuffer);
@@ -119,18 +175,24 @@ namespace GLSLPT
         //Create Buffer and Texture for Vertices
         glGenBuffers(1, &verticesBuffer);
         glBindBuffer(GL_TEXTURE_BUFFER, verticesBuffer);
-        glBufferData(GL_TEXTURE_BUFFER, sizeof(Vec4) * scene->verticesUVX.size(), &scene->verticesUVX[0], GL_STATIC_DRAW);
+        if (scene->renderOptions.quantizeVertices)
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(QuantizedVertex) * scene->quantizedVertices.size(), &scene->quantizedVertices[0], GL_STATIC_DRAW);
+        else
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(Vec4) * scene->verticesUVX.size(), &scene->verticesUVX[0], GL_STATIC_DRAW);
         glGenTextures(1, &verticesTex);
         glBindTexture(GL_TEXTURE_BUFFER, verticesTex);
-        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, verticesBuffer);
+        glTexBuffer(GL_TEXTURE_BUFFER, scene->renderOptions.quantizeVertices ? GL_RGBA16UI : GL_RGBA32F, verticesBuffer);
 
         //Create Buffer and Texture for Normals
         glGenBuffers(1, &normalsBuffer);
         glBindBuffer(GL_TEXTURE_BUFFER, normalsBuffer);
-        glBufferData(GL_TEXTURE_BUFFER, sizeof(Vec4) * scene->normalsUVY.size(), &scene->normalsUVY[0], GL_STATIC_DRAW);
+        if (scene->renderOptions.quantizeVertices)
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(QuantizedNormal) * scene->quantizedNormals.size(), &scene->quantizedNormals[0], GL_STATIC_DRAW);
+        else
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(Vec4) * scene->normalsUVY.size(), &scene->normalsUVY[0], GL_STATIC_DRAW);
         glGenTextures(1, &normalsTex);
         glBindTexture(GL_TEXTURE_BUFFER, normalsTex);
-        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, normalsBuffer);
+        glTexBuffer(GL_TEXTURE_BUFFER, scene->renderOptions.quantizeVertices ? GL_RGBA16UI : GL_RGBA32F, normalsBuffer);
 
         //Create texture for Materials
         glGenTextures(1, &materialsTex);
@@ -160,45 +222,197 @@ namespace GLSLPT
             glBindTexture(GL_TEXTURE_2D, 0);
         }
 
-        if (!scene->textures.empty())
+        if (!scene->textureAtlas.rects.empty())
         {
-            glGenTextures(1, &textureMapsArrayTex);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D_ARRAY, textureMapsArrayTex);
-            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, scene->texWidth, scene->texHeight, scene->textures.size(), 0, GL_RGB, GL_UNSIGNED_BYTE, &scene->textureMapsArray[0]);
-            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            const TextureAtlas &atlas = scene->textureAtlas;
+
+            // Every texture format has its own array of atlas pages
+            glGenTextures(atlas.arrays.size(), textureArrayTex);
+            for (int i = 0; i < atlas.arrays.size(); i++)
+            {
+                const TextureAtlas::PageArray &array = atlas.arrays[i];
+                glBindTexture(GL_TEXTURE_2D_ARRAY, textureArrayTex[i]);
+
+                GLenum internalFormat = InternalFormat(array.format, array.srgb);
+
+                if (BlockSize(array.format) == 1)
+                    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormat, array.pageWidth, array.pageHeight, array.numPages, 0, PixelFormat(array.format), GL_UNSIGNED_BYTE, &array.pages[0]);
+                else
+                    glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormat, array.pageWidth, array.pageHeight, array.numPages, 0, array.pages.size(), &array.pages[0]);
+
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            }
+
+            //Create texture for the placement of each texture level in the atlas
+            glGenTextures(1, &textureRectsTex);
+            glBindTexture(GL_TEXTURE_2D, textureRectsTex);
+            UploadTable(atlas.rects);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+        else if (!scene->virtualTextures.IsEmpty())
+        {
+            const VirtualTextures &vt = scene->virtualTextures;
+
+            // Slots start out undefined, only resident pages are ever sampled
+            glGenTextures(vt.arrays.size(), textureArrayTex);
+            for (int i = 0; i < vt.arrays.size(); i++)
+            {
+                const VirtualTextures::PageArray &array = vt.arrays[i];
+                glBindTexture(GL_TEXTURE_2D_ARRAY, textureArrayTex[i]);
+
+                GLenum internalFormat = InternalFormat(array.format, array.srgb);
+
+                if (BlockSize(array.format) == 1)
+                    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormat, Texture::kPageSize, Texture::kPageSize, array.numSlots, 0, PixelFormat(array.format), GL_UNSIGNED_BYTE, nullptr);
+                else
+                    glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormat, Texture::kPageSize, Texture::kPageSize, array.numSlots, 0, array.numSlots * PageBytes(array.format), nullptr);
+
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            }
+
+            std::vector<VirtualTextures::PageUpload> uploads;
+            vt.ResidentPages(uploads);
+            UploadPages(uploads);
+
+            // No texture unit is left for the page table, so it follows the level entries
+            std::vector<Vec4> entries(vt.rects);
+            pageTableOffset = entries.size();
+            for (int i = 0; i < vt.PageTableTexels(); i++)
+                entries.push_back(vt.PageTableTexel(i));
+
+            glGenTextures(1, &textureRectsTex);
+            glBindTexture(GL_TEXTURE_2D, textureRectsTex);
+            UploadTable(entries);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glBindTexture(GL_TEXTURE_2D, 0);
         }
 
         // Environment Map
         if (scene->hdrData != nullptr)
         {
+            // Quantized formats were rounded at load time, so the driver's conversion is exact
+            GLint hdrInternalFormat = GL_RGB32F;
+            if (scene->hdrData->format == HDRFormatRGB16F)
+                hdrInternalFormat = GL_RGB16F;
+            else if (scene->hdrData->format == HDRFormatRGB9E5)
+                hdrInternalFormat = GL_RGB9_E5;
+
             glGenTextures(1, &hdrTex);
             glBindTexture(GL_TEXTURE_2D, hdrTex);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, scene->hdrData->width, scene->hdrData->height, 0, GL_RGB, GL_FLOAT, scene->hdrData->cols);
+            glTexImage2D(GL_TEXTURE_2D, 0, hdrInternalFormat, scene->hdrData->width, scene->hdrData->height, 0, GL_RGB, GL_FLOAT, scene->hdrData->cols);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
             glBindTexture(GL_TEXTURE_2D, 0);
 
-            glGenTextures(1, &hdrMarginalDistTex);
-            glBindTexture(GL_TEXTURE_2D, hdrMarginalDistTex);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, scene->hdrData->height, 1, 0, GL_RG, GL_FLOAT, scene->hdrData->marginalDistData);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-            glBindTexture(GL_TEXTURE_2D, 0);
+            if (scene->hdrData->luminancePyramid != nullptr)
+            {
+                // Pyramid levels are the mip levels, the pyramid takes the place of the conditional distribution
+                const HDRData *hdr = scene->hdrData;
+                glGenTextures(1, &hdrConditionalDistTex);
+                glBindTexture(GL_TEXTURE_2D, hdrConditionalDistTex);
+                const float *levelData = hdr->luminancePyramid;
+                for (int level = 0; level < hdr->pyramidLevels; level++)
+                {
+                    int levelWidth = hdr->pyramidWidth >> level > 1 ? hdr->pyramidWidth >> level : 1;
+                    int levelHeight = hdr->pyramidHeight >> level > 1 ? hdr->pyramidHeight >> level : 1;
+                    glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, levelWidth, levelHeight, 0, GL_RED, GL_FLOAT, levelData);
+                    levelData += levelWidth * levelHeight;
+                }
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hdr->pyramidLevels - 1);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+                glBindTexture(GL_TEXTURE_2D, 0);
+            }
+            else if (scene->hdrData->aliasTable != nullptr)
+            {
+                // Threshold bits and alias index, the alias table takes the place of the conditional distribution
+                glGenTextures(1, &hdrConditionalDistTex);
+                glBindTexture(GL_TEXTURE_2D, hdrConditionalDistTex);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, scene->hdrData->width, scene->hdrData->height, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, scene->hdrData->aliasTable);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glBindTexture(GL_TEXTURE_2D, 0);
+            }
+            else
+            {
+                glGenTextures(1, &hdrMarginalDistTex);
+                glBindTexture(GL_TEXTURE_2D, hdrMarginalDistTex);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, scene->hdrData->height, 1, 0, GL_RG, GL_FLOAT, scene->hdrData->marginalDistData);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glBindTexture(GL_TEXTURE_2D, 0);
 
-            glGenTextures(1, &hdrConditionalDistTex);
-            glBindTexture(GL_TEXTURE_2D, hdrConditionalDistTex);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, scene->hdrData->width, scene->hdrData->height, 0, GL_RG, GL_FLOAT, scene->hdrData->conditionalDistData);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-            glBindTexture(GL_TEXTURE_2D, 0);
+                glGenTextures(1, &hdrConditionalDistTex);
+                glBindTexture(GL_TEXTURE_2D, hdrConditionalDistTex);
+                if (scene->hdrData->halfConditionalDistData != nullptr)
+                {
+                    // Column index and half float pdf bits
+                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16UI, scene->hdrData->width, scene->hdrData->height, 0, GL_RG_INTEGER, GL_UNSIGNED_SHORT, scene->hdrData->halfConditionalDistData);
+                }
+                else
+                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, scene->hdrData->width, scene->hdrData->height, 0, GL_RG, GL_FLOAT, scene->hdrData->conditionalDistData);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glBindTexture(GL_TEXTURE_2D, 0);
+            }
         }
 
         initialized = true;
     }
 
+    void Renderer::UploadPages(const std::vector<VirtualTextures::PageUpload> &uploads)
+    {
+        const VirtualTextures &vt = scene->virtualTextures;
+
+        // Unit 0 has no array bound for the shaders, so the pages go through it
+        glActiveTexture(GL_TEXTURE0);
+        for (int i = 0; i < uploads.size(); i++)
+        {
+            const VirtualTextures::PageUpload &upload = uploads[i];
+            const VirtualTextures::PageArray &array = vt.arrays[upload.array];
+            glBindTexture(GL_TEXTURE_2D_ARRAY, textureArrayTex[upload.array]);
+
+            if (BlockSize(array.format) == 1)
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, upload.slot, Texture::kPageSize, Texture::kPageSize, 1, PixelFormat(array.format), GL_UNSIGNED_BYTE, upload.data);
+            else
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, upload.slot, Texture::kPageSize, Texture::kPageSize, 1, InternalFormat(array.format, array.srgb), PageBytes(array.format), upload.data);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    void Renderer::UpdatePageTable(const std::vector<int> &dirtyPages)
+    {
+        const VirtualTextures &vt = scene->virtualTextures;
+
+        // Four pages share a texel
+        std::vector<int> texels;
+        for (int i = 0; i < dirtyPages.size(); i++)
+            texels.push_back(dirtyPages[i] / 4);
+        std::sort(texels.begin(), texels.end());
+        texels.erase(std::unique(texels.begin(), texels.end()), texels.end());
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, textureRectsTex);
+        for (int i = 0; i < texels.size(); i++)
+        {
+            int entry = pageTableOffset + texels[i];
+            Vec4 slots = vt.PageTableTexel(texels[i]);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, entry % kTableWidth, entry / kTableWidth, 1, 1, GL_RGBA, GL_FLOAT, &slots);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
     void Renderer::Update(float secondsElapsed)
     {
         if (scene->instancesModified)
@@ -209,10 +423,12 @@ namespace GLSLPT
             glBindTexture(GL_TEXTURE_2D, materialsTex);
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, (sizeof(Material) / sizeof(Vec4)) * scene->materials.size(), 1, 0, GL_RGBA, GL_FLOAT, &scene->materials[0]);
 
-            int index = scene->bvhTranslator.topLevelIndex;
+            const RadeonRays::BvhTranslator &translator = scene->bvhTranslator;
+
+            size_t index = (size_t)translator.packedTopLevelIndex * 4;
 
             glBindBuffer(GL_TEXTURE_BUFFER, BVHBuffer);
-            glBufferSubData(GL_TEXTURE_BUFFER, sizeof(RadeonRays::BvhTranslator::Node) * index, sizeof(RadeonRays::BvhTranslator::Node) * (scene->bvhTranslator.nodes.size() - index), &scene->bvhTranslator.nodes[index]);
+            glBufferSubData(GL_TEXTURE_BUFFER, sizeof(uint32_t) * index, sizeof(uint32_t) * (translator.packedNodes.size() - index), &translator.packedNodes[index]);
         }
     }
 }
\ No newline at end of file
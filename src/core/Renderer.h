@@ -26,6 +26,10 @@
 
 #include "Quad.h"
 #include "Program.h"
+#include "TextureAtlas.h"
+#include "VirtualTextures.h"
+#include "hdrloader.h"
+#include "Mesh.h"
 #include <Vec2.h>
 #include <Vec3.h>
 
@@ -35,6 +39,20 @@ namespace GLSLPT
 {
     Program* LoadShaders(const ShaderInclude::ShaderSource& vertShaderObj, const ShaderInclude::ShaderSource& fragShaderObj);
 
+    enum TextureCompression
+    {
+        TextureCompressionNone,
+        TextureCompressionBC1, // BC1 colour maps, BC5 normal maps
+        TextureCompressionBC7  // BC7 colour maps, BC5 normal maps
+    };
+
+    enum EnvMapSampling
+    {
+        EnvMapSamplingCdf,  // Marginal and conditional inverse CDFs, two dependent fetches
+        EnvMapSamplingAlias, // Alias table over all pixels, one fetch
+        EnvMapSamplingHierarchical // Warp down a low resolution luminance pyramid, fixed memory
+    };
+
     struct RenderOptions
     {
         RenderOptions()
@@ -51,6 +69,16 @@ namespace GLSLPT
             bgColor = Vec3(0.3f, 0.3f, 0.3f);
             denoiserFrameCnt = 20;
             enableDenoiser = true;
+            quantizeVertices = false;
+            textureCompression = TextureCompressionNone;
+            envMapSampling = EnvMapSamplingCdf;
+            envMapFormat = HDRFormatRGB32F;
+            envMapHalfDistribution = false;
+            envMapPyramidSize = 1024;
+            virtualTextures = false;
+            virtualTexturePages = 1024;
+            bvhWidth = 2;
+            tlasBvhBuilder = BvhBuilderMidpoint;
         }
         iVec2 resolution;
         int maxDepth;
@@ -60,8 +88,18 @@ namespace GLSLPT
         bool enableRR;
         bool enableDenoiser;
         bool useConstantBg;
+        bool quantizeVertices;
+        bool envMapHalfDistribution;
+        bool virtualTextures;
+        TextureCompression textureCompression;
+        EnvMapSampling envMapSampling;
+        HDRFormat envMapFormat;
+        BvhBuilder tlasBvhBuilder; // Meshes pick theirs in Scene::AddMesh
         int RRDepth;
+        int envMapPyramidSize;
+        int virtualTexturePages; // Slots per texture format
         int denoiserFrameCnt;
+        int bvhWidth; // Children per BVH node the shaders traverse, 2, 4 or 8
         float hdrMultiplier;
         Vec3 bgColor;
     };
@@ -88,7 +126,9 @@ namespace GLSLPT
         GLuint materialsTex;
         GLuint transformsTex;
         GLuint lightsTex;
-        GLuint textureMapsArrayTex;
+        GLuint textureArrayTex[TextureAtlas::kMaxArrays];
+        GLuint textureRectsTex;
+        int pageTableOffset; // Entry of the virtual texture page table in textureRectsTex
         GLuint hdrTex;
         GLuint hdrMarginalDistTex;
         GLuint hdrConditionalDistTex;
@@ -96,6 +136,10 @@ namespace GLSLPT
         int numOfLights;
         bool initialized;
 
+        // Streams virtual texture pages into their slots and mirrors page table changes
+        void UploadPages(const std::vector<VirtualTextures::PageUpload> &uploads);
+        void UpdatePageTable(const std::vector<int> &dirtyPages);
+
     public:
         Renderer(Scene *scene, const std::string& shadersDirectory);
         virtual ~Renderer();
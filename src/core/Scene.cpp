@@ -22,61 +22,150 @@
  * SOFTWARE.
  */
 
+#include <atomic>
 #include <iostream>
+#include <cstring>
 
 #include "Scene.h"
 #include "Camera.h"
+#include "GltfLoader.h"
+#include "Hash.h"
 
 namespace GLSLPT
 {
+    static unsigned short FloatToHalf(float f)
+    {
+        unsigned int x;
+        memcpy(&x, &f, sizeof(x));
+
+        unsigned int sign = (x >> 16) & 0x8000;
+        int exponent = (int)((x >> 23) & 0xFF) - 127 + 15;
+        unsigned int mantissa = x & 0x7FFFFF;
+
+        if (((x >> 23) & 0xFF) == 0xFF)
+            return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+        if (exponent >= 31)
+            return sign | 0x7C00;
+
+        // Denormals, rounded to nearest even like the normal case below
+        if (exponent <= 0)
+        {
+            if (exponent < -10)
+                return sign;
+
+            mantissa |= 0x800000;
+            int shift = 14 - exponent;
+            unsigned int h = mantissa >> shift;
+            unsigned int rem = mantissa & ((1u << shift) - 1);
+            unsigned int halfway = 1u << (shift - 1);
+            if (rem > halfway || (rem == halfway && (h & 1)))
+                h++;
+            return sign | h;
+        }
+
+        unsigned int h = (exponent << 10) | (mantissa >> 13);
+        unsigned int rem = mantissa & 0x1FFF;
+        if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+            h++;
+        return sign | h;
+    }
+
+    static void OctEncode(const Vec3 &n, unsigned short &x, unsigned short &y)
+    {
+        float l1 = fabs(n.x) + fabs(n.y) + fabs(n.z);
+        float u = l1 > 0.0f ? n.x / l1 : 0.0f;
+        float v = l1 > 0.0f ? n.y / l1 : 0.0f;
+
+        // Fold the lower hemisphere over the diagonals
+        if (n.z < 0.0f)
+        {
+            float fu = (1.0f - fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+            float fv = (1.0f - fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+            u = fu;
+            v = fv;
+        }
+
+        x = (unsigned short)std::round(Math::Clamp(u * 0.5f + 0.5f, 0.0f, 1.0f) * 65535.0f);
+        y = (unsigned short)std::round(Math::Clamp(v * 0.5f + 0.5f, 0.0f, 1.0f) * 65535.0f);
+    }
+
     void Scene::AddCamera(Vec3 pos, Vec3 lookAt, float fov)
     {
         delete camera;
         camera = new Camera(pos, lookAt, fov);
     }
 
-    int Scene::AddMesh(const std::string& filename)
+    // Turns equivalent spellings of a path into one key: backslashes become slashes
+    // and empty, "." and "dir/.." components are dropped
+    static std::string NormalizePath(const std::string &path)
     {
-        int id = -1;
-        // Check if mesh was already loaded
-        for (int i = 0; i < meshes.size(); i++)
-            if (meshes[i]->name == filename)
-                return i;
-            
-        id = meshes.size();
+        std::vector<std::string> parts;
+        bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\');
+        size_t begin = 0;
 
-        Mesh* mesh = new Mesh;
+        while (begin <= path.size())
+        {
+            size_t end = path.find_first_of("/\\", begin);
+            if (end == std::string::npos)
+                end = path.size();
+
+            std::string part = path.substr(begin, end - begin);
+            if (part == "..")
+            {
+                if (!parts.empty() && parts.back() != "..")
+                    parts.pop_back();
+                else if (!absolute)
+                    parts.push_back(part);
+            }
+            else if (!part.empty() && part != ".")
+                parts.push_back(part);
+
+            begin = end + 1;
+        }
 
-        if (mesh->LoadFromFile(filename))
+        std::string normalized = absolute ? "/" : "";
+        for (size_t i = 0; i < parts.size(); i++)
         {
-            meshes.push_back(mesh);
-            printf("Model %s loaded\n", filename.c_str());
+            if (i > 0)
+                normalized += '/';
+            normalized += parts[i];
         }
-        else
-            id = -1;
-        return id;
+        return normalized;
     }
 
-    int Scene::AddTexture(const std::string& filename)
+    int Scene::AddMesh(const std::string& filename, BvhBuilder bvhBuilder)
     {
-        int id = -1;
-        // Check if texture was already loaded
-        for (int i = 0; i < textures.size(); i++)
-            if (textures[i]->name == filename)
-                return i;
+        // Check if mesh was already added
+        std::string key = NormalizePath(filename) + "|" + std::to_string(bvhBuilder);
+        auto it = meshLookup.find(key);
+        if (it != meshLookup.end())
+            return it->second;
+
+        Mesh* mesh = new Mesh(bvhBuilder);
+        mesh->name = filename;
+        meshes.push_back(mesh);
+
+        int id = meshes.size() - 1;
+        meshLookup[key] = id;
+        return id;
+    }
 
-        id = textures.size();
+    int Scene::AddTexture(const std::string& filename, TextureRole role)
+    {
+        // Check if texture was already added. A file used in different roles
+        // is stored differently for each, so it gets a texture per role
+        std::string key = NormalizePath(filename) + "|" + std::to_string(role);
+        auto it = textureLookup.find(key);
+        if (it != textureLookup.end())
+            return it->second;
 
         Texture* texture = new Texture;
+        texture->name = filename;
+        texture->role = role;
+        textures.push_back(texture);
 
-        if (texture->LoadTexture(filename))
-        {
-            textures.push_back(texture);
-            printf("Texture %s loaded\n", filename.c_str());
-        }
-        else
-            id = -1;
-
+        int id = textures.size() - 1;
+        textureLookup[key] = id;
         return id;
     }
 
@@ -89,15 +178,9 @@ namespace GLSLPT
 
     void Scene::AddHDR(const std::string& filename)
     {
-        delete hdrData;
-        hdrData = HDRLoader::load(filename.c_str());
-        if (hdrData == nullptr)
-            printf("Unable to load HDR\n");
-        else
-        {
-            printf("HDR %s loaded\n", filename.c_str());
-            renderOptions.useEnvMap = true;
-        }
+        AssetCache::Instance().Release(hdrData);
+        hdrData = nullptr;
+        hdrFile = filename;
     }
 
     int Scene::AddMeshInstance(const MeshInstance &meshInstance)
@@ -114,6 +197,433 @@ namespace GLSLPT
         return id;
     }
 
+    // Assets that are imported differently from the same file must not be merged
+    static int ImportVariant(const Mesh *mesh) { return mesh->bvhBuilder; }
+    static int ImportVariant(const Texture *texture) { return texture->role; }
+
+    // Hashes the file an asset is read from. Meshes and images inside a glTF file hash
+    // the whole file plus the part of their name after it, so the same sub-asset of two
+    // identical files still matches
+    static bool HashAssetFile(const std::string &name, uint64_t &hash, uint64_t &size)
+    {
+        std::string filename;
+        if (!IsGltfAsset(name, &filename))
+            return Hash::File(name, hash, size);
+
+        if (!Hash::File(filename, hash, size))
+            return false;
+
+        hash = Hash::String(name.substr(filename.size()), hash);
+        return true;
+    }
+
+    // Hashes the files of assets[first..] and folds the ones with identical contents
+    // into the earliest of them. Assets whose file can't be read are left alone, loading
+    // reports them. Keeps the contents key of each asset, 0 if unread, in contentKeys.
+    // Returns the old to new ID mapping
+    template <typename T>
+    static std::vector<int> MergeIdenticalFiles(std::vector<T*> &assets, int first, std::vector<int> &duplicates,
+        std::vector<uint64_t> &contentKeys, int &numMerged)
+    {
+        int numAssets = assets.size();
+        std::vector<uint64_t> hashes(numAssets), sizes(numAssets);
+        std::vector<char> hashed(numAssets, 0);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = first; i < numAssets; i++)
+            hashed[i] = HashAssetFile(assets[i]->name, hashes[i], sizes[i]);
+
+        std::vector<int> remap(numAssets);
+        std::unordered_map<uint64_t, int> contents;
+        int numKept = first;
+        numMerged = 0;
+
+        for (int i = 0; i < first; i++)
+            remap[i] = i;
+
+        for (int i = first; i < numAssets; i++)
+        {
+            if (hashed[i])
+            {
+                // The size goes into the key so a hash collision also needs equal lengths
+                uint64_t key = Hash::Bytes(&sizes[i], sizeof(sizes[i]), hashes[i]);
+                int variant = ImportVariant(assets[i]);
+                key = Hash::Bytes(&variant, sizeof(variant), key);
+                auto it = contents.find(key);
+                if (it != contents.end())
+                {
+                    remap[i] = it->second;
+                    duplicates[it->second]++;
+                    numMerged++;
+                    delete assets[i];
+                    continue;
+                }
+                contents[key] = numKept;
+                contentKeys[i] = key;
+            }
+
+            remap[i] = numKept;
+            duplicates[numKept] = duplicates[i];
+            contentKeys[numKept] = contentKeys[i];
+            assets[numKept++] = assets[i];
+        }
+
+        assets.resize(numKept);
+        duplicates.resize(numKept);
+        contentKeys.resize(numKept);
+        return remap;
+    }
+
+    void Scene::DeduplicateAssets()
+    {
+        meshDuplicates.resize(meshes.size(), 0);
+        textureDuplicates.resize(textures.size(), 0);
+        meshContentKeys.resize(meshes.size(), 0);
+        textureContentKeys.resize(textures.size(), 0);
+
+        int numMergedMeshes, numMergedTextures;
+        std::vector<int> meshRemap = MergeIdenticalFiles(meshes, numCheckedMeshes, meshDuplicates, meshContentKeys, numMergedMeshes);
+        std::vector<int> texRemap = MergeIdenticalFiles(textures, numCheckedTextures, textureDuplicates, textureContentKeys, numMergedTextures);
+        numCheckedMeshes = meshes.size();
+        numCheckedTextures = textures.size();
+
+        if (numMergedMeshes == 0 && numMergedTextures == 0)
+            return;
+
+        printf("Merged %d meshes and %d textures with identical contents\n", numMergedMeshes, numMergedTextures);
+
+        // Paths of merged assets keep resolving to the asset they were folded into
+        for (auto &entry : meshLookup)
+            entry.second = meshRemap[entry.second];
+        for (auto &entry : textureLookup)
+            entry.second = texRemap[entry.second];
+
+        for (int i = 0; i < meshInstances.size(); i++)
+            meshInstances[i].meshID = meshRemap[meshInstances[i].meshID];
+
+        for (int i = 0; i < materials.size(); i++)
+        {
+            Material& mat = materials[i];
+            if (mat.albedoTexID >= 0)
+                mat.albedoTexID = texRemap[(int)mat.albedoTexID];
+            if (mat.metallicRoughnessTexID >= 0)
+                mat.metallicRoughnessTexID = texRemap[(int)mat.metallicRoughnessTexID];
+            if (mat.normalmapTexID >= 0)
+                mat.normalmapTexID = texRemap[(int)mat.normalmapTexID];
+        }
+    }
+
+    // Asset cache keys add the path and everything that changes how the file is imported
+    // to its contents, so only a scene that would load the same asset again finds it.
+    // Assets whose file couldn't be hashed get 0 and aren't cached
+    static uint64_t AssetCacheKey(uint64_t contentKey, const std::string &name, const std::string &importSettings)
+    {
+        if (contentKey == 0)
+            return 0;
+
+        return Hash::String(importSettings, Hash::String(NormalizePath(name), contentKey));
+    }
+
+    static uint64_t HDRCacheKey(const std::string &filename, const HDRLoadOptions &options)
+    {
+        uint64_t hash, size;
+        if (!Hash::File(filename, hash, size))
+            return 0;
+
+        std::string importSettings = std::to_string(options.format) + "|" + std::to_string(options.aliasTable) + "|" +
+            std::to_string(options.halfDistribution) + "|" + std::to_string(options.pyramidSize);
+        return AssetCacheKey(Hash::Bytes(&size, sizeof(size), hash), filename, importSettings);
+    }
+
+    Scene::~Scene()
+    {
+        // Assets go back to the cache, which keeps them for the next scene that uses them
+        AssetCache &cache = AssetCache::Instance();
+        for (int i = 0; i < meshes.size(); i++)
+            cache.Release(meshes[i]);
+        for (int i = 0; i < textures.size(); i++)
+            cache.Release(textures[i]);
+        cache.Release(hdrData);
+
+        delete camera;
+        delete sceneBvh;
+    }
+
+    void Scene::assignTextureFormats()
+    {
+        // Two channel roles get BC5 which keeps them precise, the others get the
+        // format picked in the render options
+        TextureFormat colorFormat = TextureFormatRGB8;
+        if (renderOptions.textureCompression == TextureCompressionBC1)
+            colorFormat = TextureFormatBC1;
+        else if (renderOptions.textureCompression == TextureCompressionBC7)
+            colorFormat = TextureFormatBC7;
+
+        for (int i = 0; i < textures.size(); i++)
+        {
+            bool twoChannel = textures[i]->role == TextureRoleMetallicRoughness || textures[i]->role == TextureRoleNormal;
+
+            if (!twoChannel)
+                textures[i]->format = colorFormat;
+            else if (renderOptions.textureCompression == TextureCompressionNone)
+                textures[i]->format = TextureFormatRG8;
+            else
+                textures[i]->format = TextureFormatBC5;
+        }
+    }
+
+    void Scene::loadAssets()
+    {
+        // Meshes, textures and the HDR are independent files so they are decoded
+        // concurrently, and each mesh builds its BVH as soon as it is loaded.
+        // IDs were already handed out by Add* so the results are compacted in
+        // registration order afterwards, which keeps them deterministic.
+        // Assets an earlier scene loaded the same way are taken from the asset cache
+        DeduplicateAssets();
+        assignTextureFormats();
+
+        AssetCache &cache = AssetCache::Instance();
+        std::atomic<int> numCacheHits(0);
+
+        bool loadHDR = !hdrFile.empty() && hdrData == nullptr;
+        int numMeshes = meshes.size();
+        int numTextures = textures.size();
+        int firstMeshTask = loadHDR ? 1 : 0;
+        int firstTextureTask = firstMeshTask + numMeshes;
+        int numTasks = firstTextureTask + numTextures;
+
+        std::vector<char> loaded(numTasks, 0);
+
+        if (loadProgress)
+            loadProgress->SetStage(LoadStageAssets, numTasks);
+
+        // A lone mesh keeps the threads for its own parallel parse
+        #pragma omp parallel for schedule(dynamic) if (numTasks > 1)
+        for (int i = 0; i < numTasks; i++)
+        {
+            // Tasks that haven't started are skipped once the load is cancelled
+            if (loadProgress && loadProgress->IsCancelled())
+                continue;
+
+            // The HDR is scheduled first as it is usually the largest single job
+            if (i < firstMeshTask)
+            {
+                HDRLoadOptions options;
+                options.format = renderOptions.envMapFormat;
+                options.aliasTable = renderOptions.envMapSampling == EnvMapSamplingAlias;
+                options.halfDistribution = renderOptions.envMapHalfDistribution;
+                if (renderOptions.envMapSampling == EnvMapSamplingHierarchical)
+                    options.pyramidSize = renderOptions.envMapPyramidSize > 1 ? renderOptions.envMapPyramidSize : 1;
+
+                uint64_t key = HDRCacheKey(hdrFile, options);
+                hdrData = key != 0 ? cache.AcquireHDR(key) : nullptr;
+                if (hdrData != nullptr)
+                    numCacheHits++;
+                else
+                {
+                    hdrData = HDRLoader::load(hdrFile.c_str(), options);
+                    if (hdrData != nullptr && key != 0)
+                        hdrData = cache.AddHDR(key, hdrData);
+                }
+                loaded[i] = hdrData != nullptr;
+            }
+            else if (i < firstTextureTask)
+            {
+                int meshID = i - firstMeshTask;
+                Mesh* mesh = meshes[meshID];
+                std::string importSettings = mesh->bvh->GetBuildParams() + (renderOptions.quantizeVertices ? "|quantized" : "");
+                uint64_t key = AssetCacheKey(meshContentKeys[meshID], mesh->name, importSettings);
+
+                Mesh* cached = key != 0 ? cache.AcquireMesh(key) : nullptr;
+                if (cached != nullptr)
+                {
+                    delete mesh;
+                    meshes[meshID] = cached;
+                    numCacheHits++;
+                    loaded[i] = 1;
+                }
+                else if (mesh->LoadFromFile(mesh->name))
+                {
+                    printf("Model %s loaded\n", mesh->name.c_str());
+                    if (renderOptions.quantizeVertices)
+                        mesh->Quantize();
+                    // Precompiled meshes come with their BLAS unless quantizing moved the positions
+                    if (!mesh->bvh->IsBuilt() || renderOptions.quantizeVertices)
+                    {
+                        printf("Building BVH for %s\n", mesh->name.c_str());
+                        mesh->BuildBVH();
+                    }
+                    if (key != 0)
+                        meshes[meshID] = cache.AddMesh(key, mesh);
+                    loaded[i] = 1;
+                }
+            }
+            else
+            {
+                int textureID = i - firstTextureTask;
+                Texture* texture = textures[textureID];
+                // The role decides the channel layout and color space, like it does for the texture lookup
+                std::string importSettings = std::to_string(texture->format) + "|" + std::to_string(texture->role) + (renderOptions.virtualTextures ? "|pages" : "");
+                uint64_t key = AssetCacheKey(textureContentKeys[textureID], texture->name, importSettings);
+
+                Texture* cached = key != 0 ? cache.AcquireTexture(key) : nullptr;
+                if (cached != nullptr)
+                {
+                    delete texture;
+                    textures[textureID] = cached;
+                    numCacheHits++;
+                    loaded[i] = 1;
+                }
+                else
+                {
+                    if (renderOptions.virtualTextures)
+                        loaded[i] = texture->LoadPages(texture->name);
+                    else
+                        loaded[i] = texture->LoadTexture(texture->name);
+
+                    if (loaded[i] && key != 0)
+                        textures[textureID] = cache.AddTexture(key, texture);
+                }
+            }
+
+            if (loadProgress)
+                loadProgress->Advance();
+        }
+
+        // Mesh and texture data the merged duplicates would have taken up
+        size_t savedBytes = 0;
+        for (int i = 0; i < numMeshes; i++)
+        {
+            if (loaded[firstMeshTask + i])
+            {
+                const Mesh* mesh = meshes[i];
+                size_t meshBytes = (mesh->verticesUVX.size() + mesh->normalsUVY.size()) * sizeof(Vec4) +
+                    (mesh->indices.size() + mesh->bvh->GetNumIndices()) * sizeof(int);
+                savedBytes += meshDuplicates[i] * meshBytes;
+            }
+        }
+
+        for (int i = 0; i < numTextures; i++)
+        {
+            if (loaded[firstTextureTask + i])
+                savedBytes += textureDuplicates[i] * textures[i]->LevelBytes();
+        }
+
+        if (savedBytes > 0)
+            printf("Deduplication saved %.2f MB\n", savedBytes / (1024.0 * 1024.0));
+
+        if (numCacheHits > 0)
+        {
+            printf("Asset cache: %d of %d assets reused, %.2f MB held in %d assets\n", (int)numCacheHits, numTasks,
+                cache.Bytes() / (1024.0 * 1024.0), cache.NumAssets());
+        }
+
+        // Drop the meshes that failed along with their instances
+        std::vector<int> meshRemap(meshes.size(), -1);
+        std::vector<Mesh*> loadedMeshes;
+        std::vector<int> loadedMeshDuplicates;
+        std::vector<uint64_t> loadedMeshContentKeys;
+
+        for (int i = 0; i < numMeshes; i++)
+        {
+            if (loaded[firstMeshTask + i])
+            {
+                meshRemap[i] = loadedMeshes.size();
+                loadedMeshes.push_back(meshes[i]);
+                loadedMeshDuplicates.push_back(meshDuplicates[i]);
+                loadedMeshContentKeys.push_back(meshContentKeys[i]);
+            }
+            else
+                delete meshes[i];
+        }
+        meshes = loadedMeshes;
+        meshDuplicates = loadedMeshDuplicates;
+        meshContentKeys = loadedMeshContentKeys;
+
+        std::vector<MeshInstance> loadedInstances;
+        for (int i = 0; i < meshInstances.size(); i++)
+        {
+            int meshID = meshRemap[meshInstances[i].meshID];
+            if (meshID != -1)
+            {
+                loadedInstances.push_back(meshInstances[i]);
+                loadedInstances.back().meshID = meshID;
+            }
+        }
+        meshInstances = loadedInstances;
+
+        // Reset material slots of the textures that failed
+        std::vector<int> texRemap(textures.size(), -1);
+        std::vector<Texture*> loadedTextures;
+        std::vector<int> loadedTextureDuplicates;
+        std::vector<uint64_t> loadedTextureContentKeys;
+
+        for (int i = 0; i < numTextures; i++)
+        {
+            if (loaded[firstTextureTask + i])
+            {
+                texRemap[i] = loadedTextures.size();
+                loadedTextures.push_back(textures[i]);
+                loadedTextureDuplicates.push_back(textureDuplicates[i]);
+                loadedTextureContentKeys.push_back(textureContentKeys[i]);
+                printf("Texture %s loaded\n", textures[i]->name.c_str());
+            }
+            else
+            {
+                printf("Unable to load texture %s\n", textures[i]->name.c_str());
+                delete textures[i];
+            }
+        }
+        textures = loadedTextures;
+        textureDuplicates = loadedTextureDuplicates;
+        textureContentKeys = loadedTextureContentKeys;
+
+        // Paths of assets that failed no longer resolve
+        for (auto it = meshLookup.begin(); it != meshLookup.end();)
+        {
+            it->second = meshRemap[it->second];
+            it = it->second == -1 ? meshLookup.erase(it) : std::next(it);
+        }
+
+        for (auto it = textureLookup.begin(); it != textureLookup.end();)
+        {
+            it->second = texRemap[it->second];
+            it = it->second == -1 ? textureLookup.erase(it) : std::next(it);
+        }
+
+        numCheckedMeshes = meshes.size();
+        numCheckedTextures = textures.size();
+
+        for (int i = 0; i < materials.size(); i++)
+        {
+            Material& mat = materials[i];
+            if (mat.albedoTexID >= 0)
+                mat.albedoTexID = texRemap[(int)mat.albedoTexID];
+            if (mat.metallicRoughnessTexID >= 0)
+                mat.metallicRoughnessTexID = texRemap[(int)mat.metallicRoughnessTexID];
+            if (mat.normalmapTexID >= 0)
+                mat.normalmapTexID = texRemap[(int)mat.normalmapTexID];
+        }
+
+        if (loadHDR)
+        {
+            if (hdrData == nullptr)
+                printf("Unable to load HDR\n");
+            else
+            {
+                printf("HDR %s loaded\n", hdrFile.c_str());
+                renderOptions.useEnvMap = true;
+            }
+        }
+    }
+
+    Mat4 Scene::instanceTransform(int instanceID)
+    {
+        // Quantized meshes have their grid to mesh mapping folded into the instance transform
+        const MeshInstance &instance = meshInstances[instanceID];
+        return meshes[instance.meshID]->dequantize * instance.transform;
+    }
+
     void Scene::createTLAS()
     {
         // Loop through all the mesh Instances and build a Top Level BVH
@@ -124,7 +634,7 @@ namespace GLSLPT
         for (int i = 0; i < meshInstances.size(); i++)
         {
             RadeonRays::bbox bbox = meshes[meshInstances[i].meshID]->bvh->Bounds();
-            Mat4 matrix = meshInstances[i].transform;
+            Mat4 matrix = instanceTransform(i);
 
             Vec3 minBound = bbox.pmin;
             Vec3 maxBound = bbox.pmax;
@@ -152,45 +662,49 @@ namespace GLSLPT
 
             bounds[i] = bound;
         }
+        delete sceneBvh;
+        sceneBvh = CreateBvh(renderOptions.tlasBvhBuilder, true);
         sceneBvh->Build(&bounds[0], bounds.size());
         sceneBounds = sceneBvh->Bounds();
     }
 
-    void Scene::createBLAS()
-    {
-        // Loop through all meshes and build BVHs
-        #pragma omp parallel for
-        for (int i = 0; i < meshes.size(); i++)
-        {
-            printf("Building BVH for %s\n", meshes[i]->name.c_str());
-            meshes[i]->BuildBVH();
-        }
-    }
-    
     void Scene::RebuildInstances()
     {
-        delete sceneBvh;
-        sceneBvh = new RadeonRays::Bvh(10.0f, 64, false);
-
         createTLAS();
         bvhTranslator.UpdateTLAS(sceneBvh, meshInstances);
 
         //Copy transforms
         for (int i = 0; i < meshInstances.size(); i++)
-            transforms[i] = meshInstances[i].transform;
+            transforms[i] = instanceTransform(i);
 
         instancesModified = true;
     }
 
     void Scene::CreateAccelerationStructures()
     {
-        createBLAS();
+        // Also builds the per mesh BVHs
+        loadAssets();
+
+        // The scene is incomplete and only good for deleting
+        if (loadProgress && loadProgress->IsCancelled())
+            return;
+
+        if (loadProgress)
+            loadProgress->SetStage(LoadStageBVH);
 
         printf("Building scene BVH\n");
         createTLAS();
 
-        // Flatten BVH
+        if (loadProgress)
+            loadProgress->SetStage(LoadStageFlatten);
+
+        // Flatten BVH, other widths than 4 and 8 stay binary
+        int bvhWidth = renderOptions.bvhWidth;
+        int requestedWidth = bvhWidth == 4 || bvhWidth == 8 ? bvhWidth : 2;
+        bvhTranslator.width = requestedWidth;
         bvhTranslator.Process(sceneBvh, meshes, meshInstances);
+        if (bvhTranslator.width != requestedWidth)
+            printf("Too many triangles for a %d wide BVH, using a binary one\n", requestedWidth);
 
         int verticesCnt = 0;
 
@@ -201,35 +715,89 @@ namespace GLSLPT
             int numIndices = meshes[i]->bvh->GetNumIndices();
             const int * triIndices = meshes[i]->bvh->GetIndices();
 
+            const std::vector<int> &meshIndices = meshes[i]->indices;
+
             for (int j = 0; j < numIndices; j++)
             {
                 int index = triIndices[j];
-                int v1 = (index * 3 + 0) + verticesCnt;
-                int v2 = (index * 3 + 1) + verticesCnt;
-                int v3 = (index * 3 + 2) + verticesCnt;
+                int v1 = meshIndices[index * 3 + 0] + verticesCnt;
+                int v2 = meshIndices[index * 3 + 1] + verticesCnt;
+                int v3 = meshIndices[index * 3 + 2] + verticesCnt;
 
                 vertIndices.push_back(Indices{ v1, v2, v3 });
             }
 
-            verticesUVX.insert(verticesUVX.end(), meshes[i]->verticesUVX.begin(), meshes[i]->verticesUVX.end());
-            normalsUVY.insert(normalsUVY.end(), meshes[i]->normalsUVY.begin(), meshes[i]->normalsUVY.end());
+            if (renderOptions.quantizeVertices)
+            {
+                for (int j = 0; j < meshes[i]->verticesUVX.size(); j++)
+                {
+                    const Vec4 &v = meshes[i]->verticesUVX[j];
+                    const Vec4 &n = meshes[i]->normalsUVY[j];
+
+                    QuantizedVertex qv;
+                    qv.x = (unsigned short)v.x;
+                    qv.y = (unsigned short)v.y;
+                    qv.z = (unsigned short)v.z;
+                    qv.u = FloatToHalf(v.w);
+
+                    QuantizedNormal qn;
+                    OctEncode(Vec3(n), qn.x, qn.y);
+                    qn.v = FloatToHalf(n.w);
+                    qn.pad = 0;
+
+                    quantizedVertices.push_back(qv);
+                    quantizedNormals.push_back(qn);
+                }
+            }
+            else
+            {
+                verticesUVX.insert(verticesUVX.end(), meshes[i]->verticesUVX.begin(), meshes[i]->verticesUVX.end());
+                normalsUVY.insert(normalsUVY.end(), meshes[i]->normalsUVY.begin(), meshes[i]->normalsUVY.end());
+            }
 
             verticesCnt += meshes[i]->verticesUVX.size();
         }
 
+        if (renderOptions.quantizeVertices)
+        {
+            printf("Vertex data: %.2f MB quantized, %.2f MB as floats\n",
+                verticesCnt * (sizeof(QuantizedVertex) + sizeof(QuantizedNormal)) / (1024.0f * 1024.0f),
+                verticesCnt * 2 * sizeof(Vec4) / (1024.0f * 1024.0f));
+        }
+
         //Copy transforms
         transforms.resize(meshInstances.size());
         #pragma omp parallel for
         for (int i = 0; i < meshInstances.size(); i++)
-            transforms[i] = meshInstances[i].transform;
+            transforms[i] = instanceTransform(i);
 
         //Copy Textures
+        if (renderOptions.virtualTextures)
+            virtualTextures.Build(textures, renderOptions.virtualTexturePages);
+        else
+            textureAtlas.Build(textures);
+    }
+
+    bool Scene::LoadVirtualTextures()
+    {
+        assignTextureFormats();
+
+        std::vector<char> loaded(textures.size(), 0);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < textures.size(); i++)
+            loaded[i] = textures[i]->LoadPages(textures[i]->name);
+
         for (int i = 0; i < textures.size(); i++)
         {
-            texWidth = textures[i]->width;
-            texHeight = textures[i]->height;
-            int texSize = texWidth * texHeight;
-            textureMapsArray.insert(textureMapsArray.end(), &textures[i]->texData[0], &textures[i]->texData[texSize * 3]);
+            if (!loaded[i])
+            {
+                printf("Unable to load texture %s\n", textures[i]->name.c_str());
+                return false;
+            }
         }
+
+        virtualTextures.Build(textures, renderOptions.virtualTexturePages);
+        return true;
     }
 }
\ No newline at end of file
@@ -27,13 +27,18 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include "hdrloader.h"
 #include "bvh.h"
+#include "AssetCache.h"
 #include "Renderer.h"
 #include "Mesh.h"
 #include "Camera.h"
+#include "LoadProgress.h"
 #include "bvh_translator.h"
 #include "Texture.h"
+#include "TextureAtlas.h"
+#include "VirtualTextures.h"
 #include "Material.h"
 
 namespace GLSLPT
@@ -62,16 +67,32 @@ namespace GLSLPT
         int x, y, z;
     };
 
+    // Compact vertex layout used when RenderOptions::quantizeVertices is set
+    struct QuantizedVertex
+    {
+        unsigned short x, y, z; // Position on the mesh's 16 bit grid
+        unsigned short u;       // Half float
+    };
+
+    struct QuantizedNormal
+    {
+        unsigned short x, y;    // Octahedral encoding
+        unsigned short v;       // Half float
+        unsigned short pad;
+    };
+
     class Scene
     {
     public:
-        Scene() : camera(nullptr), hdrData(nullptr) {
-            sceneBvh = new RadeonRays::Bvh(10.0f, 64, false);
-        }
-        ~Scene() { delete camera; delete sceneBvh; delete hdrData; };
-
-        int AddMesh(const std::string &filename);
-        int AddTexture(const std::string &filename);
+        Scene() : camera(nullptr), hdrData(nullptr), loadProgress(nullptr), sceneBvh(nullptr) {}
+        ~Scene();
+
+        // Meshes, textures and the HDR are only registered here and get
+        // loaded by CreateAccelerationStructures, unless the scene is
+        // restored from a cache
+        // A file added with different builders becomes a mesh per builder
+        int AddMesh(const std::string &filename, BvhBuilder bvhBuilder = BvhBuilderSbvh);
+        int AddTexture(const std::string &filename, TextureRole role = TextureRoleColor);
         int AddMaterial(const Material &material);
         int AddMeshInstance(const MeshInstance &meshInstance);
         int AddLight(const Light &light);
@@ -79,9 +100,18 @@ namespace GLSLPT
         void AddCamera(Vec3 eye, Vec3 lookat, float fov);
         void AddHDR(const std::string &filename);
 
+        // Merges meshes and textures whose files are byte identical and remaps the
+        // IDs held by instances and materials. Done by CreateAccelerationStructures,
+        // but has to happen earlier when the asset lists are used to key a cache
+        void DeduplicateAssets();
+
         void CreateAccelerationStructures();
         void RebuildInstances();
 
+        // Opens the page files of the textures when the scene comes from a cache,
+        // which doesn't hold the pages. Writes the ones that are missing
+        bool LoadVirtualTextures();
+
         //Options
         RenderOptions renderOptions;
 
@@ -92,6 +122,8 @@ namespace GLSLPT
         std::vector<Indices> vertIndices;
         std::vector<Vec4> verticesUVX; // Vertex Data + x coord of uv 
         std::vector<Vec4> normalsUVY;  // Normal Data + y coord of uv
+        std::vector<QuantizedVertex> quantizedVertices; // Replace the two above if quantized
+        std::vector<QuantizedNormal> quantizedNormals;
         std::vector<Mat4> transforms;
 
         //Instances
@@ -104,6 +136,7 @@ namespace GLSLPT
 
         //HDR
         HDRData *hdrData;
+        std::string hdrFile;
 
         //Camera
         Camera *camera;
@@ -112,15 +145,35 @@ namespace GLSLPT
         RadeonRays::BvhTranslator bvhTranslator; // Produces a flat bvh array for GPU consumption
         RadeonRays::bbox sceneBounds;
 
+        // Reported to while loading if set, see AsyncSceneLoader
+        LoadProgress *loadProgress;
+
         //Texture Data
         std::vector<Texture *> textures;
-        std::vector<unsigned char> textureMapsArray;
-        int texWidth;
-        int texHeight; // TODO: allow textures of different sizes
+        TextureAtlas textureAtlas;
+        VirtualTextures virtualTextures; // Replaces the atlas if RenderOptions::virtualTextures is set
 
     private:
         RadeonRays::Bvh *sceneBvh;
-        void createBLAS();
+
+        // Normalized path to ID
+        std::unordered_map<std::string, int> meshLookup;
+        std::unordered_map<std::string, int> textureLookup;
+
+        // Registrations merged into each asset by DeduplicateAssets and how many
+        // assets it has already looked at
+        std::vector<int> meshDuplicates;
+        std::vector<int> textureDuplicates;
+        int numCheckedMeshes = 0;
+        int numCheckedTextures = 0;
+
+        // File contents of each asset, 0 if unread, for keying the asset cache
+        std::vector<uint64_t> meshContentKeys;
+        std::vector<uint64_t> textureContentKeys;
+
+        void assignTextureFormats();
+        void loadAssets();
+        Mat4 instanceTransform(int instanceID);
         void createTLAS();
     };
 }
\ No newline at end of file
@@ -0,0 +1,183 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "TaskPool.h"
+
+namespace GLSLPT
+{
+    namespace
+    {
+        // Index of the worker running on this thread, -1 for threads outside the pool
+        thread_local int currentWorker = -1;
+    }
+
+    TaskPool &TaskPool::Instance()
+    {
+        // Never destroyed, the workers sleep until the process exits
+        static TaskPool *pool = new TaskPool;
+        return *pool;
+    }
+
+    TaskPool::TaskPool() : numQueued(0), stopping(false)
+    {
+        int numThreads = (int)std::thread::hardware_concurrency();
+        start(numThreads > 1 ? numThreads - 1 : 0);
+    }
+
+    void TaskPool::SetNumThreads(int numThreads)
+    {
+        stop();
+        start(numThreads > 1 ? numThreads - 1 : 0);
+    }
+
+    void TaskPool::start(int numWorkers)
+    {
+        stopping = false;
+        for (int i = 0; i < numWorkers; i++)
+            queues.push_back(new Queue);
+        for (int i = 0; i < numWorkers; i++)
+            workers.push_back(std::thread(&TaskPool::workerLoop, this, i));
+    }
+
+    void TaskPool::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (int i = 0; i < workers.size(); i++)
+            workers[i].join();
+        for (int i = 0; i < queues.size(); i++)
+            delete queues[i];
+
+        workers.clear();
+        queues.clear();
+    }
+
+    void TaskPool::Spawn(Group &group, std::function<void()> task)
+    {
+        group.pending++;
+
+        Queue &queue = currentWorker >= 0 ? *queues[currentWorker] : sharedQueue;
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(Task{ std::move(task), &group });
+        }
+        numQueued++;
+
+        // Taking the lock orders this with a worker that just found nothing and is about to sleep
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    void TaskPool::Wait(Group &group)
+    {
+        while (group.pending > 0)
+        {
+            Task task;
+            if (findTask(currentWorker, task))
+                runTask(task);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    void TaskPool::ParallelFor(int count, const std::function<void(int)> &task)
+    {
+        Group group;
+        for (int i = 1; i < count; i++)
+            Spawn(group, [&task, i]() { task(i); });
+
+        if (count > 0)
+            task(0);
+
+        Wait(group);
+    }
+
+    bool TaskPool::findTask(int worker, Task &task)
+    {
+        if (numQueued == 0)
+            return false;
+
+        // Own tasks newest first, they are the smallest and their data is still in cache
+        if (worker >= 0)
+        {
+            Queue &queue = *queues[worker];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty())
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+                numQueued--;
+                return true;
+            }
+        }
+
+        // Everyone else's oldest first, they are the largest
+        int numQueues = queues.size();
+        for (int i = 0; i <= numQueues; i++)
+        {
+            Queue &queue = i == numQueues ? sharedQueue : *queues[(worker + 1 + i) % numQueues];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty())
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                numQueued--;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void TaskPool::runTask(Task &task)
+    {
+        task.run();
+        task.group->pending--;
+    }
+
+    void TaskPool::workerLoop(int worker)
+    {
+        currentWorker = worker;
+
+        while (true)
+        {
+            Task task;
+            if (findTask(worker, task))
+            {
+                runTask(task);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]() { return stopping || numQueued > 0; });
+            if (stopping)
+                return;
+        }
+    }
+}
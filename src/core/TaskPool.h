@@ -0,0 +1,100 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace GLSLPT
+{
+    // Fork-join pool for recursive work such as BVH builds. Each worker pushes and pops
+    // tasks at the back of its own deque and steals from the front of the others once
+    // it runs dry, threads outside the pool push to a shared queue. Waiting for a group
+    // runs queued tasks instead of blocking, so tasks can wait for the tasks they spawned
+    // and several threads can use the pool at once, like the OpenMP threads loading meshes
+    class TaskPool
+    {
+    public:
+        // Tasks that are waited for together
+        class Group
+        {
+        public:
+            Group() : pending(0) {}
+
+        private:
+            std::atomic<int> pending;
+            friend class TaskPool;
+        };
+
+        static TaskPool &Instance();
+
+        // Threads running tasks, counting the one that waits. Defaults to the hardware
+        // threads. Only call it while the pool is idle
+        void SetNumThreads(int numThreads);
+        int NumThreads() const { return (int)workers.size() + 1; }
+
+        void Spawn(Group &group, std::function<void()> task);
+        void Wait(Group &group);
+
+        // Runs task(0) to task(count - 1), the calling thread takes part
+        void ParallelFor(int count, const std::function<void(int)> &task);
+
+    private:
+        TaskPool();
+        TaskPool(const TaskPool&) = delete;
+        TaskPool& operator = (const TaskPool&) = delete;
+
+        struct Task
+        {
+            std::function<void()> run;
+            Group *group;
+        };
+
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void start(int numWorkers);
+        void stop();
+        void workerLoop(int worker);
+        bool findTask(int worker, Task &task);
+        void runTask(Task &task);
+
+        std::vector<std::thread> workers;
+        std::vector<Queue *> queues;
+        Queue sharedQueue;
+
+        std::atomic<int> numQueued;
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        bool stopping;
+    };
+}
@@ -23,20 +23,552 @@
  */
 
 #include "Texture.h"
+#include "BlockCompression.h"
+#include "GltfLoader.h"
+#include "Hash.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include "stb_image.h"
 
 namespace GLSLPT
 {
+    namespace
+    {
+        const char kTextureCacheMagic[8] = { 'G', 'L', 'S', 'L', 'P', 'T', 'T', 'X' };
+        const uint32_t kTextureCacheVersion = 3;
+
+        const char kPageFileMagic[8] = { 'G', 'L', 'S', 'L', 'P', 'T', 'V', 'T' };
+        const uint32_t kPageFileVersion = 2;
+
+        const char* FormatName(TextureFormat format)
+        {
+            switch (format)
+            {
+            case TextureFormatBC1: return "bc1";
+            case TextureFormatBC5: return "bc5";
+            case TextureFormatBC7: return "bc7";
+            case TextureFormatRG8: return "rg8";
+            case TextureFormatR8:  return "r8";
+            default:               return "rgb8";
+            }
+        }
+
+        // Metallic-roughness maps are rearranged before encoding, so the role is part of the name
+        std::string CacheFilename(const std::string &name, TextureFormat format, TextureRole role)
+        {
+            const char *prefix = role == TextureRoleMetallicRoughness ? ".mr." : ".";
+            return name + prefix + FormatName(format) + ".ptex";
+        }
+
+        std::string PageFilename(const std::string &name, TextureFormat format, TextureRole role)
+        {
+            const char *prefix = role == TextureRoleMetallicRoughness ? ".mr." : ".";
+            return name + prefix + FormatName(format) + ".pvt";
+        }
+
+        // Moves metallic and roughness into red and green. The values keep their 2.2 curve,
+        // which the shader removes after filtering, so low roughness isn't crushed to 8 bits
+        void RearrangeMetallicRoughness(std::vector<unsigned char> &texels)
+        {
+            for (size_t i = 0; i < texels.size(); i += 3)
+            {
+                unsigned char metallic = texels[i + 2];
+                unsigned char roughness = texels[i + 1];
+                texels[i + 0] = metallic;
+                texels[i + 1] = roughness;
+                texels[i + 2] = 0;
+            }
+        }
+
+        bool IsGrayscale(const std::vector<unsigned char> &texels)
+        {
+            for (size_t i = 0; i < texels.size(); i += 3)
+            {
+                if (texels[i] != texels[i + 1] || texels[i] != texels[i + 2])
+                    return false;
+            }
+            return true;
+        }
+
+        // Identifies the source image. Images inside a glTF file hash the whole file plus their name
+        bool SourceHash(const std::string &name, uint64_t &key)
+        {
+            std::string filename = name;
+            IsGltfAsset(name, &filename);
+
+            uint64_t hash, size;
+            if (!Hash::File(filename, hash, size))
+                return false;
+
+            key = Hash::String(name, hash);
+            return true;
+        }
+
+        // Shared by .ptex mip chains and .pvt page files
+        struct TextureCacheHeader
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t format;
+            uint64_t source;
+            int32_t width;
+            int32_t height;
+            int32_t numLevels;
+            int32_t pad;
+        };
+
+        bool LoadCachedLevels(const std::string &filename, TextureFormat format, uint64_t source, Texture &texture)
+        {
+            MappedFile file;
+            if (!file.Open(filename) || file.Size() < sizeof(TextureCacheHeader))
+                return false;
+
+            TextureCacheHeader header;
+            memcpy(&header, file.Data(), sizeof(header));
+
+            if (memcmp(header.magic, kTextureCacheMagic, sizeof(kTextureCacheMagic)) != 0 ||
+                header.version != kTextureCacheVersion || header.format != (uint32_t)format ||
+                header.source != source || header.numLevels <= 0 || header.numLevels > 32)
+                return false;
+
+            const unsigned char *ptr = file.Data() + sizeof(header);
+            const unsigned char *end = file.Data() + file.Size();
+
+            std::vector<TextureLevel> levels(header.numLevels);
+            for (int i = 0; i < header.numLevels; i++)
+            {
+                TextureLevel &level = levels[i];
+                int32_t dims[4];
+                if ((size_t)(end - ptr) < sizeof(dims))
+                    return false;
+                memcpy(dims, ptr, sizeof(dims));
+                ptr += sizeof(dims);
+
+                level.width = dims[0];
+                level.height = dims[1];
+                level.paddedWidth = dims[2];
+                level.paddedHeight = dims[3];
+
+                int blockSize = BlockSize(format);
+                size_t bytes = (size_t)(level.paddedWidth / blockSize) * (level.paddedHeight / blockSize) * BlockBytes(format);
+                if (level.paddedWidth <= 0 || level.paddedHeight <= 0 || (size_t)(end - ptr) < bytes)
+                    return false;
+
+                level.data.assign(ptr, ptr + bytes);
+                ptr += bytes;
+            }
+
+            texture.width = header.width;
+            texture.height = header.height;
+            texture.levels.swap(levels);
+            return true;
+        }
+
+        void SaveCachedLevels(const std::string &filename, TextureFormat format, uint64_t source, const Texture &texture)
+        {
+            FILE *file = fopen(filename.c_str(), "wb");
+            if (!file)
+                return;
+
+            TextureCacheHeader header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, kTextureCacheMagic, sizeof(kTextureCacheMagic));
+            header.version = kTextureCacheVersion;
+            header.format = format;
+            header.source = source;
+            header.width = texture.width;
+            header.height = texture.height;
+            header.numLevels = (int32_t)texture.levels.size();
+
+            bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+            for (int i = 0; i < texture.levels.size() && ok; i++)
+            {
+                const TextureLevel &level = texture.levels[i];
+                int32_t dims[4] = { level.width, level.height, level.paddedWidth, level.paddedHeight };
+                ok = fwrite(dims, sizeof(dims), 1, file) == 1 &&
+                    fwrite(level.data.data(), 1, level.data.size(), file) == level.data.size();
+            }
+
+            ok = fclose(file) == 0 && ok;
+            if (!ok)
+            {
+                printf("Failed writing %s\n", filename.c_str());
+                remove(filename.c_str());
+            }
+        }
+
+        // 2x2 box filter. Repeating textures wrap around at odd sizes
+        void Downsample(const std::vector<unsigned char> &src, int w, int h, std::vector<unsigned char> &dst, int dw, int dh)
+        {
+            dst.resize((size_t)dw * dh * 3);
+
+            #pragma omp parallel for if (dh >= 64)
+            for (int y = 0; y < dh; y++)
+            {
+                const unsigned char *row0 = &src[(size_t)((2 * y) % h) * w * 3];
+                const unsigned char *row1 = &src[(size_t)((2 * y + 1) % h) * w * 3];
+
+                for (int x = 0; x < dw; x++)
+                {
+                    int x0 = ((2 * x) % w) * 3;
+                    int x1 = ((2 * x + 1) % w) * 3;
+                    for (int c = 0; c < 3; c++)
+                        dst[((size_t)y * dw + x) * 3 + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+                }
+            }
+        }
+
+        // Encodes tightly packed RGB8 texels, the size is a multiple of the block size
+        void EncodeTexels(const unsigned char *texels, int width, int height, TextureFormat format, unsigned char *out)
+        {
+            if (BlockSize(format) == 1)
+            {
+                // Uncompressed formats keep the leading channels
+                int channels = BlockBytes(format);
+                size_t numTexels = (size_t)width * height;
+                for (size_t i = 0; i < numTexels; i++)
+                    memcpy(&out[i * channels], &texels[i * 3], channels);
+                return;
+            }
+
+            int blocksX = width / 4;
+            int blocksY = height / 4;
+            int blockBytes = BlockBytes(format);
+            int pitch = width * 3;
+
+            #pragma omp parallel for schedule(dynamic)
+            for (int by = 0; by < blocksY; by++)
+            {
+                for (int bx = 0; bx < blocksX; bx++)
+                {
+                    const unsigned char *src = &texels[(size_t)by * 4 * pitch + bx * 4 * 3];
+                    unsigned char *block = &out[((size_t)by * blocksX + bx) * blockBytes];
+
+                    if (format == TextureFormatBC1)
+                        BlockCompression::EncodeBC1(src, pitch, block);
+                    else if (format == TextureFormatBC5)
+                        BlockCompression::EncodeBC5(src, pitch, block);
+                    else
+                        BlockCompression::EncodeBC7(src, pitch, block);
+                }
+            }
+        }
+
+        // Adds the wrapped border, pads to whole blocks and encodes the level
+        void EncodeLevel(const std::vector<unsigned char> &texels, int w, int h, TextureFormat format, TextureLevel &level)
+        {
+            int blockSize = BlockSize(format);
+            int border = Texture::kBorder;
+
+            level.width = w;
+            level.height = h;
+            level.paddedWidth = (w + 2 * border + blockSize - 1) / blockSize * blockSize;
+            level.paddedHeight = (h + 2 * border + blockSize - 1) / blockSize * blockSize;
+
+            std::vector<unsigned char> padded((size_t)level.paddedWidth * level.paddedHeight * 3);
+            for (int y = 0; y < level.paddedHeight; y++)
+            {
+                const unsigned char *srcRow = &texels[(size_t)(((y - border) % h + h) % h) * w * 3];
+                unsigned char *dstRow = &padded[(size_t)y * level.paddedWidth * 3];
+                for (int x = 0; x < level.paddedWidth; x++)
+                    memcpy(dstRow + x * 3, srcRow + (((x - border) % w + w) % w) * 3, 3);
+            }
+
+            if (format == TextureFormatRGB8)
+            {
+                level.data.swap(padded);
+                return;
+            }
+
+            level.data.resize((size_t)(level.paddedWidth / blockSize) * (level.paddedHeight / blockSize) * BlockBytes(format));
+            EncodeTexels(&padded[0], level.paddedWidth, level.paddedHeight, format, &level.data[0]);
+        }
+
+        // Writes the levels of the image as pages of kPageSize texels, each with a border
+        // wrapped in from around it. Rows of pages are encoded in parallel and written
+        // as they are done, so only one row is held besides the level itself
+        bool WritePageFile(const std::string &filename, TextureFormat format, uint64_t source, int width, int height, std::vector<unsigned char> &texels)
+        {
+            const int content = Texture::kPageContent;
+            const int border = Texture::kPageBorder;
+            const int pageSize = Texture::kPageSize;
+
+            std::vector<int32_t> table;
+            int w = width;
+            int h = height;
+            while (true)
+            {
+                int pagesX = (w + content - 1) / content;
+                int pagesY = (h + content - 1) / content;
+                table.insert(table.end(), { w, h, pagesX, pagesY });
+                if (pagesX == 1 && pagesY == 1)
+                    break;
+                w = std::max(w / 2, 1);
+                h = std::max(h / 2, 1);
+            }
+
+            FILE *file = fopen(filename.c_str(), "wb");
+            if (!file)
+                return false;
+
+            TextureCacheHeader header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, kPageFileMagic, sizeof(kPageFileMagic));
+            header.version = kPageFileVersion;
+            header.format = format;
+            header.source = source;
+            header.width = width;
+            header.height = height;
+            header.numLevels = (int32_t)(table.size() / 4);
+
+            bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                fwrite(table.data(), sizeof(int32_t), table.size(), file) == table.size();
+
+            size_t pageBytes = PageBytes(format);
+            w = width;
+            h = height;
+
+            for (int l = 0; l < header.numLevels && ok; l++)
+            {
+                if (l > 0)
+                {
+                    int dw = table[l * 4 + 0];
+                    int dh = table[l * 4 + 1];
+                    std::vector<unsigned char> next;
+                    Downsample(texels, w, h, next, dw, dh);
+                    texels.swap(next);
+                    w = dw;
+                    h = dh;
+                }
+
+                int pagesX = table[l * 4 + 2];
+                int pagesY = table[l * 4 + 3];
+                std::vector<unsigned char> row(pagesX * pageBytes);
+
+                for (int py = 0; py < pagesY && ok; py++)
+                {
+                    #pragma omp parallel
+                    {
+                        std::vector<unsigned char> pageTexels((size_t)pageSize * pageSize * 3);
+
+                        #pragma omp for schedule(dynamic)
+                        for (int px = 0; px < pagesX; px++)
+                        {
+                            int x0 = px * content - border;
+                            int y0 = py * content - border;
+                            for (int y = 0; y < pageSize; y++)
+                            {
+                                const unsigned char *srcRow = &texels[(size_t)(((y0 + y) % h + h) % h) * w * 3];
+                                for (int x = 0; x < pageSize; x++)
+                                    memcpy(&pageTexels[((size_t)y * pageSize + x) * 3], srcRow + (((x0 + x) % w + w) % w) * 3, 3);
+                            }
+                            EncodeTexels(&pageTexels[0], pageSize, pageSize, format, &row[px * pageBytes]);
+                        }
+                    }
+
+                    ok = fwrite(row.data(), 1, row.size(), file) == row.size();
+                }
+            }
+
+            ok = fclose(file) == 0 && ok;
+            if (!ok)
+            {
+                printf("Failed writing %s\n", filename.c_str());
+                remove(filename.c_str());
+            }
+            return ok;
+        }
+
+        // The page file has to be for the same image and format. RGB8 images may have been stored as R8
+        bool CheckPageFile(const std::string &filename, uint64_t source, Texture &texture)
+        {
+            MappedFile file;
+            if (!file.Open(filename) || file.Size() < sizeof(TextureCacheHeader))
+                return false;
+
+            TextureCacheHeader header;
+            memcpy(&header, file.Data(), sizeof(header));
+
+            bool formatMatches = header.format == (uint32_t)texture.format ||
+                (texture.format == TextureFormatRGB8 && header.format == TextureFormatR8);
+
+            if (memcmp(header.magic, kPageFileMagic, sizeof(kPageFileMagic)) != 0 ||
+                header.version != kPageFileVersion || !formatMatches ||
+                header.source != source || header.numLevels <= 0 || header.numLevels > 32 ||
+                file.Size() < sizeof(header) + header.numLevels * 4 * sizeof(int32_t))
+                return false;
+
+            std::vector<int32_t> table(header.numLevels * 4);
+            memcpy(table.data(), file.Data() + sizeof(header), table.size() * sizeof(int32_t));
+
+            size_t pageBytes = PageBytes((TextureFormat)header.format);
+            size_t offset = sizeof(header) + table.size() * sizeof(int32_t);
+            std::vector<PageLevel> pageLevels(header.numLevels);
+            for (int l = 0; l < header.numLevels; l++)
+            {
+                pageLevels[l] = PageLevel{ table[l * 4 + 0], table[l * 4 + 1], table[l * 4 + 2], table[l * 4 + 3], offset };
+                if (pageLevels[l].pagesX <= 0 || pageLevels[l].pagesY <= 0)
+                    return false;
+                offset += (size_t)pageLevels[l].pagesX * pageLevels[l].pagesY * pageBytes;
+            }
+
+            if (file.Size() != offset)
+                return false;
+
+            texture.width = header.width;
+            texture.height = header.height;
+            texture.format = (TextureFormat)header.format;
+            texture.pageLevels.swap(pageLevels);
+            return true;
+        }
+    }
+
+    int BlockSize(TextureFormat format)
+    {
+        switch (format)
+        {
+        case TextureFormatBC1:
+        case TextureFormatBC5:
+        case TextureFormatBC7: return 4;
+        default:               return 1;
+        }
+    }
+
+    int BlockBytes(TextureFormat format)
+    {
+        switch (format)
+        {
+        case TextureFormatBC1: return 8;
+        case TextureFormatBC5: return 16;
+        case TextureFormatBC7: return 16;
+        case TextureFormatRG8: return 2;
+        case TextureFormatR8:  return 1;
+        default:               return 3;
+        }
+    }
+
+    bool HasSrgbVariant(TextureFormat format)
+    {
+        return format == TextureFormatRGB8 || format == TextureFormatBC1 || format == TextureFormatBC7;
+    }
+
+    size_t PageBytes(TextureFormat format)
+    {
+        size_t blocks = Texture::kPageSize / BlockSize(format);
+        return blocks * blocks * BlockBytes(format);
+    }
+
     bool Texture::LoadTexture(const std::string &filename)
     {
         name = filename;
+        levels.clear();
 
-        texData = stbi_load(filename.c_str(), &width, &height, NULL, 3);
+        // Compressed chains take a while to encode so they are kept on disk
+        uint64_t source = 0;
+        bool cacheable = BlockSize(format) > 1 && SourceHash(filename, source);
+        std::string cacheFile = CacheFilename(filename, format, role);
 
-        if (texData != nullptr)
+        if (cacheable && LoadCachedLevels(cacheFile, format, source, *this))
             return true;
 
-        return false;
+        auto start = std::chrono::high_resolution_clock::now();
+
+        std::vector<unsigned char> texels;
+        if (!DecodeImage(filename, texels))
+            return false;
+
+        int w = width;
+        int h = height;
+        while (true)
+        {
+            levels.push_back(TextureLevel());
+            EncodeLevel(texels, w, h, format, levels.back());
+
+            if (w == 1 && h == 1)
+                break;
+
+            int dw = std::max(w / 2, 1);
+            int dh = std::max(h / 2, 1);
+            std::vector<unsigned char> next;
+            Downsample(texels, w, h, next, dw, dh);
+            texels.swap(next);
+            w = dw;
+            h = dh;
+        }
+
+        if (cacheable)
+        {
+            SaveCachedLevels(cacheFile, format, source, *this);
+
+            auto end = std::chrono::high_resolution_clock::now();
+            printf("Compressed %s to %s in %.1f ms\n", filename.c_str(), FormatName(format),
+                std::chrono::duration<double, std::milli>(end - start).count());
+        }
+
+        return true;
+    }
+
+    bool Texture::LoadPages(const std::string &filename)
+    {
+        name = filename;
+        levels.clear();
+        pageLevels.clear();
+
+        uint64_t source = 0;
+        if (!SourceHash(filename, source))
+            return false;
+
+        pageFile = PageFilename(filename, format, role);
+        if (CheckPageFile(pageFile, source, *this))
+            return true;
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        std::vector<unsigned char> texels;
+        if (!DecodeImage(filename, texels))
+            return false;
+
+        if (!WritePageFile(pageFile, format, source, width, height, texels) || !CheckPageFile(pageFile, source, *this))
+            return false;
+
+        auto end = std::chrono::high_resolution_clock::now();
+        printf("Paged %s as %s in %.1f ms\n", filename.c_str(), FormatName(format),
+            std::chrono::duration<double, std::milli>(end - start).count());
+
+        return true;
+    }
+
+    size_t Texture::LevelBytes() const
+    {
+        size_t bytes = 0;
+        for (int i = 0; i < levels.size(); i++)
+            bytes += levels[i].data.size();
+        return bytes;
+    }
+
+    bool Texture::DecodeImage(const std::string &filename, std::vector<unsigned char> &texels)
+    {
+        unsigned char *texData;
+        if (IsGltfAsset(filename))
+            texData = LoadGltfImage(filename, width, height);
+        else
+            texData = stbi_load(filename.c_str(), &width, &height, NULL, 3);
+
+        if (texData == nullptr)
+            return false;
+
+        texels.assign(texData, texData + (size_t)width * height * 3);
+        stbi_image_free(texData);
+
+        if (role == TextureRoleMetallicRoughness)
+            RearrangeMetallicRoughness(texels);
+        else if (format == TextureFormatRGB8 && IsGrayscale(texels))
+            format = TextureFormatR8;
+
+        return true;
     }
-}
\ No newline at end of file
+}
@@ -28,18 +28,100 @@
 #include "split_bvh.h"
 
 namespace GLSLPT
-{    
+{
+    enum TextureFormat
+    {
+        TextureFormatRGB8,
+        TextureFormatBC1,
+        TextureFormatBC5,
+        TextureFormatBC7,
+        TextureFormatRG8,
+        TextureFormatR8
+    };
+
+    // What a texture is used for, which decides how its channels are stored
+    enum TextureRole
+    {
+        TextureRoleColor,             // Linear RGB
+        TextureRoleAlbedo,            // sRGB encoded RGB
+        TextureRoleMetallicRoughness, // Metallic in blue and roughness in green, stored as RG
+        TextureRoleNormal             // Tangent space xyz, stored as xy
+    };
+
+    // Texels along the side of a block and bytes per block, an uncompressed block is one texel
+    int BlockSize(TextureFormat format);
+    int BlockBytes(TextureFormat format);
+
+    // Formats with an sRGB variant that the hardware decodes while filtering
+    bool HasSrgbVariant(TextureFormat format);
+
+    // Bytes of one virtual texture page
+    size_t PageBytes(TextureFormat format);
+
+    // One level of a mip chain, stored with a border wrapped around from the opposite
+    // edges and padded to whole blocks so the atlas can copy it as is
+    struct TextureLevel
+    {
+        int width;
+        int height;
+        int paddedWidth;
+        int paddedHeight;
+        std::vector<unsigned char> data;
+    };
+
+    // One level of a page file, its pages follow each other row by row
+    struct PageLevel
+    {
+        int width;
+        int height;
+        int pagesX;
+        int pagesY;
+        size_t offset;
+    };
+
     class Texture
     {
     public:
-        Texture() : texData(nullptr), width(0), height(0) {};
-        ~Texture() { delete texData; }
+        // Texels of border on each side of every level
+        static const int kBorder = 1;
+
+        // Virtual texture pages are square and carry a border wrapped in from their
+        // neighbours, so filtering never crosses into another page. Four texels keep
+        // the content aligned to compressed blocks
+        static const int kPageSize = 128;
+        static const int kPageBorder = 4;
+        static const int kPageContent = kPageSize - 2 * kPageBorder;
 
+        Texture() : width(0), height(0), format(TextureFormatRGB8), role(TextureRoleColor) {};
+
+        // Decodes the image, rearranges its channels for the role and builds its box
+        // filtered mip chain in format. RGB8 images whose channels are all equal are
+        // stored as R8 instead. Compressed chains are cached next to the source image
+        // and reused while it is unchanged
         bool LoadTexture(const std::string &filename);
-        
+
+        // For virtual texturing. Splits the mip chain into pages and writes them to pageFile
+        // next to the source image instead of keeping the levels in memory. Levels stop at
+        // the first one that fits in a single page. The file is reused while the image is unchanged
+        bool LoadPages(const std::string &filename);
+
+        // Texels are sRGB encoded
+        bool IsSrgb() const { return role == TextureRoleAlbedo; }
+
+        // Bytes of the mip chain held in memory, pages of virtual textures stay in their files
+        size_t LevelBytes() const;
+
         int width;
         int height;
-        unsigned char* texData;
+        TextureFormat format;
+        TextureRole role;
+        std::vector<TextureLevel> levels;
         std::string name;
+        std::string pageFile;
+        std::vector<PageLevel> pageLevels;
+
+    private:
+        // Decodes the image as RGB8 and arranges its channels for the role
+        bool DecodeImage(const std::string &filename, std::vector<unsigned char> &texels);
     };
 }
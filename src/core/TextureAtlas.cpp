@@ -0,0 +1,270 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "TextureAtlas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace GLSLPT
+{
+    namespace
+    {
+        struct Item
+        {
+            int texture;
+            int level;
+            int width;  // In blocks, including the border and padding
+            int height;
+        };
+
+        struct Placement
+        {
+            int page;
+            int x;
+            int y;
+        };
+
+        // Page widths are kept a multiple of four texels so RGB8 rows stay 4 byte aligned for upload
+        int AlignWidth(int width, int blockSize)
+        {
+            int alignment = std::max(4 / blockSize, 1);
+            return (width + alignment - 1) / alignment * alignment;
+        }
+
+        // Shelf packs the items in the given order into pages of size x size blocks.
+        // Returns the number of pages and the extent used on the last one
+        int PackShelves(const std::vector<Item> &items, const std::vector<int> &order, int size,
+            std::vector<Placement> &placements, int &usedWidth, int &usedHeight)
+        {
+            int page = 0;
+            int cursorX = 0;
+            int shelfY = 0;
+            int shelfHeight = 0;
+            usedWidth = 0;
+
+            for (int i = 0; i < order.size(); i++)
+            {
+                const Item &item = items[order[i]];
+
+                // Items come tallest first so the first one on a shelf sets its height
+                if (cursorX + item.width > size)
+                {
+                    shelfY += shelfHeight;
+                    cursorX = 0;
+                    shelfHeight = 0;
+                }
+
+                if (shelfY + item.height > size)
+                {
+                    page++;
+                    shelfY = 0;
+                    cursorX = 0;
+                    shelfHeight = 0;
+                }
+
+                placements[order[i]] = Placement{ page, cursorX, shelfY };
+                cursorX += item.width;
+                shelfHeight = std::max(shelfHeight, item.height);
+                usedWidth = std::max(usedWidth, cursorX);
+            }
+
+            usedHeight = shelfY + shelfHeight;
+            return page + 1;
+        }
+    }
+
+    const TextureAtlas::Storage TextureAtlas::kStorages[TextureAtlas::kNumStorages] = {
+        { TextureFormatRGB8, true }, { TextureFormatRGB8, false }, { TextureFormatRG8, false }, { TextureFormatR8, false },
+        { TextureFormatBC1, true }, { TextureFormatBC1, false }, { TextureFormatBC7, true }, { TextureFormatBC7, false },
+        { TextureFormatBC5, false } };
+
+    bool TextureAtlas::IsStoredIn(const Texture *texture, const Storage &storage)
+    {
+        return texture->format == storage.format && (texture->IsSrgb() && HasSrgbVariant(texture->format)) == storage.srgb;
+    }
+
+    TextureAtlas::Layout TextureAtlas::LayoutOf(const Texture *texture)
+    {
+        if (texture->format == TextureFormatR8)
+            return LayoutGray;
+        if (texture->role == TextureRoleNormal)
+            return LayoutNormalXY;
+        return LayoutRGB;
+    }
+
+    const char *TextureAtlas::FormatName(TextureFormat format)
+    {
+        switch (format)
+        {
+        case TextureFormatBC1: return "BC1";
+        case TextureFormatBC5: return "BC5";
+        case TextureFormatBC7: return "BC7";
+        case TextureFormatRG8: return "RG8";
+        case TextureFormatR8:  return "R8";
+        default:               return "RGB8";
+        }
+    }
+
+    void TextureAtlas::Clear()
+    {
+        arrays.clear();
+        rects.clear();
+    }
+
+    void TextureAtlas::Build(const std::vector<Texture *> &textures)
+    {
+        Clear();
+        if (textures.empty())
+            return;
+
+        // Headers come first, the level entries of each texture follow in order
+        rects.resize(textures.size());
+        std::vector<int> firstEntry(textures.size());
+        for (int i = 0; i < textures.size(); i++)
+        {
+            firstEntry[i] = rects.size();
+            rects[i] = Vec4(float(firstEntry[i]), float(textures[i]->levels.size()), float(textures[i]->width), float(textures[i]->height));
+            rects.resize(rects.size() + textures[i]->levels.size() * 2);
+        }
+
+        size_t sourceBytes = 0;
+        for (int i = 0; i < textures.size(); i++)
+            sourceBytes += (size_t)textures[i]->width * textures[i]->height * 3;
+
+        for (const Storage &storage : kStorages)
+        {
+            TextureFormat format = storage.format;
+            int blockSize = BlockSize(format);
+            int blockBytes = BlockBytes(format);
+
+            std::vector<Item> items;
+            size_t area = 0;
+            int maxSide = 0;
+            for (int i = 0; i < textures.size(); i++)
+            {
+                if (!IsStoredIn(textures[i], storage))
+                    continue;
+
+                for (int l = 0; l < textures[i]->levels.size(); l++)
+                {
+                    const TextureLevel &level = textures[i]->levels[l];
+                    Item item = { i, l, level.paddedWidth / blockSize, level.paddedHeight / blockSize };
+                    items.push_back(item);
+                    area += (size_t)item.width * item.height;
+                    maxSide = std::max(maxSide, std::max(item.width, item.height));
+                }
+            }
+
+            if (items.empty())
+                continue;
+
+            if (arrays.size() == kMaxArrays)
+            {
+                printf("Texture atlas: more than %d texture formats, %s%s textures are skipped\n", kMaxArrays,
+                    storage.srgb ? "sRGB " : "", FormatName(format));
+                continue;
+            }
+
+            std::vector<int> order(items.size());
+            for (int i = 0; i < items.size(); i++)
+                order[i] = i;
+
+            std::stable_sort(order.begin(), order.end(), [&items](int a, int b)
+            {
+                if (items[a].height != items[b].height)
+                    return items[a].height > items[b].height;
+                return items[a].width > items[b].width;
+            });
+
+            // Start with a square page just big enough for the padded area and grow it
+            // until everything fits on one page or the page size limit is reached
+            int maxSize = kMaxPageSize / blockSize;
+            int size = AlignWidth(std::max(maxSide, std::min((int)std::ceil(std::sqrt((double)area)), maxSize)), blockSize);
+
+            std::vector<Placement> placements(items.size());
+            int usedWidth = 0;
+            int usedHeight = 0;
+            int numPages = PackShelves(items, order, size, placements, usedWidth, usedHeight);
+
+            while (numPages > 1 && size < maxSize)
+            {
+                size = std::min(AlignWidth(size + size / 8, blockSize), maxSize);
+                numPages = PackShelves(items, order, size, placements, usedWidth, usedHeight);
+            }
+
+            // A single page only needs to be as large as its shelves
+            int pageBlocksX = numPages == 1 ? AlignWidth(usedWidth, blockSize) : size;
+            int pageBlocksY = numPages == 1 ? usedHeight : size;
+
+            PageArray array;
+            array.format = format;
+            array.srgb = storage.srgb;
+            array.pageWidth = pageBlocksX * blockSize;
+            array.pageHeight = pageBlocksY * blockSize;
+            array.numPages = numPages;
+
+            size_t pageBytes = (size_t)pageBlocksX * pageBlocksY * blockBytes;
+            array.pages.assign(pageBytes * numPages, 0);
+
+            int arrayIndex = arrays.size();
+
+            #pragma omp parallel for schedule(dynamic)
+            for (int i = 0; i < items.size(); i++)
+            {
+                const Item &item = items[i];
+                const Placement &placement = placements[i];
+                const TextureLevel &level = textures[item.texture]->levels[item.level];
+                unsigned char *page = &array.pages[pageBytes * placement.page];
+
+                size_t rowBytes = (size_t)item.width * blockBytes;
+                for (int y = 0; y < item.height; y++)
+                    memcpy(&page[((size_t)(placement.y + y) * pageBlocksX + placement.x) * blockBytes], &level.data[y * rowBytes], rowBytes);
+
+                int entry = firstEntry[item.texture] + item.level * 2;
+                rects[entry + 0] = Vec4(
+                    float(placement.x * blockSize + Texture::kBorder) / array.pageWidth,
+                    float(placement.y * blockSize + Texture::kBorder) / array.pageHeight,
+                    float(level.width) / array.pageWidth,
+                    float(level.height) / array.pageHeight);
+                const Texture *texture = textures[item.texture];
+                float decodeSrgb = texture->IsSrgb() && !storage.srgb ? 1.0f : 0.0f;
+                rects[entry + 1] = Vec4(float(placement.page), float(arrayIndex), float(LayoutOf(texture)), decodeSrgb);
+            }
+
+            printf("Texture atlas: %d page(s) of %dx%d %s%s, %.2f MB\n", numPages, array.pageWidth, array.pageHeight,
+                storage.srgb ? "sRGB " : "", FormatName(format), array.pages.size() / (1024.0 * 1024.0));
+
+            arrays.push_back(std::move(array));
+        }
+
+        size_t atlasBytes = 0;
+        for (int i = 0; i < arrays.size(); i++)
+            atlasBytes += arrays[i].pages.size();
+
+        printf("Texture memory: %.2f MB with mips, %.2f MB of RGB8 source texels\n",
+            atlasBytes / (1024.0 * 1024.0), sourceBytes / (1024.0 * 1024.0));
+    }
+}
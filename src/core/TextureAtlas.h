@@ -0,0 +1,91 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <vector>
+#include "Texture.h"
+#include "Vec4.h"
+
+namespace GLSLPT
+{
+    // Packs the mip levels of textures of any size into equally sized pages that are
+    // uploaded as the layers of a texture array, one array per texture format. Levels
+    // are placed on shelves with the wrapped border they were imported with, so
+    // bilinear filtering of repeating uvs never picks up a neighbouring texture
+    class TextureAtlas
+    {
+    public:
+        // Pages grow up to this size before a second page is started. A texture that
+        // is larger on its own gets pages big enough to hold it
+        static const int kMaxPageSize = 4096;
+
+        // The shaders have a sampler for each array
+        static const int kMaxArrays = 4;
+
+        // How the shader turns a fetched texel into the channels its role expects
+        enum Layout
+        {
+            LayoutRGB,      // As stored
+            LayoutGray,     // Red is broadcast to all channels
+            LayoutNormalXY  // Blue is reconstructed from red and green
+        };
+
+        // Format of an array and whether it is sampled through the sRGB variant
+        struct Storage
+        {
+            TextureFormat format;
+            bool srgb;
+        };
+
+        // Arrays are made in this order so the layout is deterministic
+        static const int kNumStorages = 9;
+        static const Storage kStorages[kNumStorages];
+
+        // Textures go into an array of their format, sRGB textures into the sRGB variant if there is one
+        static bool IsStoredIn(const Texture *texture, const Storage &storage);
+        static Layout LayoutOf(const Texture *texture);
+        static const char *FormatName(TextureFormat format);
+
+        struct PageArray
+        {
+            TextureFormat format;
+            bool srgb;
+            int pageWidth;
+            int pageHeight;
+            int numPages;
+            std::vector<unsigned char> pages;
+        };
+
+        void Build(const std::vector<Texture *> &textures);
+        void Clear();
+
+        std::vector<PageArray> arrays;
+
+        // Lookup table uploaded as a row of texels. Texture i starts with a header at
+        // entry i holding (first level entry, number of levels, width, height). Every
+        // level then has two entries, offset.xy and scale.xy of the level in page uv
+        // followed by (page, array, layout, 1 if the shader has to decode sRGB)
+        std::vector<Vec4> rects;
+    };
+}
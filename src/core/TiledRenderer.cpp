@@ -48,12 +48,17 @@ namespace GLSLPT
         , pathTraceTextureLowRes(0)
         , accumTexture(0)
         , tileOutputTexture()
+        , feedbackTexture(0)
+        , feedbackPBO()
+        , feedbackPending()
+        , feedbackIndex(0)
         , tileX(-1)
         , tileY(-1)
         , numTilesX(-1)
         , numTilesY(-1)
         , currentBuffer(0)
         , sampleCounter(0)
+        , bvhStackSize(0)
     {
     }
 
@@ -84,45 +89,11 @@ namespace GLSLPT
         //----------------------------------------------------------
 
         ShaderInclude::ShaderSource vertexShaderSrcObj          = ShaderInclude::load(shadersDirectory + "common/vertex.glsl");
-        ShaderInclude::ShaderSource pathTraceShaderSrcObj       = ShaderInclude::load(shadersDirectory + "tiled.glsl");
-        ShaderInclude::ShaderSource pathTraceShaderLowResSrcObj = ShaderInclude::load(shadersDirectory + "progressive.glsl");
         ShaderInclude::ShaderSource accumShaderSrcObj           = ShaderInclude::load(shadersDirectory + "accumulation.glsl");
         ShaderInclude::ShaderSource outputShaderSrcObj          = ShaderInclude::load(shadersDirectory + "output.glsl");
         ShaderInclude::ShaderSource tonemapShaderSrcObj         = ShaderInclude::load(shadersDirectory + "tonemap.glsl");
 
-        // Add preprocessor defines for conditional compilation
-        std::string defines = "";
-        if (scene->renderOptions.useEnvMap && scene->hdrData != nullptr)
-            defines += "#define ENVMAP\n";
-        if (!scene->lights.empty())
-            defines += "#define LIGHTS\n";
-        if (scene->renderOptions.enableRR)
-        {
-            defines += "#define RR\n";
-            defines += "#define RR_DEPTH " + std::to_string(scene->renderOptions.RRDepth) + "\n";
-        }
-        if (scene->renderOptions.useConstantBg)
-            defines += "#define CONSTANT_BG\n";
-
-        if (defines.size() > 0)
-        {
-            size_t idx = pathTraceShaderSrcObj.src.find("#version");
-            if (idx != -1)
-                idx = pathTraceShaderSrcObj.src.find("\n", idx);
-            else
-                idx = 0;
-            pathTraceShaderSrcObj.src.insert(idx + 1, defines);
-
-            idx = pathTraceShaderLowResSrcObj.src.find("#version");
-            if (idx != -1)
-                idx = pathTraceShaderLowResSrcObj.src.find("\n", idx);
-            else
-                idx = 0;
-            pathTraceShaderLowResSrcObj.src.insert(idx + 1, defines);
-        }
-
-        pathTraceShader       = LoadShaders(vertexShaderSrcObj, pathTraceShaderSrcObj);
-        pathTraceShaderLowRes = LoadShaders(vertexShaderSrcObj, pathTraceShaderLowResSrcObj);
+        LoadPathTraceShaders();
         accumShader           = LoadShaders(vertexShaderSrcObj, accumShaderSrcObj);
         outputShader          = LoadShaders(vertexShaderSrcObj, outputShaderSrcObj);
         tonemapShader         = LoadShaders(vertexShaderSrcObj, tonemapShaderSrcObj);
@@ -145,6 +116,29 @@ namespace GLSLPT
         glBindTexture(GL_TEXTURE_2D, 0);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pathTraceTexture, 0);
 
+        // The tile shader also writes the page each pixel wants streamed in
+        if (!scene->virtualTextures.IsEmpty())
+        {
+            glGenTextures(1, &feedbackTexture);
+            glBindTexture(GL_TEXTURE_2D, feedbackTexture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, tileWidth, tileHeight, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, feedbackTexture, 0);
+
+            GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+            glDrawBuffers(2, drawBuffers);
+
+            glGenBuffers(2, feedbackPBO);
+            for (int i = 0; i < 2; i++)
+            {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackPBO[i]);
+                glBufferData(GL_PIXEL_PACK_BUFFER, tileWidth * tileHeight * sizeof(GLuint), nullptr, GL_STREAM_READ);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+
         //Create FBOs for path trace shader (Progressive)
         printf("Buffer pathTraceFBOLowRes\n");
         glGenFramebuffers(1, &pathTraceFBOLowRes);
@@ -209,13 +203,109 @@ namespace GLSLPT
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glBindTexture(GL_TEXTURE_2D, 0);
 
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_BUFFER, BVHTex);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_BUFFER, vertexIndicesTex);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_BUFFER, verticesTex);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_BUFFER, normalsTex);
+        glActiveTexture(GL_TEXTURE5);
+        glBindTexture(GL_TEXTURE_2D, materialsTex);
+        glActiveTexture(GL_TEXTURE6);
+        glBindTexture(GL_TEXTURE_2D, transformsTex);
+        glActiveTexture(GL_TEXTURE7);
+        glBindTexture(GL_TEXTURE_2D, lightsTex);
+        glActiveTexture(GL_TEXTURE8);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textureArrayTex[0]);
+        glActiveTexture(GL_TEXTURE9);
+        glBindTexture(GL_TEXTURE_2D, hdrTex);
+        glActiveTexture(GL_TEXTURE10);
+        glBindTexture(GL_TEXTURE_2D, hdrMarginalDistTex);
+        glActiveTexture(GL_TEXTURE11);
+        glBindTexture(GL_TEXTURE_2D, hdrConditionalDistTex);
+        glActiveTexture(GL_TEXTURE12);
+        glBindTexture(GL_TEXTURE_2D, textureRectsTex);
+        glActiveTexture(GL_TEXTURE13);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textureArrayTex[1]);
+        glActiveTexture(GL_TEXTURE14);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textureArrayTex[2]);
+        glActiveTexture(GL_TEXTURE15);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textureArrayTex[3]);
+    }
+
+    void TiledRenderer::LoadPathTraceShaders()
+    {
+        ShaderInclude::ShaderSource vertexShaderSrcObj          = ShaderInclude::load(shadersDirectory + "common/vertex.glsl");
+        ShaderInclude::ShaderSource pathTraceShaderSrcObj       = ShaderInclude::load(shadersDirectory + "tiled.glsl");
+        ShaderInclude::ShaderSource pathTraceShaderLowResSrcObj = ShaderInclude::load(shadersDirectory + "progressive.glsl");
+
+        // Add preprocessor defines for conditional compilation
+        std::string defines = "";
+        if (scene->renderOptions.useEnvMap && scene->hdrData != nullptr)
+        {
+            defines += "#define ENVMAP\n";
+            if (scene->hdrData->luminancePyramid != nullptr)
+                defines += "#define ENVMAP_PYRAMID\n";
+            else if (scene->hdrData->aliasTable != nullptr)
+                defines += "#define ENVMAP_ALIAS\n";
+            else if (scene->hdrData->halfConditionalDistData != nullptr)
+                defines += "#define ENVMAP_HALF_DIST\n";
+        }
+        if (!scene->lights.empty())
+            defines += "#define LIGHTS\n";
+        if (scene->renderOptions.enableRR)
+        {
+            defines += "#define RR\n";
+            defines += "#define RR_DEPTH " + std::to_string(scene->renderOptions.RRDepth) + "\n";
+        }
+        if (scene->renderOptions.useConstantBg)
+            defines += "#define CONSTANT_BG\n";
+        if (scene->renderOptions.quantizeVertices)
+            defines += "#define QUANTIZED_VERTICES\n";
+        if (scene->bvhTranslator.width > 2)
+        {
+            defines += "#define WIDE_BVH\n";
+            defines += "#define BVH_WIDTH " + std::to_string(scene->bvhTranslator.width) + "\n";
+            defines += "#define BVH_STACK_SIZE " + std::to_string(scene->bvhTranslator.wideStackSize) + "\n";
+        }
+        bvhStackSize = scene->bvhTranslator.wideStackSize;
+        if (!scene->virtualTextures.IsEmpty())
+        {
+            defines += "#define VIRTUAL_TEXTURES\n";
+            defines += "#define VT_PAGE_SIZE " + std::to_string(Texture::kPageSize) + "\n";
+            defines += "#define VT_PAGE_BORDER " + std::to_string(Texture::kPageBorder) + "\n";
+        }
+
+        if (defines.size() > 0)
+        {
+            size_t idx = pathTraceShaderSrcObj.src.find("#version");
+            if (idx != -1)
+                idx = pathTraceShaderSrcObj.src.find("\n", idx);
+            else
+                idx = 0;
+            pathTraceShaderSrcObj.src.insert(idx + 1, defines);
+
+            idx = pathTraceShaderLowResSrcObj.src.find("#version");
+            if (idx != -1)
+                idx = pathTraceShaderLowResSrcObj.src.find("\n", idx);
+            else
+                idx = 0;
+            pathTraceShaderLowResSrcObj.src.insert(idx + 1, defines);
+        }
+
+        pathTraceShader       = LoadShaders(vertexShaderSrcObj, pathTraceShaderSrcObj);
+        pathTraceShaderLowRes = LoadShaders(vertexShaderSrcObj, pathTraceShaderLowResSrcObj);
+
         GLuint shaderObject;
 
         pathTraceShader->Use();
         shaderObject = pathTraceShader->getObject();
 
         glUniform1f(glGetUniformLocation(shaderObject, "hdrResolution"), scene->hdrData == nullptr ? 0 : float(scene->hdrData->width * scene->hdrData->height));
-        glUniform1i(glGetUniformLocation(shaderObject, "topBVHIndex"), scene->bvhTranslator.topLevelIndex);
+        glUniform1f(glGetUniformLocation(shaderObject, "hdrLuminanceSum"), scene->hdrData == nullptr ? 0 : scene->hdrData->luminanceSum);
+        glUniform1i(glGetUniformLocation(shaderObject, "topBVHIndex"), scene->bvhTranslator.packedTopLevelIndex);
         glUniform2f(glGetUniformLocation(shaderObject, "screenResolution"), float(screenSize.x), float(screenSize.y));
         glUniform1i(glGetUniformLocation(shaderObject, "numOfLights"), numOfLights);
         glUniform1f(glGetUniformLocation(shaderObject, "invNumTilesX"), 1.0f / ((float)screenSize.x / tileWidth));
@@ -228,10 +318,18 @@ namespace GLSLPT
         glUniform1i(glGetUniformLocation(shaderObject, "materialsTex"), 5);
         glUniform1i(glGetUniformLocation(shaderObject, "transformsTex"), 6);
         glUniform1i(glGetUniformLocation(shaderObject, "lightsTex"), 7);
-        glUniform1i(glGetUniformLocation(shaderObject, "textureMapsArrayTex"), 8);
+        glUniform1i(glGetUniformLocation(shaderObject, "textureArray0"), 8);
         glUniform1i(glGetUniformLocation(shaderObject, "hdrTex"), 9);
         glUniform1i(glGetUniformLocation(shaderObject, "hdrMarginalDistTex"), 10);
         glUniform1i(glGetUniformLocation(shaderObject, "hdrCondDistTex"), 11);
+        glUniform1i(glGetUniformLocation(shaderObject, "hdrAliasTex"), 11);
+        glUniform1i(glGetUniformLocation(shaderObject, "hdrPyramidTex"), 11);
+        glUniform1i(glGetUniformLocation(shaderObject, "hdrPyramidLevels"), scene->hdrData == nullptr ? 0 : scene->hdrData->pyramidLevels);
+        glUniform1i(glGetUniformLocation(shaderObject, "textureRectsTex"), 12);
+        glUniform1i(glGetUniformLocation(shaderObject, "textureArray1"), 13);
+        glUniform1i(glGetUniformLocation(shaderObject, "textureArray2"), 14);
+        glUniform1i(glGetUniformLocation(shaderObject, "textureArray3"), 15);
+        glUniform1i(glGetUniformLocation(shaderObject, "pageTableOffset"), pageTableOffset);
 
         pathTraceShader->StopUsing();
 
@@ -239,7 +337,8 @@ namespace GLSLPT
         shaderObject = pathTraceShaderLowRes->getObject();
 
         glUniform1f(glGetUniformLocation(shaderObject, "hdrResolution"), scene->hdrData == nullptr ? 0 : float(scene->hdrData->width * scene->hdrData->height));
-        glUniform1i(glGetUniformLocation(shaderObject, "topBVHIndex"), scene->bvhTranslator.topLevelIndex);
+        glUniform1f(glGetUniformLocation(shaderObject, "hdrLuminanceSum"), scene->hdrData == nullptr ? 0 : scene->hdrData->luminanceSum);
+        glUniform1i(glGetUniformLocation(shaderObject, "topBVHIndex"), scene->bvhTranslator.packedTopLevelIndex);
         glUniform2f(glGetUniformLocation(shaderObject, "screenResolution"), float(screenSize.x), float(screenSize.y));
         glUniform1i(glGetUniformLocation(shaderObject, "numOfLights"), numOfLights);
         glUniform1i(glGetUniformLocation(shaderObject, "accumTexture"), 0);
@@ -250,35 +349,20 @@ namespace GLSLPT
         glUniform1i(glGetUniformLocation(shaderObject, "materialsTex"), 5);
         glUniform1i(glGetUniformLocation(shaderObject, "transformsTex"), 6);
         glUniform1i(glGetUniformLocation(shaderObject, "lightsTex"), 7);
-        glUniform1i(glGetUniformLocation(shaderObject, "textureMapsArrayTex"), 8);
+        glUniform1i(glGetUniformLocation(shaderObject, "textureArray0"), 8);
         glUniform1i(glGetUniformLocation(shaderObject, "hdrTex"), 9);
         glUniform1i(glGetUniformLocation(shaderObject, "hdrMarginalDistTex"), 10);
         glUniform1i(glGetUniformLocation(shaderObject, "hdrCondDistTex"), 11);
+        glUniform1i(glGetUniformLocation(shaderObject, "hdrAliasTex"), 11);
+        glUniform1i(glGetUniformLocation(shaderObject, "hdrPyramidTex"), 11);
+        glUniform1i(glGetUniformLocation(shaderObject, "hdrPyramidLevels"), scene->hdrData == nullptr ? 0 : scene->hdrData->pyramidLevels);
+        glUniform1i(glGetUniformLocation(shaderObject, "textureRectsTex"), 12);
+        glUniform1i(glGetUniformLocation(shaderObject, "textureArray1"), 13);
+        glUniform1i(glGetUniformLocation(shaderObject, "textureArray2"), 14);
+        glUniform1i(glGetUniformLocation(shaderObject, "textureArray3"), 15);
+        glUniform1i(glGetUniformLocation(shaderObject, "pageTableOffset"), pageTableOffset);
 
         pathTraceShaderLowRes->StopUsing();
-
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_BUFFER, BVHTex);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_BUFFER, vertexIndicesTex);
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_BUFFER, verticesTex);
-        glActiveTexture(GL_TEXTURE4);
-        glBindTexture(GL_TEXTURE_BUFFER, normalsTex);
-        glActiveTexture(GL_TEXTURE5);
-        glBindTexture(GL_TEXTURE_2D, materialsTex);
-        glActiveTexture(GL_TEXTURE6);
-        glBindTexture(GL_TEXTURE_2D, transformsTex);
-        glActiveTexture(GL_TEXTURE7);
-        glBindTexture(GL_TEXTURE_2D, lightsTex);
-        glActiveTexture(GL_TEXTURE8);
-        glBindTexture(GL_TEXTURE_2D_ARRAY, textureMapsArrayTex);
-        glActiveTexture(GL_TEXTURE9);
-        glBindTexture(GL_TEXTURE_2D, hdrTex);
-        glActiveTexture(GL_TEXTURE10);
-        glBindTexture(GL_TEXTURE_2D, hdrMarginalDistTex);
-        glActiveTexture(GL_TEXTURE11);
-        glBindTexture(GL_TEXTURE_2D, hdrConditionalDistTex);
     }
 
     void TiledRenderer::Finish()
@@ -292,6 +376,8 @@ namespace GLSLPT
         glDeleteTextures(1, &tileOutputTexture[0]);
         glDeleteTextures(1, &tileOutputTexture[1]);
         glDeleteTextures(1, &denoisedTexture);
+        glDeleteTextures(1, &feedbackTexture);
+        glDeleteBuffers(2, feedbackPBO);
 
         glDeleteFramebuffers(1, &pathTraceFBO);
         glDeleteFramebuffers(1, &pathTraceFBOLowRes);
@@ -318,6 +404,9 @@ namespace GLSLPT
             return;
         }
 
+        if (feedbackTexture != 0)
+            StreamPages();
+
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, accumTexture);
 
@@ -344,6 +433,17 @@ namespace GLSLPT
             glViewport(0, 0, tileWidth, tileHeight);
             quad->Draw(pathTraceShader);
 
+            if (feedbackTexture != 0)
+            {
+                glReadBuffer(GL_COLOR_ATTACHMENT1);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackPBO[feedbackIndex]);
+                glReadPixels(0, 0, tileWidth, tileHeight, GL_RED_INTEGER, GL_UNSIGNED_INT, 0);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                glReadBuffer(GL_COLOR_ATTACHMENT0);
+                feedbackPending[feedbackIndex] = true;
+                feedbackIndex = 1 - feedbackIndex;
+            }
+
             glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
             glViewport(tileWidth * tileX, tileHeight * tileY, tileWidth, tileHeight);
             glActiveTexture(GL_TEXTURE0);
@@ -365,6 +465,32 @@ namespace GLSLPT
         }
     }
 
+    void TiledRenderer::StreamPages()
+    {
+        // Requests of the tile before last, the last one may still be in flight
+        if (!feedbackPending[feedbackIndex])
+            return;
+
+        // Enough pages to fill the slots in a few tiles without stalling a frame
+        const int kMaxUploadsPerTile = 64;
+
+        std::vector<VirtualTextures::PageUpload> uploads;
+        std::vector<int> dirtyPages;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackPBO[feedbackIndex]);
+        const GLuint *requests = (const GLuint *)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if (requests != nullptr)
+        {
+            scene->virtualTextures.Update(requests, tileWidth * tileHeight, kMaxUploadsPerTile, uploads, dirtyPages);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        feedbackPending[feedbackIndex] = false;
+
+        UploadPages(uploads);
+        UpdatePageTable(dirtyPages);
+    }
+
     void TiledRenderer::Present() const
     {
         if (!initialized)
@@ -420,6 +546,17 @@ namespace GLSLPT
     {
         Renderer::Update(secondsElapsed);
 
+        // The traversal drops nodes that don't fit its stack, so the shaders are rebuilt
+        // whenever the packed BVH needs more than they were compiled for, as moved
+        // instances can give a deeper TLAS
+        if (scene->bvhTranslator.width > 2 && scene->bvhTranslator.wideStackSize > bvhStackSize)
+        {
+            printf("BVH stack grew from %d to %d entries, recompiling shaders\n", bvhStackSize, scene->bvhTranslator.wideStackSize);
+            delete pathTraceShader;
+            delete pathTraceShaderLowRes;
+            LoadPathTraceShaders();
+        }
+
         float r1, r2, r3;
 
         // Denoise Image
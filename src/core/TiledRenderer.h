@@ -53,6 +53,13 @@ namespace GLSLPT
         GLuint tileOutputTexture[2];
         GLuint denoisedTexture;
 
+        // Virtual texture page requests of the tiles, read back a frame late so
+        // mapping a buffer doesn't wait on the tile that is being traced
+        GLuint feedbackTexture;
+        GLuint feedbackPBO[2];
+        bool feedbackPending[2];
+        int feedbackIndex;
+
         int tileX;
         int tileY;
         int numTilesX;
@@ -71,6 +78,13 @@ namespace GLSLPT
 
         bool denoised;
 
+        // Wide BVH traversal stack the path trace shaders were compiled with
+        int bvhStackSize;
+
+        // Compiles the path trace shaders for the scene and sets their uniforms
+        void LoadPathTraceShaders();
+        void StreamPages();
+
     public:
         TiledRenderer(Scene *scene, const std::string& shadersDirectory);
         ~TiledRenderer();
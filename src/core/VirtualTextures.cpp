@@ -0,0 +1,261 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "VirtualTextures.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace GLSLPT
+{
+    void VirtualTextures::Clear()
+    {
+        for (int i = 0; i < files.size(); i++)
+            delete files[i];
+
+        files.clear();
+        ranges.clear();
+        pageStates.clear();
+        lru.clear();
+        freeSlots.clear();
+        arrays.clear();
+        rects.clear();
+        pageTable.clear();
+        numPages = 0;
+        updateIndex = 0;
+    }
+
+    void VirtualTextures::Build(const std::vector<Texture *> &textures, int slotsPerArray)
+    {
+        Clear();
+        if (textures.empty())
+            return;
+
+        // Textures keep the array order of the atlas
+        std::vector<int> arrayOf(textures.size(), -1);
+        for (const TextureAtlas::Storage &storage : TextureAtlas::kStorages)
+        {
+            bool used = false;
+            for (int i = 0; i < textures.size(); i++)
+            {
+                if (!TextureAtlas::IsStoredIn(textures[i], storage))
+                    continue;
+
+                if (arrays.size() == TextureAtlas::kMaxArrays)
+                {
+                    printf("Virtual textures: more than %d texture formats, %s%s textures are skipped\n", TextureAtlas::kMaxArrays,
+                        storage.srgb ? "sRGB " : "", TextureAtlas::FormatName(storage.format));
+                    break;
+                }
+
+                arrayOf[i] = arrays.size();
+                used = true;
+            }
+
+            if (used)
+                arrays.push_back(PageArray{ storage.format, storage.srgb, 0 });
+        }
+
+        // Headers come first, the level entries of each texture follow in order
+        rects.resize(textures.size());
+        for (int i = 0; i < textures.size(); i++)
+        {
+            const Texture *texture = textures[i];
+            MappedFile *file = new MappedFile;
+            files.push_back(file);
+
+            int numLevels = texture->pageLevels.size();
+            if (arrayOf[i] < 0 || !file->Open(texture->pageFile))
+            {
+                printf("Virtual textures: no pages for %s\n", texture->name.c_str());
+                numLevels = 0;
+            }
+
+            int firstEntry = rects.size();
+            rects[i] = Vec4(float(firstEntry), float(numLevels), float(texture->width), float(texture->height));
+
+            for (int l = 0; l < numLevels; l++)
+            {
+                float decodeSrgb = texture->IsSrgb() && !arrays[arrayOf[i]].srgb ? 1.0f : 0.0f;
+                const PageLevel &level = texture->pageLevels[l];
+                ranges.push_back(PageRange{ numPages, i, l, arrayOf[i], level.offset });
+                rects.push_back(Vec4(float(numPages), float(level.pagesX), float(level.width), float(level.height)));
+                rects.push_back(Vec4(0.0f, float(arrayOf[i]), float(TextureAtlas::LayoutOf(texture)), decodeSrgb));
+                numPages += level.pagesX * level.pagesY;
+            }
+        }
+
+        pageTable.assign(numPages, -1);
+        pageStates.assign(numPages, PageState{ -1, false, std::list<int>::iterator() });
+        lru.resize(arrays.size());
+        freeSlots.resize(arrays.size());
+
+        // The last level of every texture is a single page
+        std::vector<std::vector<int>> pinned(arrays.size());
+        for (int i = 0; i < ranges.size(); i++)
+        {
+            if (i + 1 == ranges.size() || ranges[i + 1].texture != ranges[i].texture)
+                pinned[ranges[i].array].push_back(ranges[i].firstPage);
+        }
+
+        // Streamed pages need some room besides the pinned ones
+        const int kMinStreamedSlots = 64;
+        const int maxSlots = kMaxSlots;
+        size_t slotBytes = 0;
+        for (int a = 0; a < arrays.size(); a++)
+        {
+            int numPinned = std::min((int)pinned[a].size(), maxSlots - kMinStreamedSlots);
+            if (numPinned < pinned[a].size())
+            {
+                printf("Virtual textures: %d %s textures don't fit in the array and are left without a fallback\n",
+                    (int)pinned[a].size() - numPinned, TextureAtlas::FormatName(arrays[a].format));
+            }
+
+            arrays[a].numSlots = std::min(std::max(slotsPerArray, numPinned + kMinStreamedSlots), maxSlots);
+
+            for (int slot = 0; slot < numPinned; slot++)
+            {
+                pageTable[pinned[a][slot]] = slot;
+                pageStates[pinned[a][slot]].pinned = true;
+            }
+
+            // Handed out from the back, lowest slot first
+            for (int slot = arrays[a].numSlots - 1; slot >= numPinned; slot--)
+                freeSlots[a].push_back(slot);
+
+            slotBytes += arrays[a].numSlots * PageBytes(arrays[a].format);
+        }
+
+        printf("Virtual textures: %d pages in %d array(s) of %dx%d slots, %.2f MB resident\n", numPages, (int)arrays.size(),
+            Texture::kPageSize, Texture::kPageSize, slotBytes / (1024.0 * 1024.0));
+    }
+
+    const VirtualTextures::PageRange &VirtualTextures::RangeOf(int page) const
+    {
+        auto it = std::upper_bound(ranges.begin(), ranges.end(), page, [](int page, const PageRange &range)
+        {
+            return page < range.firstPage;
+        });
+        return *(it - 1);
+    }
+
+    const unsigned char *VirtualTextures::PageData(int page) const
+    {
+        const PageRange &range = RangeOf(page);
+        return files[range.texture]->Data() + range.offset + (page - range.firstPage) * PageBytes(arrays[range.array].format);
+    }
+
+    void VirtualTextures::Update(const unsigned int *requests, size_t count, int maxUploads,
+        std::vector<PageUpload> &uploads, std::vector<int> &dirtyPages)
+    {
+        if (numPages == 0)
+            return;
+
+        updateIndex++;
+
+        std::vector<int> pages;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (requests[i] != 0 && requests[i] <= (unsigned int)numPages)
+                pages.push_back(int(requests[i] - 1));
+        }
+
+        std::sort(pages.begin(), pages.end());
+        pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+        // Keep what is resident, collect what is missing
+        std::vector<int> missing;
+        for (int i = 0; i < pages.size(); i++)
+        {
+            int page = pages[i];
+            PageState &state = pageStates[page];
+            state.lastUsed = updateIndex;
+
+            if (pageTable[page] < 0)
+                missing.push_back(page);
+            else if (!state.pinned)
+            {
+                std::list<int> &list = lru[RangeOf(page).array];
+                list.splice(list.begin(), list, state.lruPosition);
+            }
+        }
+
+        // A coarser level covers more of the texture and makes a better fallback for the finer ones
+        std::stable_sort(missing.begin(), missing.end(), [this](int a, int b)
+        {
+            return RangeOf(a).level > RangeOf(b).level;
+        });
+
+        for (int i = 0; i < missing.size() && (int)uploads.size() < maxUploads; i++)
+        {
+            int page = missing[i];
+            int array = RangeOf(page).array;
+            std::list<int> &list = lru[array];
+
+            int slot;
+            if (!freeSlots[array].empty())
+            {
+                slot = freeSlots[array].back();
+                freeSlots[array].pop_back();
+            }
+            else
+            {
+                // Everything resident is in use, the rest has to wait for a later update
+                int victim = list.empty() ? -1 : list.back();
+                if (victim < 0 || pageStates[victim].lastUsed == updateIndex)
+                    continue;
+
+                list.pop_back();
+                slot = pageTable[victim];
+                pageTable[victim] = -1;
+                dirtyPages.push_back(victim);
+            }
+
+            pageTable[page] = slot;
+            list.push_front(page);
+            pageStates[page].lruPosition = list.begin();
+            dirtyPages.push_back(page);
+            uploads.push_back(PageUpload{ array, slot, PageData(page) });
+        }
+    }
+
+    void VirtualTextures::ResidentPages(std::vector<PageUpload> &uploads) const
+    {
+        for (int page = 0; page < numPages; page++)
+        {
+            if (pageTable[page] >= 0)
+                uploads.push_back(PageUpload{ RangeOf(page).array, pageTable[page], PageData(page) });
+        }
+    }
+
+    Vec4 VirtualTextures::PageTableTexel(int texel) const
+    {
+        float slots[4];
+        for (int i = 0; i < 4; i++)
+        {
+            int page = texel * 4 + i;
+            slots[i] = page < numPages ? float(pageTable[page]) : -1.0f;
+        }
+        return Vec4(slots[0], slots[1], slots[2], slots[3]);
+    }
+}
@@ -0,0 +1,130 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <list>
+#include <vector>
+#include "MappedFile.h"
+#include "Texture.h"
+#include "TextureAtlas.h"
+#include "Vec4.h"
+
+namespace GLSLPT
+{
+    // Streams the pages of textures loaded with Texture::LoadPages into a fixed number
+    // of slots, the layers of one texture array per format. Page files stay mapped and
+    // pages are copied out of them when the renderer reports that it needs them. The
+    // single page holding the coarsest levels of each texture is pinned, so a lookup
+    // always finds something to filter while finer pages are on their way
+    class VirtualTextures
+    {
+    public:
+        // Most GPUs allow 2048 layers per array
+        static const int kMaxSlots = 2048;
+
+        struct PageArray
+        {
+            TextureFormat format;
+            bool srgb;
+            int numSlots;
+        };
+
+        // A page to copy into a slot of an array
+        struct PageUpload
+        {
+            int array;
+            int slot;
+            const unsigned char *data;
+        };
+
+        VirtualTextures() : numPages(0), updateIndex(0) {}
+        ~VirtualTextures() { Clear(); }
+
+        // Lays out the page table of the textures and pins their last page.
+        // Arrays get slotsPerArray slots or more if the pinned pages need them
+        void Build(const std::vector<Texture *> &textures, int slotsPerArray);
+        void Clear();
+
+        // Takes the page requests read back from the renderer, numbered from 1 with 0 for
+        // none, and picks up to maxUploads missing pages to stream in, coarser levels first.
+        // Slots of the least recently requested pages are reused, but never for a page
+        // requested in the same update. Changed page table entries are added to dirtyPages
+        void Update(const unsigned int *requests, size_t count, int maxUploads,
+            std::vector<PageUpload> &uploads, std::vector<int> &dirtyPages);
+
+        // Every page that is currently in a slot, for filling the arrays from scratch
+        void ResidentPages(std::vector<PageUpload> &uploads) const;
+
+        // The page table is uploaded after the rects, four entries per texel
+        Vec4 PageTableTexel(int texel) const;
+        int PageTableTexels() const { return (numPages + 3) / 4; }
+
+        bool IsEmpty() const { return rects.empty(); }
+
+        std::vector<PageArray> arrays;
+
+        // Same header entries as TextureAtlas::rects. The two entries of a level are
+        // (first page, pages across, width, height) and (0, array, layout, 1 if the
+        // shader has to decode sRGB). Pages of a level are numbered row by row
+        std::vector<Vec4> rects;
+
+        // Slot of every page or -1 if it isn't resident
+        std::vector<int> pageTable;
+
+    private:
+        VirtualTextures(const VirtualTextures&) = delete;
+        VirtualTextures& operator = (const VirtualTextures&) = delete;
+
+        // Consecutive pages of one texture level and where they start in its page file
+        struct PageRange
+        {
+            int firstPage;
+            int texture;
+            int level;
+            int array;
+            size_t offset;
+        };
+
+        struct PageState
+        {
+            int lastUsed;
+            bool pinned;
+            std::list<int>::iterator lruPosition;
+        };
+
+        const PageRange &RangeOf(int page) const;
+        const unsigned char *PageData(int page) const;
+
+        std::vector<MappedFile *> files;
+        std::vector<PageRange> ranges;
+        std::vector<PageState> pageStates;
+
+        // Per array, resident pages from most to least recently requested and unused slots
+        std::vector<std::list<int>> lru;
+        std::vector<std::vector<int>> freeSlots;
+
+        int numPages;
+        int updateIndex;
+    };
+}
@@ -0,0 +1,88 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "AsyncSceneLoader.h"
+#include "Loader.h"
+
+namespace GLSLPT
+{
+    AsyncSceneLoader::~AsyncSceneLoader()
+    {
+        Cancel();
+        Join();
+        delete scene;
+    }
+
+    void AsyncSceneLoader::Start(const std::string &sceneFile, const RenderOptions &renderOptions)
+    {
+        Cancel();
+        Join();
+        delete scene;
+
+        filename = sceneFile;
+        options = renderOptions;
+        progress.Reset();
+        finished = false;
+        succeeded = false;
+        scene = new Scene();
+        scene->loadProgress = &progress;
+
+        worker = std::thread([this]()
+        {
+            succeeded = LoadSceneFromFile(filename, scene, options) && !progress.IsCancelled();
+            finished = true;
+        });
+    }
+
+    void AsyncSceneLoader::Cancel()
+    {
+        if (IsLoading())
+            progress.Cancel();
+    }
+
+    void AsyncSceneLoader::Join()
+    {
+        // A cancelled load returns at the next asset or stage
+        if (worker.joinable())
+            worker.join();
+    }
+
+    Scene *AsyncSceneLoader::Take(RenderOptions &renderOptions)
+    {
+        Join();
+
+        Scene *loaded = scene;
+        scene = nullptr;
+
+        if (!succeeded)
+        {
+            delete loaded;
+            return nullptr;
+        }
+
+        loaded->loadProgress = nullptr;
+        renderOptions = options;
+        succeeded = false;
+        return loaded;
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include "LoadProgress.h"
+#include "Scene.h"
+
+namespace GLSLPT
+{
+    // Loads a scene file on a worker thread while the caller keeps rendering its current
+    // scene. Nothing touches GL here, the caller takes the finished scene and creates
+    // its renderer on the render thread
+    class AsyncSceneLoader
+    {
+    public:
+        AsyncSceneLoader() : scene(nullptr), finished(false), succeeded(false) {}
+        ~AsyncSceneLoader();
+
+        // Cancels a load that is still running before starting the new one
+        void Start(const std::string &filename, const RenderOptions &renderOptions);
+        void Cancel();
+
+        bool IsLoading() const { return worker.joinable() && !finished; }
+        bool IsFinished() const { return worker.joinable() && finished; }
+
+        // Hands over the scene of a finished load along with the options read from its
+        // file. Returns nullptr if the load failed or was cancelled
+        Scene *Take(RenderOptions &renderOptions);
+
+        const LoadProgress &Progress() const { return progress; }
+        const std::string &Filename() const { return filename; }
+
+    private:
+        AsyncSceneLoader(const AsyncSceneLoader&) = delete;
+        AsyncSceneLoader& operator = (const AsyncSceneLoader&) = delete;
+
+        void Join();
+
+        std::thread worker;
+        LoadProgress progress;
+        std::string filename;
+        Scene *scene;
+        RenderOptions options;
+        std::atomic<bool> finished;
+        bool succeeded;
+    };
+}
@@ -0,0 +1,986 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "GltfLoader.h"
+#include "MappedFile.h"
+#include "Scene.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace GLSLPT
+{
+    namespace
+    {
+        const uint32_t kGlbMagic = 0x46546C67;     // "glTF"
+        const uint32_t kGlbChunkJson = 0x4E4F534A; // "JSON"
+        const uint32_t kGlbChunkBin = 0x004E4942;  // "BIN\0"
+
+        const int kComponentByte = 5120;
+        const int kComponentUnsignedByte = 5121;
+        const int kComponentShort = 5122;
+        const int kComponentUnsignedShort = 5123;
+        const int kComponentUnsignedInt = 5125;
+        const int kComponentFloat = 5126;
+
+        const int kModeTriangles = 4;
+
+        // Number of parsed files kept around while their assets are being loaded
+        const size_t kMaxOpenFiles = 4;
+
+        //--------------------------------------------
+        // Minimal JSON DOM
+
+        struct JsonValue
+        {
+            enum Type
+            {
+                Null,
+                Bool,
+                Number,
+                String,
+                Array,
+                Object
+            };
+
+            JsonValue() : type(Null), number(0.0), boolean(false) {}
+
+            const JsonValue& operator[](const char *key) const
+            {
+                for (size_t i = 0; i < object.size(); i++)
+                {
+                    if (object[i].first == key)
+                        return object[i].second;
+                }
+                return Empty();
+            }
+
+            const JsonValue& operator[](int i) const
+            {
+                return i >= 0 && i < (int)array.size() ? array[i] : Empty();
+            }
+
+            bool Has(const char *key) const { return (*this)[key].type != Null; }
+            size_t Size() const { return array.size(); }
+            int Int(int def) const { return type == Number ? (int)number : def; }
+            float Float(float def) const { return type == Number ? (float)number : def; }
+            bool Boolean(bool def) const { return type == Bool ? boolean : def; }
+
+            static const JsonValue& Empty()
+            {
+                static const JsonValue empty;
+                return empty;
+            }
+
+            Type type;
+            double number;
+            bool boolean;
+            std::string string;
+            std::vector<JsonValue> array;
+            std::vector<std::pair<std::string, JsonValue>> object;
+        };
+
+        class JsonParser
+        {
+        public:
+            JsonParser(const char *data, size_t size) : p(data), end(data + size) {}
+
+            bool Parse(JsonValue &value)
+            {
+                if (!parseValue(value, 0))
+                    return false;
+                skipSpaces();
+                return p == end;
+            }
+
+        private:
+            void skipSpaces()
+            {
+                while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+                    p++;
+            }
+
+            bool parseValue(JsonValue &value, int depth)
+            {
+                if (depth > 64)
+                    return false;
+
+                skipSpaces();
+                if (p == end)
+                    return false;
+
+                switch (*p)
+                {
+                case '{': return parseObject(value, depth);
+                case '[': return parseArray(value, depth);
+                case '"':
+                    value.type = JsonValue::String;
+                    return parseString(value.string);
+                case 't':
+                    value.type = JsonValue::Bool;
+                    value.boolean = true;
+                    return parseLiteral("true");
+                case 'f':
+                    value.type = JsonValue::Bool;
+                    value.boolean = false;
+                    return parseLiteral("false");
+                case 'n':
+                    value.type = JsonValue::Null;
+                    return parseLiteral("null");
+                default:
+                    value.type = JsonValue::Number;
+                    return parseNumber(value.number);
+                }
+            }
+
+            bool parseLiteral(const char *literal)
+            {
+                size_t len = strlen(literal);
+                if ((size_t)(end - p) < len || memcmp(p, literal, len) != 0)
+                    return false;
+                p += len;
+                return true;
+            }
+
+            // Locale independent, accumulates the digits as an integer and scales once
+            bool parseNumber(double &number)
+            {
+                bool negative = false;
+                if (p < end && *p == '-')
+                {
+                    negative = true;
+                    p++;
+                }
+
+                uint64_t mantissa = 0;
+                int exponent = 0;
+                int numDigits = 0;
+
+                while (p < end && *p >= '0' && *p <= '9')
+                {
+                    if (mantissa < 100000000000000000ULL)
+                        mantissa = mantissa * 10 + (*p - '0');
+                    else
+                        exponent++;
+                    p++;
+                    numDigits++;
+                }
+
+                if (p < end && *p == '.')
+                {
+                    p++;
+                    while (p < end && *p >= '0' && *p <= '9')
+                    {
+                        if (mantissa < 100000000000000000ULL)
+                        {
+                            mantissa = mantissa * 10 + (*p - '0');
+                            exponent--;
+                        }
+                        p++;
+                        numDigits++;
+                    }
+                }
+
+                if (numDigits == 0)
+                    return false;
+
+                if (p < end && (*p == 'e' || *p == 'E'))
+                {
+                    p++;
+                    bool negativeExp = false;
+                    if (p < end && (*p == '+' || *p == '-'))
+                    {
+                        negativeExp = *p == '-';
+                        p++;
+                    }
+
+                    if (p == end || *p < '0' || *p > '9')
+                        return false;
+
+                    int e = 0;
+                    while (p < end && *p >= '0' && *p <= '9')
+                    {
+                        if (e < 10000)
+                            e = e * 10 + (*p - '0');
+                        p++;
+                    }
+                    exponent += negativeExp ? -e : e;
+                }
+
+                number = (double)mantissa;
+                if (mantissa != 0 && exponent != 0)
+                    number *= std::pow(10.0, exponent);
+                if (negative)
+                    number = -number;
+
+                return true;
+            }
+
+            static void appendUtf8(std::string &s, uint32_t c)
+            {
+                if (c < 0x80)
+                    s += (char)c;
+                else if (c < 0x800)
+                {
+                    s += (char)(0xC0 | (c >> 6));
+                    s += (char)(0x80 | (c & 0x3F));
+                }
+                else if (c < 0x10000)
+                {
+                    s += (char)(0xE0 | (c >> 12));
+                    s += (char)(0x80 | ((c >> 6) & 0x3F));
+                    s += (char)(0x80 | (c & 0x3F));
+                }
+                else
+                {
+                    s += (char)(0xF0 | (c >> 18));
+                    s += (char)(0x80 | ((c >> 12) & 0x3F));
+                    s += (char)(0x80 | ((c >> 6) & 0x3F));
+                    s += (char)(0x80 | (c & 0x3F));
+                }
+            }
+
+            bool parseHex4(uint32_t &c)
+            {
+                if (end - p < 4)
+                    return false;
+
+                c = 0;
+                for (int i = 0; i < 4; i++, p++)
+                {
+                    char h = *p;
+                    c <<= 4;
+                    if (h >= '0' && h <= '9')
+                        c |= h - '0';
+                    else if (h >= 'a' && h <= 'f')
+                        c |= h - 'a' + 10;
+                    else if (h >= 'A' && h <= 'F')
+                        c |= h - 'A' + 10;
+                    else
+                        return false;
+                }
+                return true;
+            }
+
+            bool parseString(std::string &s)
+            {
+                p++; // opening quote
+                while (p < end && *p != '"')
+                {
+                    if (*p != '\\')
+                    {
+                        s += *p++;
+                        continue;
+                    }
+
+                    if (++p == end)
+                        return false;
+
+                    char e = *p++;
+                    switch (e)
+                    {
+                    case '"':  s += '"';  break;
+                    case '\\': s += '\\'; break;
+                    case '/':  s += '/';  break;
+                    case 'b':  s += '\b'; break;
+                    case 'f':  s += '\f'; break;
+                    case 'n':  s += '\n'; break;
+                    case 'r':  s += '\r'; break;
+                    case 't':  s += '\t'; break;
+                    case 'u':
+                    {
+                        uint32_t c;
+                        if (!parseHex4(c))
+                            return false;
+
+                        // Surrogate pair
+                        if (c >= 0xD800 && c < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u')
+                        {
+                            p += 2;
+                            uint32_t low;
+                            if (!parseHex4(low))
+                                return false;
+                            c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                        }
+                        appendUtf8(s, c);
+                        break;
+                    }
+                    default:
+                        return false;
+                    }
+                }
+
+                if (p == end)
+                    return false;
+                p++; // closing quote
+                return true;
+            }
+
+            bool parseArray(JsonValue &value, int depth)
+            {
+                value.type = JsonValue::Array;
+                p++;
+
+                skipSpaces();
+                if (p < end && *p == ']')
+                {
+                    p++;
+                    return true;
+                }
+
+                while (true)
+                {
+                    value.array.push_back(JsonValue());
+                    if (!parseValue(value.array.back(), depth + 1))
+                        return false;
+
+                    skipSpaces();
+                    if (p == end)
+                        return false;
+                    if (*p == ']')
+                    {
+                        p++;
+                        return true;
+                    }
+                    if (*p++ != ',')
+                        return false;
+                }
+            }
+
+            bool parseObject(JsonValue &value, int depth)
+            {
+                value.type = JsonValue::Object;
+                p++;
+
+                skipSpaces();
+                if (p < end && *p == '}')
+                {
+                    p++;
+                    return true;
+                }
+
+                while (true)
+                {
+                    skipSpaces();
+                    if (p == end || *p != '"')
+                        return false;
+
+                    value.object.push_back(std::make_pair(std::string(), JsonValue()));
+                    if (!parseString(value.object.back().first))
+                        return false;
+
+                    skipSpaces();
+                    if (p == end || *p++ != ':')
+                        return false;
+
+                    if (!parseValue(value.object.back().second, depth + 1))
+                        return false;
+
+                    skipSpaces();
+                    if (p == end)
+                        return false;
+                    if (*p == '}')
+                    {
+                        p++;
+                        return true;
+                    }
+                    if (*p++ != ',')
+                        return false;
+                }
+            }
+
+            const char *p;
+            const char *end;
+        };
+
+        //--------------------------------------------
+        // GLB container
+
+        struct GlbFile
+        {
+            MappedFile file;
+            JsonValue json;
+            const unsigned char *bin;
+            size_t binSize;
+        };
+
+        uint32_t ReadU32(const unsigned char *p)
+        {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        std::shared_ptr<GlbFile> ParseGlb(const std::string &filename)
+        {
+            std::shared_ptr<GlbFile> glb = std::make_shared<GlbFile>();
+            if (!glb->file.Open(filename))
+            {
+                printf("Unable to open %s\n", filename.c_str());
+                return nullptr;
+            }
+
+            const unsigned char *data = glb->file.Data();
+            size_t size = glb->file.Size();
+
+            // 12 byte header followed by the JSON chunk header
+            if (size < 20 || ReadU32(data) != kGlbMagic || ReadU32(data + 4) != 2)
+            {
+                printf("%s is not a binary glTF 2.0 file\n", filename.c_str());
+                return nullptr;
+            }
+
+            size_t length = std::min((size_t)ReadU32(data + 8), size);
+            size_t jsonLength = ReadU32(data + 12);
+            if (ReadU32(data + 16) != kGlbChunkJson || 20 + jsonLength > length)
+            {
+                printf("%s has no JSON chunk\n", filename.c_str());
+                return nullptr;
+            }
+
+            JsonParser parser(reinterpret_cast<const char*>(data + 20), jsonLength);
+            if (!parser.Parse(glb->json) || glb->json.type != JsonValue::Object)
+            {
+                printf("Invalid JSON in %s\n", filename.c_str());
+                return nullptr;
+            }
+
+            // The binary chunk is optional and 4 byte aligned
+            glb->bin = nullptr;
+            glb->binSize = 0;
+            size_t binHeader = 20 + ((jsonLength + 3) & ~(size_t)3);
+            if (binHeader + 8 <= length && ReadU32(data + binHeader + 4) == kGlbChunkBin)
+            {
+                glb->bin = data + binHeader + 8;
+                glb->binSize = std::min((size_t)ReadU32(data + binHeader), length - binHeader - 8);
+            }
+
+            return glb;
+        }
+
+        // Scene import and the concurrent mesh/texture loads all go through here so
+        // the JSON of a file is only parsed once while its assets are being loaded
+        std::shared_ptr<GlbFile> OpenGlb(const std::string &filename)
+        {
+            static std::mutex mutex;
+            static std::vector<std::pair<std::string, std::shared_ptr<GlbFile>>> openFiles;
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            for (size_t i = 0; i < openFiles.size(); i++)
+            {
+                if (openFiles[i].first == filename)
+                {
+                    // Move to the front as most recently used
+                    std::rotate(openFiles.begin(), openFiles.begin() + i, openFiles.begin() + i + 1);
+                    return openFiles[0].second;
+                }
+            }
+
+            std::shared_ptr<GlbFile> glb = ParseGlb(filename);
+            if (glb)
+            {
+                openFiles.insert(openFiles.begin(), std::make_pair(filename, glb));
+                if (openFiles.size() > kMaxOpenFiles)
+                    openFiles.pop_back();
+            }
+
+            return glb;
+        }
+
+        //--------------------------------------------
+        // Accessors
+
+        struct AccessorView
+        {
+            const unsigned char *data;
+            int count;
+            int stride;
+            int componentType;
+            int numComponents;
+            bool normalized;
+        };
+
+        int ComponentSize(int componentType)
+        {
+            switch (componentType)
+            {
+            case kComponentByte:
+            case kComponentUnsignedByte:  return 1;
+            case kComponentShort:
+            case kComponentUnsignedShort: return 2;
+            case kComponentUnsignedInt:
+            case kComponentFloat:         return 4;
+            default:                      return 0;
+            }
+        }
+
+        int NumComponents(const std::string &type)
+        {
+            if (type == "SCALAR") return 1;
+            if (type == "VEC2")   return 2;
+            if (type == "VEC3")   return 3;
+            if (type == "VEC4")   return 4;
+            return 0;
+        }
+
+        // Points straight into the binary chunk, no data is copied
+        bool GetAccessor(const GlbFile &glb, int index, AccessorView &view)
+        {
+            const JsonValue &accessor = glb.json["accessors"][index];
+            const JsonValue &bufferView = glb.json["bufferViews"][accessor["bufferView"].Int(-1)];
+
+            // Sparse accessors and external buffers aren't supported
+            if (accessor.type != JsonValue::Object || bufferView.type != JsonValue::Object ||
+                accessor.Has("sparse") || bufferView["buffer"].Int(-1) != 0 || glb.bin == nullptr ||
+                glb.json["buffers"][0].Has("uri"))
+                return false;
+
+            view.count = accessor["count"].Int(0);
+            view.componentType = accessor["componentType"].Int(0);
+            view.numComponents = NumComponents(accessor["type"].string);
+            view.normalized = accessor["normalized"].Boolean(false);
+
+            int elementSize = ComponentSize(view.componentType) * view.numComponents;
+            if (elementSize == 0 || view.count <= 0)
+                return false;
+
+            view.stride = bufferView["byteStride"].Int(elementSize);
+            if (view.stride < elementSize)
+                return false;
+
+            size_t viewOffset = (size_t)bufferView["byteOffset"].Int(0);
+            size_t viewLength = (size_t)bufferView["byteLength"].Int(0);
+            size_t offset = (size_t)accessor["byteOffset"].Int(0);
+
+            if (viewOffset + viewLength > glb.binSize ||
+                offset + (size_t)view.stride * (view.count - 1) + elementSize > viewLength)
+                return false;
+
+            view.data = glb.bin + viewOffset + offset;
+            return true;
+        }
+
+        float ReadComponent(const unsigned char *p, int componentType, bool normalized)
+        {
+            switch (componentType)
+            {
+            case kComponentFloat:
+            {
+                float f;
+                memcpy(&f, p, sizeof(f));
+                return f;
+            }
+            case kComponentUnsignedByte:
+                return normalized ? *p / 255.0f : *p;
+            case kComponentByte:
+                return normalized ? std::max(*(const int8_t*)p / 127.0f, -1.0f) : *(const int8_t*)p;
+            case kComponentUnsignedShort:
+            {
+                uint16_t v;
+                memcpy(&v, p, sizeof(v));
+                return normalized ? v / 65535.0f : v;
+            }
+            case kComponentShort:
+            {
+                int16_t v;
+                memcpy(&v, p, sizeof(v));
+                return normalized ? std::max(v / 32767.0f, -1.0f) : v;
+            }
+            default:
+                return 0.0f;
+            }
+        }
+
+        Vec4 ReadElement(const AccessorView &view, int i)
+        {
+            const unsigned char *p = view.data + (size_t)view.stride * i;
+            int componentSize = ComponentSize(view.componentType);
+            float v[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+            for (int c = 0; c < view.numComponents; c++)
+                v[c] = ReadComponent(p + c * componentSize, view.componentType, view.normalized);
+
+            return Vec4(v[0], v[1], v[2], v[3]);
+        }
+
+        uint32_t ReadIndex(const AccessorView &view, int i)
+        {
+            const unsigned char *p = view.data + (size_t)view.stride * i;
+            switch (view.componentType)
+            {
+            case kComponentUnsignedByte:
+                return *p;
+            case kComponentUnsignedShort:
+            {
+                uint16_t v;
+                memcpy(&v, p, sizeof(v));
+                return v;
+            }
+            default:
+                return ReadU32(p);
+            }
+        }
+
+        //--------------------------------------------
+        // Scene import
+
+        Mat4 NodeTransform(const JsonValue &node)
+        {
+            Mat4 out;
+            const JsonValue &matrix = node["matrix"];
+
+            // glTF matrices are column major for column vectors, which is the
+            // same memory layout as our row major matrices for row vectors
+            if (matrix.Size() == 16)
+            {
+                for (int i = 0; i < 16; i++)
+                    out.data[i / 4][i % 4] = matrix[i].Float(0.0f);
+                return out;
+            }
+
+            const JsonValue &t = node["translation"];
+            const JsonValue &r = node["rotation"];
+            const JsonValue &s = node["scale"];
+
+            Vec3 translation = Vec3(t[0].Float(0.0f), t[1].Float(0.0f), t[2].Float(0.0f));
+            Vec3 scale = Vec3(s[0].Float(1.0f), s[1].Float(1.0f), s[2].Float(1.0f));
+            float x = r[0].Float(0.0f), y = r[1].Float(0.0f), z = r[2].Float(0.0f), w = r[3].Float(1.0f);
+
+            Mat4 rotation;
+            rotation[0][0] = 1.0f - 2.0f * (y * y + z * z);
+            rotation[0][1] = 2.0f * (x * y + z * w);
+            rotation[0][2] = 2.0f * (x * z - y * w);
+            rotation[1][0] = 2.0f * (x * y - z * w);
+            rotation[1][1] = 1.0f - 2.0f * (x * x + z * z);
+            rotation[1][2] = 2.0f * (y * z + x * w);
+            rotation[2][0] = 2.0f * (x * z + y * w);
+            rotation[2][1] = 2.0f * (y * z - x * w);
+            rotation[2][2] = 1.0f - 2.0f * (x * x + y * y);
+
+            return Mat4::Scale(scale) * rotation * Mat4::Translate(translation);
+        }
+
+        struct GltfImport
+        {
+            std::string filename;
+            std::string directory;
+            const GlbFile *glb;
+            Scene *scene;
+            std::vector<int> materialIDs;
+            int defaultMaterialID;
+            int numInstances;
+        };
+
+        int AddTexture(GltfImport &import, const JsonValue &textureInfo, TextureRole role)
+        {
+            const JsonValue &texture = import.glb->json["textures"][textureInfo["index"].Int(-1)];
+            int source = texture["source"].Int(-1);
+            const JsonValue &image = import.glb->json["images"][source];
+
+            if (image.Has("bufferView"))
+                return import.scene->AddTexture(import.filename + "#image" + std::to_string(source), role);
+
+            // Data URIs are not supported, anything else is a file next to the .glb
+            const std::string &uri = image["uri"].string;
+            if (!uri.empty() && uri.compare(0, 5, "data:") != 0)
+                return import.scene->AddTexture(import.directory + uri, role);
+
+            return -1;
+        }
+
+        void AddMaterials(GltfImport &import)
+        {
+            const JsonValue &materials = import.glb->json["materials"];
+
+            for (size_t i = 0; i < materials.Size(); i++)
+            {
+                const JsonValue &mat = materials[(int)i];
+                const JsonValue &pbr = mat["pbrMetallicRoughness"];
+                const JsonValue &baseColor = pbr["baseColorFactor"];
+                const JsonValue &emissive = mat["emissiveFactor"];
+
+                Material material;
+                material.albedo = Vec3(baseColor[0].Float(1.0f), baseColor[1].Float(1.0f), baseColor[2].Float(1.0f));
+                material.metallic = pbr["metallicFactor"].Float(1.0f);
+                material.roughness = pbr["roughnessFactor"].Float(1.0f);
+                material.emission = Vec3(emissive[0].Float(0.0f), emissive[1].Float(0.0f), emissive[2].Float(0.0f));
+
+                if (pbr.Has("baseColorTexture"))
+                    material.albedoTexID = AddTexture(import, pbr["baseColorTexture"], TextureRoleAlbedo);
+                if (pbr.Has("metallicRoughnessTexture"))
+                    material.metallicRoughnessTexID = AddTexture(import, pbr["metallicRoughnessTexture"], TextureRoleMetallicRoughness);
+                if (mat.Has("normalTexture"))
+                    material.normalmapTexID = AddTexture(import, mat["normalTexture"], TextureRoleNormal);
+
+                import.materialIDs.push_back(import.scene->AddMaterial(material));
+            }
+        }
+
+        void AddNode(GltfImport &import, int nodeIndex, const Mat4 &parentTransform, int depth)
+        {
+            const JsonValue &node = import.glb->json["nodes"][nodeIndex];
+            if (node.type != JsonValue::Object || depth > 64)
+                return;
+
+            Mat4 transform = NodeTransform(node) * parentTransform;
+
+            int meshIndex = node["mesh"].Int(-1);
+            const JsonValue &mesh = import.glb->json["meshes"][meshIndex];
+            const JsonValue &primitives = mesh["primitives"];
+
+            for (size_t p = 0; p < primitives.Size(); p++)
+            {
+                if (primitives[(int)p]["mode"].Int(kModeTriangles) != kModeTriangles)
+                {
+                    printf("Skipping non triangle primitive %d of mesh %d\n", (int)p, meshIndex);
+                    continue;
+                }
+
+                int materialIndex = primitives[(int)p]["material"].Int(-1);
+                int materialID;
+                if (materialIndex >= 0 && materialIndex < (int)import.materialIDs.size())
+                    materialID = import.materialIDs[materialIndex];
+                else
+                {
+                    if (import.defaultMaterialID == -1)
+                        import.defaultMaterialID = import.scene->AddMaterial(Material());
+                    materialID = import.defaultMaterialID;
+                }
+
+                std::string meshName = import.filename + "#mesh" + std::to_string(meshIndex) + "." + std::to_string(p);
+                int meshID = import.scene->AddMesh(meshName);
+
+                std::string instanceName = node["name"].string;
+                if (instanceName.empty())
+                    instanceName = mesh["name"].string;
+                if (instanceName.empty())
+                    instanceName = "node" + std::to_string(nodeIndex);
+                if (primitives.Size() > 1)
+                    instanceName += "." + std::to_string(p);
+
+                import.scene->AddMeshInstance(MeshInstance(instanceName, meshID, transform, materialID));
+                import.numInstances++;
+            }
+
+            const JsonValue &children = node["children"];
+            for (size_t i = 0; i < children.Size(); i++)
+                AddNode(import, children[(int)i].Int(-1), transform, depth + 1);
+        }
+
+        bool ParseAssetName(const std::string &assetName, const char *kind, std::string &filename, int &a, int &b)
+        {
+            std::string tag = std::string(".glb#") + kind;
+            size_t pos = assetName.rfind(tag);
+            if (pos == std::string::npos)
+                return false;
+
+            filename = assetName.substr(0, pos + 4);
+            b = 0;
+            return sscanf(assetName.c_str() + pos + tag.size(), "%d.%d", &a, &b) >= 1;
+        }
+    }
+
+    bool LoadGltf(const std::string &filename, Scene *scene, const Mat4 &xform)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        std::shared_ptr<GlbFile> glb = OpenGlb(filename);
+        if (!glb)
+            return false;
+
+        GltfImport import;
+        import.filename = filename;
+        import.directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+        import.glb = glb.get();
+        import.scene = scene;
+        import.defaultMaterialID = -1;
+        import.numInstances = 0;
+
+        AddMaterials(import);
+
+        // Default scene, or every root node if the file has no scenes
+        const JsonValue &json = glb->json;
+        const JsonValue &sceneNodes = json["scenes"][json["scene"].Int(0)]["nodes"];
+
+        if (sceneNodes.Size() > 0)
+        {
+            for (size_t i = 0; i < sceneNodes.Size(); i++)
+                AddNode(import, sceneNodes[(int)i].Int(-1), xform, 0);
+        }
+        else
+        {
+            const JsonValue &nodes = json["nodes"];
+            std::vector<bool> isChild(nodes.Size(), false);
+            for (size_t i = 0; i < nodes.Size(); i++)
+            {
+                const JsonValue &children = nodes[(int)i]["children"];
+                for (size_t c = 0; c < children.Size(); c++)
+                {
+                    int child = children[(int)c].Int(-1);
+                    if (child >= 0 && child < (int)isChild.size())
+                        isChild[child] = true;
+                }
+            }
+
+            for (size_t i = 0; i < nodes.Size(); i++)
+            {
+                if (!isChild[i])
+                    AddNode(import, (int)i, xform, 0);
+            }
+        }
+
+        float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("Imported %s: %d materials, %d instances in %.2f ms\n", filename.c_str(), (int)import.materialIDs.size(), import.numInstances, ms);
+
+        return true;
+    }
+
+    bool IsGltfAsset(const std::string &assetName, std::string *filename)
+    {
+        size_t pos = assetName.rfind(".glb#");
+        if (pos == std::string::npos)
+            return false;
+
+        if (filename)
+            *filename = assetName.substr(0, pos + 4);
+        return true;
+    }
+
+    bool LoadGltfMesh(const std::string &assetName, std::vector<Vec4> &verticesUVX, std::vector<Vec4> &normalsUVY, std::vector<int> &indices)
+    {
+        std::string filename;
+        int meshIndex, primitiveIndex;
+        if (!ParseAssetName(assetName, "mesh", filename, meshIndex, primitiveIndex))
+            return false;
+
+        std::shared_ptr<GlbFile> glb = OpenGlb(filename);
+        if (!glb)
+            return false;
+
+        const JsonValue &primitive = glb->json["meshes"][meshIndex]["primitives"][primitiveIndex];
+        const JsonValue &attributes = primitive["attributes"];
+
+        AccessorView positions, normals, texCoords, triIndices;
+        if (!GetAccessor(*glb, attributes["POSITION"].Int(-1), positions) || positions.numComponents != 3)
+            return false;
+
+        bool hasNormals = GetAccessor(*glb, attributes["NORMAL"].Int(-1), normals) && normals.numComponents == 3 && normals.count == positions.count;
+        bool hasTexCoords = GetAccessor(*glb, attributes["TEXCOORD_0"].Int(-1), texCoords) && texCoords.numComponents == 2 && texCoords.count == positions.count;
+        bool hasIndices = primitive.Has("indices");
+
+        if (hasIndices && (!GetAccessor(*glb, primitive["indices"].Int(-1), triIndices) || triIndices.numComponents != 1))
+            return false;
+
+        int numVertices = positions.count;
+        int numIndices = hasIndices ? triIndices.count : numVertices;
+        numIndices -= numIndices % 3;
+
+        std::vector<int> outIndices(numIndices);
+        for (int i = 0; i < numIndices; i++)
+        {
+            uint32_t index = hasIndices ? ReadIndex(triIndices, i) : i;
+            if (index >= (uint32_t)numVertices)
+                return false;
+            outIndices[i] = index;
+        }
+
+        std::vector<Vec4> outVertices(numVertices);
+        std::vector<Vec4> outNormals(numVertices);
+
+        #pragma omp parallel for
+        for (int i = 0; i < numVertices; i++)
+        {
+            Vec4 p = ReadElement(positions, i);
+            Vec4 n = hasNormals ? ReadElement(normals, i) : Vec4();
+            Vec4 uv = hasTexCoords ? ReadElement(texCoords, i) : Vec4();
+
+            // glTF puts the uv origin at the top left, the shaders expect OBJ's bottom left
+            outVertices[i] = Vec4(p.x, p.y, p.z, uv.x);
+            outNormals[i] = Vec4(n.x, n.y, n.z, 1.0f - uv.y);
+        }
+
+        // Without normals the spec asks for flat shading, so every triangle gets its own vertices
+        if (!hasNormals)
+        {
+            std::vector<Vec4> flatVertices(numIndices);
+            std::vector<Vec4> flatNormals(numIndices);
+
+            for (int i = 0; i < numIndices; i += 3)
+            {
+                Vec3 v0 = Vec3(outVertices[outIndices[i + 0]]);
+                Vec3 v1 = Vec3(outVertices[outIndices[i + 1]]);
+                Vec3 v2 = Vec3(outVertices[outIndices[i + 2]]);
+                Vec3 n = Vec3::Cross(v1 - v0, v2 - v0);
+                float len = Vec3::Length(n);
+                if (len > 0.0f)
+                    n = n * (1.0f / len);
+
+                for (int k = 0; k < 3; k++)
+                {
+                    flatVertices[i + k] = outVertices[outIndices[i + k]];
+                    flatNormals[i + k] = Vec4(n.x, n.y, n.z, outNormals[outIndices[i + k]].w);
+                    outIndices[i + k] = i + k;
+                }
+            }
+
+            outVertices.swap(flatVertices);
+            outNormals.swap(flatNormals);
+        }
+
+        verticesUVX.swap(outVertices);
+        normalsUVY.swap(outNormals);
+        indices.swap(outIndices);
+
+        return true;
+    }
+
+    unsigned char* LoadGltfImage(const std::string &assetName, int &width, int &height)
+    {
+        std::string filename;
+        int imageIndex, unused;
+        if (!ParseAssetName(assetName, "image", filename, imageIndex, unused))
+            return nullptr;
+
+        std::shared_ptr<GlbFile> glb = OpenGlb(filename);
+        if (!glb)
+            return nullptr;
+
+        const JsonValue &bufferView = glb->json["bufferViews"][glb->json["images"][imageIndex]["bufferView"].Int(-1)];
+        size_t offset = (size_t)bufferView["byteOffset"].Int(0);
+        size_t length = (size_t)bufferView["byteLength"].Int(0);
+
+        if (bufferView.type != JsonValue::Object || glb->bin == nullptr || offset + length > glb->binSize)
+            return nullptr;
+
+        return stbi_load_from_memory(glb->bin + offset, (int)length, &width, &height, NULL, 3);
+    }
+}
@@ -0,0 +1,49 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Mat4.h"
+
+namespace GLSLPT
+{
+    class Scene;
+
+    // Imports a binary glTF 2.0 file. Materials and instances (one per node and
+    // primitive, with the node hierarchy flattened into the transform) are added
+    // right away. Primitives and embedded images are only registered, under names
+    // of the form "<file>#mesh<m>.<p>" and "<file>#image<i>", and get read straight
+    // out of the memory mapped binary chunk when the scene loads its assets
+    bool LoadGltf(const std::string &filename, Scene *scene, const Mat4 &xform);
+
+    // Tells if a mesh/texture name was registered by LoadGltf and optionally returns the .glb it lives in
+    bool IsGltfAsset(const std::string &assetName, std::string *filename = nullptr);
+
+    bool LoadGltfMesh(const std::string &assetName, std::vector<Vec4> &verticesUVX, std::vector<Vec4> &normalsUVY, std::vector<int> &indices);
+
+    // Returns RGB8 pixels allocated by stb_image
+    unsigned char* LoadGltfImage(const std::string &assetName, int &width, int &height);
+}
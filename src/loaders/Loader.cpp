@@ -26,7 +26,11 @@ freely, subject to the following restrictions:
 */
 
 #include "Loader.h"
+#include "SceneCache.h"
+#include "GltfLoader.h"
+#include "ObjLoader.h"
 #include <tiny_obj_loader.h>
+#include <chrono>
 #include <iostream>
 #include <iterator>
 #include <algorithm>
@@ -34,13 +38,326 @@ freely, subject to the following restrictions:
 
 namespace GLSLPT
 {
-    static const int kMaxLineLength = 2048;
     int(*Log)(const char* szFormat, ...) = printf;
 
+    namespace
+    {
+        // Splits the scene file into lines and whitespace separated tokens. Lines that
+        // are empty or start with '#' are skipped
+        class SceneTokenizer
+        {
+        public:
+            SceneTokenizer(const char *data, size_t size) : next(data), end(data + size), p(data), lineEnd(data), lineNumber(0) {}
+
+            bool NextLine()
+            {
+                while (next < end)
+                {
+                    p = next;
+                    lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+                    if (lineEnd == nullptr)
+                        lineEnd = end;
+                    next = lineEnd < end ? lineEnd + 1 : end;
+                    lineNumber++;
+
+                    SkipBlanks();
+                    if (p < lineEnd && *p != '#')
+                        return true;
+                }
+
+                p = lineEnd = end;
+                return false;
+            }
+
+            // Next token on the current line, empty at the end of the line
+            std::string Token()
+            {
+                SkipBlanks();
+                const char *begin = p;
+                while (p < lineEnd && !IsBlank(*p))
+                    p++;
+                return std::string(begin, p);
+            }
+
+            // Remainder of the line without surrounding whitespace
+            std::string Rest()
+            {
+                SkipBlanks();
+                const char *last = lineEnd;
+                while (last > p && IsBlank(last[-1]))
+                    last--;
+                std::string rest(p, last);
+                p = lineEnd;
+                return rest;
+            }
+
+            bool Float(float &out)
+            {
+                return ParseFloat(p, lineEnd, out);
+            }
+
+            bool Int(int &out)
+            {
+                SkipBlanks();
+                if (p == lineEnd)
+                    return false;
+
+                char *numEnd;
+                long value = strtol(p, &numEnd, 10);
+                if (numEnd == p || numEnd > lineEnd)
+                    return false;
+
+                p = numEnd;
+                out = (int)value;
+                return true;
+            }
+
+            bool Vector(Vec3 &out)
+            {
+                Vec3 v;
+                if (!Float(v.x) || !Float(v.y) || !Float(v.z))
+                    return false;
+                out = v;
+                return true;
+            }
+
+            bool Bool(bool &out)
+            {
+                std::string token = Token();
+                if (token == "True")
+                    out = true;
+                else if (token == "False")
+                    out = false;
+                else
+                    return false;
+                return true;
+            }
+
+            bool AtLineEnd()
+            {
+                SkipBlanks();
+                return p == lineEnd;
+            }
+
+            int LineNumber() const { return lineNumber; }
+
+        private:
+            static bool IsBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+            void SkipBlanks()
+            {
+                while (p < lineEnd && IsBlank(*p))
+                    p++;
+            }
+
+            const char *next;
+            const char *end;
+            const char *p;
+            const char *lineEnd;
+            int lineNumber;
+        };
+
+        enum BlockType
+        {
+            BlockMaterial,
+            BlockLight,
+            BlockCamera,
+            BlockRenderer,
+            BlockMesh,
+            BlockGltf
+        };
+
+        struct BlockKeyword
+        {
+            const char *name;
+            BlockType type;
+        };
+
+        const BlockKeyword kBlockKeywords[] =
+        {
+            { "material", BlockMaterial },
+            { "light",    BlockLight },
+            { "Camera",   BlockCamera },
+            { "Renderer", BlockRenderer },
+            { "mesh",     BlockMesh },
+            { "gltf",     BlockGltf }
+        };
+
+        // Scalar and vector properties that map straight onto a struct member
+        template<typename T, typename V>
+        struct MemberKeyword
+        {
+            const char *name;
+            V T::*member;
+        };
+
+        const MemberKeyword<Material, float> kMaterialFloats[] =
+        {
+            { "metallic",       &Material::metallic },
+            { "roughness",      &Material::roughness },
+            { "subsurface",     &Material::subsurface },
+            { "specular",       &Material::specular },
+            { "specularTint",   &Material::specularTint },
+            { "anisotropic",    &Material::anisotropic },
+            { "sheen",          &Material::sheen },
+            { "sheenTint",      &Material::sheenTint },
+            { "clearcoat",      &Material::clearcoat },
+            { "clearcoatGloss", &Material::clearcoatGloss },
+            { "transmission",   &Material::transmission },
+            { "ior",            &Material::ior },
+            { "atDistance",     &Material::atDistance }
+        };
+
+        const MemberKeyword<Material, Vec3> kMaterialVectors[] =
+        {
+            { "color",      &Material::albedo },
+            { "emission",   &Material::emission },
+            { "extinction", &Material::extinction }
+        };
+
+        const MemberKeyword<Light, float> kLightFloats[] =
+        {
+            { "radius", &Light::radius }
+        };
+
+        const MemberKeyword<Light, Vec3> kLightVectors[] =
+        {
+            { "position", &Light::position },
+            { "emission", &Light::emission },
+            { "v1",       &Light::u },
+            { "v2",       &Light::v }
+        };
+
+        const MemberKeyword<RenderOptions, int> kRendererInts[] =
+        {
+            { "maxDepth",            &RenderOptions::maxDepth },
+            { "tileWidth",           &RenderOptions::tileWidth },
+            { "tileHeight",          &RenderOptions::tileHeight },
+            { "RRDepth",             &RenderOptions::RRDepth },
+            { "envMapPyramidSize",   &RenderOptions::envMapPyramidSize },
+            { "virtualTexturePages", &RenderOptions::virtualTexturePages },
+            { "bvhWidth",            &RenderOptions::bvhWidth }
+        };
+
+        const MemberKeyword<RenderOptions, float> kRendererFloats[] =
+        {
+            { "hdrMultiplier", &RenderOptions::hdrMultiplier }
+        };
+
+        const MemberKeyword<RenderOptions, bool> kRendererBools[] =
+        {
+            { "enableRR",               &RenderOptions::enableRR },
+            { "quantizeVertices",       &RenderOptions::quantizeVertices },
+            { "envMapHalfDistribution", &RenderOptions::envMapHalfDistribution },
+            { "virtualTextures",        &RenderOptions::virtualTextures }
+        };
+
+        template<typename K, size_t N>
+        const K* FindKeyword(const K (&table)[N], const std::string &name)
+        {
+            for (size_t i = 0; i < N; i++)
+            {
+                if (name == table[i].name)
+                    return &table[i];
+            }
+            return nullptr;
+        }
+
+        bool ReadValue(SceneTokenizer &tokenizer, int &value) { return tokenizer.Int(value); }
+        bool ReadValue(SceneTokenizer &tokenizer, float &value) { return tokenizer.Float(value); }
+        bool ReadValue(SceneTokenizer &tokenizer, bool &value) { return tokenizer.Bool(value); }
+        bool ReadValue(SceneTokenizer &tokenizer, Vec3 &value) { return tokenizer.Vector(value); }
+
+        // Looks the key up in a member table and parses its value into the object.
+        // Returns false if the table doesn't have the key
+        template<typename T, typename V, size_t N>
+        bool ReadMember(SceneTokenizer &tokenizer, const MemberKeyword<T, V> (&table)[N], const std::string &key, T &object)
+        {
+            const MemberKeyword<T, V> *keyword = FindKeyword(table, key);
+            if (keyword == nullptr)
+                return false;
+
+            if (!ReadValue(tokenizer, object.*(keyword->member)))
+                Log("Invalid value for %s on line %d\n", key.c_str(), tokenizer.LineNumber());
+            return true;
+        }
+
+        // Moves past the opening brace, which is either the last token of the
+        // header line or on a line of its own
+        bool BeginBlock(SceneTokenizer &tokenizer)
+        {
+            std::string token = tokenizer.Token();
+            if (token.empty())
+            {
+                if (!tokenizer.NextLine())
+                    return false;
+                token = tokenizer.Token();
+            }
+
+            return token == "{" && tokenizer.AtLineEnd();
+        }
+
+        // Advances to the next property line, false once the closing brace is reached
+        bool NextProperty(SceneTokenizer &tokenizer, std::string &key)
+        {
+            if (!tokenizer.NextLine())
+            {
+                Log("Unexpected end of file in block\n");
+                return false;
+            }
+
+            key = tokenizer.Token();
+            return key != "}";
+        }
+
+        // position and scale of mesh and gltf blocks
+        bool ReadTransform(SceneTokenizer &tokenizer, const std::string &key, Mat4 &xform)
+        {
+            bool ok;
+            if (key == "position")
+                ok = tokenizer.Float(xform[3][0]) && tokenizer.Float(xform[3][1]) && tokenizer.Float(xform[3][2]);
+            else if (key == "scale")
+                ok = tokenizer.Float(xform[0][0]) && tokenizer.Float(xform[1][1]) && tokenizer.Float(xform[2][2]);
+            else
+                return false;
+
+            if (!ok)
+                Log("Invalid value for %s on line %d\n", key.c_str(), tokenizer.LineNumber());
+            return true;
+        }
+
+        // bvh of mesh blocks and tlasBvh of the Renderer, the TLAS can't have spatial splits
+        void ReadBvhBuilder(SceneTokenizer &tokenizer, const std::string &key, bool topLevel, BvhBuilder &builder)
+        {
+            std::string name = tokenizer.Token();
+            if (name == "Sbvh" && !topLevel)
+                builder = BvhBuilderSbvh;
+            else if (name == "Midpoint")
+                builder = BvhBuilderMidpoint;
+            else if (name == "Lbvh")
+                builder = BvhBuilderLbvh;
+            else if (name == "Hlbvh")
+                builder = BvhBuilderHlbvh;
+            else
+                Log("Invalid value for %s on line %d\n", key.c_str(), tokenizer.LineNumber());
+        }
+
+        void SkipBlock(SceneTokenizer &tokenizer)
+        {
+            std::string key;
+            while (NextProperty(tokenizer, key)) {}
+        }
+
+        void UnknownProperty(SceneTokenizer &tokenizer, const std::string &key, const char *block)
+        {
+            Log("Ignoring unknown property %s in %s block on line %d\n", key.c_str(), block, tokenizer.LineNumber());
+        }
+    }
+
     bool LoadSceneFromFile(const std::string &filename, Scene *scene, RenderOptions& renderOptions)
     {
         FILE* file;
-        file = fopen(filename.c_str(), "r");
+        file = fopen(filename.c_str(), "rb");
 
         if (!file)
         {
@@ -50,6 +367,17 @@ namespace GLSLPT
 
         Log("Loading Scene..\n");
 
+        auto startTime = std::chrono::steady_clock::now();
+
+        // Read the whole file, the null terminator keeps strtol in bounds
+        std::string text;
+        char buffer[65536];
+        size_t numRead;
+        while ((numRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            text.append(buffer, numRead);
+
+        fclose(file);
+
         struct MaterialData
         {
             Material mat;
@@ -57,78 +385,93 @@ namespace GLSLPT
         };
 
         std::map<std::string, MaterialData> materialMap;
-        std::vector<std::string> albedoTex;
-        std::vector<std::string> metallicRoughnessTex;
-        std::vector<std::string> normalTex;
         std::string path = filename.substr(0, filename.find_last_of("/\\")) + "/";
 
-        int materialCount = 0;
-        char line[kMaxLineLength];
-
         //Defaults
         Material defaultMat;
         scene->AddMaterial(defaultMat);
 
         bool cameraAdded = false;
+        int numBlocks = 0;
+
+        SceneTokenizer tokenizer(text.c_str(), text.size());
+        std::string key;
 
-        while (fgets(line, kMaxLineLength, file))
+        if (scene->loadProgress)
+            scene->loadProgress->SetStage(LoadStageParse);
+
+        while (tokenizer.NextLine())
         {
-            // skip comments
-            if (line[0] == '#')
+            if (scene->loadProgress && scene->loadProgress->IsCancelled())
+                return false;
+
+            int blockLine = tokenizer.LineNumber();
+            std::string blockName = tokenizer.Token();
+            const BlockKeyword *block = FindKeyword(kBlockKeywords, blockName);
+
+            // Unknown or commented out blocks are skipped as a whole
+            if (block == nullptr)
+            {
+                if (blockName != "{")
+                {
+                    Log("Ignoring unknown block %s on line %d\n", blockName.c_str(), blockLine);
+                    if (!BeginBlock(tokenizer))
+                        continue;
+                }
+                SkipBlock(tokenizer);
+                continue;
+            }
+
+            // Materials are named in the header
+            std::string name = block->type == BlockMaterial ? tokenizer.Token() : std::string();
+
+            if (!BeginBlock(tokenizer))
+            {
+                Log("Expected { after %s on line %d\n", blockName.c_str(), blockLine);
                 continue;
+            }
 
-            // name used for materials and meshes
-            char name[kMaxLineLength] = { 0 };
+            numBlocks++;
 
             //--------------------------------------------
             // Material
 
-            if (sscanf(line, " material %s", name) == 1)
+            if (block->type == BlockMaterial)
             {
                 Material material;
-                char albedoTexName[100] = "None";
-                char metallicRoughnessTexName[100] = "None";
-                char normalTexName[100] = "None";
+                std::string albedoTexName;
+                std::string metallicRoughnessTexName;
+                std::string normalTexName;
 
-                while (fgets(line, kMaxLineLength, file))
+                while (NextProperty(tokenizer, key))
                 {
-                    // end group
-                    if (strchr(line, '}'))
-                        break;
-
-                    sscanf(line, " name %s", name);
-                    sscanf(line, " color %f %f %f", &material.albedo.x, &material.albedo.y, &material.albedo.z);
-                    sscanf(line, " emission %f %f %f", &material.emission.x, &material.emission.y, &material.emission.z);
-                    sscanf(line, " metallic %f", &material.metallic);
-                    sscanf(line, " roughness %f", &material.roughness);
-                    sscanf(line, " subsurface %f", &material.subsurface);
-                    sscanf(line, " specular %f", &material.specular);
-                    sscanf(line, " specularTint %f", &material.specularTint);
-                    sscanf(line, " anisotropic %f", &material.anisotropic);
-                    sscanf(line, " sheen %f", &material.sheen);
-                    sscanf(line, " sheenTint %f", &material.sheenTint);
-                    sscanf(line, " clearcoat %f", &material.clearcoat);
-                    sscanf(line, " clearcoatGloss %f", &material.clearcoatGloss);
-                    sscanf(line, " transmission %f", &material.transmission);
-                    sscanf(line, " ior %f", &material.ior);
-                    sscanf(line, " extinction %f %f %f", &material.extinction.x, &material.extinction.y, &material.extinction.z);
-                    sscanf(line, " atDistance %f", &material.atDistance);
-                    sscanf(line, " albedoTexture %s", albedoTexName);
-                    sscanf(line, " metallicRoughnessTexture %s", metallicRoughnessTexName);
-                    sscanf(line, " normalTexture %s", normalTexName);
+                    if (ReadMember(tokenizer, kMaterialFloats, key, material) ||
+                        ReadMember(tokenizer, kMaterialVectors, key, material))
+                        continue;
+
+                    if (key == "name")
+                        name = tokenizer.Token();
+                    else if (key == "albedoTexture")
+                        albedoTexName = tokenizer.Token();
+                    else if (key == "metallicRoughnessTexture")
+                        metallicRoughnessTexName = tokenizer.Token();
+                    else if (key == "normalTexture")
+                        normalTexName = tokenizer.Token();
+                    else
+                        UnknownProperty(tokenizer, key, "material");
                 }
 
                 // Albedo Texture
-                if (strcmp(albedoTexName, "None") != 0)
-                    material.albedoTexID = scene->AddTexture(path + albedoTexName);
-             
+                if (!albedoTexName.empty() && albedoTexName != "None")
+                    material.albedoTexID = scene->AddTexture(path + albedoTexName, TextureRoleAlbedo);
+
                 // MetallicRoughness Texture
-                if (strcmp(metallicRoughnessTexName, "None") != 0)
-                    material.metallicRoughnessTexID = scene->AddTexture(path + metallicRoughnessTexName);
-    
+                if (!metallicRoughnessTexName.empty() && metallicRoughnessTexName != "None")
+                    material.metallicRoughnessTexID = scene->AddTexture(path + metallicRoughnessTexName, TextureRoleMetallicRoughness);
+
                 // Normal Map Texture
-                if (strcmp(normalTexName, "None") != 0)
-                    material.normalmapTexID = scene->AddTexture(path + normalTexName);
+                if (!normalTexName.empty() && normalTexName != "None")
+                    material.normalmapTexID = scene->AddTexture(path + normalTexName, TextureRoleNormal);
 
                 // add material to map
                 if (materialMap.find(name) == materialMap.end()) // New material
@@ -141,35 +484,32 @@ namespace GLSLPT
             //--------------------------------------------
             // Light
 
-            if (strstr(line, "light"))
+            else if (block->type == BlockLight)
             {
-                Light light;
-                Vec3 v1, v2;
-                char light_type[20] = "None";
+                Light light = Light();
+                std::string lightType;
 
-                while (fgets(line, kMaxLineLength, file))
+                while (NextProperty(tokenizer, key))
                 {
-                    // end group
-                    if (strchr(line, '}'))
-                        break;
-
-                    sscanf(line, " position %f %f %f", &light.position.x, &light.position.y, &light.position.z);
-                    sscanf(line, " emission %f %f %f", &light.emission.x, &light.emission.y, &light.emission.z);
-
-                    sscanf(line, " radius %f", &light.radius);
-                    sscanf(line, " v1 %f %f %f", &v1.x, &v1.y, &v1.z);
-                    sscanf(line, " v2 %f %f %f", &v2.x, &v2.y, &v2.z);
-                    sscanf(line, " type %s", light_type);
+                    if (ReadMember(tokenizer, kLightFloats, key, light) ||
+                        ReadMember(tokenizer, kLightVectors, key, light))
+                        continue;
+
+                    if (key == "type")
+                        lightType = tokenizer.Token();
+                    else
+                        UnknownProperty(tokenizer, key, "light");
                 }
 
-               if (strcmp(light_type, "Quad") == 0)
+                // v1 and v2 are corners of the quad, u and v are stored relative to the position
+                if (lightType == "Quad")
                 {
                     light.type = LightType::RectLight;
-                    light.u = v1 - light.position;
-                    light.v = v2 - light.position;
+                    light.u = light.u - light.position;
+                    light.v = light.v - light.position;
                     light.area = Vec3::Length(Vec3::Cross(light.u, light.v));
                 }
-                else if (strcmp(light_type, "Sphere") == 0)
+                else if (lightType == "Sphere")
                 {
                     light.type = LightType::SphereLight;
                     light.area = 4.0f * PI * light.radius * light.radius;
@@ -181,24 +521,32 @@ namespace GLSLPT
             //--------------------------------------------
             // Camera
 
-            if (strstr(line, "Camera"))
+            else if (block->type == BlockCamera)
             {
                 Vec3 position;
                 Vec3 lookAt;
-                float fov;
+                float fov = 35.0f;
                 float aperture = 0, focalDist = 1;
+                bool ok = true;
 
-                while (fgets(line, kMaxLineLength, file))
+                while (NextProperty(tokenizer, key))
                 {
-                    // end group
-                    if (strchr(line, '}'))
-                        break;
-
-                    sscanf(line, " position %f %f %f", &position.x, &position.y, &position.z);
-                    sscanf(line, " lookAt %f %f %f", &lookAt.x, &lookAt.y, &lookAt.z);
-                    sscanf(line, " aperture %f ", &aperture);
-                    sscanf(line, " focaldist %f", &focalDist);
-                    sscanf(line, " fov %f", &fov);
+                    if (key == "position")
+                        ok = tokenizer.Vector(position);
+                    else if (key == "lookAt")
+                        ok = tokenizer.Vector(lookAt);
+                    else if (key == "aperture")
+                        ok = tokenizer.Float(aperture);
+                    else if (key == "focaldist")
+                        ok = tokenizer.Float(focalDist);
+                    else if (key == "fov")
+                        ok = tokenizer.Float(fov);
+                    else
+                        UnknownProperty(tokenizer, key, "Camera");
+
+                    if (!ok)
+                        Log("Invalid value for %s on line %d\n", key.c_str(), tokenizer.LineNumber());
+                    ok = true;
                 }
 
                 delete scene->camera;
@@ -211,115 +559,192 @@ namespace GLSLPT
             //--------------------------------------------
             // Renderer
 
-            if (strstr(line, "Renderer"))
+            else if (block->type == BlockRenderer)
             {
-                char envMap[200] = "None";
-                char enableRR[10] = "None";
+                std::string envMap;
 
-                while (fgets(line, kMaxLineLength, file))
+                while (NextProperty(tokenizer, key))
                 {
-                    // end group
-                    if (strchr(line, '}'))
-                        break;
-
-                    sscanf(line, " envMap %s", envMap);
-                    sscanf(line, " resolution %d %d", &renderOptions.resolution.x, &renderOptions.resolution.y);
-                    sscanf(line, " hdrMultiplier %f", &renderOptions.hdrMultiplier);
-                    sscanf(line, " maxDepth %i", &renderOptions.maxDepth);
-                    sscanf(line, " tileWidth %i", &renderOptions.tileWidth);
-                    sscanf(line, " tileHeight %i", &renderOptions.tileHeight);
-                    sscanf(line, " enableRR %s", enableRR);
-                    sscanf(line, " RRDepth %i", &renderOptions.RRDepth);
+                    if (ReadMember(tokenizer, kRendererInts, key, renderOptions) ||
+                        ReadMember(tokenizer, kRendererFloats, key, renderOptions) ||
+                        ReadMember(tokenizer, kRendererBools, key, renderOptions))
+                        continue;
+
+                    if (key == "envMap")
+                        envMap = tokenizer.Token();
+                    else if (key == "textureCompression")
+                    {
+                        std::string mode = tokenizer.Token();
+                        if (mode == "None")
+                            renderOptions.textureCompression = TextureCompressionNone;
+                        else if (mode == "BC1")
+                            renderOptions.textureCompression = TextureCompressionBC1;
+                        else if (mode == "BC7")
+                            renderOptions.textureCompression = TextureCompressionBC7;
+                        else
+                            Log("Invalid value for %s on line %d\n", key.c_str(), tokenizer.LineNumber());
+                    }
+                    else if (key == "envMapSampling")
+                    {
+                        std::string mode = tokenizer.Token();
+                        if (mode == "Cdf")
+                            renderOptions.envMapSampling = EnvMapSamplingCdf;
+                        else if (mode == "Alias")
+                            renderOptions.envMapSampling = EnvMapSamplingAlias;
+                        else if (mode == "Hierarchical")
+                            renderOptions.envMapSampling = EnvMapSamplingHierarchical;
+                        else
+                            Log("Invalid value for %s on line %d\n", key.c_str(), tokenizer.LineNumber());
+                    }
+                    else if (key == "envMapFormat")
+                    {
+                        std::string format = tokenizer.Token();
+                        if (format == "RGB32F")
+                            renderOptions.envMapFormat = HDRFormatRGB32F;
+                        else if (format == "RGB16F")
+                            renderOptions.envMapFormat = HDRFormatRGB16F;
+                        else if (format == "RGB9E5")
+                            renderOptions.envMapFormat = HDRFormatRGB9E5;
+                        else
+                            Log("Invalid value for %s on line %d\n", key.c_str(), tokenizer.LineNumber());
+                    }
+                    else if (key == "tlasBvh")
+                        ReadBvhBuilder(tokenizer, key, true, renderOptions.tlasBvhBuilder);
+                    else if (key == "resolution")
+                    {
+                        if (!tokenizer.Int(renderOptions.resolution.x) || !tokenizer.Int(renderOptions.resolution.y))
+                            Log("Invalid value for %s on line %d\n", key.c_str(), tokenizer.LineNumber());
+                    }
+                    else
+                        UnknownProperty(tokenizer, key, "Renderer");
                 }
 
-                if (strcmp(envMap, "None") != 0)
+                if (!envMap.empty() && envMap != "None")
                 {
                     scene->AddHDR(path + envMap);
                     renderOptions.useEnvMap = true;
                 }
-
-                if (strcmp(enableRR, "False") == 0)
-                    renderOptions.enableRR = false;
-                else if (strcmp(enableRR, "True") == 0)
-                    renderOptions.enableRR = true;
             }
 
-
             //--------------------------------------------
             // Mesh
 
-            if (strstr(line, "mesh"))
+            else if (block->type == BlockMesh)
             {
                 std::string filename;
-                Vec3 pos;
-                Vec3 scale;
                 Mat4 xform;
                 int material_id = 0; // Default Material ID
-                char meshName[200] = "None";
+                std::string meshName;
+                BvhBuilder bvhBuilder = BvhBuilderSbvh;
 
-                while (fgets(line, kMaxLineLength, file))
+                while (NextProperty(tokenizer, key))
                 {
-                    // end group
-                    if (strchr(line, '}'))
-                        break;
-
-                    char file[2048];
-                    char matName[100];
-
-                    sscanf(line, " name %[^\t\n]s", meshName);
-
-                    if (sscanf(line, " file %s", file) == 1)
-                    {
-                        filename = path + file;
-                    }
-
-                    if (sscanf(line, " material %s", matName) == 1)
+                    if (key == "name")
+                        meshName = tokenizer.Rest();
+                    else if (key == "file")
+                        filename = path + tokenizer.Token();
+                    else if (key == "material")
                     {
                         // look up material in dictionary
-                        if (materialMap.find(matName) != materialMap.end())
-                        {
-                            material_id = materialMap[matName].id;
-                        }
+                        std::string matName = tokenizer.Token();
+                        auto it = materialMap.find(matName);
+                        if (it != materialMap.end())
+                            material_id = it->second.id;
                         else
-                        {
-                            Log("Could not find material %s\n", matName);
-                        }
+                            Log("Could not find material %s\n", matName.c_str());
                     }
-
-                    sscanf(line, " position %f %f %f", &xform[3][0], &xform[3][1], &xform[3][2]);
-                    sscanf(line, " scale %f %f %f", &xform[0][0], &xform[1][1], &xform[2][2]);
+                    else if (key == "bvh")
+                        ReadBvhBuilder(tokenizer, key, false, bvhBuilder);
+                    else if (ReadTransform(tokenizer, key, xform))
+                        continue;
+                    else
+                        UnknownProperty(tokenizer, key, "mesh");
                 }
+
                 if (!filename.empty())
                 {
-                    int mesh_id = scene->AddMesh(filename);
+                    int mesh_id = scene->AddMesh(filename, bvhBuilder);
                     if (mesh_id != -1)
                     {
                         std::string instanceName;
 
-                        if (strcmp(meshName, "None") != 0)
+                        if (!meshName.empty() && meshName != "None")
                         {
-                            instanceName = std::string(meshName);
+                            instanceName = meshName;
                         }
                         else
                         {
                             std::size_t pos = filename.find_last_of("/\\");
                             instanceName = filename.substr(pos + 1);
                         }
-                        
+
                         MeshInstance instance1(instanceName, mesh_id, xform, material_id);
                         scene->AddMeshInstance(instance1);
                     }
                 }
             }
+
+            //--------------------------------------------
+            // glTF
+
+            else if (block->type == BlockGltf)
+            {
+                std::string filename;
+                Mat4 xform;
+
+                while (NextProperty(tokenizer, key))
+                {
+                    if (key == "file")
+                        filename = path + tokenizer.Token();
+                    else if (ReadTransform(tokenizer, key, xform))
+                        continue;
+                    else
+                        UnknownProperty(tokenizer, key, "gltf");
+                }
+
+                if (!filename.empty() && !LoadGltf(filename, scene, xform))
+                    Log("Unable to load glTF file %s\n", filename.c_str());
+            }
         }
 
-        fclose(file);
+        std::chrono::duration<double, std::milli> parseTime = std::chrono::steady_clock::now() - startTime;
+        Log("Parsed %d blocks in %.2f ms (%.0f blocks/s)\n", numBlocks, parseTime.count(),
+            parseTime.count() > 0.0 ? numBlocks * 1000.0 / parseTime.count() : 0.0);
 
         if (!cameraAdded)
             scene->AddCamera(Vec3(0.0f, 0.0f, 10.0f), Vec3(0.0f, 0.0f, -10.0f), 35.0f);
 
-        scene->CreateAccelerationStructures();
+        // Asset loading depends on some of the options
+        scene->renderOptions = renderOptions;
+
+        // The cache is keyed on the asset lists, so they have to be final before it is looked up
+        scene->DeduplicateAssets();
+
+        if (scene->loadProgress)
+            scene->loadProgress->SetStage(LoadStageCache);
+
+        bool cacheHit = LoadSceneCache(filename, scene);
+
+        if (!cacheHit)
+        {
+            scene->CreateAccelerationStructures();
+
+            // A cancelled load leaves the scene incomplete
+            if (scene->loadProgress && scene->loadProgress->IsCancelled())
+            {
+                Log("Loading %s cancelled\n", filename.c_str());
+                return false;
+            }
+
+            SaveSceneCache(filename, scene);
+        }
+
+        if (scene->loadProgress)
+            scene->loadProgress->SetStage(LoadStageDone);
+
+        std::chrono::duration<double, std::milli> loadTime = std::chrono::steady_clock::now() - startTime;
+        Log("Scene loaded in %.2f ms%s\n", loadTime.count(), cacheHit ? " (from cache)" : "");
 
         return true;
     }
-}
\ No newline at end of file
+}
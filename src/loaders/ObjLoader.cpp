@@ -0,0 +1,571 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ObjLoader.h"
+#include "MappedFile.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace GLSLPT
+{
+    namespace
+    {
+        const size_t kChunkSize = 256 * 1024;
+
+        const double kPow10[] =
+        {
+            1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        enum LineType
+        {
+            LINE_SKIP,
+            LINE_POSITION,
+            LINE_NORMAL,
+            LINE_TEXCOORD,
+            LINE_FACE,
+            LINE_UNSUPPORTED
+        };
+
+        struct ObjChunk
+        {
+            const char *begin;
+            const char *end;
+
+            // Record counts from the first pass
+            int numPositions;
+            int numNormals;
+            int numTexCoords;
+            int numCorners;
+
+            // Prefix sums of the counts above
+            int positionOffset;
+            int normalOffset;
+            int texCoordOffset;
+            int cornerOffset;
+
+            bool ok;
+        };
+
+        inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+        inline bool IsSpace(char c) { return c == ' ' || c == '\t'; }
+        inline bool IsDelim(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+        inline void SkipSpaces(const char *&p, const char *end)
+        {
+            while (p < end && IsSpace(*p))
+                p++;
+        }
+
+        inline const char* FindLineEnd(const char *p, const char *end)
+        {
+            const void *nl = memchr(p, '\n', end - p);
+            return nl ? static_cast<const char*>(nl) : end;
+        }
+
+        inline bool KeywordIs(const char *p, size_t len, const char *keyword)
+        {
+            return strlen(keyword) == len && memcmp(p, keyword, len) == 0;
+        }
+
+        // Classifies the line and moves p past its keyword
+        LineType Classify(const char *&p, const char *end)
+        {
+            SkipSpaces(p, end);
+            if (p == end || *p == '\r' || *p == '#')
+                return LINE_SKIP;
+
+            // Line continuations are left to tinyobj
+            const char *last = end;
+            while (last > p && (IsDelim(last[-1])))
+                last--;
+            if (last[-1] == '\\')
+                return LINE_UNSUPPORTED;
+
+            const char *keyword = p;
+            while (p < end && !IsDelim(*p))
+                p++;
+            size_t len = p - keyword;
+
+            if (KeywordIs(keyword, len, "v"))
+                return LINE_POSITION;
+            if (KeywordIs(keyword, len, "vn"))
+                return LINE_NORMAL;
+            if (KeywordIs(keyword, len, "vt"))
+                return LINE_TEXCOORD;
+            if (KeywordIs(keyword, len, "f"))
+                return LINE_FACE;
+
+            // Grouping, smoothing and material statements don't affect the mesh
+            if (KeywordIs(keyword, len, "o") || KeywordIs(keyword, len, "g") || KeywordIs(keyword, len, "s") ||
+                KeywordIs(keyword, len, "usemtl") || KeywordIs(keyword, len, "mtllib"))
+                return LINE_SKIP;
+
+            return LINE_UNSUPPORTED;
+        }
+
+        bool ParseIndex(const char *&p, const char *end, int &out)
+        {
+            bool negative = false;
+            if (p < end && *p == '-')
+            {
+                negative = true;
+                p++;
+            }
+
+            if (p == end || !IsDigit(*p))
+                return false;
+
+            int value = 0;
+            while (p < end && IsDigit(*p))
+            {
+                if (value > 100000000)
+                    return false;
+                value = value * 10 + (*p - '0');
+                p++;
+            }
+
+            out = negative ? -value : value;
+            return true;
+        }
+
+        // Makes an OBJ index zero based; n is the number of records seen so far
+        inline bool FixIndex(int idx, int n, int &out)
+        {
+            if (idx == 0)
+                return false;
+            out = idx > 0 ? idx - 1 : n + idx;
+            return out >= 0;
+        }
+
+        // Parses a face vertex of the form v, v/vt, v//vn or v/vt/vn
+        bool ParseCorner(const char *&p, const char *end, const ObjChunk &chunk, int numPositions, int numNormals, int numTexCoords, ObjCorner &corner)
+        {
+            int idx;
+            corner.vt = -1;
+            corner.vn = -1;
+
+            if (!ParseIndex(p, end, idx) || !FixIndex(idx, chunk.positionOffset + numPositions, corner.v))
+                return false;
+
+            if (p < end && *p == '/')
+            {
+                p++;
+                if (p < end && *p != '/')
+                {
+                    if (!ParseIndex(p, end, idx) || !FixIndex(idx, chunk.texCoordOffset + numTexCoords, corner.vt))
+                        return false;
+                }
+
+                if (p < end && *p == '/')
+                {
+                    p++;
+                    if (!ParseIndex(p, end, idx) || !FixIndex(idx, chunk.normalOffset + numNormals, corner.vn))
+                        return false;
+                }
+            }
+
+            return p == end || IsDelim(*p);
+        }
+
+        // First pass: validate record types and count them
+        void CountChunk(ObjChunk &chunk)
+        {
+            chunk.numPositions = chunk.numNormals = chunk.numTexCoords = chunk.numCorners = 0;
+            chunk.ok = true;
+
+            const char *line = chunk.begin;
+            while (line < chunk.end)
+            {
+                const char *lineEnd = FindLineEnd(line, chunk.end);
+                const char *p = line;
+
+                switch (Classify(p, lineEnd))
+                {
+                case LINE_POSITION: chunk.numPositions++; break;
+                case LINE_NORMAL:   chunk.numNormals++;   break;
+                case LINE_TEXCOORD: chunk.numTexCoords++; break;
+                case LINE_FACE:
+                {
+                    int numVerts = 0;
+                    while (true)
+                    {
+                        SkipSpaces(p, lineEnd);
+                        if (p == lineEnd || *p == '\r')
+                            break;
+                        while (p < lineEnd && !IsDelim(*p))
+                            p++;
+                        numVerts++;
+                    }
+
+                    if (numVerts < 3)
+                    {
+                        chunk.ok = false;
+                        return;
+                    }
+                    chunk.numCorners += (numVerts - 2) * 3;
+                    break;
+                }
+                case LINE_SKIP:
+                    break;
+                default:
+                    chunk.ok = false;
+                    return;
+                }
+
+                line = lineEnd + 1;
+            }
+        }
+
+        // Second pass: parse the records into their final slots
+        void ParseChunk(ObjChunk &chunk, Vec4 *positions, Vec4 *normals, Vec4 *texCoords, ObjCorner *corners)
+        {
+            int numPositions = 0;
+            int numNormals = 0;
+            int numTexCoords = 0;
+            int numCorners = 0;
+            std::vector<ObjCorner> face;
+
+            const char *line = chunk.begin;
+            while (line < chunk.end)
+            {
+                const char *lineEnd = FindLineEnd(line, chunk.end);
+                const char *p = line;
+                float x, y, z;
+
+                switch (Classify(p, lineEnd))
+                {
+                case LINE_POSITION:
+                    if (!ParseFloat(p, lineEnd, x) || !ParseFloat(p, lineEnd, y) || !ParseFloat(p, lineEnd, z))
+                    {
+                        chunk.ok = false;
+                        return;
+                    }
+                    positions[chunk.positionOffset + numPositions++] = Vec4(x, y, z, 0);
+                    break;
+                case LINE_NORMAL:
+                    if (!ParseFloat(p, lineEnd, x) || !ParseFloat(p, lineEnd, y) || !ParseFloat(p, lineEnd, z))
+                    {
+                        chunk.ok = false;
+                        return;
+                    }
+                    normals[chunk.normalOffset + numNormals++] = Vec4(x, y, z, 0);
+                    break;
+                case LINE_TEXCOORD:
+                    if (!ParseFloat(p, lineEnd, x))
+                    {
+                        chunk.ok = false;
+                        return;
+                    }
+                    if (!ParseFloat(p, lineEnd, y))
+                        y = 0;
+                    texCoords[chunk.texCoordOffset + numTexCoords++] = Vec4(x, y, 0, 0);
+                    break;
+                case LINE_FACE:
+                {
+                    face.clear();
+                    while (true)
+                    {
+                        SkipSpaces(p, lineEnd);
+                        if (p == lineEnd || *p == '\r')
+                            break;
+
+                        ObjCorner corner;
+                        if (!ParseCorner(p, lineEnd, chunk, numPositions, numNormals, numTexCoords, corner))
+                        {
+                            chunk.ok = false;
+                            return;
+                        }
+                        face.push_back(corner);
+                    }
+
+                    // Polygon -> triangle fan, same as tinyobj
+                    for (size_t k = 2; k < face.size(); k++)
+                    {
+                        corners[chunk.cornerOffset + numCorners++] = face[0];
+                        corners[chunk.cornerOffset + numCorners++] = face[k - 1];
+                        corners[chunk.cornerOffset + numCorners++] = face[k];
+                    }
+                    break;
+                }
+                default:
+                    break;
+                }
+
+                line = lineEnd + 1;
+            }
+        }
+
+        bool AllChunksOk(const std::vector<ObjChunk> &chunks)
+        {
+            for (size_t i = 0; i < chunks.size(); i++)
+            {
+                if (!chunks[i].ok)
+                    return false;
+            }
+            return true;
+        }
+    }
+
+    bool ParseFloat(const char *&p, const char *end, float &out)
+    {
+        SkipSpaces(p, end);
+        const char *s = p;
+
+        bool negative = false;
+        if (s < end && (*s == '+' || *s == '-'))
+        {
+            negative = *s == '-';
+            s++;
+        }
+
+        uint64_t mantissa = 0;
+        int exponent = 0;
+        int numDigits = 0;
+
+        while (s < end && IsDigit(*s))
+        {
+            if (mantissa < 100000000000000000ULL)
+                mantissa = mantissa * 10 + (*s - '0');
+            else
+                exponent++;
+            s++;
+            numDigits++;
+        }
+
+        if (s < end && *s == '.')
+        {
+            s++;
+            while (s < end && IsDigit(*s))
+            {
+                if (mantissa < 100000000000000000ULL)
+                {
+                    mantissa = mantissa * 10 + (*s - '0');
+                    exponent--;
+                }
+                s++;
+                numDigits++;
+            }
+        }
+
+        if (numDigits == 0)
+            return false;
+
+        if (s < end && (*s == 'e' || *s == 'E'))
+        {
+            s++;
+            bool negativeExp = false;
+            if (s < end && (*s == '+' || *s == '-'))
+            {
+                negativeExp = *s == '-';
+                s++;
+            }
+
+            if (s == end || !IsDigit(*s))
+                return false;
+
+            int e = 0;
+            while (s < end && IsDigit(*s))
+            {
+                if (e < 10000)
+                    e = e * 10 + (*s - '0');
+                s++;
+            }
+            exponent += negativeExp ? -e : e;
+        }
+
+        if (s < end && !IsDelim(*s))
+            return false;
+
+        double value = static_cast<double>(mantissa);
+        if (mantissa != 0)
+        {
+            if (exponent >= 0 && exponent <= 22)
+                value *= kPow10[exponent];
+            else if (exponent < 0 && exponent >= -22)
+                value /= kPow10[-exponent];
+            else
+                value *= std::pow(10.0, exponent);
+        }
+
+        out = static_cast<float>(negative ? -value : value);
+        p = s;
+        return true;
+    }
+
+    void WeldObjCorners(const std::vector<ObjCorner> &corners, std::vector<int> &indices, std::vector<ObjCorner> &uniqueCorners)
+    {
+        // Open addressing table of vertex ids, kept at most half full
+        size_t tableSize = 16;
+        while (tableSize < corners.size() * 2)
+            tableSize <<= 1;
+        const size_t mask = tableSize - 1;
+
+        std::vector<int> table(tableSize, -1);
+        indices.resize(corners.size());
+        uniqueCorners.clear();
+
+        for (size_t i = 0; i < corners.size(); i++)
+        {
+            const ObjCorner &c = corners[i];
+
+            uint64_t h = ((uint64_t)(uint32_t)c.v << 32 | (uint32_t)c.vn) * 0x9E3779B97F4A7C15ULL;
+            h ^= (uint64_t)(uint32_t)c.vt * 0xC2B2AE3D27D4EB4FULL;
+            h ^= h >> 29;
+
+            size_t slot = h & mask;
+            while (true)
+            {
+                int id = table[slot];
+                if (id == -1)
+                {
+                    id = uniqueCorners.size();
+                    uniqueCorners.push_back(c);
+                    table[slot] = id;
+                    indices[i] = id;
+                    break;
+                }
+
+                const ObjCorner &u = uniqueCorners[id];
+                if (u.v == c.v && u.vt == c.vt && u.vn == c.vn)
+                {
+                    indices[i] = id;
+                    break;
+                }
+
+                slot = (slot + 1) & mask;
+            }
+        }
+    }
+
+    bool LoadObjFast(const std::string &filename, std::vector<Vec4> &verticesUVX, std::vector<Vec4> &normalsUVY, std::vector<int> &indices)
+    {
+        MappedFile file;
+        if (!file.Open(filename) || file.Size() == 0)
+            return false;
+
+        const char *data = reinterpret_cast<const char*>(file.Data());
+        const char *dataEnd = data + file.Size();
+
+        // Split into chunks that start right after a newline
+        int numChunks = static_cast<int>(file.Size() / kChunkSize) + 1;
+        std::vector<ObjChunk> chunks(numChunks);
+
+        const char *begin = data;
+        for (int i = 0; i < numChunks; i++)
+        {
+            const char *end = dataEnd;
+            if (i + 1 < numChunks)
+            {
+                end = data + (file.Size() / numChunks) * (i + 1);
+                if (end < begin)
+                    end = begin;
+                end = FindLineEnd(end, dataEnd);
+                if (end < dataEnd)
+                    end++;
+            }
+
+            chunks[i].begin = begin;
+            chunks[i].end = end;
+            begin = end;
+        }
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < numChunks; i++)
+            CountChunk(chunks[i]);
+
+        if (!AllChunksOk(chunks))
+            return false;
+
+        int numPositions = 0, numNormals = 0, numTexCoords = 0, numCorners = 0;
+        for (int i = 0; i < numChunks; i++)
+        {
+            chunks[i].positionOffset = numPositions;
+            chunks[i].normalOffset = numNormals;
+            chunks[i].texCoordOffset = numTexCoords;
+            chunks[i].cornerOffset = numCorners;
+
+            numPositions += chunks[i].numPositions;
+            numNormals += chunks[i].numNormals;
+            numTexCoords += chunks[i].numTexCoords;
+            numCorners += chunks[i].numCorners;
+        }
+
+        if (numCorners == 0)
+            return false;
+
+        std::vector<Vec4> positions(numPositions);
+        std::vector<Vec4> normals(numNormals);
+        std::vector<Vec4> texCoords(numTexCoords);
+        std::vector<ObjCorner> corners(numCorners);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < numChunks; i++)
+            ParseChunk(chunks[i], positions.data(), normals.data(), texCoords.data(), corners.data());
+
+        if (!AllChunksOk(chunks))
+            return false;
+
+        std::vector<int> outIndices;
+        std::vector<ObjCorner> uniqueCorners;
+        WeldObjCorners(corners, outIndices, uniqueCorners);
+
+        int numVertices = uniqueCorners.size();
+        std::vector<Vec4> outVertices(numVertices);
+        std::vector<Vec4> outNormals(numVertices);
+        bool ok = true;
+
+        #pragma omp parallel for reduction(&&: ok)
+        for (int i = 0; i < numVertices; i++)
+        {
+            const ObjCorner &c = uniqueCorners[i];
+
+            // Faces without normals are left to tinyobj
+            if (c.v >= numPositions || c.vn < 0 || c.vn >= numNormals || c.vt >= numTexCoords)
+            {
+                ok = false;
+                continue;
+            }
+
+            const Vec4 &v = positions[c.v];
+            const Vec4 &n = normals[c.vn];
+            Vec4 uv = c.vt < 0 ? Vec4() : texCoords[c.vt];
+
+            outVertices[i] = Vec4(v.x, v.y, v.z, uv.x);
+            outNormals[i] = Vec4(n.x, n.y, n.z, uv.y);
+        }
+
+        if (!ok)
+            return false;
+
+        verticesUVX.swap(outVertices);
+        normalsUVY.swap(outNormals);
+        indices.swap(outIndices);
+
+        return true;
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Vec4.h"
+
+namespace GLSLPT
+{
+    // Zero based position, texcoord and normal index of a face corner (-1 if absent)
+    struct ObjCorner
+    {
+        int v, vt, vn;
+    };
+
+    // Locale independent decimal parser: [sign] digits [. digits] [(e|E) [sign] digits].
+    // Skips leading blanks, the number has to end at a blank or at end. Advances p on success
+    bool ParseFloat(const char *&p, const char *end, float &out);
+
+    // Collapses corners referencing the same (v, vt, vn) triple into one vertex.
+    // indices gets one entry per corner, uniqueCorners the distinct triples in order of first use
+    void WeldObjCorners(const std::vector<ObjCorner> &corners, std::vector<int> &indices, std::vector<ObjCorner> &uniqueCorners);
+
+    // Native parser for the common subset of OBJ (v/vn/vt/f plus o/g/s/usemtl/mtllib
+    // which are ignored). The file is memory mapped, split into newline aligned chunks
+    // and parsed in parallel. Faces are fan triangulated in file order like tinyobj does
+    // and the output is indexed, three indices per triangle.
+    // Returns false for anything outside that subset so the caller can fall back to tinyobj.
+    bool LoadObjFast(const std::string &filename, std::vector<Vec4> &verticesUVX, std::vector<Vec4> &normalsUVY, std::vector<int> &indices);
+}
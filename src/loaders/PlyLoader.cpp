@@ -0,0 +1,649 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "PlyLoader.h"
+#include "MappedFile.h"
+#include "Vec3.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+
+namespace GLSLPT
+{
+    namespace
+    {
+        // Faces and vertices are converted in blocks of this many elements
+        const int kBlockSize = 1 << 16;
+
+        enum PlyType
+        {
+            PlyInvalid,
+            PlyInt8,
+            PlyUInt8,
+            PlyInt16,
+            PlyUInt16,
+            PlyInt32,
+            PlyUInt32,
+            PlyFloat32,
+            PlyFloat64
+        };
+
+        struct PlyProperty
+        {
+            std::string name;
+            PlyType type;
+            PlyType countType; // PlyInvalid unless this is a list
+            size_t offset;     // Only valid for properties in front of the first list
+        };
+
+        struct PlyElement
+        {
+            std::string name;
+            size_t count;
+            std::vector<PlyProperty> properties;
+            size_t fixedSize;  // Size of the leading properties up to the first list
+            bool hasList;
+        };
+
+        PlyType ParseType(const std::string &name)
+        {
+            if (name == "char" || name == "int8")       return PlyInt8;
+            if (name == "uchar" || name == "uint8")     return PlyUInt8;
+            if (name == "short" || name == "int16")     return PlyInt16;
+            if (name == "ushort" || name == "uint16")   return PlyUInt16;
+            if (name == "int" || name == "int32")       return PlyInt32;
+            if (name == "uint" || name == "uint32")     return PlyUInt32;
+            if (name == "float" || name == "float32")   return PlyFloat32;
+            if (name == "double" || name == "float64")  return PlyFloat64;
+            return PlyInvalid;
+        }
+
+        size_t TypeSize(PlyType type)
+        {
+            switch (type)
+            {
+            case PlyInt8:
+            case PlyUInt8:   return 1;
+            case PlyInt16:
+            case PlyUInt16:  return 2;
+            case PlyInt32:
+            case PlyUInt32:
+            case PlyFloat32: return 4;
+            case PlyFloat64: return 8;
+            default:         return 0;
+            }
+        }
+
+        template<typename T>
+        T Load(const unsigned char *p, bool swap)
+        {
+            unsigned char bytes[sizeof(T)];
+            memcpy(bytes, p, sizeof(T));
+            if (swap)
+                std::reverse(bytes, bytes + sizeof(T));
+
+            T value;
+            memcpy(&value, bytes, sizeof(T));
+            return value;
+        }
+
+        double ReadValue(const unsigned char *p, PlyType type, bool swap)
+        {
+            switch (type)
+            {
+            case PlyInt8:    return *(const int8_t*)p;
+            case PlyUInt8:   return *p;
+            case PlyInt16:   return Load<int16_t>(p, swap);
+            case PlyUInt16:  return Load<uint16_t>(p, swap);
+            case PlyInt32:   return Load<int32_t>(p, swap);
+            case PlyUInt32:  return Load<uint32_t>(p, swap);
+            case PlyFloat32: return Load<float>(p, swap);
+            case PlyFloat64: return Load<double>(p, swap);
+            default:         return 0.0;
+            }
+        }
+
+        int64_t ReadInteger(const unsigned char *p, PlyType type, bool swap)
+        {
+            switch (type)
+            {
+            case PlyInt8:   return *(const int8_t*)p;
+            case PlyUInt8:  return *p;
+            case PlyInt16:  return Load<int16_t>(p, swap);
+            case PlyUInt16: return Load<uint16_t>(p, swap);
+            case PlyInt32:  return Load<int32_t>(p, swap);
+            case PlyUInt32: return Load<uint32_t>(p, swap);
+            default:        return (int64_t)ReadValue(p, type, swap);
+            }
+        }
+
+        // Parses everything up to end_header, dataOffset points at the first byte after it
+        bool ParseHeader(const unsigned char *data, size_t size, std::vector<PlyElement> &elements, bool &swap, size_t &dataOffset)
+        {
+            const char *text = reinterpret_cast<const char*>(data);
+            const char *end = text + size;
+            const char *line = text;
+            bool formatOk = false;
+
+            while (line < end)
+            {
+                const char *lineEnd = std::find(line, end, '\n');
+                std::istringstream tokens(std::string(line, lineEnd));
+                line = lineEnd < end ? lineEnd + 1 : end;
+
+                std::string keyword;
+                tokens >> keyword;
+
+                if (keyword == "format")
+                {
+                    std::string format;
+                    tokens >> format;
+                    if (format != "binary_little_endian" && format != "binary_big_endian")
+                    {
+                        printf("Unsupported PLY format %s, only binary files are supported\n", format.c_str());
+                        return false;
+                    }
+
+                    uint16_t one = 1;
+                    bool littleEndianHost = *reinterpret_cast<unsigned char*>(&one) == 1;
+                    swap = (format == "binary_little_endian") != littleEndianHost;
+                    formatOk = true;
+                }
+                else if (keyword == "element")
+                {
+                    PlyElement element;
+                    tokens >> element.name >> element.count;
+                    if (tokens.fail())
+                        return false;
+
+                    element.fixedSize = 0;
+                    element.hasList = false;
+                    elements.push_back(element);
+                }
+                else if (keyword == "property")
+                {
+                    if (elements.empty())
+                        return false;
+
+                    PlyElement &element = elements.back();
+                    PlyProperty property;
+                    std::string type;
+                    tokens >> type;
+
+                    if (type == "list")
+                    {
+                        std::string countType, itemType;
+                        tokens >> countType >> itemType;
+                        property.countType = ParseType(countType);
+                        property.type = ParseType(itemType);
+                        if (property.countType == PlyInvalid || property.countType == PlyFloat32 || property.countType == PlyFloat64)
+                            return false;
+                    }
+                    else
+                    {
+                        property.countType = PlyInvalid;
+                        property.type = ParseType(type);
+                    }
+
+                    tokens >> property.name;
+                    if (tokens.fail() || property.type == PlyInvalid)
+                        return false;
+
+                    property.offset = element.fixedSize;
+                    if (!element.hasList)
+                    {
+                        if (property.countType != PlyInvalid)
+                            element.hasList = true;
+                        else
+                            element.fixedSize += TypeSize(property.type);
+                    }
+
+                    element.properties.push_back(property);
+                }
+                else if (keyword == "end_header")
+                {
+                    dataOffset = line - text;
+                    return formatOk;
+                }
+                else if (keyword != "ply" && keyword != "comment" && keyword != "obj_info" && !keyword.empty())
+                {
+                    return false;
+                }
+            }
+
+            return false;
+        }
+
+        // Size in bytes of one record of an element that contains lists, 0 if it runs past the end
+        size_t RecordSize(const unsigned char *p, const unsigned char *end, const PlyElement &element, bool swap)
+        {
+            size_t size = 0;
+            for (size_t i = 0; i < element.properties.size(); i++)
+            {
+                const PlyProperty &property = element.properties[i];
+                if (property.countType == PlyInvalid)
+                {
+                    size += TypeSize(property.type);
+                    continue;
+                }
+
+                size_t countSize = TypeSize(property.countType);
+                if (p + size + countSize > end)
+                    return 0;
+
+                int64_t count = ReadInteger(p + size, property.countType, swap);
+                if (count < 0)
+                    return 0;
+                size += countSize + count * TypeSize(property.type);
+            }
+
+            return p + size <= end ? size : 0;
+        }
+
+        // Byte size of a whole element, walking the records if it has lists
+        bool ElementSize(const unsigned char *p, const unsigned char *end, const PlyElement &element, bool swap, size_t &size)
+        {
+            if (!element.hasList)
+            {
+                size = element.count * element.fixedSize;
+                return p + size <= end;
+            }
+
+            size = 0;
+            for (size_t i = 0; i < element.count; i++)
+            {
+                size_t recordSize = RecordSize(p + size, end, element, swap);
+                if (recordSize == 0)
+                    return false;
+                size += recordSize;
+            }
+
+            return true;
+        }
+
+        const PlyProperty* FindProperty(const PlyElement &element, const char *name0, const char *name1 = nullptr, const char *name2 = nullptr)
+        {
+            for (size_t i = 0; i < element.properties.size(); i++)
+            {
+                const std::string &name = element.properties[i].name;
+                if (name == name0 || (name1 && name == name1) || (name2 && name == name2))
+                    return &element.properties[i];
+            }
+            return nullptr;
+        }
+
+        bool ReadVertices(const MappedFile &file, const unsigned char *p, const PlyElement &element, bool swap,
+            std::vector<Vec4> &verticesUVX, std::vector<Vec4> &normalsUVY, bool &hasNormals)
+        {
+            const unsigned char *end = file.Data() + file.Size();
+            if (element.hasList || p + element.count * element.fixedSize > end)
+                return false;
+
+            const PlyProperty *x = FindProperty(element, "x");
+            const PlyProperty *y = FindProperty(element, "y");
+            const PlyProperty *z = FindProperty(element, "z");
+            if (!x || !y || !z)
+                return false;
+
+            const PlyProperty *nx = FindProperty(element, "nx");
+            const PlyProperty *ny = FindProperty(element, "ny");
+            const PlyProperty *nz = FindProperty(element, "nz");
+            const PlyProperty *u = FindProperty(element, "u", "s", "texture_u");
+            const PlyProperty *v = FindProperty(element, "v", "t", "texture_v");
+            if (!u)
+                u = FindProperty(element, "texture_s");
+            if (!v)
+                v = FindProperty(element, "texture_t");
+
+            hasNormals = nx && ny && nz;
+            bool hasTexCoords = u && v;
+
+            size_t numVertices = element.count;
+            size_t stride = element.fixedSize;
+            verticesUVX.resize(numVertices);
+            normalsUVY.resize(numVertices);
+
+            int numBlocks = (int)((numVertices + kBlockSize - 1) / kBlockSize);
+
+            #pragma omp parallel for schedule(dynamic)
+            for (int b = 0; b < numBlocks; b++)
+            {
+                size_t first = (size_t)b * kBlockSize;
+                size_t last = std::min(first + kBlockSize, numVertices);
+
+                for (size_t i = first; i < last; i++)
+                {
+                    const unsigned char *record = p + i * stride;
+                    Vec4 vertex((float)ReadValue(record + x->offset, x->type, swap),
+                                (float)ReadValue(record + y->offset, y->type, swap),
+                                (float)ReadValue(record + z->offset, z->type, swap), 0.0f);
+                    Vec4 normal;
+
+                    if (hasNormals)
+                    {
+                        normal.x = (float)ReadValue(record + nx->offset, nx->type, swap);
+                        normal.y = (float)ReadValue(record + ny->offset, ny->type, swap);
+                        normal.z = (float)ReadValue(record + nz->offset, nz->type, swap);
+                    }
+
+                    if (hasTexCoords)
+                    {
+                        vertex.w = (float)ReadValue(record + u->offset, u->type, swap);
+                        normal.w = (float)ReadValue(record + v->offset, v->type, swap);
+                    }
+
+                    verticesUVX[i] = vertex;
+                    normalsUVY[i] = normal;
+                }
+
+                file.Discard(p + first * stride - file.Data(), (last - first) * stride);
+            }
+
+            return true;
+        }
+
+        // Faces that are all triangles with no lists besides the indices have a fixed
+        // record size and convert in a single parallel pass. Returns false otherwise
+        bool ReadTriangles(const MappedFile &file, const unsigned char *p, const PlyElement &element, const PlyProperty &list,
+            bool swap, std::vector<int> &indices, size_t &size)
+        {
+            const unsigned char *end = file.Data() + file.Size();
+            for (size_t i = 0; i < element.properties.size(); i++)
+            {
+                if (element.properties[i].countType != PlyInvalid && &element.properties[i] != &list)
+                    return false;
+            }
+
+            size_t countSize = TypeSize(list.countType);
+            size_t indexSize = TypeSize(list.type);
+            size_t trailing = 0;
+            for (const PlyProperty *q = &list + 1; q < element.properties.data() + element.properties.size(); q++)
+                trailing += TypeSize(q->type);
+
+            size_t stride = element.fixedSize + countSize + 3 * indexSize + trailing;
+            size_t numFaces = element.count;
+            if (p + numFaces * stride > end)
+                return false;
+
+            indices.resize(numFaces * 3);
+            int numBlocks = (int)((numFaces + kBlockSize - 1) / kBlockSize);
+            bool ok = true;
+
+            #pragma omp parallel for schedule(dynamic) reduction(&&: ok)
+            for (int b = 0; b < numBlocks; b++)
+            {
+                size_t first = (size_t)b * kBlockSize;
+                size_t last = std::min(first + kBlockSize, numFaces);
+
+                for (size_t i = first; i < last && ok; i++)
+                {
+                    const unsigned char *record = p + i * stride + element.fixedSize;
+                    if (ReadInteger(record, list.countType, swap) != 3)
+                    {
+                        ok = false;
+                        break;
+                    }
+
+                    record += countSize;
+                    indices[i * 3 + 0] = (int)ReadInteger(record, list.type, swap);
+                    indices[i * 3 + 1] = (int)ReadInteger(record + indexSize, list.type, swap);
+                    indices[i * 3 + 2] = (int)ReadInteger(record + 2 * indexSize, list.type, swap);
+                }
+
+                file.Discard(p + first * stride - file.Data(), (last - first) * stride);
+            }
+
+            size = numFaces * stride;
+            return ok;
+        }
+
+        // General case: one serial pass records where each block of faces starts and
+        // how many triangles come before it, then the blocks are triangulated in parallel
+        bool ReadPolygons(const MappedFile &file, const unsigned char *p, const PlyElement &element, const PlyProperty &list,
+            bool swap, std::vector<int> &indices, size_t &size)
+        {
+            const unsigned char *end = file.Data() + file.Size();
+            size_t numFaces = element.count;
+            int numBlocks = (int)((numFaces + kBlockSize - 1) / kBlockSize);
+            std::vector<size_t> blockOffsets(numBlocks);
+            std::vector<size_t> blockTriangles(numBlocks);
+
+            // The offset of the index list is only fixed if no other list comes before it
+            for (const PlyProperty *q = element.properties.data(); q < &list; q++)
+            {
+                if (q->countType != PlyInvalid)
+                    return false;
+            }
+            size_t listOffset = list.offset;
+
+            size_t offset = 0;
+            size_t numTriangles = 0;
+            for (size_t i = 0; i < numFaces; i++)
+            {
+                if (i % kBlockSize == 0)
+                {
+                    if (i > 0)
+                        file.Discard(p + blockOffsets[i / kBlockSize - 1] - file.Data(), offset - blockOffsets[i / kBlockSize - 1]);
+                    blockOffsets[i / kBlockSize] = offset;
+                    blockTriangles[i / kBlockSize] = numTriangles;
+                }
+
+                size_t recordSize = RecordSize(p + offset, end, element, swap);
+                if (recordSize == 0)
+                    return false;
+
+                int64_t count = ReadInteger(p + offset + listOffset, list.countType, swap);
+                if (count >= 3)
+                    numTriangles += count - 2;
+                offset += recordSize;
+            }
+
+            size_t countSize = TypeSize(list.countType);
+            size_t indexSize = TypeSize(list.type);
+
+            indices.resize(numTriangles * 3);
+
+            #pragma omp parallel for schedule(dynamic)
+            for (int b = 0; b < numBlocks; b++)
+            {
+                size_t first = (size_t)b * kBlockSize;
+                size_t last = std::min(first + kBlockSize, numFaces);
+                size_t recordOffset = blockOffsets[b];
+                int *out = indices.data() + blockTriangles[b] * 3;
+
+                for (size_t i = first; i < last; i++)
+                {
+                    const unsigned char *record = p + recordOffset;
+                    const unsigned char *items = record + listOffset + countSize;
+                    int64_t count = ReadInteger(record + listOffset, list.countType, swap);
+
+                    // Fan triangulation like the OBJ loaders
+                    int i0 = (int)ReadInteger(items, list.type, swap);
+                    for (int64_t k = 1; k + 1 < count; k++)
+                    {
+                        *out++ = i0;
+                        *out++ = (int)ReadInteger(items + k * indexSize, list.type, swap);
+                        *out++ = (int)ReadInteger(items + (k + 1) * indexSize, list.type, swap);
+                    }
+
+                    recordOffset += RecordSize(record, end, element, swap);
+                }
+
+                file.Discard(p + blockOffsets[b] - file.Data(), recordOffset - blockOffsets[b]);
+            }
+
+            size = offset;
+            return true;
+        }
+
+        // Area weighted vertex normals. The accumulation is serial so that no per thread
+        // copies of the normal array are needed
+        void GenerateNormals(const std::vector<Vec4> &verticesUVX, std::vector<Vec4> &normalsUVY, const std::vector<int> &indices)
+        {
+            for (size_t i = 0; i < indices.size(); i += 3)
+            {
+                Vec3 v0 = Vec3(verticesUVX[indices[i + 0]]);
+                Vec3 v1 = Vec3(verticesUVX[indices[i + 1]]);
+                Vec3 v2 = Vec3(verticesUVX[indices[i + 2]]);
+                Vec3 n = Vec3::Cross(v1 - v0, v2 - v0);
+
+                for (int k = 0; k < 3; k++)
+                {
+                    Vec4 &normal = normalsUVY[indices[i + k]];
+                    normal.x += n.x;
+                    normal.y += n.y;
+                    normal.z += n.z;
+                }
+            }
+
+            int numVertices = (int)normalsUVY.size();
+
+            #pragma omp parallel for
+            for (int i = 0; i < numVertices; i++)
+            {
+                Vec4 &normal = normalsUVY[i];
+                float len = Vec3::Length(Vec3(normal));
+                if (len > 0.0f)
+                {
+                    normal.x /= len;
+                    normal.y /= len;
+                    normal.z /= len;
+                }
+            }
+        }
+    }
+
+    bool LoadPly(const std::string &filename, std::vector<Vec4> &verticesUVX, std::vector<Vec4> &normalsUVY, std::vector<int> &indices)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        MappedFile file;
+        if (!file.Open(filename))
+        {
+            printf("Unable to open %s\n", filename.c_str());
+            return false;
+        }
+
+        const unsigned char *data = file.Data();
+        const unsigned char *end = data + file.Size();
+
+        std::vector<PlyElement> elements;
+        bool swap = false;
+        size_t offset = 0;
+
+        if (file.Size() < 4 || memcmp(data, "ply", 3) != 0 || !ParseHeader(data, file.Size(), elements, swap, offset))
+        {
+            printf("Invalid PLY header in %s\n", filename.c_str());
+            return false;
+        }
+
+        std::vector<Vec4> outVertices;
+        std::vector<Vec4> outNormals;
+        std::vector<int> outIndices;
+        bool hasVertices = false, hasFaces = false, hasNormals = false;
+
+        // Elements are stored back to back in header order
+        for (size_t e = 0; e < elements.size() && !(hasVertices && hasFaces); e++)
+        {
+            const PlyElement &element = elements[e];
+            const unsigned char *p = data + offset;
+            size_t size = 0;
+            bool ok;
+
+            if (element.name == "vertex" && !hasVertices)
+            {
+                ok = ReadVertices(file, p, element, swap, outVertices, outNormals, hasNormals);
+                size = element.count * element.fixedSize;
+                hasVertices = true;
+            }
+            else if (element.name == "face" && !hasFaces)
+            {
+                const PlyProperty *list = FindProperty(element, "vertex_indices", "vertex_index");
+                if (!list || list->countType == PlyInvalid || list->type == PlyFloat32 || list->type == PlyFloat64)
+                    ok = false;
+                else
+                    ok = ReadTriangles(file, p, element, *list, swap, outIndices, size) ||
+                         ReadPolygons(file, p, element, *list, swap, outIndices, size);
+                hasFaces = true;
+            }
+            else
+            {
+                ok = ElementSize(p, end, element, swap, size);
+            }
+
+            if (!ok)
+            {
+                printf("Unable to read element %s of %s\n", element.name.c_str(), filename.c_str());
+                return false;
+            }
+
+            offset += size;
+        }
+
+        if (!hasVertices || !hasFaces || outIndices.empty())
+        {
+            printf("%s has no triangles\n", filename.c_str());
+            return false;
+        }
+
+        int numVertices = (int)outVertices.size();
+        int numBlocks = (int)((outIndices.size() + kBlockSize - 1) / kBlockSize);
+        bool ok = true;
+
+        #pragma omp parallel for reduction(&&: ok)
+        for (int b = 0; b < numBlocks; b++)
+        {
+            size_t first = (size_t)b * kBlockSize;
+            size_t last = std::min(first + kBlockSize, outIndices.size());
+            for (size_t i = first; i < last; i++)
+            {
+                if (outIndices[i] < 0 || outIndices[i] >= numVertices)
+                    ok = false;
+            }
+        }
+
+        if (!ok)
+        {
+            printf("%s has out of range vertex indices\n", filename.c_str());
+            return false;
+        }
+
+        if (!hasNormals)
+            GenerateNormals(outVertices, outNormals, outIndices);
+
+        verticesUVX.swap(outVertices);
+        normalsUVY.swap(outNormals);
+        indices.swap(outIndices);
+
+        float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        float mb = file.Size() / (1024.0f * 1024.0f);
+        printf("Parsed %s: %.2f MB in %.2f ms (%.1f MB/s), %d vertices for %zu triangles\n",
+            filename.c_str(), mb, ms, ms > 0.0f ? mb * 1000.0f / ms : 0.0f, numVertices, indices.size() / 3);
+
+        return true;
+    }
+}
@@ -0,0 +1,202 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "PtMeshLoader.h"
+#include "MappedFile.h"
+#include "Mesh.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace GLSLPT
+{
+    namespace
+    {
+        const char kPtMeshMagic[8] = { 'G', 'L', 'S', 'L', 'P', 'T', 'M', 'S' };
+
+        // Bumped whenever the layout of the file or of Bvh::FlatNode changes
+        const uint32_t kPtMeshVersion = 2;
+
+        // Sections follow the header in this order: positions + u, normals + v,
+        // triangle indices, BLAS nodes, primitive indices of the BLAS leaves
+        struct PtMeshHeader
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t nodeSize;
+            uint32_t numVertices;
+            uint32_t numIndices;
+            uint32_t numNodes;
+            uint32_t numPrimIndices;
+            float boundsMin[3];
+            float boundsMax[3];
+        };
+
+        template <typename T>
+        bool ReadSection(const unsigned char *&ptr, const unsigned char *end, std::vector<T> &values, uint32_t count)
+        {
+            if ((size_t)(end - ptr) / sizeof(T) < count)
+                return false;
+
+            values.resize(count);
+            if (count > 0)
+                memcpy(values.data(), ptr, sizeof(T) * count);
+            ptr += sizeof(T) * count;
+            return true;
+        }
+
+        // Checks that the nodes only point forward to nodes in the array and that the leaves
+        // and primitive indices stay inside the index arrays, so a damaged file can't send
+        // traversal out of bounds or around in a loop
+        bool ValidateBvh(const std::vector<RadeonRays::Bvh::FlatNode> &nodes, const std::vector<int> &primIndices, uint32_t numTriangles)
+        {
+            int numNodes = (int)nodes.size();
+            int numPrimIndices = (int)primIndices.size();
+
+            for (int i = 0; i < numNodes; i++)
+            {
+                const int *LRLeaf = nodes[i].LRLeaf;
+                if (LRLeaf[2] == 1)
+                {
+                    if (LRLeaf[0] < 0 || LRLeaf[1] < 0 || LRLeaf[0] > numPrimIndices - LRLeaf[1])
+                        return false;
+                }
+                else if (LRLeaf[2] != 0 || LRLeaf[0] <= i || LRLeaf[0] >= numNodes || LRLeaf[1] <= i || LRLeaf[1] >= numNodes)
+                    return false;
+            }
+
+            for (int i = 0; i < numPrimIndices; i++)
+            {
+                if (primIndices[i] < 0 || (uint32_t)primIndices[i] >= numTriangles)
+                    return false;
+            }
+
+            return true;
+        }
+
+        bool WriteBytes(FILE *file, const void *data, size_t size)
+        {
+            return size == 0 || fwrite(data, 1, size, file) == size;
+        }
+    }
+
+    bool LoadPtMesh(const std::string &filename, Mesh &mesh)
+    {
+        MappedFile file;
+        if (!file.Open(filename) || file.Size() < sizeof(PtMeshHeader))
+        {
+            printf("Unable to open %s\n", filename.c_str());
+            return false;
+        }
+
+        PtMeshHeader header;
+        memcpy(&header, file.Data(), sizeof(header));
+
+        if (memcmp(header.magic, kPtMeshMagic, sizeof(kPtMeshMagic)) != 0 ||
+            header.version != kPtMeshVersion || header.nodeSize != sizeof(RadeonRays::Bvh::FlatNode))
+        {
+            printf("%s is not a version %d ptmesh file\n", filename.c_str(), kPtMeshVersion);
+            return false;
+        }
+
+        const unsigned char *ptr = file.Data() + sizeof(header);
+        const unsigned char *end = file.Data() + file.Size();
+
+        std::vector<RadeonRays::Bvh::FlatNode> nodes;
+        std::vector<int> primIndices;
+
+        bool ok = header.numIndices % 3 == 0 && header.numNodes > 0 &&
+            ReadSection(ptr, end, mesh.verticesUVX, header.numVertices) &&
+            ReadSection(ptr, end, mesh.normalsUVY, header.numVertices) &&
+            ReadSection(ptr, end, mesh.indices, header.numIndices) &&
+            ReadSection(ptr, end, nodes, header.numNodes) &&
+            ReadSection(ptr, end, primIndices, header.numPrimIndices);
+
+        if (!ok)
+        {
+            printf("%s is truncated\n", filename.c_str());
+            return false;
+        }
+
+        RadeonRays::bbox bounds(
+            Vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]),
+            Vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]));
+
+        // The mesh is still usable without its BLAS, loading builds a new one
+        if (!ValidateBvh(nodes, primIndices, header.numIndices / 3))
+        {
+            printf("%s has an invalid BVH, it will be rebuilt\n", filename.c_str());
+            return true;
+        }
+
+        mesh.bvh->SetFlattened(std::move(nodes), std::move(primIndices), bounds);
+        return true;
+    }
+
+    bool SavePtMesh(const std::string &filename, const Mesh &mesh)
+    {
+        const RadeonRays::Bvh *bvh = mesh.bvh;
+        if (!bvh->IsBuilt())
+            return false;
+
+        std::vector<RadeonRays::Bvh::FlatNode> nodes(bvh->GetNodeCount());
+        bvh->Flatten(nodes.data(), 0, 0);
+
+        PtMeshHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, kPtMeshMagic, sizeof(kPtMeshMagic));
+        header.version = kPtMeshVersion;
+        header.nodeSize = sizeof(RadeonRays::Bvh::FlatNode);
+        header.numVertices = (uint32_t)mesh.verticesUVX.size();
+        header.numIndices = (uint32_t)mesh.indices.size();
+        header.numNodes = (uint32_t)nodes.size();
+        header.numPrimIndices = (uint32_t)bvh->GetNumIndices();
+
+        const RadeonRays::bbox &bounds = bvh->Bounds();
+        for (int i = 0; i < 3; i++)
+        {
+            header.boundsMin[i] = bounds.pmin[i];
+            header.boundsMax[i] = bounds.pmax[i];
+        }
+
+        FILE *file = fopen(filename.c_str(), "wb");
+        if (!file)
+        {
+            printf("Couldn't open %s for writing\n", filename.c_str());
+            return false;
+        }
+
+        bool ok = WriteBytes(file, &header, sizeof(header)) &&
+            WriteBytes(file, mesh.verticesUVX.data(), mesh.verticesUVX.size() * sizeof(Vec4)) &&
+            WriteBytes(file, mesh.normalsUVY.data(), mesh.normalsUVY.size() * sizeof(Vec4)) &&
+            WriteBytes(file, mesh.indices.data(), mesh.indices.size() * sizeof(int)) &&
+            WriteBytes(file, nodes.data(), nodes.size() * sizeof(RadeonRays::Bvh::FlatNode)) &&
+            WriteBytes(file, bvh->GetIndices(), bvh->GetNumIndices() * sizeof(int));
+
+        ok = fclose(file) == 0 && ok;
+        if (!ok)
+            printf("Failed writing %s\n", filename.c_str());
+
+        return ok;
+    }
+}
@@ -0,0 +1,488 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "SceneCache.h"
+#include "Loader.h"
+#include "Scene.h"
+#include "Hash.h"
+#include "MappedFile.h"
+#include "GltfLoader.h"
+
+#include <cstdint>
+#include <stdio.h>
+
+namespace GLSLPT
+{
+    static const char kCacheMagic[8] = { 'G', 'L', 'S', 'L', 'P', 'T', 'S', 'C' };
+    static const uint32_t kCacheVersion = 14;
+
+    static std::string CacheFilename(const std::string &sceneFile)
+    {
+        return sceneFile + ".cache";
+    }
+
+    // Assets imported from a glTF file live inside it, so the whole file is hashed
+    static std::string SourceFile(const std::string &assetName)
+    {
+        std::string filename;
+        return IsGltfAsset(assetName, &filename) ? filename : assetName;
+    }
+
+    // Combines the scene file, every asset it references and the build
+    // parameters into a single key. Fails if any of the files can't be read
+    static bool ComputeCacheKey(const std::string &sceneFile, const Scene *scene, uint64_t &key)
+    {
+        uint64_t hash, size;
+
+        if (!Hash::File(sceneFile, hash, size))
+            return false;
+
+        key = Hash::Bytes(&kCacheVersion, sizeof(kCacheVersion), hash);
+
+        // Layout of the cached arrays
+        uint32_t layout[] = { sizeof(RadeonRays::BvhTranslator::Node), sizeof(Indices), sizeof(Vec4), sizeof(Vec2),
+            sizeof(QuantizedVertex), sizeof(QuantizedNormal), sizeof(Mat4) };
+        key = Hash::Bytes(layout, sizeof(layout), key);
+
+        for (int i = 0; i < scene->meshes.size(); i++)
+        {
+            if (!Hash::File(SourceFile(scene->meshes[i]->name), hash, size))
+                return false;
+            key = Hash::String(scene->meshes[i]->name, key);
+            key = Hash::String(scene->meshes[i]->bvh->GetBuildParams(), key);
+            key = Hash::Bytes(&hash, sizeof(hash), key);
+        }
+
+        for (int i = 0; i < scene->textures.size(); i++)
+        {
+            if (!Hash::File(SourceFile(scene->textures[i]->name), hash, size))
+                return false;
+            key = Hash::String(scene->textures[i]->name, key);
+            key = Hash::Bytes(&hash, sizeof(hash), key);
+        }
+
+        if (!scene->hdrFile.empty())
+        {
+            if (!Hash::File(scene->hdrFile, hash, size))
+                return false;
+            key = Hash::String(scene->hdrFile, key);
+            key = Hash::Bytes(&hash, sizeof(hash), key);
+        }
+
+        return true;
+    }
+
+    class CacheWriter
+    {
+    public:
+        CacheWriter(FILE *file) : ok(true), file(file) {}
+
+        template <typename T>
+        void Write(const T &value)
+        {
+            WriteBytes(&value, sizeof(T));
+        }
+
+        template <typename T>
+        void WriteArray(const T *values, uint64_t count)
+        {
+            Write(count);
+            WriteBytes(values, sizeof(T) * count);
+        }
+
+        template <typename T>
+        void WriteArray(const std::vector<T> &values)
+        {
+            WriteArray(values.data(), values.size());
+        }
+
+        void WriteBytes(const void *data, size_t size)
+        {
+            if (size > 0 && fwrite(data, 1, size, file) != size)
+                ok = false;
+        }
+
+        bool ok;
+
+    private:
+        FILE *file;
+    };
+
+    class CacheReader
+    {
+    public:
+        CacheReader(const unsigned char *data, size_t size) : ptr(data), end(data + size) {}
+
+        template <typename T>
+        bool Read(T &value)
+        {
+            return ReadBytes(&value, sizeof(T));
+        }
+
+        // Reads an array into a preallocated buffer of known size
+        template <typename T>
+        bool ReadArray(T *values, uint64_t expected)
+        {
+            uint64_t count;
+            if (!Read(count) || count != expected)
+                return false;
+            return ReadBytes(values, sizeof(T) * count);
+        }
+
+        template <typename T>
+        bool ReadArray(std::vector<T> &values)
+        {
+            uint64_t count;
+            if (!Read(count) || count > (uint64_t)(end - ptr) / sizeof(T))
+                return false;
+            values.resize(count);
+            return ReadBytes(values.data(), sizeof(T) * count);
+        }
+
+        bool ReadBytes(void *data, size_t size)
+        {
+            if (size > (size_t)(end - ptr))
+                return false;
+            if (size > 0)
+                memcpy(data, ptr, size);
+            ptr += size;
+            return true;
+        }
+
+    private:
+        const unsigned char *ptr;
+        const unsigned char *end;
+    };
+
+    static void WriteTextureAtlas(CacheWriter &writer, const TextureAtlas &atlas)
+    {
+        writer.Write((uint64_t)atlas.arrays.size());
+        for (const TextureAtlas::PageArray &array : atlas.arrays)
+        {
+            writer.Write((int)array.format);
+            writer.Write((int)array.srgb);
+            writer.Write(array.pageWidth);
+            writer.Write(array.pageHeight);
+            writer.Write(array.numPages);
+            writer.WriteArray(array.pages);
+        }
+        writer.WriteArray(atlas.rects);
+    }
+
+    static bool ReadTextureAtlas(CacheReader &reader, TextureAtlas &atlas)
+    {
+        uint64_t numArrays;
+        if (!reader.Read(numArrays) || numArrays > TextureAtlas::kMaxArrays)
+            return false;
+
+        atlas.arrays.resize(numArrays);
+        for (TextureAtlas::PageArray &array : atlas.arrays)
+        {
+            int format, srgb;
+            if (!reader.Read(format) || format < TextureFormatRGB8 || format > TextureFormatR8 || !reader.Read(srgb))
+                return false;
+            array.format = (TextureFormat)format;
+            array.srgb = srgb != 0;
+
+            if (!reader.Read(array.pageWidth) || !reader.Read(array.pageHeight) ||
+                !reader.Read(array.numPages) || !reader.ReadArray(array.pages))
+                return false;
+        }
+        return reader.ReadArray(atlas.rects);
+    }
+
+    bool LoadSceneCache(const std::string &sceneFile, Scene *scene)
+    {
+        MappedFile file;
+        if (!file.Open(CacheFilename(sceneFile)))
+            return false;
+
+        uint64_t key;
+        if (!ComputeCacheKey(sceneFile, scene, key))
+            return false;
+
+        CacheReader reader(file.Data(), file.Size());
+
+        char magic[8];
+        uint32_t version;
+        uint64_t cachedKey;
+        if (!reader.Read(magic) || memcmp(magic, kCacheMagic, sizeof(kCacheMagic)) != 0 ||
+            !reader.Read(version) || version != kCacheVersion ||
+            !reader.Read(cachedKey) || cachedKey != key)
+        {
+            Log("Scene cache is out of date\n");
+            return false;
+        }
+
+        // Meshes are kept for their names, bounds and grid transforms, which are needed to rebuild the TLAS
+        std::vector<RadeonRays::bbox> meshBounds;
+        if (!reader.ReadArray(meshBounds) || meshBounds.size() != scene->meshes.size())
+            return false;
+
+        std::vector<Mat4> meshDequantize;
+        if (!reader.ReadArray(meshDequantize) || meshDequantize.size() != scene->meshes.size())
+            return false;
+
+        std::vector<iVec2> texSizes;
+        if (!reader.ReadArray(texSizes) || texSizes.size() != scene->textures.size())
+            return false;
+
+        // Virtual textures stay in their page files and the atlas is left empty
+        int virtualTextures = 0;
+        // The packed width may be narrower than the requested one, see BvhTranslator::width
+        int bvhWidth = scene->renderOptions.bvhWidth;
+        int requestedWidth = 0;
+        RadeonRays::BvhTranslator &translator = scene->bvhTranslator;
+        bool ok = reader.Read(translator.topLevelIndex) &&
+            reader.ReadArray(translator.bvhRootStartIndices) &&
+            reader.ReadArray(translator.nodes) &&
+            reader.Read(requestedWidth) && requestedWidth == bvhWidth &&
+            reader.Read(translator.width) &&
+            reader.ReadArray(translator.packedNodes) &&
+            reader.ReadArray(translator.packedRoots) &&
+            reader.Read(translator.packedTopLevelIndex) &&
+            reader.Read(translator.wideStackSize) &&
+            reader.Read(translator.wideBLASStackSize) &&
+            reader.ReadArray(scene->vertIndices) &&
+            reader.ReadArray(scene->verticesUVX) &&
+            reader.ReadArray(scene->normalsUVY) &&
+            reader.ReadArray(scene->quantizedVertices) &&
+            reader.ReadArray(scene->quantizedNormals) &&
+            reader.Read(virtualTextures) && virtualTextures == (scene->renderOptions.virtualTextures ? 1 : 0) &&
+            ReadTextureAtlas(reader, scene->textureAtlas) &&
+            (virtualTextures || scene->textureAtlas.rects.size() >= scene->textures.size());
+
+        int hasHDR = 0;
+        ok = ok && reader.Read(hasHDR) && hasHDR == (scene->hdrFile.empty() ? 0 : 1);
+
+        if (ok && hasHDR)
+        {
+            HDRData *hdr = new HDRData;
+            ok = reader.Read(hdr->width) && reader.Read(hdr->height) && hdr->width > 0 && hdr->height > 0;
+
+            if (ok)
+            {
+                size_t numPixels = (size_t)hdr->width * hdr->height;
+                hdr->cols = new float[numPixels * 3];
+
+                const RenderOptions &options = scene->renderOptions;
+                int format = 0, hasPyramid = 0, hasAliasTable = 0, hasHalfDist = 0;
+                ok = reader.Read(format) && format == options.envMapFormat &&
+                    reader.ReadArray(hdr->cols, numPixels * 3) && reader.Read(hasPyramid) && reader.Read(hasAliasTable) && reader.Read(hasHalfDist) &&
+                    hasPyramid == (options.envMapSampling == EnvMapSamplingHierarchical ? 1 : 0) &&
+                    hasAliasTable == (options.envMapSampling == EnvMapSamplingAlias ? 1 : 0) &&
+                    hasHalfDist == (!hasPyramid && !hasAliasTable && options.envMapHalfDistribution && hdr->width <= 0xffff ? 1 : 0);
+                hdr->format = options.envMapFormat;
+
+                if (ok && hasPyramid)
+                {
+                    // A different size option needs the pyramid rebuilt
+                    int maxSize = 0;
+                    ok = reader.Read(maxSize) && maxSize == options.envMapPyramidSize &&
+                        reader.Read(hdr->pyramidWidth) && reader.Read(hdr->pyramidHeight) && reader.Read(hdr->pyramidLevels) &&
+                        hdr->pyramidWidth > 0 && hdr->pyramidHeight > 0 && hdr->pyramidLevels > 0 && hdr->pyramidLevels <= 32;
+                    if (ok)
+                    {
+                        hdr->luminancePyramid = new float[hdr->PyramidSize()];
+                        ok = reader.ReadArray(hdr->luminancePyramid, hdr->PyramidSize());
+                    }
+                }
+                else if (ok && hasAliasTable)
+                {
+                    hdr->aliasTable = new HDRAliasEntry[numPixels];
+                    ok = reader.Read(hdr->luminanceSum) && reader.ReadArray(hdr->aliasTable, numPixels);
+                }
+                else if (ok)
+                {
+                    hdr->marginalDistData = new Vec2[hdr->height];
+                    ok = reader.ReadArray(hdr->marginalDistData, hdr->height);
+                    if (hasHalfDist)
+                    {
+                        hdr->halfConditionalDistData = new HDRHalfDistEntry[numPixels];
+                        ok = ok && reader.ReadArray(hdr->halfConditionalDistData, numPixels);
+                    }
+                    else
+                    {
+                        hdr->conditionalDistData = new Vec2[numPixels];
+                        ok = ok && reader.ReadArray(hdr->conditionalDistData, numPixels);
+                    }
+                }
+            }
+
+            delete scene->hdrData;
+            scene->hdrData = hdr;
+        }
+
+        ok = ok && (!virtualTextures || scene->LoadVirtualTextures());
+
+        if (!ok)
+        {
+            Log("Scene cache is corrupt\n");
+            translator.nodes.clear();
+            translator.bvhRootStartIndices.clear();
+            translator.packedNodes.clear();
+            translator.packedRoots.clear();
+            scene->vertIndices.clear();
+            scene->verticesUVX.clear();
+            scene->normalsUVY.clear();
+            scene->quantizedVertices.clear();
+            scene->quantizedNormals.clear();
+            scene->textureAtlas.Clear();
+            scene->virtualTextures.Clear();
+            delete scene->hdrData;
+            scene->hdrData = nullptr;
+            return false;
+        }
+
+        for (int i = 0; i < scene->meshes.size(); i++)
+        {
+            scene->meshes[i]->bvh->SetBounds(meshBounds[i]);
+            scene->meshes[i]->dequantize = meshDequantize[i];
+        }
+
+        for (int i = 0; i < scene->textures.size(); i++)
+        {
+            scene->textures[i]->width = texSizes[i].x;
+            scene->textures[i]->height = texSizes[i].y;
+        }
+
+        if (scene->hdrData != nullptr)
+            scene->renderOptions.useEnvMap = true;
+
+        // Rebuild the top level BVH so instances can still be edited
+        scene->transforms.resize(scene->meshInstances.size());
+        scene->RebuildInstances();
+        scene->instancesModified = false;
+
+        return true;
+    }
+
+    bool SaveSceneCache(const std::string &sceneFile, Scene *scene)
+    {
+        uint64_t key;
+        if (!ComputeCacheKey(sceneFile, scene, key))
+            return false;
+
+        std::string filename = CacheFilename(sceneFile);
+        FILE *file = fopen(filename.c_str(), "wb");
+        if (!file)
+        {
+            Log("Couldn't open %s for writing\n", filename.c_str());
+            return false;
+        }
+
+        CacheWriter writer(file);
+        writer.Write(kCacheMagic);
+        writer.Write(kCacheVersion);
+        writer.Write(key);
+
+        std::vector<RadeonRays::bbox> meshBounds;
+        for (int i = 0; i < scene->meshes.size(); i++)
+            meshBounds.push_back(scene->meshes[i]->bvh->Bounds());
+        writer.WriteArray(meshBounds);
+
+        std::vector<Mat4> meshDequantize;
+        for (int i = 0; i < scene->meshes.size(); i++)
+            meshDequantize.push_back(scene->meshes[i]->dequantize);
+        writer.WriteArray(meshDequantize);
+
+        std::vector<iVec2> texSizes;
+        for (int i = 0; i < scene->textures.size(); i++)
+            texSizes.push_back(iVec2(scene->textures[i]->width, scene->textures[i]->height));
+        writer.WriteArray(texSizes);
+
+        const RadeonRays::BvhTranslator &translator = scene->bvhTranslator;
+        writer.Write(translator.topLevelIndex);
+        writer.WriteArray(translator.bvhRootStartIndices);
+        writer.WriteArray(translator.nodes);
+        writer.Write(scene->renderOptions.bvhWidth);
+        writer.Write(translator.width);
+        writer.WriteArray(translator.packedNodes);
+        writer.WriteArray(translator.packedRoots);
+        writer.Write(translator.packedTopLevelIndex);
+        writer.Write(translator.wideStackSize);
+        writer.Write(translator.wideBLASStackSize);
+        writer.WriteArray(scene->vertIndices);
+        writer.WriteArray(scene->verticesUVX);
+        writer.WriteArray(scene->normalsUVY);
+        writer.WriteArray(scene->quantizedVertices);
+        writer.WriteArray(scene->quantizedNormals);
+        writer.Write(scene->renderOptions.virtualTextures ? 1 : 0);
+        WriteTextureAtlas(writer, scene->textureAtlas);
+
+        const HDRData *hdr = scene->hdrData;
+        int hasHDR = hdr != nullptr ? 1 : 0;
+        writer.Write(hasHDR);
+
+        if (hasHDR)
+        {
+            size_t numPixels = (size_t)hdr->width * hdr->height;
+            writer.Write(hdr->width);
+            writer.Write(hdr->height);
+            int format = hdr->format;
+            writer.Write(format);
+            // Quantized radiance is kept as the rounded floats
+            writer.WriteArray(hdr->cols, numPixels * 3);
+
+            int hasPyramid = hdr->luminancePyramid != nullptr ? 1 : 0;
+            int hasAliasTable = hdr->aliasTable != nullptr ? 1 : 0;
+            int hasHalfDist = hdr->halfConditionalDistData != nullptr ? 1 : 0;
+            writer.Write(hasPyramid);
+            writer.Write(hasAliasTable);
+            writer.Write(hasHalfDist);
+            if (hasPyramid)
+            {
+                writer.Write(scene->renderOptions.envMapPyramidSize);
+                writer.Write(hdr->pyramidWidth);
+                writer.Write(hdr->pyramidHeight);
+                writer.Write(hdr->pyramidLevels);
+                writer.WriteArray(hdr->luminancePyramid, hdr->PyramidSize());
+            }
+            else if (hasAliasTable)
+            {
+                writer.Write(hdr->luminanceSum);
+                writer.WriteArray(hdr->aliasTable, numPixels);
+            }
+            else
+            {
+                writer.WriteArray(hdr->marginalDistData, hdr->height);
+                if (hasHalfDist)
+                    writer.WriteArray(hdr->halfConditionalDistData, numPixels);
+                else
+                    writer.WriteArray(hdr->conditionalDistData, numPixels);
+            }
+        }
+
+        fclose(file);
+
+        if (!writer.ok)
+        {
+            Log("Failed writing scene cache %s\n", filename.c_str());
+            remove(filename.c_str());
+            return false;
+        }
+
+        return true;
+    }
+}
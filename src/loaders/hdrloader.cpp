@@ -12,10 +12,14 @@
 */
 
 #include "hdrloader.h"
+#include "MappedFile.h"
 
+#include <algorithm>
+#include <chrono>
 #include <math.h>
 #include <memory.h>
 #include <stdio.h>
+#include <vector>
 
 typedef unsigned char RGBE[4];
 #define R            0
@@ -26,32 +30,28 @@ typedef unsigned char RGBE[4];
 #define  MINELEN    8                // minimum scanline length for encoding
 #define  MAXELEN    0x7fff            // maximum scanline length for encoding
 
-static void workOnRGBE(RGBE *scan, int len, float *cols);
-static bool decrunch(RGBE *scanline, int len, FILE *file);
-static bool oldDecrunch(RGBE *scanline, int len, FILE *file);
+static void workOnRGBE(const RGBE *scan, int len, float *cols);
+static const unsigned char* skipScanline(const unsigned char *ptr, const unsigned char *end, int len);
+static void decrunch(RGBE *scanline, int len, const unsigned char *ptr);
+static bool oldDecrunch(RGBE *scanline, int len, const unsigned char *&ptr, const unsigned char *end, RGBE &prev);
 
 float Luminance(const Vec3 &c)
 {
     return c.x*0.3f + c.y*0.6f + c.z*0.1f;
 }
 
-int LowerBound(const float* array, int lower, int upper, const float value)
+// Index of the first entry of a sorted cdf that is >= each of count evenly spaced targets
+// (i + 1) / count. The targets increase, so one walk over the cdf finds all of them
+static void MergeLowerBounds(const float* cdf, int size, int count, Vec2* out)
 {
-    while (lower < upper)
+    int index = 0;
+    for (int i = 0; i < count; i++)
     {
-        int mid = lower + (upper - lower) / 2;
-
-        if (array[mid] < value)
-        {
-            lower = mid + 1;
-        }
-        else
-        {
-            upper = mid;
-        }
+        float target = (float)(i + 1) / count;
+        while (index < size && cdf[index] < target)
+            index++;
+        out[i].x = index / (float)size;
     }
-
-    return lower;
 }
 
 void HDRLoader::buildDistributions(HDRData* res)
@@ -59,44 +59,51 @@ void HDRLoader::buildDistributions(HDRData* res)
     int width  = res->width;
     int height = res->height;
 
-    float *pdf2D = new float[width*height];
-    float *cdf2D = new float[width*height];
+    float *pdf2D = new float[(size_t)width*height];
+    float *cdf2D = new float[(size_t)width*height];
 
     float *pdf1D = new float[height];
     float *cdf1D = new float[height];
 
     res->marginalDistData    = new Vec2[height];
-    res->conditionalDistData = new Vec2[width*height];
-
-    float colWeightSum = 0.0f;
+    res->conditionalDistData = new Vec2[(size_t)width*height];
 
+    // Rows are independent, only the marginal needs them in order
+    #pragma omp parallel for schedule(static)
     for (int j = 0; j < height; j++)
     {
         float rowWeightSum = 0.0f;
+        float *pdfRow = pdf2D + (size_t)j*width;
+        float *cdfRow = cdf2D + (size_t)j*width;
+        const float *colsRow = res->cols + (size_t)j*width * 3;
 
         for (int i = 0; i < width; ++i)
         {
-            float weight = Luminance(Vec3(res->cols[j*width * 3 + i * 3 + 0], res->cols[j*width * 3 + i * 3 + 1], res->cols[j*width * 3 + i * 3 + 2]));
+            float weight = Luminance(Vec3(colsRow[i * 3 + 0], colsRow[i * 3 + 1], colsRow[i * 3 + 2]));
 
             rowWeightSum += weight;
 
-            pdf2D[j*width + i] = weight;
-            cdf2D[j*width + i] = rowWeightSum;
+            pdfRow[i] = weight;
+            cdfRow[i] = rowWeightSum;
         }
 
         /* Convert to range 0,1 */
         for (int i = 0; i < width; i++)
         {
-            pdf2D[j*width + i] /= rowWeightSum;
-            cdf2D[j*width + i] /= rowWeightSum;
+            pdfRow[i] /= rowWeightSum;
+            cdfRow[i] /= rowWeightSum;
         }
 
-        colWeightSum += rowWeightSum;
-
         pdf1D[j] = rowWeightSum;
+    }
+
+    float colWeightSum = 0.0f;
+    for (int j = 0; j < height; j++)
+    {
+        colWeightSum += pdf1D[j];
         cdf1D[j] = colWeightSum;
     }
-    
+
     /* Convert to range 0,1 */
     for (int j = 0; j < height; j++)
     {
@@ -105,23 +112,17 @@ void HDRLoader::buildDistributions(HDRData* res)
     }
 
     /* Precalculate row and col to avoid binary search during lookup in the shader */
+    MergeLowerBounds(cdf1D, height, height, res->marginalDistData);
     for (int i = 0; i < height; i++)
-    {
-        float invHeight = (float)(i+1) / height;
-        int row = LowerBound(cdf1D, 0, height, invHeight);
-        res->marginalDistData[i].x = row / (float)height;
         res->marginalDistData[i].y = pdf1D[i];
-    }
 
+    #pragma omp parallel for schedule(static)
     for (int j = 0; j < height; j++)
     {
+        Vec2 *condRow = res->conditionalDistData + (size_t)j*width;
+        MergeLowerBounds(cdf2D + (size_t)j*width, width, width, condRow);
         for (int i = 0; i < width; i++)
-        {
-            float invWidth = (float)(i+1) / width;
-            int col = LowerBound(cdf2D, j*width, (j + 1)*width, invWidth) - j * width;
-            res->conditionalDistData[j*width + i].x = col / (float)width;
-            res->conditionalDistData[j*width + i].y = pdf2D[j*width + i];
-        }
+            condRow[i].y = pdf2D[(size_t)j*width + i];
     }
 
     delete[] pdf2D;
@@ -130,169 +131,582 @@ void HDRLoader::buildDistributions(HDRData* res)
     delete[] cdf1D;
 }
 
-HDRData* HDRLoader::load(const char *fileName)
+void HDRLoader::buildAliasTable(HDRData* res)
 {
-    int i;
-    char str[200];
-    FILE *file;
+    int numPixels = res->width * res->height;
 
-    file = fopen(fileName, "rb");
-    if (!file)
-        return nullptr;
+    // Pixels are picked in proportion to their luminance. The shader recomputes the
+    // luminance of a pixel for its pdf, so only the sum is kept
+    double *scaled = new double[numPixels];
+    double sum = 0.0;
 
-    HDRData *res = new HDRData;
+    #pragma omp parallel for schedule(static) reduction(+: sum)
+    for (int i = 0; i < numPixels; i++)
+    {
+        scaled[i] = Luminance(Vec3(res->cols[i * 3 + 0], res->cols[i * 3 + 1], res->cols[i * 3 + 2]));
+        sum += scaled[i];
+    }
 
-    fread(str, 10, 1, file);
-    if (memcmp(str, "#?RADIANCE", 10)) {
-        fclose(file);
-        return nullptr;
+    res->luminanceSum = (float)sum;
+    res->aliasTable = new HDRAliasEntry[numPixels];
+
+    // Vose's method. Pixels below the average probability take the rest of their
+    // slot from one above it. Small ones are queued from the front of the worklist,
+    // large ones from the back. The leftovers are tracked in double, float drifts
+    // by tenths of a percent on large maps
+    int *work = new int[numPixels];
+    int numSmall = 0;
+    int firstLarge = numPixels;
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < numPixels; i++)
+        scaled[i] = sum > 0.0 ? scaled[i] * numPixels / sum : 1.0;
+
+    for (int i = 0; i < numPixels; i++)
+    {
+        if (scaled[i] < 1.0)
+            work[numSmall++] = i;
+        else
+            work[--firstLarge] = i;
     }
 
-    fseek(file, 1, SEEK_CUR);
+    while (numSmall > 0 && firstLarge < numPixels)
+    {
+        int small = work[--numSmall];
+        int large = work[firstLarge];
 
-    char cmd[200];
-    i = 0;
-    char c = 0, oldc;
-    while(true) {
-        oldc = c;
-        c = fgetc(file);
-        if (c == 0xa && oldc == 0xa)
-            break;
-        cmd[i++] = c;
+        res->aliasTable[small].threshold = (float)scaled[small];
+        res->aliasTable[small].alias = large;
+
+        scaled[large] = (scaled[large] + scaled[small]) - 1.0;
+        if (scaled[large] < 1.0)
+        {
+            firstLarge++;
+            work[numSmall++] = large;
+        }
     }
 
-    char reso[200];
-    i = 0;
-    while(true) {
-        c = fgetc(file);
-        reso[i++] = c;
-        if (c == 0xa)
+    // What is left only differs from 1 by rounding
+    for (int i = 0; i < numSmall; i++)
+        res->aliasTable[work[i]] = HDRAliasEntry{ 1.0f, work[i] };
+    for (int i = firstLarge; i < numPixels; i++)
+        res->aliasTable[work[i]] = HDRAliasEntry{ 1.0f, work[i] };
+
+    delete[] work;
+    delete[] scaled;
+}
+
+size_t HDRData::PyramidSize() const
+{
+    size_t size = 0;
+    for (int level = 0; level < pyramidLevels; level++)
+        size += (size_t)(pyramidWidth >> level > 1 ? pyramidWidth >> level : 1) * (pyramidHeight >> level > 1 ? pyramidHeight >> level : 1);
+    return size;
+}
+
+size_t HDRData::RadianceBytes() const
+{
+    return (size_t)width * height * (format == HDRFormatRGB32F ? 12 : format == HDRFormatRGB16F ? 6 : 4);
+}
+
+size_t HDRData::SamplingBytes() const
+{
+    size_t numPixels = (size_t)width * height;
+    if (luminancePyramid)
+        return PyramidSize() * sizeof(float);
+    if (aliasTable)
+        return numPixels * sizeof(HDRAliasEntry);
+    return height * sizeof(Vec2) + numPixels * (halfConditionalDistData ? sizeof(HDRHalfDistEntry) : sizeof(Vec2));
+}
+
+static int largestPowerOfTwo(int value)
+{
+    int power = 1;
+    while (power * 2 <= value)
+        power *= 2;
+    return power;
+}
+
+void HDRLoader::buildLuminancePyramid(HDRData* res, int maxSize)
+{
+    int width = res->width;
+    int height = res->height;
+
+    // Power of two sizes let every level split evenly, the aspect ratio of the map is kept
+    int pyramidWidth = largestPowerOfTwo(width < maxSize ? width : maxSize);
+    int pyramidHeight = largestPowerOfTwo((int)((double)pyramidWidth * height / width + 0.5));
+    pyramidHeight = pyramidHeight < height ? pyramidHeight : largestPowerOfTwo(height);
+
+    int levels = 1;
+    while ((pyramidWidth >> (levels - 1)) > 1 || (pyramidHeight >> (levels - 1)) > 1)
+        levels++;
+
+    res->pyramidWidth = pyramidWidth;
+    res->pyramidHeight = pyramidHeight;
+    res->pyramidLevels = levels;
+    res->luminancePyramid = new float[res->PyramidSize()];
+
+    // A cell covers the pixels bilinear filtering reads anywhere inside it, so it never gets
+    // a zero weight where the shader can see radiance. The texture repeats in both directions
+    #pragma omp parallel
+    {
+        std::vector<double> columnSums(width);
+
+        #pragma omp for schedule(static)
+        for (int cy = 0; cy < pyramidHeight; cy++) {
+            int y0 = (int)floor((double)cy * height / pyramidHeight - 0.5);
+            int y1 = (int)floor((double)(cy + 1) * height / pyramidHeight - 0.5) + 1;
+
+            std::fill(columnSums.begin(), columnSums.end(), 0.0);
+            for (int y = y0; y <= y1; y++) {
+                const float *row = res->cols + (size_t)((y % height + height) % height) * width * 3;
+                for (int x = 0; x < width; x++)
+                    columnSums[x] += Luminance(Vec3(row[x * 3 + 0], row[x * 3 + 1], row[x * 3 + 2]));
+            }
+
+            for (int cx = 0; cx < pyramidWidth; cx++) {
+                int x0 = (int)floor((double)cx * width / pyramidWidth - 0.5);
+                int x1 = (int)floor((double)(cx + 1) * width / pyramidWidth - 0.5) + 1;
+
+                double sum = 0.0;
+                for (int x = x0; x <= x1; x++)
+                    sum += columnSums[(x % width + width) % width];
+                res->luminancePyramid[(size_t)cy * pyramidWidth + cx] = (float)(sum / ((double)(x1 - x0 + 1) * (y1 - y0 + 1)));
+            }
+        }
+    }
+
+    float *child = res->luminancePyramid;
+    int childWidth = pyramidWidth, childHeight = pyramidHeight;
+    for (int level = 1; level < levels; level++) {
+        int levelWidth = childWidth > 1 ? childWidth / 2 : 1;
+        int levelHeight = childHeight > 1 ? childHeight / 2 : 1;
+        float *parent = child + (size_t)childWidth * childHeight;
+
+        for (int y = 0; y < levelHeight; y++) {
+            for (int x = 0; x < levelWidth; x++) {
+                int x0 = childWidth > levelWidth ? x * 2 : x;
+                int y0 = childHeight > levelHeight ? y * 2 : y;
+                int x1 = childWidth > levelWidth ? x0 + 1 : x0;
+                int y1 = childHeight > levelHeight ? y0 + 1 : y0;
+
+                float sum = child[y0 * childWidth + x0];
+                if (x1 != x0)
+                    sum += child[y0 * childWidth + x1];
+                if (y1 != y0)
+                    sum += child[y1 * childWidth + x0];
+                if (x1 != x0 && y1 != y0)
+                    sum += child[y1 * childWidth + x1];
+                parent[y * levelWidth + x] = sum;
+            }
+        }
+
+        child = parent;
+        childWidth = levelWidth;
+        childHeight = levelHeight;
+    }
+}
+
+// Round to nearest even, values above the largest half become infinity
+static uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t absBits = bits & 0x7fffffff;
+
+    if (absBits >= 0x7f800000) // inf or nan
+        return (uint16_t)(sign | 0x7c00 | (absBits > 0x7f800000 ? 0x200 : 0));
+    if (absBits >= 0x477ff000) // rounds past 65504
+        return (uint16_t)(sign | 0x7c00);
+    if (absBits < 0x38800000) { // subnormal or zero
+        if (absBits < 0x33000000)
+            return (uint16_t)sign;
+        uint32_t mantissa = (absBits & 0x7fffff) | 0x800000;
+        int shift = 126 - (absBits >> 23);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return (uint16_t)(sign | half);
+    }
+
+    uint32_t half = ((absBits - 0x38000000) >> 13);
+    uint32_t rest = absBits & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return (uint16_t)(sign | half);
+}
+
+static float halfToFloat(uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    int exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+
+    if (exponent == 0)
+        return (sign ? -1.0f : 1.0f) * ldexpf((float)mantissa, -24);
+
+    uint32_t bits = exponent == 31 ? sign | 0x7f800000 | (mantissa << 13) : sign | ((exponent + 112) << 23) | (mantissa << 13);
+    float value;
+    memcpy(&value, &bits, 4);
+    return value;
+}
+
+// Shared exponent rounding from EXT_texture_shared_exponent: 9 bit mantissas, 5 bit exponent with a bias of 15.
+// Powers of two are built from their bits so no libm calls are needed per pixel
+static float powerOfTwo(int exponent)
+{
+    uint32_t bits = (uint32_t)(exponent + 127) << 23;
+    float value;
+    memcpy(&value, &bits, 4);
+    return value;
+}
+
+static void roundToRGB9E5(float *rgb)
+{
+    const int mantissaBits = 9, bias = 15;
+    const float maxValue = 511.0f / 512.0f * 65536.0f;
+
+    float maxc = 0.0f;
+    for (int c = 0; c < 3; c++) {
+        rgb[c] = rgb[c] > 0.0f ? (rgb[c] < maxValue ? rgb[c] : maxValue) : 0.0f;
+        maxc = rgb[c] > maxc ? rgb[c] : maxc;
+    }
+
+    if (maxc == 0.0f)
+        return;
+
+    uint32_t maxBits;
+    memcpy(&maxBits, &maxc, 4);
+    int log2Max = (int)(maxBits >> 23) - 127; // floor(log2(maxc)), denormals fall below the range anyway
+    int exponent = (log2Max > -bias - 1 ? log2Max : -bias - 1) + 1 + bias;
+    float scale = powerOfTwo(-(exponent - bias - mantissaBits));
+    if ((int)(maxc * scale + 0.5f) == (1 << mantissaBits)) {
+        exponent++;
+        scale *= 0.5f;
+    }
+
+    float step = powerOfTwo(exponent - bias - mantissaBits);
+    for (int c = 0; c < 3; c++)
+        rgb[c] = (float)(int)(rgb[c] * scale + 0.5f) * step;
+}
+
+static const char* formatName(HDRFormat format)
+{
+    switch (format) {
+    case HDRFormatRGB16F: return "RGB16F";
+    case HDRFormatRGB9E5: return "RGB9E5";
+    default:              return "RGB32F";
+    }
+}
+
+void HDRLoader::quantize(HDRData* res)
+{
+    int width = res->width;
+    int height = res->height;
+    std::vector<double> rowErrorSum(height, 0.0), rowMaxError(height, 0.0);
+    std::vector<int> rowClamped(height, 0);
+
+    #pragma omp parallel for schedule(static)
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            float *rgb = res->cols + ((size_t)j * width + i) * 3;
+            float before = Luminance(Vec3(rgb[0], rgb[1], rgb[2]));
+
+            if (res->format == HDRFormatRGB16F) {
+                for (int c = 0; c < 3; c++) {
+                    // Larger values would turn into infinity
+                    if (rgb[c] > 65504.0f) {
+                        rgb[c] = 65504.0f;
+                        rowClamped[j]++;
+                    }
+                    rgb[c] = halfToFloat(floatToHalf(rgb[c]));
+                }
+            }
+            else
+                roundToRGB9E5(rgb);
+
+            if (before > 0.0f) {
+                double error = fabs(Luminance(Vec3(rgb[0], rgb[1], rgb[2])) - before) / before;
+                rowErrorSum[j] += error;
+                rowMaxError[j] = error > rowMaxError[j] ? error : rowMaxError[j];
+            }
+        }
+    }
+
+    double errorSum = 0.0, maxError = 0.0;
+    int numClamped = 0;
+    for (int j = 0; j < height; j++) {
+        errorSum += rowErrorSum[j];
+        maxError = rowMaxError[j] > maxError ? rowMaxError[j] : maxError;
+        numClamped += rowClamped[j];
+    }
+
+    printf("HDR stored as %s: luminance error %.4f%% mean, %.4f%% max, %d components clamped\n", formatName(res->format),
+        errorSum * 100.0 / ((double)width * height), maxError * 100.0, numClamped);
+}
+
+void HDRLoader::buildHalfDistribution(HDRData* res)
+{
+    buildDistributions(res);
+
+    size_t numPixels = (size_t)res->width * res->height;
+    res->halfConditionalDistData = new HDRHalfDistEntry[numPixels];
+
+    // The pdf is stored times the width so it averages 1, dim pixels stay clear of
+    // the half float range limit. Those that still underflow keep the smallest value
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < (int)numPixels; i++) {
+        const Vec2 &entry = res->conditionalDistData[i];
+        float pdf = entry.y * res->width;
+        uint16_t halfPdf = floatToHalf(pdf);
+        if (halfPdf == 0 && pdf > 0.0f)
+            halfPdf = 1;
+
+        // The pixel the inverse CDF lands in, the last column starting at or before entry.x.
+        // Entries were written as column / width, so the product can come out just below
+        // the column and is corrected with the same division
+        int column = (int)(entry.x * res->width);
+        if ((column + 1) / (float)res->width <= entry.x)
+            column++;
+        res->halfConditionalDistData[i].column = (uint16_t)(column < res->width ? column : res->width - 1);
+        res->halfConditionalDistData[i].pdf = halfPdf;
+    }
+
+    delete[] res->conditionalDistData;
+    res->conditionalDistData = nullptr;
+}
+
+HDRData* HDRLoader::load(const char *fileName, const HDRLoadOptions &options)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    MappedFile file;
+    if (!file.Open(fileName))
+        return nullptr;
+
+    const unsigned char *ptr = file.Data();
+    const unsigned char *end = ptr + file.Size();
+
+    if (file.Size() < 10 || (memcmp(ptr, "#?RADIANCE", 10) && memcmp(ptr, "#?RGBE", 6)))
+        return nullptr;
+
+    // Header lines end with an empty line, the resolution line follows
+    while (true) {
+        const unsigned char *eol = (const unsigned char *)memchr(ptr, 0xa, end - ptr);
+        if (!eol)
+            return nullptr;
+        bool empty = eol == ptr;
+        ptr = eol + 1;
+        if (empty)
             break;
     }
 
+    char reso[200];
+    int i = 0;
+    while (ptr < end && *ptr != 0xa && i < sizeof(reso) - 1)
+        reso[i++] = *ptr++;
+    reso[i] = 0;
+    ptr++;
+
     int w, h;
-    if (!sscanf(reso, "-Y %d +X %d", &h, &w)) {
-        fclose(file);
+    if (sscanf(reso, "-Y %d +X %d", &h, &w) != 2 || w <= 0 || h <= 0 || ptr > end)
         return nullptr;
-    }
 
+    HDRData *res = new HDRData;
     res->width = w;
     res->height = h;
+    res->cols = new float[(size_t)w * h * 3];
+
+    // Scanlines in the run length encoding state their size, so one pass over the
+    // run headers finds where each of them starts and they can be decoded in parallel
+    std::vector<const unsigned char*> rows(h);
+    int numRLERows = 0;
+    for (const unsigned char *row = ptr; numRLERows < h; numRLERows++) {
+        rows[numRLERows] = row;
+        row = skipScanline(row, end, w);
+        if (!row)
+            break;
+    }
 
-    float *cols = new float[w * h * 3];
-    res->cols = cols;
+    if (numRLERows == h) {
+        #pragma omp parallel
+        {
+            std::vector<RGBE> scanline(w);
 
-    RGBE *scanline = new RGBE[w];
-    if (!scanline) {
-        fclose(file);
-        return nullptr;
+            #pragma omp for schedule(static)
+            for (int y = 0; y < h; y++) {
+                decrunch(scanline.data(), w, rows[y]);
+                workOnRGBE(scanline.data(), w, res->cols + (size_t)y * w * 3);
+            }
+        }
     }
+    else {
+        // Flat or old style run length encoded files, where runs may continue
+        // from the previous scanline, are decoded in order
+        std::vector<RGBE> scanline(w);
+        RGBE prev = { 0, 0, 0, 0 };
+        int y = 0;
+        for (; y < h; y++) {
+            const unsigned char *next = skipScanline(ptr, end, w);
+            if (next) {
+                decrunch(scanline.data(), w, ptr);
+                ptr = next;
+            }
+            else if (!oldDecrunch(scanline.data(), w, ptr, end, prev))
+                break;
 
-    // convert image 
-    for (int y = h - 1; y >= 0; y--) {
-        if (decrunch(scanline, w, file) == false)
-            break;
-        workOnRGBE(scanline, w, cols);
-        cols += w * 3;
+            memcpy(prev, scanline[w - 1], 4);
+            workOnRGBE(scanline.data(), w, res->cols + (size_t)y * w * 3);
+        }
+
+        // Truncated files keep what was decoded
+        if (y < h)
+            memset(res->cols + (size_t)y * w * 3, 0, (size_t)(h - y) * w * 3 * sizeof(float));
     }
 
-    delete [] scanline;
-    fclose(file);
+    auto decoded = std::chrono::high_resolution_clock::now();
+
+    res->format = options.format;
+    if (res->format != HDRFormatRGB32F)
+        quantize(res);
+
+    auto quantized = std::chrono::high_resolution_clock::now();
+
+    if (options.pyramidSize > 0)
+        buildLuminancePyramid(res, options.pyramidSize);
+    else if (options.aliasTable)
+        buildAliasTable(res);
+    else if (options.halfDistribution && w <= 0xffff)
+        buildHalfDistribution(res);
+    else
+        buildDistributions(res);
+
+    auto built = std::chrono::high_resolution_clock::now();
+    printf("HDR %s: %dx%d decoded in %.1f ms, quantized in %.1f ms, %s built in %.1f ms\n", fileName, w, h,
+        std::chrono::duration<double, std::milli>(decoded - start).count(),
+        std::chrono::duration<double, std::milli>(quantized - decoded).count(), options.pyramidSize > 0 ? "luminance pyramid" : options.aliasTable ? "alias table" : "distributions",
+        std::chrono::duration<double, std::milli>(built - quantized).count());
+
+    printf("HDR %s: %.1f MB of radiance and %.1f MB of sampling data on the GPU\n", fileName,
+        res->RadianceBytes() / (1024.0 * 1024.0), res->SamplingBytes() / (1024.0 * 1024.0));
 
-    buildDistributions(res);
     return res;
 }
 
-float convertComponent(int expo, int val)
+// A mantissa of 1 scaled by each exponent. Mantissas are in 1/256 steps and exponents
+// are biased by 128, so a component is mantissa * 2^(exponent - 136). Products are exact
+struct ExponentTable
 {
-    float v = val / 256.0f;
-    float d = (float) pow(2, expo);
-    return v * d;
-}
+    float scale[256];
 
-void workOnRGBE(RGBE *scan, int len, float *cols)
+    ExponentTable()
+    {
+        for (int i = 0; i < 256; i++)
+            scale[i] = ldexpf(1.0f, i - 136);
+    }
+};
+
+void workOnRGBE(const RGBE *scan, int len, float *cols)
 {
-    while (len-- > 0) {
-        int expo = scan[0][E] - 128;
-        cols[0] = convertComponent(expo, scan[0][R]);
-        cols[1] = convertComponent(expo, scan[0][G]);
-        cols[2] = convertComponent(expo, scan[0][B]);
+    static const ExponentTable exponents;
+
+    for (int i = 0; i < len; i++) {
+        float scale = exponents.scale[scan[i][E]];
+        cols[0] = scan[i][R] * scale;
+        cols[1] = scan[i][G] * scale;
+        cols[2] = scan[i][B] * scale;
         cols += 3;
-        scan++;
     }
 }
 
-bool decrunch(RGBE *scanline, int len, FILE *file)
+// Returns the end of a run length encoded scanline of len pixels starting at ptr,
+// or nullptr if it isn't one or runs past the end of the file
+const unsigned char* skipScanline(const unsigned char *ptr, const unsigned char *end, int len)
 {
-    int  i, j;
-                    
-    if (len < MINELEN || len > MAXELEN)
-        return oldDecrunch(scanline, len, file);
-
-    i = fgetc(file);
-    if (i != 2) {
-        fseek(file, -1, SEEK_CUR);
-        return oldDecrunch(scanline, len, file);
-    }
+    if (len < MINELEN || len > MAXELEN || end - ptr < 4)
+        return nullptr;
+
+    if (ptr[0] != 2 || ptr[1] != 2 || (ptr[2] & 128) || ((ptr[2] << 8) | ptr[3]) != len)
+        return nullptr;
+
+    ptr += 4;
+
+    // Each component is encoded separately
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < len; ) {
+            if (ptr >= end)
+                return nullptr;
 
-    scanline[0][G] = fgetc(file);
-    scanline[0][B] = fgetc(file);
-    i = fgetc(file);
+            int code = *ptr++;
+            if (code > 128) { // run
+                code &= 127;
+                ptr++;
+            }
+            else              // non-run
+                ptr += code;
 
-    if (scanline[0][G] != 2 || scanline[0][B] & 128) {
-        scanline[0][R] = 2;
-        scanline[0][E] = i;
-        return oldDecrunch(scanline + 1, len - 1, file);
+            j += code;
+            if (code == 0 || j > len || ptr > end)
+                return nullptr;
+        }
     }
 
-    // read each component
-    for (i = 0; i < 4; i++) {
-        for (j = 0; j < len; ) {
-            unsigned char code = fgetc(file);
+    return ptr;
+}
+
+// Decodes a scanline that skipScanline accepted
+void decrunch(RGBE *scanline, int len, const unsigned char *ptr)
+{
+    ptr += 4;
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < len; ) {
+            int code = *ptr++;
             if (code > 128) { // run
                 code &= 127;
-                unsigned char val = fgetc(file);
+                unsigned char val = *ptr++;
                 while (code--)
                     scanline[j++][i] = val;
             }
-            else  {    // non-run
-                while(code--)
-                    scanline[j++][i] = fgetc(file);
+            else {            // non-run
+                while (code--)
+                    scanline[j++][i] = *ptr++;
             }
         }
     }
-
-    return feof(file) ? false : true;
 }
 
-bool oldDecrunch(RGBE *scanline, int len, FILE *file)
+// Flat pixels where (1, 1, 1, n) repeats the previous pixel n times. Consecutive
+// repeat pixels add the next 8 bits of the count
+bool oldDecrunch(RGBE *scanline, int len, const unsigned char *&ptr, const unsigned char *end, RGBE &prev)
 {
-    int i;
     int rshift = 0;
-    
+    RGBE *pixel = scanline;
+
     while (len > 0) {
-        scanline[0][R] = fgetc(file);
-        scanline[0][G] = fgetc(file);
-        scanline[0][B] = fgetc(file);
-        scanline[0][E] = fgetc(file);
-        if (feof(file))
+        if (end - ptr < 4)
             return false;
 
-        if (scanline[0][R] == 1 &&
-            scanline[0][G] == 1 &&
-            scanline[0][B] == 1) {
-            for (i = scanline[0][E] << rshift; i > 0; i--) {
-                memcpy(&scanline[0][0], &scanline[-1][0], 4);
-                scanline++;
+        if (ptr[R] == 1 && ptr[G] == 1 && ptr[B] == 1) {
+            int count = rshift < 24 ? ptr[E] << rshift : len;
+            for (int i = count; i > 0 && len > 0; i--) {
+                memcpy(pixel, pixel == scanline ? prev : pixel[-1], 4);
+                pixel++;
                 len--;
             }
             rshift += 8;
         }
         else {
-            scanline++;
+            memcpy(pixel, ptr, 4);
+            pixel++;
             len--;
             rshift = 0;
         }
+        ptr += 4;
     }
     return true;
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <iostream>
 #include <Vec2.h>
 #include <Vec3.h>
@@ -16,20 +17,68 @@
 
 using namespace GLSLPT;
 
+// How the radiance is stored on the GPU. Decoded values are rounded to it, so
+// the sampling distributions are built from exactly what the shader reads
+enum HDRFormat {
+    HDRFormatRGB32F,
+    HDRFormatRGB16F,
+    HDRFormatRGB9E5
+};
+
+struct HDRLoadOptions {
+    HDRLoadOptions() : format(HDRFormatRGB32F), aliasTable(false), halfDistribution(false), pyramidSize(0) {}
+    HDRFormat format;
+    bool aliasTable;       // Alias table instead of the marginal and conditional distributions
+    bool halfDistribution; // 16 bit conditional distribution
+    int pyramidSize;       // Luminance pyramid at most this wide instead of the distributions, 0 for none
+};
+
+// Pixel i is kept with probability threshold, otherwise pixel alias is taken
+struct HDRAliasEntry {
+    float threshold;
+    int alias;
+};
+
+// Column index and the pdf times the width as a half float
+struct HDRHalfDistEntry {
+    uint16_t column;
+    uint16_t pdf;
+};
+
 class HDRData {
 public:
-    HDRData() : width(0), height(0), cols(nullptr), marginalDistData(nullptr), conditionalDistData(nullptr) {}
-    ~HDRData() { delete cols; delete marginalDistData; delete conditionalDistData; }
+    HDRData() : width(0), height(0), format(HDRFormatRGB32F), cols(nullptr), marginalDistData(nullptr), conditionalDistData(nullptr), halfConditionalDistData(nullptr), aliasTable(nullptr), luminanceSum(0),
+        luminancePyramid(nullptr), pyramidWidth(0), pyramidHeight(0), pyramidLevels(0) {}
+    ~HDRData() { delete[] cols; delete[] marginalDistData; delete[] conditionalDistData; delete[] halfConditionalDistData; delete[] aliasTable; delete[] luminancePyramid; }
     int width, height;
+    HDRFormat format;
     // each pixel takes 3 float32, each component can be of any value...
     float *cols;
     Vec2 *marginalDistData;    // y component holds the pdf
     Vec2 *conditionalDistData; // y component holds the pdf
+    // Replaces conditionalDistData with the half distribution option
+    HDRHalfDistEntry *halfConditionalDistData;
+    // Built instead of the distributions above when alias sampling is used
+    HDRAliasEntry *aliasTable;
+    float luminanceSum;
+    // Built instead for hierarchical sampling. Level 0 is pyramidWidth x pyramidHeight cells
+    // covering the map, each holding the mean luminance of the pixels it touches. Each level
+    // after it sums the cells below it down to 1x1, levels are stored one after another
+    float *luminancePyramid;
+    int pyramidWidth, pyramidHeight, pyramidLevels;
+    size_t PyramidSize() const;
+    // Bytes of the radiance and of whichever sampling data was built
+    size_t RadianceBytes() const;
+    size_t SamplingBytes() const;
 };
 
 class HDRLoader {
 private:
+    static void quantize(HDRData* res);
     static void buildDistributions(HDRData* res);
+    static void buildHalfDistribution(HDRData* res);
+    static void buildAliasTable(HDRData* res);
+    static void buildLuminancePyramid(HDRData* res, int maxSize);
 public:
-    static HDRData* load(const char *fileName);
+    static HDRData* load(const char *fileName, const HDRLoadOptions &options = HDRLoadOptions());
 };
\ No newline at end of file
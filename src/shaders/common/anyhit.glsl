@@ -64,55 +64,140 @@ bool AnyHit(Ray r, float maxDist)
     }
 #endif
 
-    // Intersect BVH and tris
-    int stack[64];
+#ifdef WIDE_BVH
+    // Intersect wide BVH and tris. BVH_STACK_SIZE is BvhTranslator::wideStackSize, the most
+    // this traversal pushes, so the size checks below are only a guard against overflow
+    uint stackChild[BVH_STACK_SIZE];
     int ptr = 0;
-    stack[ptr++] = -1;
 
-    int idx = topBVHIndex;
-    float leftHit = 0.0;
-    float rightHit = 0.0;
+    uint hitChild[BVH_WIDTH];
+    float hitDist[BVH_WIDTH];
 
-    int currMatID = 0;
-    bool meshBVH = false;
+    uint child = texelFetch(BVH, topBVHIndex).x;
 
     Ray r_trans;
     mat4 temp_transform;
     r_trans.origin = r.origin;
     r_trans.direction = r.direction;
+    vec3 invDir = WideInverseDirection(r.direction);
 
-    while (idx > -1 || meshBVH)
+    while (true)
     {
-        int n = idx;
+        uint type = child >> 30u;
+        int offset = int(child & 0x3FFFFFFFu);
+
+        if (type == WIDE_INNER)
+        {
+            int numHits = WideNodeIntersect(offset, r_trans.origin, invDir, maxDist, hitChild, hitDist);
+            if (numHits > 0)
+            {
+                for (int i = numHits - 1; i > 0; i--)
+                {
+                    if (ptr < BVH_STACK_SIZE)
+                        stackChild[ptr++] = hitChild[i];
+                }
+                child = hitChild[0];
+                continue;
+            }
+        }
+        else if (type == WIDE_TRIANGLES) // Leaf of BLAS
+        {
+            int first = offset >> 4;
+            int count = offset & 15;
+            for (int i = 0; i < count; i++) // Loop through tris
+            {
+                int index = first + i;
+                ivec3 vert_indices = ivec3(texelFetch(vertexIndicesTex, index).xyz);
 
-        if (meshBVH && idx < 0)
+                vec4 v0 = FetchVertex(vert_indices.x);
+                vec4 v1 = FetchVertex(vert_indices.y);
+                vec4 v2 = FetchVertex(vert_indices.z);
+
+                vec3 e0 = v1.xyz - v0.xyz;
+                vec3 e1 = v2.xyz - v0.xyz;
+                vec3 pv = cross(r_trans.direction, e1);
+                float det = dot(e0, pv);
+
+                vec3 tv = r_trans.origin - v0.xyz;
+                vec3 qv = cross(tv, e0);
+
+                vec4 uvt;
+                uvt.x = dot(tv, pv);
+                uvt.y = dot(r_trans.direction, qv);
+                uvt.z = dot(e1, qv);
+                uvt.xyz = uvt.xyz / det;
+                uvt.w = 1.0 - uvt.x - uvt.y;
+
+                if (all(greaterThanEqual(uvt, vec4(0.0))) && uvt.z < maxDist)
+                    return true;
+            }
+        }
+        else if (ptr < BVH_STACK_SIZE) // Leaf of TLAS
         {
-            meshBVH = false;
+            uvec4 instance = texelFetch(BVH, offset);
+            int instanceIndex = int(instance.w);
+
+            vec4 r1 = texelFetch(transformsTex, ivec2(instanceIndex * 4 + 0, 0), 0).xyzw;
+            vec4 r2 = texelFetch(transformsTex, ivec2(instanceIndex * 4 + 1, 0), 0).xyzw;
+            vec4 r3 = texelFetch(transformsTex, ivec2(instanceIndex * 4 + 2, 0), 0).xyzw;
+            vec4 r4 = texelFetch(transformsTex, ivec2(instanceIndex * 4 + 3, 0), 0).xyzw;
+
+            temp_transform = mat4(r1, r2, r3, r4);
 
-            idx = stack[--ptr];
+            r_trans.origin = vec3(inverse(temp_transform) * vec4(r.origin, 1.0));
+            r_trans.direction = vec3(inverse(temp_transform) * vec4(r.direction, 0.0));
+            invDir = WideInverseDirection(r_trans.direction);
 
-            r_trans.origin = r.origin;
-            r_trans.direction = r.direction;
+            stackChild[ptr++] = BVH_INSTANCE_END;
+            child = instance.x;
             continue;
         }
 
-        int index = n;
-        ivec3 LRLeaf = ivec3(texelFetch(BVH, index * 3 + 2).xyz);
+        bool found = false;
+        while (ptr > 0 && !found)
+        {
+            child = stackChild[--ptr];
+            if (child == BVH_INSTANCE_END)
+            {
+                r_trans.origin = r.origin;
+                r_trans.direction = r.direction;
+                invDir = WideInverseDirection(r.direction);
+            }
+            else
+                found = true;
+        }
+
+        if (!found)
+            break;
+    }
+#else
+    // Intersect BVH and tris
+    uvec2 stack[64];
+    int ptr = 0;
 
-        int leftIndex = int(LRLeaf.x);
-        int rightIndex = int(LRLeaf.y);
-        int leaf = int(LRLeaf.z);
+    // Entry of the node to visit, see BvhTranslator for the layout
+    uvec2 node = texelFetch(BVH, topBVHIndex).xy;
 
-        if (leaf > 0) // Leaf node of BLAS
+    Ray r_trans;
+    mat4 temp_transform;
+    r_trans.origin = r.origin;
+    r_trans.direction = r.direction;
+
+    while (true)
+    {
+        int count = int(node.y);
+
+        if (count > 0) // Leaf of BLAS
         {
-            for (int i = 0; i < rightIndex; i++) // Loop through tris
+            int first = int(node.x);
+            for (int i = 0; i < count; i++) // Loop through tris
             {
-                int index = leftIndex + i;
+                int index = first + i;
                 ivec3 vert_indices = ivec3(texelFetch(vertexIndicesTex, index).xyz);
 
-                vec4 v0 = texelFetch(verticesTex, vert_indices.x);
-                vec4 v1 = texelFetch(verticesTex, vert_indices.y);
-                vec4 v2 = texelFetch(verticesTex, vert_indices.z);
+                vec4 v0 = FetchVertex(vert_indices.x);
+                vec4 v1 = FetchVertex(vert_indices.y);
+                vec4 v2 = FetchVertex(vert_indices.z);
 
                 vec3 e0 = v1.xyz - v0.xyz;
                 vec3 e1 = v2.xyz - v0.xyz;
@@ -133,60 +218,83 @@ bool AnyHit(Ray r, float maxDist)
                     return true;
             }
         }
-        else if (leaf < 0) // Leaf node of TLAS
+        else if (count < 0) // Leaf of TLAS
         {
-            idx = leftIndex;
+            uvec4 instance = texelFetch(BVH, int(node.x));
+            int instanceIndex = int(instance.w);
 
-            vec4 r1 = texelFetch(transformsTex, ivec2((-leaf - 1) * 4 + 0, 0), 0).xyzw;
-            vec4 r2 = texelFetch(transformsTex, ivec2((-leaf - 1) * 4 + 1, 0), 0).xyzw;
-            vec4 r3 = texelFetch(transformsTex, ivec2((-leaf - 1) * 4 + 2, 0), 0).xyzw;
-            vec4 r4 = texelFetch(transformsTex, ivec2((-leaf - 1) * 4 + 3, 0), 0).xyzw;
+            vec4 r1 = texelFetch(transformsTex, ivec2(instanceIndex * 4 + 0, 0), 0).xyzw;
+            vec4 r2 = texelFetch(transformsTex, ivec2(instanceIndex * 4 + 1, 0), 0).xyzw;
+            vec4 r3 = texelFetch(transformsTex, ivec2(instanceIndex * 4 + 2, 0), 0).xyzw;
+            vec4 r4 = texelFetch(transformsTex, ivec2(instanceIndex * 4 + 3, 0), 0).xyzw;
 
             temp_transform = mat4(r1, r2, r3, r4);
 
             r_trans.origin = vec3(inverse(temp_transform) * vec4(r.origin, 1.0));
             r_trans.direction = vec3(inverse(temp_transform) * vec4(r.direction, 0.0));
 
-            stack[ptr++] = -1;
-            meshBVH = true;
-            currMatID = rightIndex;
+            stack[ptr++] = uvec2(BVH_INSTANCE_END);
+            node = instance.xy;
             continue;
         }
         else
         {
-            leftHit =  AABBIntersect(texelFetch(BVH, leftIndex  * 3 + 0).xyz, texelFetch(BVH, leftIndex  * 3 + 1).xyz, r_trans);
-            rightHit = AABBIntersect(texelFetch(BVH, rightIndex * 3 + 0).xyz, texelFetch(BVH, rightIndex * 3 + 1).xyz, r_trans);
+            // Both children with their boxes, two texels each
+            int index = int(node.x);
+            uvec4 leftMin  = texelFetch(BVH, index + 0);
+            uvec4 leftMax  = texelFetch(BVH, index + 1);
+            uvec4 rightMin = texelFetch(BVH, index + 2);
+            uvec4 rightMax = texelFetch(BVH, index + 3);
+
+            float leftHit  = AABBIntersect(uintBitsToFloat(leftMin.xyz),  uintBitsToFloat(leftMax.xyz),  r_trans);
+            float rightHit = AABBIntersect(uintBitsToFloat(rightMin.xyz), uintBitsToFloat(rightMax.xyz), r_trans);
+
+            uvec2 left  = uvec2(leftMin.w,  leftMax.w);
+            uvec2 right = uvec2(rightMin.w, rightMax.w);
 
             if (leftHit > 0.0 && rightHit > 0.0)
             {
-                int deferred = -1;
                 if (leftHit > rightHit)
                 {
-                    idx = rightIndex;
-                    deferred = leftIndex;
+                    node = right;
+                    stack[ptr++] = left;
                 }
                 else
                 {
-                    idx = leftIndex;
-                    deferred = rightIndex;
+                    node = left;
+                    stack[ptr++] = right;
                 }
-
-                stack[ptr++] = deferred;
                 continue;
             }
             else if (leftHit > 0.)
             {
-                idx = leftIndex;
+                node = left;
                 continue;
             }
             else if (rightHit > 0.)
             {
-                idx = rightIndex;
+                node = right;
                 continue;
             }
         }
-        idx = stack[--ptr];
+
+        bool found = false;
+        while (ptr > 0 && !found)
+        {
+            node = stack[--ptr];
+            if (node.x == BVH_INSTANCE_END)
+            {
+                r_trans.origin = r.origin;
+                r_trans.direction = r.direction;
+            }
+            else
+                found = true;
+        }
+
+        if (!found)
+            break;
     }
+#endif
 
     return false;
 }
\ No newline at end of file
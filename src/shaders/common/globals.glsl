@@ -39,6 +39,12 @@ mat4 transform;
 vec2 seed;
 vec3 tempTexCoords;
 
+#ifdef VIRTUAL_TEXTURES
+// Missing page reported back to the renderer, see RequestPage
+uint vtRequest = 0u;
+float vtNumRequests = 0.0;
+#endif
+
 struct Ray
 {
     vec3 origin;
@@ -107,6 +113,8 @@ struct State
     bool specularBounce;
 
     vec2 texCoord;
+    float coneWidth;
+    float texLod;
     vec3 bary;
     ivec3 triID;
     int matID;
@@ -139,4 +147,54 @@ float rand()
 vec3 FaceForward(vec3 a, vec3 b)
 {
     return dot(a, b) < 0.0 ? -b : b;
-}
\ No newline at end of file
+}
+#if defined(QUANTIZED_VERTICES) || defined(ENVMAP_HALF_DIST)
+// unpackHalf2x16 needs GLSL 4.20
+float HalfToFloat(uint h)
+{
+    uint sign = (h & 0x8000u) << 16;
+    uint exponent = (h >> 10) & 0x1Fu;
+    uint mantissa = h & 0x3FFu;
+
+    if (exponent == 0u)
+        return (sign != 0u ? -1.0 : 1.0) * float(mantissa) * (1.0 / 16777216.0);
+    if (exponent == 31u)
+        return uintBitsToFloat(sign | 0x7F800000u | (mantissa << 13));
+    return uintBitsToFloat(sign | ((exponent + 112u) << 23) | (mantissa << 13));
+}
+#endif
+
+#ifdef QUANTIZED_VERTICES
+vec3 OctDecode(uvec2 e)
+{
+    vec2 f = vec2(e) * (2.0 / 65535.0) - 1.0;
+    vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+#endif
+
+// Position + x coord of uv. Quantized positions stay in grid units, the
+// instance transform takes them back to world space
+vec4 FetchVertex(int index)
+{
+#ifdef QUANTIZED_VERTICES
+    uvec4 q = texelFetch(verticesTex, index);
+    return vec4(vec3(q.xyz), HalfToFloat(q.w));
+#else
+    return texelFetch(verticesTex, index);
+#endif
+}
+
+// Normal + y coord of uv
+vec4 FetchNormal(int index)
+{
+#ifdef QUANTIZED_VERTICES
+    uvec4 q = texelFetch(normalsTex, index);
+    return vec4(OctDecode(q.xy), HalfToFloat(q.z));
+#else
+    return texelFetch(normalsTex, index);
+#endif
+}
@@ -84,4 +84,85 @@ float AABBIntersect(vec3 minCorner, vec3 maxCorner, Ray r)
     float t0 = max(tmin.x, max(tmin.y, tmin.z));
 
     return (t1 >= t0) ? (t0 > 0.f ? t0 : t1) : -1.0;
-}
\ No newline at end of file
+}
+
+// Pushed when entering an instance, popping it restores the world space ray
+#define BVH_INSTANCE_END 0xFFFFFFFFu
+
+#ifdef WIDE_BVH
+
+// Types in the top 2 bits of a child word, see BvhTranslator::WideChildType
+#define WIDE_INNER     0u
+#define WIDE_TRIANGLES 1u
+#define WIDE_INSTANCE  2u
+
+//----------------------------------------------------------------
+vec3 WideInverseDirection(vec3 dir)
+//----------------------------------------------------------------
+{
+    // Infinity times the zero offset of a child at the node origin would give NaN
+    return 1.0 / mix(dir, vec3(1e-20), equal(dir, vec3(0.0)));
+}
+
+//----------------------------------------------------------------
+int WideNodeIntersect(int node, vec3 origin, vec3 invDir, float tMax, inout uint hitChild[BVH_WIDTH], inout float hitDist[BVH_WIDTH])
+//----------------------------------------------------------------
+{
+    // Child boxes are origin + q * step with q in 0..255, so their slabs are
+    // tOrigin + q * tStep in ray distances
+    uvec4 header = texelFetch(BVH, node);
+    vec3 step = uintBitsToFloat((uvec3(header.w, header.w >> 8u, header.w >> 16u) & 0xFFu) << 23u);
+    vec3 tOrigin = (uintBitsToFloat(header.xyz) - origin) * invDir;
+    vec3 tStep = step * invDir;
+    int numChildren = int(header.w >> 24u);
+
+    uvec4 b0 = texelFetch(BVH, node + 1 + BVH_WIDTH / 4);
+    uvec4 b1 = texelFetch(BVH, node + 2 + BVH_WIDTH / 4);
+#if BVH_WIDTH == 8
+    uvec4 b2 = texelFetch(BVH, node + 3 + BVH_WIDTH / 4);
+#endif
+
+    // Hits sorted nearest first
+    int numHits = 0;
+    for (int g = 0; g < BVH_WIDTH / 4; g++)
+    {
+        uvec4 children = texelFetch(BVH, node + 1 + g);
+        uvec3 qlo = b0.xyz;
+        uvec3 qhi = uvec3(b0.w, b1.xy);
+#if BVH_WIDTH == 8
+        if (g == 1)
+        {
+            qlo = uvec3(b1.zw, b2.x);
+            qhi = b2.yzw;
+        }
+#endif
+
+        for (int i = 0; i < 4 && g * 4 + i < numChildren; i++)
+        {
+            uint shift = uint(i * 8);
+            vec3 tlo = tOrigin + vec3((qlo >> shift) & 0xFFu) * tStep;
+            vec3 thi = tOrigin + vec3((qhi >> shift) & 0xFFu) * tStep;
+
+            vec3 tnear = min(tlo, thi);
+            vec3 tfar = max(tlo, thi);
+            float t0 = max(max(tnear.x, tnear.y), max(tnear.z, 0.0));
+            float t1 = min(min(tfar.x, tfar.y), min(tfar.z, tMax));
+
+            if (t0 <= t1)
+            {
+                int j = numHits++;
+                for (; j > 0 && hitDist[j - 1] > t0; j--)
+                {
+                    hitDist[j] = hitDist[j - 1];
+                    hitChild[j] = hitChild[j - 1];
+                }
+                hitDist[j] = t0;
+                hitChild[j] = children[i];
+            }
+        }
+    }
+
+    return numHits;
+}
+
+#endif
\ No newline at end of file
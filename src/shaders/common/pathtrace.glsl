@@ -35,9 +35,9 @@ void Onb(in vec3 N, inout vec3 T, inout vec3 B)
 void GetNormalsAndTexCoord(inout State state, inout Ray r)
 //-----------------------------------------------------------------------
 {
-    vec4 n1 = texelFetch(normalsTex, state.triID.x);
-    vec4 n2 = texelFetch(normalsTex, state.triID.y);
-    vec4 n3 = texelFetch(normalsTex, state.triID.z);
+    vec4 n1 = FetchNormal(state.triID.x);
+    vec4 n2 = FetchNormal(state.triID.y);
+    vec4 n3 = FetchNormal(state.triID.z);
 
     vec2 t1 = vec2(tempTexCoords.x, n1.w);
     vec2 t2 = vec2(tempTexCoords.y, n2.w);
@@ -45,6 +45,17 @@ void GetNormalsAndTexCoord(inout State state, inout Ray r)
 
     state.texCoord = t1 * state.bary.x + t2 * state.bary.y + t3 * state.bary.z;
 
+    // Ray cone footprint in texels per unit of uv, from the ratio of uv to world area
+    // of the triangle. TextureLookup adds the log2 size of the texture that is sampled
+    vec3 p1 = vec3(transform * vec4(FetchVertex(state.triID.x).xyz, 1.0));
+    vec3 p2 = vec3(transform * vec4(FetchVertex(state.triID.y).xyz, 1.0));
+    vec3 p3 = vec3(transform * vec4(FetchVertex(state.triID.z).xyz, 1.0));
+    vec3 faceNormal = cross(p2 - p1, p3 - p1);
+    float worldArea = length(faceNormal);
+    float uvArea = abs((t2.x - t1.x) * (t3.y - t1.y) - (t3.x - t1.x) * (t2.y - t1.y));
+    float cosTheta = abs(dot(faceNormal, r.direction)) / max(worldArea, 1e-12);
+    state.texLod = 0.5 * log2(max(uvArea, 1e-12) / max(worldArea, 1e-12)) + log2(max(state.coneWidth, 1e-12)) - 0.5 * log2(max(cosTheta, 1e-6));
+
     vec3 normal = normalize(n1.xyz * state.bary.x + n2.xyz * state.bary.y + n3.xyz * state.bary.z);
 
     mat3 normalMatrix = transpose(inverse(mat3(transform)));
@@ -55,6 +66,137 @@ void GetNormalsAndTexCoord(inout State state, inout Ray r)
     Onb(state.ffnormal, state.tangent, state.bitangent);
 }
 
+//-----------------------------------------------------------------------
+vec4 FetchRect(int entry)
+//-----------------------------------------------------------------------
+{
+    // Rows of the lookup table are 4096 entries wide, see Renderer::Init
+    return texelFetch(textureRectsTex, ivec2(entry & 4095, entry >> 12), 0);
+}
+
+//-----------------------------------------------------------------------
+vec4 SampleTextureArray(vec4 page, vec3 coord)
+//-----------------------------------------------------------------------
+{
+    vec4 texel;
+    if (page.y == 0.0)
+        texel = texture(textureArray0, coord);
+    else if (page.y == 1.0)
+        texel = texture(textureArray1, coord);
+    else if (page.y == 2.0)
+        texel = texture(textureArray2, coord);
+    else
+        texel = texture(textureArray3, coord);
+
+    // Grayscale textures only store red
+    if (page.z == 1.0)
+        texel.xyz = texel.xxx;
+
+    // Normal maps only store x and y
+    if (page.z == 2.0)
+    {
+        vec2 xy = texel.xy * 2.0 - 1.0;
+        texel.z = sqrt(clamp(1.0 - dot(xy, xy), 0.0, 1.0)) * 0.5 + 0.5;
+    }
+
+    // sRGB textures without a hardware sRGB format
+    if (page.w != 0.0)
+        texel.xyz = pow(texel.xyz, vec3(2.2));
+
+    return texel;
+}
+
+#ifdef VIRTUAL_TEXTURES
+
+//-----------------------------------------------------------------------
+void RequestPage(int page)
+//-----------------------------------------------------------------------
+{
+    // A pixel reports one page, reservoir sampling gives every miss
+    // along its path the same chance of being the one
+    vtNumRequests += 1.0;
+    if (rand() * vtNumRequests < 1.0)
+        vtRequest = uint(page + 1);
+}
+
+//-----------------------------------------------------------------------
+vec4 SampleTextureLevel(int entry, int lastEntry, vec2 uv)
+//-----------------------------------------------------------------------
+{
+    // A page that isn't resident is requested and the next coarser level that
+    // is takes its place. The last level is pinned so the walk ends there
+    bool requested = false;
+    while (true)
+    {
+        vec4 level = FetchRect(entry + 0);
+        vec4 page = FetchRect(entry + 1);
+
+        int content = VT_PAGE_SIZE - 2 * VT_PAGE_BORDER;
+        int pagesX = int(level.y);
+        int pagesY = (int(level.w) + content - 1) / content;
+        vec2 texel = fract(uv) * level.zw;
+        ivec2 pageXY = min(ivec2(texel / float(content)), ivec2(pagesX - 1, pagesY - 1));
+
+        int pageID = int(level.x) + pageXY.y * pagesX + pageXY.x;
+        vec4 slots = FetchRect(pageTableOffset + pageID / 4);
+        float slot = slots[pageID % 4];
+
+        if (slot < 0.0 && !requested)
+        {
+            RequestPage(pageID);
+            requested = true;
+        }
+
+        if (slot >= 0.0)
+        {
+            // Pages carry a border wrapped in from their neighbours so filtering stays inside them
+            vec2 coord = (texel - vec2(pageXY * content) + float(VT_PAGE_BORDER)) / float(VT_PAGE_SIZE);
+            return SampleTextureArray(page, vec3(coord, slot));
+        }
+
+        if (entry >= lastEntry)
+            return vec4(1.0);
+
+        entry += 2;
+    }
+}
+
+#else
+
+//-----------------------------------------------------------------------
+vec4 SampleTextureLevel(int entry, int lastEntry, vec2 uv)
+//-----------------------------------------------------------------------
+{
+    // Levels live in atlas pages with a wrapped border, so repeating
+    // the uv within the level's rect filters like GL_REPEAT would
+    vec4 rect = FetchRect(entry + 0);
+    vec4 page = FetchRect(entry + 1);
+
+    return SampleTextureArray(page, vec3(rect.xy + fract(uv) * rect.zw, page.x));
+}
+
+#endif
+
+//-----------------------------------------------------------------------
+vec4 TextureLookup(int texID, vec2 uv, float texLod)
+//-----------------------------------------------------------------------
+{
+    vec4 header = FetchRect(texID);
+    int firstEntry = int(header.x);
+    float maxLevel = header.y - 1.0;
+    int lastEntry = firstEntry + int(maxLevel) * 2;
+
+    // Trilinear filtering between the two levels closest to the ray cone footprint
+    float lod = clamp(texLod + 0.5 * log2(header.z * header.w), 0.0, maxLevel);
+    float level = floor(lod);
+    vec4 texel = SampleTextureLevel(firstEntry + int(level) * 2, lastEntry, uv);
+
+    if (level < maxLevel && lod > level)
+        texel = mix(texel, SampleTextureLevel(firstEntry + int(level) * 2 + 2, lastEntry, uv), lod - level);
+
+    return texel;
+}
+
 //-----------------------------------------------------------------------
 void GetMaterialsAndTextures(inout State state, in Ray r)
 //-----------------------------------------------------------------------
@@ -100,13 +242,13 @@ void GetMaterialsAndTextures(inout State state, in Ray r)
 
     // Albedo Map
     if (int(mat.texIDs.x) >= 0)
-        mat.albedo *= pow(texture(textureMapsArrayTex, vec3(texUV, int(mat.texIDs.x))).xyz, vec3(2.2));
+        mat.albedo *= TextureLookup(int(mat.texIDs.x), texUV, state.texLod).xyz;
 
     // Metallic Roughness Map
     if (int(mat.texIDs.y) >= 0)
     {
-        vec2 matRgh;
-        matRgh = pow(texture(textureMapsArrayTex, vec3(texUV, int(mat.texIDs.y))).zy, vec2(2.2));
+        // Metallic and roughness in red and green, stored with a 2.2 curve
+        vec2 matRgh = pow(TextureLookup(int(mat.texIDs.y), texUV, state.texLod).xy, vec2(2.2));
         mat.metallic = matRgh.x;
         mat.roughness = matRgh.y;
     }
@@ -114,7 +256,7 @@ void GetMaterialsAndTextures(inout State state, in Ray r)
     // Normal Map
     if (int(mat.texIDs.z) >= 0)
     {
-        vec3 nrm = texture(textureMapsArrayTex, vec3(texUV, int(mat.texIDs.z))).xyz;
+        vec3 nrm = TextureLookup(int(mat.texIDs.z), texUV, state.texLod).xyz;
         nrm = normalize(nrm * 2.0 - 1.0);
 
         // Orthonormal Basis
@@ -232,11 +374,17 @@ vec3 PathTrace(Ray r)
     BsdfSampleRec bsdfSampleRec;
     vec3 absorption = vec3(0.0);
     state.specularBounce = false;
-    
+
+    // Spread angle of a primary ray through one pixel. The cone widening at
+    // surfaces is ignored, it only grows with the distance travelled
+    float coneSpread = 2.0 * tan(camera.fov * 0.5) / screenResolution.y;
+    state.coneWidth = 0.0;
+
     for (int depth = 0; depth < maxDepth; depth++)
     {
         state.depth = depth;
         float t = ClosestHit(r, state, lightSampleRec);
+        state.coneWidth += coneSpread * t;
 
         if (t == INFINITY)
         {
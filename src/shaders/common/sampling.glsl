@@ -224,6 +224,202 @@ void sampleLight(in Light light, inout LightSampleRec lightSampleRec)
 #ifdef ENVMAP
 #ifndef CONSTANT_BG
 
+#if defined(ENVMAP_PYRAMID)
+
+//-----------------------------------------------------------------------
+float EnvCellPdf(ivec2 cell)
+//-----------------------------------------------------------------------
+{
+    // Samples are spread evenly inside a cell, so this is the density over uv
+    ivec2 size = textureSize(hdrPyramidTex, 0);
+    float total = texelFetch(hdrPyramidTex, ivec2(0), hdrPyramidLevels - 1).x;
+    return texelFetch(hdrPyramidTex, cell, 0).x / total * float(size.x * size.y);
+}
+
+//-----------------------------------------------------------------------
+float EnvPdf(in Ray r)
+//-----------------------------------------------------------------------
+{
+    float theta = acos(clamp(r.direction.y, -1.0, 1.0));
+    vec2 uv = vec2((PI + atan(r.direction.z, r.direction.x)) * (1.0 / TWO_PI), theta * (1.0 / PI));
+    ivec2 size = textureSize(hdrPyramidTex, 0);
+    ivec2 cell = min(ivec2(uv * vec2(size)), size - 1);
+    return EnvCellPdf(cell) / (2.0 * PI * PI * sin(theta));
+}
+
+//-----------------------------------------------------------------------
+vec4 EnvSample(inout vec3 color)
+//-----------------------------------------------------------------------
+{
+    // Walk down from the 1x1 level, picking a child in proportion to its luminance
+    // and rescaling the random numbers to reuse them on the next level
+    vec2 r = vec2(rand(), rand());
+    ivec2 cell = ivec2(0);
+
+    for (int level = hdrPyramidLevels - 2; level >= 0; level--)
+    {
+        ivec2 size = textureSize(hdrPyramidTex, level);
+        ivec2 parentSize = textureSize(hdrPyramidTex, level + 1);
+        bool splitX = size.x > parentSize.x;
+        bool splitY = size.y > parentSize.y;
+        cell *= ivec2(splitX ? 2 : 1, splitY ? 2 : 1);
+
+        if (splitX)
+        {
+            float left = texelFetch(hdrPyramidTex, cell, level).x;
+            float right = texelFetch(hdrPyramidTex, cell + ivec2(1, 0), level).x;
+            if (splitY)
+            {
+                left += texelFetch(hdrPyramidTex, cell + ivec2(0, 1), level).x;
+                right += texelFetch(hdrPyramidTex, cell + ivec2(1, 1), level).x;
+            }
+
+            float p = left / (left + right);
+            if (r.x < p)
+                r.x /= p;
+            else
+            {
+                r.x = (r.x - p) / (1.0 - p);
+                cell.x++;
+            }
+        }
+
+        if (splitY)
+        {
+            float top = texelFetch(hdrPyramidTex, cell, level).x;
+            float bottom = texelFetch(hdrPyramidTex, cell + ivec2(0, 1), level).x;
+
+            float p = top / (top + bottom);
+            if (r.y < p)
+                r.y /= p;
+            else
+            {
+                r.y = (r.y - p) / (1.0 - p);
+                cell.y++;
+            }
+        }
+    }
+
+    // What is left of the random numbers places the sample inside the cell
+    ivec2 size = textureSize(hdrPyramidTex, 0);
+    vec2 uv = (vec2(cell) + min(r, vec2(0.99999))) / vec2(size);
+    color = texture(hdrTex, uv).xyz * hdrMultiplier;
+    float pdf = EnvCellPdf(cell);
+
+    float phi = uv.x * TWO_PI;
+    float theta = uv.y * PI;
+
+    if (sin(theta) == 0.0)
+        pdf = 0.0;
+
+    return vec4(-sin(theta) * cos(phi), cos(theta), -sin(theta) * sin(phi), pdf / (2.0 * PI * PI * sin(theta)));
+}
+
+#elif defined(ENVMAP_ALIAS)
+
+//-----------------------------------------------------------------------
+float EnvPixelPdf(ivec2 pixel)
+//-----------------------------------------------------------------------
+{
+    // Same weights the alias table was built with
+    vec3 c = texelFetch(hdrTex, pixel, 0).xyz;
+    return dot(c, vec3(0.3, 0.6, 0.1)) / hdrLuminanceSum;
+}
+
+//-----------------------------------------------------------------------
+float EnvPdf(in Ray r)
+//-----------------------------------------------------------------------
+{
+    float theta = acos(clamp(r.direction.y, -1.0, 1.0));
+    vec2 uv = vec2((PI + atan(r.direction.z, r.direction.x)) * (1.0 / TWO_PI), theta * (1.0 / PI));
+    ivec2 size = textureSize(hdrTex, 0);
+    ivec2 pixel = min(ivec2(uv * vec2(size)), size - 1);
+    return (EnvPixelPdf(pixel) * hdrResolution) / (2.0 * PI * PI * sin(theta));
+}
+
+//-----------------------------------------------------------------------
+vec4 EnvSample(inout vec3 color)
+//-----------------------------------------------------------------------
+{
+    // Pick a pixel uniformly, then keep it or take its alias
+    ivec2 size = textureSize(hdrTex, 0);
+    vec2 r = vec2(rand(), rand()) * vec2(size);
+    ivec2 pixel = min(ivec2(r), size - 1);
+
+    uvec2 entry = texelFetch(hdrAliasTex, pixel, 0).xy;
+    if (rand() >= uintBitsToFloat(entry.x))
+        pixel = ivec2(int(entry.y) % size.x, int(entry.y) / size.x);
+
+    // The fraction left over from picking the first pixel places the sample inside the chosen one
+    vec2 uv = (vec2(pixel) + fract(r)) / vec2(size);
+    color = texture(hdrTex, uv).xyz * hdrMultiplier;
+    float pdf = EnvPixelPdf(pixel);
+
+    float phi = uv.x * TWO_PI;
+    float theta = uv.y * PI;
+
+    if (sin(theta) == 0.0)
+        pdf = 0.0;
+
+    return vec4(-sin(theta) * cos(phi), cos(theta), -sin(theta) * sin(phi), (pdf * hdrResolution) / (2.0 * PI * PI * sin(theta)));
+}
+
+#elif defined(ENVMAP_HALF_DIST)
+
+//-----------------------------------------------------------------------
+float EnvPixelPdf(ivec2 pixel)
+//-----------------------------------------------------------------------
+{
+    // The conditional pdf is stored times the width, so this is already the density over uv
+    float condPdf = HalfToFloat(texelFetch(hdrCondDistTex, pixel, 0).y);
+    return condPdf * texelFetch(hdrMarginalDistTex, ivec2(pixel.y, 0), 0).y * float(textureSize(hdrTex, 0).y);
+}
+
+//-----------------------------------------------------------------------
+float EnvPdf(in Ray r)
+//-----------------------------------------------------------------------
+{
+    float theta = acos(clamp(r.direction.y, -1.0, 1.0));
+    vec2 uv = vec2((PI + atan(r.direction.z, r.direction.x)) * (1.0 / TWO_PI), theta * (1.0 / PI));
+    ivec2 size = textureSize(hdrTex, 0);
+    ivec2 pixel = min(ivec2(uv * vec2(size)), size - 1);
+    return EnvPixelPdf(pixel) / (2.0 * PI * PI * sin(theta));
+}
+
+//-----------------------------------------------------------------------
+vec4 EnvSample(inout vec3 color)
+//-----------------------------------------------------------------------
+{
+    float r1 = rand();
+    float r2 = rand();
+
+    // Each random number picks an entry of an inverse CDF, which holds the row or the
+    // column of the pixel it lands in. The fraction left over from picking the entry
+    // places the sample inside that pixel
+    ivec2 size = textureSize(hdrTex, 0);
+    vec2 r = vec2(r2, r1) * vec2(size);
+    ivec2 entry = min(ivec2(r), size - 1);
+    // Marginal entries hold row / height, rounding undoes the division
+    float marginal = texelFetch(hdrMarginalDistTex, ivec2(entry.y, 0), 0).x;
+    int row = min(int(marginal * float(size.y) + 0.5), size.y - 1);
+    int column = int(texelFetch(hdrCondDistTex, ivec2(entry.x, row), 0).x);
+    float u = (float(column) + fract(r.x)) / float(size.x);
+    float v = (float(row) + fract(r.y)) / float(size.y);
+
+    color = texture(hdrTex, vec2(u, v)).xyz * hdrMultiplier;
+    float pdf = EnvPixelPdf(ivec2(column, row));
+
+    float phi = u * TWO_PI;
+    float theta = v * PI;
+
+    if (sin(theta) == 0.0)
+        pdf = 0.0;
+
+    return vec4(-sin(theta) * cos(phi), cos(theta), -sin(theta) * sin(phi), pdf / (2.0 * PI * PI * sin(theta)));
+}
+
+#else
+
 //-----------------------------------------------------------------------
 float EnvPdf(in Ray r)
 //-----------------------------------------------------------------------
@@ -256,6 +452,7 @@ vec4 EnvSample(inout vec3 color)
     return vec4(-sin(theta) * cos(phi), cos(theta), -sin(theta) * sin(phi), (pdf * hdrResolution) / (2.0 * PI * PI * sin(theta)));
 }
 
+#endif
 #endif
 #endif
 
@@ -33,18 +33,42 @@ uniform float invNumTilesX;
 uniform float invNumTilesY;
 
 uniform sampler2D accumTexture;
-uniform samplerBuffer BVH;
+uniform usamplerBuffer BVH;
 uniform isamplerBuffer vertexIndicesTex;
+#ifdef QUANTIZED_VERTICES
+uniform usamplerBuffer verticesTex;
+uniform usamplerBuffer normalsTex;
+#else
 uniform samplerBuffer verticesTex;
 uniform samplerBuffer normalsTex;
+#endif
 uniform sampler2D materialsTex;
 uniform sampler2D transformsTex;
 uniform sampler2D lightsTex;
-uniform sampler2DArray textureMapsArrayTex;
+uniform sampler2DArray textureArray0;
+uniform sampler2DArray textureArray1;
+uniform sampler2DArray textureArray2;
+uniform sampler2DArray textureArray3;
+uniform sampler2D textureRectsTex;
+#ifdef VIRTUAL_TEXTURES
+uniform int pageTableOffset;
+#endif
 
 uniform sampler2D hdrTex;
+#if defined(ENVMAP_PYRAMID)
+uniform sampler2D hdrPyramidTex;
+uniform int hdrPyramidLevels;
+#elif defined(ENVMAP_ALIAS)
+uniform usampler2D hdrAliasTex;
+uniform float hdrLuminanceSum;
+#else
 uniform sampler2D hdrMarginalDistTex;
+#ifdef ENVMAP_HALF_DIST
+uniform usampler2D hdrCondDistTex;
+#else
 uniform sampler2D hdrCondDistTex;
+#endif
+#endif
 
 uniform float hdrResolution;
 uniform float hdrMultiplier;
@@ -32,7 +32,10 @@ precision highp samplerCube;
 precision highp isampler2D;
 precision highp sampler2DArray;
 
-out vec3 color;
+layout(location = 0) out vec3 color;
+#ifdef VIRTUAL_TEXTURES
+layout(location = 1) out uint feedback;
+#endif
 in vec2 TexCoords;
 
 #include common/uniforms.glsl
@@ -96,4 +99,8 @@ void main(void)
     vec3 pixelColor = PathTrace(ray);
 
     color = pixelColor + accumColor;
+
+#ifdef VIRTUAL_TEXTURES
+    feedback = vtRequest;
+#endif
 }
\ No newline at end of file
@@ -52,14 +52,14 @@ namespace GLSLPT
         Material gold;
         Material red_plastic;
 
-        int headAlbedo = scene->AddTexture("./assets/Figurine/textures/01_Head_Base_Color.png");
-        int bodyAlbedo = scene->AddTexture("./assets/Figurine/textures/02_Body_Base_Color.png");
-        int baseAlbedo = scene->AddTexture("./assets/Figurine/textures/03_Base_Base_Color.png");
-        int bgAlbedo   = scene->AddTexture("./assets/Figurine/textures/grid.jpg");
-
-        int headMatRgh = scene->AddTexture("./assets/Figurine/textures/01_Head_MetallicRoughness.png");
-        int bodyMatRgh = scene->AddTexture("./assets/Figurine/textures/02_Body_MetallicRoughness.png");
-        int baseMatRgh = scene->AddTexture("./assets/Figurine/textures/03_Base_MetallicRoughness.png");
+        int headAlbedo = scene->AddTexture("./assets/Figurine/textures/01_Head_Base_Color.png", TextureRoleAlbedo);
+        int bodyAlbedo = scene->AddTexture("./assets/Figurine/textures/02_Body_Base_Color.png", TextureRoleAlbedo);
+        int baseAlbedo = scene->AddTexture("./assets/Figurine/textures/03_Base_Base_Color.png", TextureRoleAlbedo);
+        int bgAlbedo   = scene->AddTexture("./assets/Figurine/textures/grid.jpg", TextureRoleAlbedo);
+
+        int headMatRgh = scene->AddTexture("./assets/Figurine/textures/01_Head_MetallicRoughness.png", TextureRoleMetallicRoughness);
+        int bodyMatRgh = scene->AddTexture("./assets/Figurine/textures/02_Body_MetallicRoughness.png", TextureRoleMetallicRoughness);
+        int baseMatRgh = scene->AddTexture("./assets/Figurine/textures/03_Base_MetallicRoughness.png", TextureRoleMetallicRoughness);
 
         head.albedoTexID = headAlbedo;
         head.metallicRoughnessTexID = headMatRgh;
@@ -20,6 +20,7 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 ********************************************************************/
 #include "bvh.h"
+#include "TaskPool.h"
 
 #include <algorithm>
 #include <thread>
@@ -40,6 +41,15 @@ namespace RadeonRays
 
     void Bvh::Build(bbox const* bounds, int numbounds)
     {
+        // A tree restored from flattened nodes or built before is replaced entirely
+        if (!m_flat_nodes.empty())
+        {
+            m_flat_nodes.clear();
+            m_packed_indices.clear();
+        }
+        m_bounds = bbox();
+        m_height = 0;
+
         for (int i = 0; i < numbounds; ++i)
         {
             // Calc bbox
@@ -54,6 +64,11 @@ namespace RadeonRays
         return m_bounds;
     }
 
+    void Bvh::SetBounds(bbox const& bounds)
+    {
+        m_bounds = bounds;
+    }
+
     void  Bvh::InitNodeAllocator(size_t maxnum)
     {
         m_nodecnt = 0;
@@ -65,31 +80,29 @@ namespace RadeonRays
         return &m_nodes[m_nodecnt++];
     }
 
+    void Bvh::UpdateHeight(int level)
+    {
+        int height = m_height;
+        while (level > height && !m_height.compare_exchange_weak(height, level))
+        {
+        }
+    }
+
     void Bvh::BuildNode(SplitRequest const& req, bbox const* bounds, Vec3 const* centroids, int* primindices)
     {
-        m_height = std::max(m_height, req.level);
+        UpdateHeight(req.level);
 
         Node* node = AllocateNode();
         node->bounds = req.bounds;
         node->index = req.index;
 
-        // Create leaf node if we have enough prims
+        // Create leaf node if we have enough prims. Leaves tile the primitive indices
+        // from left to right, so they are packed in place once the build is done
         if (req.numprims < 2)
         {
-#ifdef USE_TBB
-            primitive_mutex_.lock();
-#endif
             node->type = kLeaf;
-            node->startidx = static_cast<int>(m_packed_indices.size());
+            node->startidx = req.startidx;
             node->numprims = req.numprims;
-
-            for (auto i = 0; i < req.numprims; ++i)
-            {
-                m_packed_indices.push_back(primindices[req.startidx + i]);
-            }
-#ifdef USE_TBB
-            primitive_mutex_.unlock();
-#endif
         }
         else
         {
@@ -99,7 +112,7 @@ namespace RadeonRays
 
             if (m_usesah)
             {
-                SahSplit ss = FindSahSplit(req, bounds, centroids, primindices);
+                SahSplit ss = FindSahSplit(req, bounds, primindices);
 
                 if (!is_nan(ss.split))
                 {
@@ -109,14 +122,9 @@ namespace RadeonRays
                     if (req.numprims < ss.sah && req.numprims < kMaxPrimitivesPerLeaf)
                     {
                         node->type = kLeaf;
-                        node->startidx = static_cast<int>(m_packed_indices.size());
+                        node->startidx = req.startidx;
                         node->numprims = req.numprims;
 
-                        for (auto i = 0; i < req.numprims; ++i)
-                        {
-                            m_packed_indices.push_back(primindices[req.startidx + i]);
-                        }
-
                         if (req.ptr) *req.ptr = node;
                         return;
                     }
@@ -228,12 +236,18 @@ namespace RadeonRays
             // Right request
             SplitRequest rightrequest = { splitidx, req.numprims - (splitidx - req.startidx), &node->rc, rightbounds, rightcentroid_bounds, req.level + 1, (req.index << 1) + 1 };
 
+            // Children work on their own ranges, so large ones are built concurrently
+            if (req.numprims >= kMinTaskPrims)
             {
-                // Put those to stack
+                GLSLPT::TaskPool& pool = GLSLPT::TaskPool::Instance();
+                GLSLPT::TaskPool::Group group;
+                pool.Spawn(group, [&]() { BuildNode(rightrequest, bounds, centroids, primindices); });
                 BuildNode(leftrequest, bounds, centroids, primindices);
+                pool.Wait(group);
             }
-
+            else
             {
+                BuildNode(leftrequest, bounds, centroids, primindices);
                 BuildNode(rightrequest, bounds, centroids, primindices);
             }
         }
@@ -242,11 +256,10 @@ namespace RadeonRays
         if (req.ptr) *req.ptr = node;
     }
 
-    Bvh::SahSplit Bvh::FindSahSplit(SplitRequest const& req, bbox const* bounds, Vec3 const* centroids, int* primindices) const
+    Bvh::SahSplit Bvh::FindSahSplit(SplitRequest const& req, bbox const* bounds, int* primindices) const
     {
         // SAH implementation
         // calc centroids histogram
-        // int const kNumBins = 128;
         // moving split bin index
         int splitidx = -1;
         // Set SAH to maximum float value as a start
@@ -265,84 +278,58 @@ namespace RadeonRays
             return split;
         }
 
-        // Bin has bbox and occurence count
-        struct Bin
-        {
-            bbox bounds;
-            int count;
-        };
-
-        // Keep bins for each dimension
-        std::vector<Bin> bins[3];
-        bins[0].resize(m_num_bins);
-        bins[1].resize(m_num_bins);
-        bins[2].resize(m_num_bins);
-
         // Precompute inverse parent area
         float invarea = 1.f / req.bounds.surface_area();
         // Precompute min point
         Vec3 rootmin = req.centroid_bounds.pmin;
 
-        // Evaluate all dimensions
-        for (int axis = 0; axis < 3; ++axis)
-        {
-            float rootminc = rootmin[axis];
-            // Range for histogram
-            float centroid_rng = centroid_extents[axis];
-            float invcentroid_rng = 1.f / centroid_rng;
+        // Calc primitive refs histogram of all dimensions at once, large nodes in
+        // chunks that are merged in order. Merging only takes mins, maxs and sums
+        int numchunks = req.numprims >= kMinParallelBinningPrims ? (req.numprims + kBinningChunkPrims - 1) / kBinningChunkPrims : 1;
+        SahBins bins;
+        std::vector<SahBins> chunkbins(numchunks - 1);
 
-            // If the box is degenerate in that dimension skip it
-            if (centroid_rng == 0.f) continue;
+        auto binchunk = [&](int chunk)
+        {
+            SahBins& chunkb = chunk == 0 ? bins : chunkbins[chunk - 1];
+            chunkb.init(m_num_bins, req.centroid_bounds);
 
-            // Initialize bins
-            for (int i = 0; i < m_num_bins; ++i)
+            int begin = req.startidx + chunk * kBinningChunkPrims;
+            int end = numchunks == 1 ? req.startidx + req.numprims : std::min(begin + kBinningChunkPrims, req.startidx + req.numprims);
+            for (int i = begin; i < end; ++i)
             {
-                bins[axis][i].count = 0;
-                bins[axis][i].bounds = bbox();
+                SimdBox box = SimdBox::Load(bounds[primindices[i]]);
+                chunkb.add(box.center(), box);
             }
+        };
 
-            // Calc primitive refs histogram
-            for (int i = req.startidx; i < req.startidx + req.numprims; ++i)
-            {
-                int idx = primindices[i];
-                int binidx = (int)std::min<float>(static_cast<float>(m_num_bins) * ((centroids[idx][axis] - rootminc) * invcentroid_rng), static_cast<float>(m_num_bins - 1));
-
-                ++bins[axis][binidx].count;
-                bins[axis][binidx].bounds.grow(bounds[idx]);
-            }
+        if (numchunks > 1)
+            GLSLPT::TaskPool::Instance().ParallelFor(numchunks, binchunk);
+        else
+            binchunk(0);
 
-            std::vector<bbox> rightbounds(m_num_bins - 1);
+        for (int chunk = 1; chunk < numchunks; ++chunk)
+            bins.merge(chunkbins[chunk - 1]);
 
-            // Start with 1-bin right box
-            bbox rightbox = bbox();
-            for (int i = m_num_bins - 1; i > 0; --i)
-            {
-                rightbox.grow(bins[axis][i].bounds);
-                rightbounds[i - 1] = rightbox;
-            }
-
-            bbox leftbox = bbox();
-            int  leftcount = 0;
-            int  rightcount = req.numprims;
+        // Evaluate all dimensions
+        SimdBox leftboxes[kMaxSahBins];
+        SimdBox rightboxes[kMaxSahBins];
+        alignas(16) float sahs[kMaxSahBins];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            // If the box is degenerate in that dimension skip it
+            if (centroid_extents[axis] == 0.f) continue;
 
-            // Start best SAH search
             // i is current split candidate (split between i and i + 1)
-            float sahtmp = 0.f;
+            bins.evaluate(axis, req.numprims, m_traversal_cost, invarea, sahs, leftboxes, rightboxes);
             for (int i = 0; i < m_num_bins - 1; ++i)
             {
-                leftbox.grow(bins[axis][i].bounds);
-                leftcount += bins[axis][i].count;
-                rightcount -= bins[axis][i].count;
-
-                // Compute SAH
-                sahtmp = m_traversal_cost + (leftcount * leftbox.surface_area() + rightcount * rightbounds[i].surface_area()) * invarea;
-
                 // Check if it is better than what we found so far
-                if (sahtmp < sah)
+                if (sahs[i] < sah)
                 {
                     split.dim = axis;
                     splitidx = i;
-                    split.sah = sah = sahtmp;
+                    split.sah = sah = sahs[i];
                 }
             }
         }
@@ -366,14 +353,23 @@ namespace RadeonRays
         m_indices.resize(numbounds);
         std::iota(m_indices.begin(), m_indices.end(), 0);
 
-        // Calc bbox
-        bbox centroid_bounds;
-        for (size_t i = 0; i < static_cast<size_t>(numbounds); ++i)
+        // Calc bbox, chunks are merged in order
+        int numchunks = (numbounds + kBinningChunkPrims - 1) / kBinningChunkPrims;
+        std::vector<bbox> chunkbounds(numchunks);
+        GLSLPT::TaskPool::Instance().ParallelFor(numchunks, [&](int chunk)
         {
-            Vec3 c = bounds[i].center();
-            centroid_bounds.grow(c);
-            centroids[i] = c;
-        }
+            int end = std::min(numbounds, (chunk + 1) * kBinningChunkPrims);
+            for (int i = chunk * kBinningChunkPrims; i < end; ++i)
+            {
+                Vec3 c = bounds[i].center();
+                chunkbounds[chunk].grow(c);
+                centroids[i] = c;
+            }
+        });
+
+        bbox centroid_bounds;
+        for (int chunk = 0; chunk < numchunks; ++chunk)
+            centroid_bounds.grow(chunkbounds[chunk]);
 
         SplitRequest init = { 0, numbounds, nullptr, m_bounds, centroid_bounds, 0, 1 };
 
@@ -485,6 +481,9 @@ namespace RadeonRays
         }
 #else
         BuildNode(init, bounds, &centroids[0], &m_indices[0]);
+
+        // Leaves point into the reordered indices
+        m_packed_indices = m_indices;
 #endif
 
         // Set root_ pointer
@@ -501,4 +500,68 @@ namespace RadeonRays
         os << "Tree height: " << GetHeight() << "\n";
     }
 
+    int Bvh::FlattenNode(Node const* node, FlatNode* out, int& curnode, int nodeOffset, int primOffset) const
+    {
+        int index = curnode;
+        FlatNode& flat = out[index];
+        flat.bboxmin = node->bounds.pmin;
+        flat.bboxmax = node->bounds.pmax;
+
+        if (node->type == kLeaf)
+        {
+            flat.LRLeaf[0] = primOffset + node->startidx;
+            flat.LRLeaf[1] = node->numprims;
+            flat.LRLeaf[2] = 1;
+        }
+        else
+        {
+            ++curnode;
+            int left = FlattenNode(node->lc, out, curnode, nodeOffset, primOffset);
+            ++curnode;
+            int right = FlattenNode(node->rc, out, curnode, nodeOffset, primOffset);
+            out[index].LRLeaf[0] = nodeOffset + left;
+            out[index].LRLeaf[1] = nodeOffset + right;
+            out[index].LRLeaf[2] = 0;
+        }
+
+        return index;
+    }
+
+    void Bvh::Flatten(FlatNode* out, int nodeOffset, int primOffset) const
+    {
+        if (!m_flat_nodes.empty())
+        {
+            // Restored trees are stored with zero offsets, only the indices need moving
+            for (size_t i = 0; i < m_flat_nodes.size(); ++i)
+            {
+                FlatNode const& node = m_flat_nodes[i];
+                bool leaf = node.LRLeaf[2] != 0;
+
+                out[i].bboxmin = node.bboxmin;
+                out[i].bboxmax = node.bboxmax;
+                out[i].LRLeaf[0] = node.LRLeaf[0] + (leaf ? primOffset : nodeOffset);
+                out[i].LRLeaf[1] = node.LRLeaf[1] + (leaf ? 0 : nodeOffset);
+                out[i].LRLeaf[2] = node.LRLeaf[2];
+            }
+            return;
+        }
+
+        int curnode = 0;
+        FlattenNode(m_root, out, curnode, nodeOffset, primOffset);
+    }
+
+    void Bvh::SetFlattened(std::vector<FlatNode> nodes, std::vector<int> indices, bbox const& bounds)
+    {
+        m_flat_nodes = std::move(nodes);
+        m_packed_indices = std::move(indices);
+        m_nodecnt = static_cast<int>(m_flat_nodes.size());
+        m_bounds = bounds;
+        m_root = nullptr;
+    }
+
+    std::string Bvh::GetBuildParams() const
+    {
+        return "Bvh " + std::to_string(m_traversal_cost) + " " + std::to_string(m_num_bins) + " " + std::to_string(m_usesah);
+    }
+
 }
@@ -29,8 +29,10 @@ THE SOFTWARE.
 #include <list>
 #include <atomic>
 #include <iostream>
+#include <string>
 
 #include "bbox.h"
+#include "sah_bins.h"
 
 namespace RadeonRays
 {
@@ -40,20 +42,25 @@ namespace RadeonRays
     class Bvh
     {
     public:
+        // num_bins is capped at kMaxSahBins
         Bvh(float traversal_cost, int num_bins = 64, bool usesah = false)
             : m_root(nullptr)
-            , m_num_bins(num_bins)
+            , m_num_bins(std::min(num_bins, kMaxSahBins))
             , m_usesah(usesah)
             , m_height(0)
             , m_traversal_cost(traversal_cost)
         {
         }
 
-        ~Bvh() = default;
+        virtual ~Bvh() = default;
 
         // World space bounding box
         bbox const& Bounds() const;
 
+        // Set the bounding box of a tree whose flattened nodes
+        // were restored from a cache instead of being built
+        void SetBounds(bbox const& bounds);
+
         // Build function
         // bounds is an array of bounding boxes
         void Build(bbox const* bounds, int numbounds);
@@ -71,6 +78,33 @@ namespace RadeonRays
 
         // Print BVH statistics
         virtual void PrintStatistics(std::ostream& os) const;
+
+        // Describe build parameters, used to key caches of built trees
+        virtual std::string GetBuildParams() const;
+
+        // Node of the index based layout BvhTranslator packs for the shaders. Interior
+        // nodes keep their child indices in LRLeaf[0] and LRLeaf[1] with LRLeaf[2] = 0,
+        // leaves keep their first primitive and primitive count with LRLeaf[2] = 1
+        struct FlatNode
+        {
+            Vec3 bboxmin;
+            Vec3 bboxmax;
+            int LRLeaf[3];
+        };
+
+        // Number of nodes in the tree
+        int GetNodeCount() const;
+
+        // True once the tree was built or restored from flattened nodes
+        bool IsBuilt() const;
+
+        // Writes the tree depth first into out, which must hold GetNodeCount() nodes.
+        // Child indices are offset by nodeOffset and primitive ranges by primOffset
+        void Flatten(FlatNode* out, int nodeOffset, int primOffset) const;
+
+        // Replaces the tree with one flattened earlier with zero offsets and
+        // its reordered primitive indices, so a prebuilt tree needs no Build
+        void SetFlattened(std::vector<FlatNode> nodes, std::vector<int> indices, bbox const& bounds);
     protected:
         // Build function
         virtual void BuildImpl(bbox const* bounds, int numbounds);
@@ -106,9 +140,19 @@ namespace RadeonRays
             float overlap;
         };
 
+        // Requests with at least this many primitives hand one child to the task pool,
+        // nodes with at least kMinParallelBinningPrims also bin in parallel, in chunks of
+        // a fixed size so the bins don't depend on the number of threads
+        static int constexpr kMinTaskPrims = 4096;
+        static int constexpr kMinParallelBinningPrims = 65536;
+        static int constexpr kBinningChunkPrims = 16384;
+
         void BuildNode(SplitRequest const& req, bbox const* bounds, Vec3 const* centroids, int* primindices);
 
-        SahSplit FindSahSplit(SplitRequest const& req, bbox const* bounds, Vec3 const* centroids, int* primindices) const;
+        // Raises m_height to level, called concurrently by the build tasks
+        void UpdateHeight(int level);
+
+        SahSplit FindSahSplit(SplitRequest const& req, bbox const* bounds, int* primindices) const;
 
         // Enum for node type
         enum NodeType
@@ -131,10 +175,12 @@ namespace RadeonRays
         bbox m_bounds;
         // Root node
         Node* m_root;
+        // Nodes of a tree restored by SetFlattened, empty for built trees
+        std::vector<FlatNode> m_flat_nodes;
         // SAH flag
         bool m_usesah;
         // Tree height
-        int m_height;
+        std::atomic<int> m_height;
         // Node traversal cost
         float m_traversal_cost;
         // Number of spatial bins to use for SAH
@@ -142,6 +188,8 @@ namespace RadeonRays
 
 
     private:
+        int FlattenNode(Node const* node, FlatNode* out, int& curnode, int nodeOffset, int primOffset) const;
+
         Bvh(Bvh const&) = delete;
         Bvh& operator = (Bvh const&) = delete;
 
@@ -166,11 +214,13 @@ namespace RadeonRays
                 Node* rc;
             };
 
-            // For leaves: starting primitive index and number of primitives
+            // For leaves: starting primitive index and number of primitives.
+            // SplitBvh also notes where the primitives are kept until the build ends
             struct
             {
                 int startidx;
                 int numprims;
+                int refarray;
             };
         };
     };
@@ -189,6 +239,16 @@ namespace RadeonRays
     {
         return m_height;
     }
+
+    inline int Bvh::GetNodeCount() const
+    {
+        return m_nodecnt;
+    }
+
+    inline bool Bvh::IsBuilt() const
+    {
+        return m_root != nullptr || !m_flat_nodes.empty();
+    }
 }
 
 #endif // BVH_H
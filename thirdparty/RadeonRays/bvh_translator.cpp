@@ -26,36 +26,32 @@ THE SOFTWARE.
 
 #include "bvh_translator.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
 #include <stack>
 #include <iostream>
 
 namespace RadeonRays
 {
-	int BvhTranslator::ProcessBLASNodes(const Bvh::Node *node)
+	namespace
 	{
-		RadeonRays::bbox bbox = node->bounds;
-
-		nodes[curNode].bboxmin = bbox.pmin;
-		nodes[curNode].bboxmax = bbox.pmax;
-		nodes[curNode].LRLeaf.z = 0;
+		// Most triangles a child word can hold
+		int constexpr kWideMaxLeafTriangles = 15;
 
-		int index = curNode;
+		// Child words have 26 bits for the first triangle
+		int constexpr kWideMaxTriangles = 1 << 26;
 
-		if (node->type == RadeonRays::Bvh::NodeType::kLeaf)
+		bool IsInner(const BvhTranslator::Node &node)
 		{
-			nodes[curNode].LRLeaf.x = curTriIndex + node->startidx;
-			nodes[curNode].LRLeaf.y = node->numprims;
-			nodes[curNode].LRLeaf.z = 1;
+			return node.LRLeaf[2] == 0;
 		}
-		else
+
+		bbox NodeBounds(const BvhTranslator::Node &node)
 		{
-			curNode++;
-			nodes[index].LRLeaf.x = ProcessBLASNodes(node->lc);
-			curNode++;
-			nodes[index].LRLeaf.y = ProcessBLASNodes(node->rc);
+			return bbox(node.bboxmin, node.bboxmax);
 		}
-		return index;
 	}
 
 	int BvhTranslator::ProcessTLASNodes(const Bvh::Node *node)
@@ -64,7 +60,7 @@ namespace RadeonRays
 
 		nodes[curNode].bboxmin = bbox.pmin;
 		nodes[curNode].bboxmax = bbox.pmax;
-		nodes[curNode].LRLeaf.z = 0;
+		nodes[curNode].LRLeaf[2] = 0;
 
 		int index = curNode;
 
@@ -74,16 +70,16 @@ namespace RadeonRays
 			int meshIndex = meshInstances[instanceIndex].meshID;
 			int materialID = meshInstances[instanceIndex].materialID;
 
-			nodes[curNode].LRLeaf.x = bvhRootStartIndices[meshIndex];
-			nodes[curNode].LRLeaf.y = materialID;
-			nodes[curNode].LRLeaf.z = -instanceIndex - 1;
+			nodes[curNode].LRLeaf[0] = bvhRootStartIndices[meshIndex];
+			nodes[curNode].LRLeaf[1] = materialID;
+			nodes[curNode].LRLeaf[2] = -instanceIndex - 1;
 		}
 		else
 		{
 			curNode++;
-			nodes[index].LRLeaf.x = ProcessTLASNodes(node->lc);
+			nodes[index].LRLeaf[0] = ProcessTLASNodes(node->lc);
 			curNode++;
-			nodes[index].LRLeaf.y = ProcessTLASNodes(node->rc);
+			nodes[index].LRLeaf[1] = ProcessTLASNodes(node->rc);
 		}
 		return index;
 	}
@@ -106,12 +102,11 @@ namespace RadeonRays
 		for (int i = 0; i < meshes.size(); i++)
 		{
 			GLSLPT::Mesh *mesh = meshes[i];
-			curNode = bvhRootIndex;
 
 			bvhRootStartIndices.push_back(bvhRootIndex);
+			mesh->bvh->Flatten(&nodes[bvhRootIndex], bvhRootIndex, curTriIndex);
+
 			bvhRootIndex += mesh->bvh->m_nodecnt;
-			
-			ProcessBLASNodes(mesh->bvh->m_root);
 			curTriIndex += mesh->bvh->GetNumIndices();
 		}
 	}
@@ -122,12 +117,291 @@ namespace RadeonRays
 		ProcessTLASNodes(TLBvh->m_root);
 	}
 
+	void BvhTranslator::WriteWideNode(int texel, const bbox *boxes, int numChildren)
+	{
+		bbox bounds;
+		for (int i = 0; i < numChildren; i++)
+			bounds.grow(boxes[i]);
+
+		uint32_t *words = &packedNodes[(size_t)texel * 4];
+		std::fill(words, words + PackedNodeTexels() * 4, 0u);
+
+		float step[3];
+		uint32_t exponents[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			// Smallest power of two step reaching the max from the min in 255 steps
+			float origin = bounds.pmin[axis];
+			int e = -126;
+			if (bounds.pmax[axis] > origin)
+			{
+				std::frexp((bounds.pmax[axis] - origin) / 255.0f, &e);
+				e = std::max(-126, std::min(e, 127));
+			}
+			while (e < 127 && origin + 255.0f * std::ldexp(1.0f, e) < bounds.pmax[axis])
+				e++;
+
+			step[axis] = std::ldexp(1.0f, e);
+			exponents[axis] = (uint32_t)(e + 127);
+			memcpy(&words[axis], &origin, sizeof(float));
+		}
+		words[3] = exponents[0] | exponents[1] << 8 | exponents[2] << 16 | (uint32_t)numChildren << 24;
+
+		for (int i = 0; i < width; i++)
+			words[4 + i] = (uint32_t)kWideEmpty << 30;
+
+		uint32_t *boxWords = words + 4 + width;
+		for (int i = 0; i < numChildren; i++)
+		{
+			uint32_t *group = boxWords + (i / 4) * 6;
+			int shift = 8 * (i % 4);
+
+			for (int axis = 0; axis < 3; axis++)
+			{
+				// Rounded outwards and checked with the math the shaders decode with.
+				// The product is exact, so the sum is rounded once with or without fma
+				float origin = bounds.pmin[axis];
+				float s = step[axis];
+				float lo = boxes[i].pmin[axis];
+				float hi = boxes[i].pmax[axis];
+
+				int qlo = (int)std::min(std::max(std::floor((lo - origin) / s), 0.0f), 255.0f);
+				while (qlo > 0 && origin + (float)qlo * s > lo)
+					qlo--;
+
+				int qhi = (int)std::min(std::max(std::ceil((hi - origin) / s), 0.0f), 255.0f);
+				while (qhi < 255 && origin + (float)qhi * s < hi)
+					qhi++;
+
+				group[axis] |= (uint32_t)qlo << shift;
+				group[3 + axis] |= (uint32_t)qhi << shift;
+			}
+		}
+	}
+
+	int BvhTranslator::WideLeafNode(int first, int count, const bbox &box, int &curTexel, int &stackSize)
+	{
+		// Leaves too big for a child word are spread over the children of an extra
+		// node, all with the box of the leaf
+		int texel = curTexel;
+		curTexel += PackedNodeTexels();
+		if (packedNodes.size() < (size_t)curTexel * 4)
+			packedNodes.resize((size_t)curTexel * 4);
+
+		int numChildren = std::min(width, (count + kWideMaxLeafTriangles - 1) / kWideMaxLeafTriangles);
+		int childCount = (count + numChildren - 1) / numChildren;
+
+		bbox boxes[8];
+		std::fill(boxes, boxes + numChildren, box);
+		WriteWideNode(texel, boxes, numChildren);
+
+		int childStackSize = 0;
+		for (int i = 0; i < numChildren; i++)
+		{
+			int childFirst = first + i * childCount;
+			int num = std::min(childCount, first + count - childFirst);
+
+			uint32_t word;
+			if (num <= kWideMaxLeafTriangles)
+			{
+				assert(childFirst < kWideMaxTriangles);
+				word = (uint32_t)kWideTriangles << 30 | (uint32_t)childFirst << 4 | (uint32_t)num;
+			}
+			else
+			{
+				int need = 0;
+				word = (uint32_t)WideLeafNode(childFirst, num, box, curTexel, need);
+				childStackSize = std::max(childStackSize, need);
+			}
+			packedNodes[(size_t)texel * 4 + 4 + i] = word;
+		}
+
+		stackSize = numChildren - 1 + childStackSize;
+		return texel;
+	}
+
+	int BvhTranslator::CollapseNode(int index, int &curTexel, int &curInstance, int &stackSize)
+	{
+		// Opens the child with the largest surface area until the node is full. A leaf
+		// gets a node of its own, roots always have to be nodes
+		int children[8];
+		int numChildren = 0;
+		if (IsInner(nodes[index]))
+		{
+			children[numChildren++] = nodes[index].LRLeaf[0];
+			children[numChildren++] = nodes[index].LRLeaf[1];
+		}
+		else
+			children[numChildren++] = index;
+
+		while (numChildren < width)
+		{
+			int best = -1;
+			float bestArea = -1.0f;
+			for (int i = 0; i < numChildren; i++)
+			{
+				const Node &child = nodes[children[i]];
+				float area = NodeBounds(child).surface_area();
+				if (IsInner(child) && area > bestArea)
+				{
+					best = i;
+					bestArea = area;
+				}
+			}
+
+			if (best < 0)
+				break;
+
+			const Node &opened = nodes[children[best]];
+			children[best] = opened.LRLeaf[0];
+			children[numChildren++] = opened.LRLeaf[1];
+		}
+
+		bbox boxes[8];
+		for (int i = 0; i < numChildren; i++)
+			boxes[i] = NodeBounds(nodes[children[i]]);
+
+		int texel = curTexel;
+		curTexel += PackedNodeTexels();
+		if (packedNodes.size() < (size_t)curTexel * 4)
+			packedNodes.resize((size_t)curTexel * 4);
+		WriteWideNode(texel, boxes, numChildren);
+
+		// Pushes for all but the nearest child plus what the deepest child needs
+		int childStackSize = 0;
+		for (int i = 0; i < numChildren; i++)
+		{
+			const Node &child = nodes[children[i]];
+			int need = 0;
+
+			uint32_t word;
+			if (IsInner(child))
+				word = (uint32_t)CollapseNode(children[i], curTexel, curInstance, need);
+			else if (child.LRLeaf[2] > 0)
+			{
+				int first = child.LRLeaf[0];
+				int count = child.LRLeaf[1];
+				if (count <= kWideMaxLeafTriangles)
+				{
+					assert(first < kWideMaxTriangles);
+					word = (uint32_t)kWideTriangles << 30 | (uint32_t)first << 4 | (uint32_t)count;
+				}
+				else
+					word = (uint32_t)WideLeafNode(first, count, boxes[i], curTexel, need);
+			}
+			else
+			{
+				word = (uint32_t)kWideInstance << 30 | (uint32_t)WriteInstanceRecord(child, curInstance);
+				// The marker that restores the ray goes on the stack too
+				need = 1 + wideBLASStackSize;
+			}
+
+			packedNodes[(size_t)texel * 4 + 4 + i] = word;
+			childStackSize = std::max(childStackSize, need);
+		}
+
+		stackSize = numChildren - 1 + childStackSize;
+		return texel;
+	}
+
+	int BvhTranslator::WriteInstanceRecord(const Node &leaf, int &curInstance)
+	{
+		int instanceIndex = -leaf.LRLeaf[2] - 1;
+		const iVec2 &root = packedRoots[meshInstances[instanceIndex].meshID];
+
+		int record = curInstance++;
+		uint32_t *words = &packedNodes[(size_t)record * 4];
+		words[0] = (uint32_t)root.x;
+		words[1] = (uint32_t)root.y;
+		words[2] = (uint32_t)leaf.LRLeaf[1];
+		words[3] = (uint32_t)instanceIndex;
+		return record;
+	}
+
+	iVec2 BvhTranslator::PackBinaryEntry(int index, int &curTexel, int &curInstance)
+	{
+		const Node &node = nodes[index];
+		if (node.LRLeaf[2] > 0)
+			return iVec2(node.LRLeaf[0], node.LRLeaf[1]);
+		if (node.LRLeaf[2] < 0)
+			return iVec2(WriteInstanceRecord(node, curInstance), kPackedInstance);
+
+		int texel = curTexel;
+		curTexel += PackedNodeTexels();
+		if (packedNodes.size() < (size_t)curTexel * 4)
+			packedNodes.resize((size_t)curTexel * 4);
+
+		for (int i = 0; i < 2; i++)
+		{
+			int childIndex = node.LRLeaf[i];
+			iVec2 entry = PackBinaryEntry(childIndex, curTexel, curInstance);
+
+			const Node &child = nodes[childIndex];
+			uint32_t *words = &packedNodes[(size_t)(texel + 2 * i) * 4];
+			memcpy(&words[0], &child.bboxmin.x, 3 * sizeof(float));
+			words[3] = (uint32_t)entry.x;
+			memcpy(&words[4], &child.bboxmax.x, 3 * sizeof(float));
+			words[7] = (uint32_t)entry.y;
+		}
+
+		return iVec2(texel, 0);
+	}
+
+	void BvhTranslator::ProcessPackedBLAS()
+	{
+		packedNodes.clear();
+		packedRoots.clear();
+		wideBLASStackSize = 0;
+
+		int curTexel = 0;
+		int curInstance = 0;
+		for (int i = 0; i < meshes.size(); i++)
+		{
+			int root = bvhRootStartIndices[i];
+			if (width > 2)
+			{
+				int stackSize = 0;
+				packedRoots.push_back(iVec2(CollapseNode(root, curTexel, curInstance, stackSize), 0));
+				wideBLASStackSize = std::max(wideBLASStackSize, stackSize);
+			}
+			else
+				packedRoots.push_back(PackBinaryEntry(root, curTexel, curInstance));
+		}
+		packedTopLevelIndex = curTexel;
+
+		// Reserve space for the top level, the root entry, a node per interior node
+		// of the binary TLAS at most and the instance records
+		int numInstances = (int)meshInstances.size();
+		curTexel += 1 + std::max(numInstances - 1, 1) * PackedNodeTexels() + numInstances;
+		packedNodes.resize((size_t)curTexel * 4);
+	}
+
+	void BvhTranslator::ProcessPackedTLAS()
+	{
+		int curTexel = packedTopLevelIndex + 1;
+		int curInstance = curTexel + std::max((int)meshInstances.size() - 1, 1) * PackedNodeTexels();
+
+		// The stack bound of the whole layout, see wideStackSize
+		iVec2 root;
+		if (width > 2)
+			root = iVec2(CollapseNode(topLevelIndex, curTexel, curInstance, wideStackSize), 0);
+		else
+			root = PackBinaryEntry(topLevelIndex, curTexel, curInstance);
+
+		uint32_t *words = &packedNodes[(size_t)packedTopLevelIndex * 4];
+		words[0] = (uint32_t)root.x;
+		words[1] = (uint32_t)root.y;
+		words[2] = 0;
+		words[3] = 0;
+	}
+
 	void BvhTranslator::UpdateTLAS(const Bvh *topLevelBvh, const std::vector<GLSLPT::MeshInstance> &sceneInstances)
 	{
 		TLBvh = topLevelBvh;
 		meshInstances = sceneInstances;
 		curNode = topLevelIndex;
 		ProcessTLASNodes(TLBvh->m_root);
+		ProcessPackedTLAS();
 	}
 
 	void BvhTranslator::Process(const Bvh *topLevelBvh, const std::vector<GLSLPT::Mesh*> &sceneMeshes,const std::vector<GLSLPT::MeshInstance> &sceneInstances)
@@ -137,5 +411,12 @@ namespace RadeonRays
 		meshInstances = sceneInstances;
 		ProcessBLAS();
 		ProcessTLAS();
+
+		// Scenes with more triangles than child words can address are packed binary
+		if (width > 2 && curTriIndex > kWideMaxTriangles)
+			width = 2;
+
+		ProcessPackedBLAS();
+		ProcessPackedTLAS();
 	}
 }
@@ -29,6 +29,7 @@ THE SOFTWARE.
 #ifndef BVH_TRANSLATOR_H
 #define BVH_TRANSLATOR_H
 
+#include <cstdint>
 #include <map>
 
 #include "bvh.h"
@@ -45,12 +46,7 @@ namespace RadeonRays
         // Constructor
         BvhTranslator() = default;
 
-		struct Node
-		{
-			Vec3 bboxmin;
-			Vec3 bboxmax;
-			Vec3 LRLeaf;
-		};
+		using Node = Bvh::FlatNode;
 
 		void ProcessBLAS();
 		void ProcessTLAS();
@@ -58,14 +54,68 @@ namespace RadeonRays
 		void Process(const Bvh *topLevelBvh, const std::vector<GLSLPT::Mesh*> &meshes, const std::vector<GLSLPT::MeshInstance> &instances);
 		int topLevelIndex = 0;
 		std::vector<Node> nodes;
+		std::vector<int> bvhRootStartIndices;
 		int nodeTexWidth;
 
+		// Children per node of the layout the shaders traverse, 2, 4 or 8. Set it
+		// before calling Process, which falls back to 2 for scenes with more
+		// triangles than wide child words can address
+		int width = 2;
+
+		// Layout the shaders traverse, packed from nodes by Process and UpdateTLAS as
+		// texels of four words. Each mesh is packed on its own, then comes the TLAS:
+		// the entry of its root at packedTopLevelIndex, its nodes and its instance
+		// records. Entries reference a child in two words, (texel of the node, 0)
+		// for nodes, (first triangle, triangle count) for triangles and (texel of
+		// the instance record, kPackedInstance) for instances. Instance records hold
+		// the entry of the mesh root, the material and the instance index.
+		//
+		// A binary node is four texels, per child (box min, entry word 0) and
+		// (box max, entry word 1), so the links and bounds of a child take two fetches.
+		//
+		// A wide node is a header texel with the origin of its box as float bits and
+		// per axis an 8 bit biased exponent e, so the step is 2^(e - 127), and the
+		// child count in the top byte. Then come width child words and the child
+		// boxes as 8 bit multiples of the step from the origin, rounded outwards. Per
+		// group of 4 children the box words are min x, min y, min z, max x, max y,
+		// max z with a byte per child. Child words keep a type in their top 2 bits,
+		// see WideChildType. Wide entries always reference a node
+		std::vector<uint32_t> packedNodes;
+		std::vector<iVec2> packedRoots;
+		int packedTopLevelIndex = 0;
+		// Stack entries the wide traversal needs at most, the TLAS and the deepest
+		// BLAS stacked on each other. A node pushes all children the ray hits but
+		// the nearest, at most its child count - 1, and an instance pushes a marker
+		// before its BLAS, so this is the largest sum of those along any path from
+		// the root. The shaders are compiled with it as BVH_STACK_SIZE and drop
+		// pushes past it, so the renderer recompiles them when it grows
+		int wideStackSize = 0;
+		int wideBLASStackSize = 0;
+
+		static const int kPackedInstance = -1;
+
+		enum WideChildType
+		{
+			kWideInner = 0,     // Texel of the node
+			kWideTriangles = 1, // First triangle << 4 | triangle count
+			kWideInstance = 2,  // Texel of the instance record
+			kWideEmpty = 3
+		};
+
+		// Texels per packed node
+		int PackedNodeTexels() const { return width > 2 ? 1 + width / 4 + (6 * width / 4 + 3) / 4 : 4; }
+
     private:
 		int curNode = 0;
 		int curTriIndex = 0;
-		std::vector<int> bvhRootStartIndices;
-		int ProcessBLASNodes(const Bvh::Node *root);
 		int ProcessTLASNodes(const Bvh::Node *root);
+		void ProcessPackedBLAS();
+		void ProcessPackedTLAS();
+		int WriteInstanceRecord(const Node &leaf, int &curInstance);
+		iVec2 PackBinaryEntry(int index, int &curTexel, int &curInstance);
+		int CollapseNode(int index, int &curTexel, int &curInstance, int &stackSize);
+		int WideLeafNode(int first, int count, const bbox &box, int &curTexel, int &stackSize);
+		void WriteWideNode(int texel, const bbox *boxes, int numChildren);
 		std::vector<GLSLPT::MeshInstance> meshInstances;
 		std::vector<GLSLPT::Mesh *> meshes;
 		const Bvh *TLBvh;
@@ -0,0 +1,336 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "linear_bvh.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace RadeonRays
+{
+    // Spreads the low 10 bits of x out to every third bit
+    static uint32_t SpreadBits(uint32_t x)
+    {
+        x = (x | (x << 16)) & 0x030000FF;
+        x = (x | (x << 8)) & 0x0300F00F;
+        x = (x | (x << 4)) & 0x030C30C3;
+        x = (x | (x << 2)) & 0x09249249;
+        return x;
+    }
+
+    void LinearBvh::BuildImpl(bbox const* bounds, int numbounds)
+    {
+        InitNodeAllocator(2 * numbounds - 1);
+
+        GLSLPT::TaskPool& pool = GLSLPT::TaskPool::Instance();
+
+        // Calc centroid bounds, chunks are merged in order
+        int numchunks = (numbounds + kBinningChunkPrims - 1) / kBinningChunkPrims;
+        std::vector<bbox> chunkbounds(numchunks);
+        pool.ParallelFor(numchunks, [&](int chunk)
+        {
+            int end = std::min(numbounds, (chunk + 1) * kBinningChunkPrims);
+            for (int i = chunk * kBinningChunkPrims; i < end; ++i)
+                chunkbounds[chunk].grow(bounds[i].center());
+        });
+
+        bbox centroid_bounds;
+        for (int chunk = 0; chunk < numchunks; ++chunk)
+            centroid_bounds.grow(chunkbounds[chunk]);
+
+        // Morton codes of the centroids on a grid of 2^kMortonAxisBits cells per axis
+        // spanning the centroid bounds, degenerate axes get cell 0
+        float cells = static_cast<float>(1 << kMortonAxisBits);
+        Vec3 extents = centroid_bounds.extents();
+        float scale[3];
+        for (int axis = 0; axis < 3; ++axis)
+            scale[axis] = extents[axis] > 0.f ? cells / extents[axis] : 0.f;
+
+        std::vector<MortonPrim> prims(numbounds);
+        pool.ParallelFor(numchunks, [&](int chunk)
+        {
+            int end = std::min(numbounds, (chunk + 1) * kBinningChunkPrims);
+            for (int i = chunk * kBinningChunkPrims; i < end; ++i)
+            {
+                Vec3 c = bounds[i].center();
+                uint32_t code = 0;
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    float cell = std::min(std::max((c[axis] - centroid_bounds.pmin[axis]) * scale[axis], 0.f), cells - 1.f);
+                    code |= SpreadBits(static_cast<uint32_t>(cell)) << (2 - axis);
+                }
+                prims[i].code = code;
+                prims[i].index = i;
+            }
+        });
+
+        SortMortonPrims(prims);
+
+        // Leaves point into the sorted primitives
+        m_indices.resize(numbounds);
+        for (int i = 0; i < numbounds; ++i)
+            m_indices[i] = prims[i].index;
+        m_packed_indices = m_indices;
+
+        if (!m_usesah)
+        {
+            m_root = BuildLinearNode(0, numbounds, 3 * kMortonAxisBits - 1, 0, 1, bounds, &prims[0]);
+            return;
+        }
+
+        // Cut the sorted primitives into runs of equal top bits
+        int shift = 3 * kMortonAxisBits - kClusterBits;
+        std::vector<Cluster> clusters;
+        for (int i = 0; i < numbounds; ++i)
+        {
+            if (i == 0 || (prims[i].code >> shift) != (prims[i - 1].code >> shift))
+                clusters.push_back({ i, 0, bbox() });
+            ++clusters.back().numprims;
+        }
+
+        int numclusters = static_cast<int>(clusters.size());
+        pool.ParallelFor(numclusters, [&](int i)
+        {
+            Cluster& cluster = clusters[i];
+            for (int j = cluster.first; j < cluster.first + cluster.numprims; ++j)
+                cluster.bounds.grow(bounds[prims[j].index]);
+        });
+
+        m_root = BuildClusterNode(&clusters[0], numclusters, 0, 1, bounds, &prims[0]);
+    }
+
+    void LinearBvh::SortMortonPrims(std::vector<MortonPrim>& prims) const
+    {
+        // LSD radix sort. Chunks of a fixed size count their digits, then scatter to
+        // offsets that put the chunks of a digit in order, which keeps every pass stable
+        int constexpr numdigits = 1 << kRadixBits;
+        int numprims = static_cast<int>(prims.size());
+        int numchunks = (numprims + kBinningChunkPrims - 1) / kBinningChunkPrims;
+
+        std::vector<MortonPrim> sorted(numprims);
+        std::vector<int> offsets(static_cast<size_t>(numchunks) * numdigits);
+        GLSLPT::TaskPool& pool = GLSLPT::TaskPool::Instance();
+
+        for (int shift = 0; shift < 3 * kMortonAxisBits; shift += kRadixBits)
+        {
+            pool.ParallelFor(numchunks, [&](int chunk)
+            {
+                int* counts = &offsets[static_cast<size_t>(chunk) * numdigits];
+                std::fill(counts, counts + numdigits, 0);
+
+                int end = std::min(numprims, (chunk + 1) * kBinningChunkPrims);
+                for (int i = chunk * kBinningChunkPrims; i < end; ++i)
+                    ++counts[(prims[i].code >> shift) & (numdigits - 1)];
+            });
+
+            int offset = 0;
+            for (int digit = 0; digit < numdigits; ++digit)
+            {
+                for (int chunk = 0; chunk < numchunks; ++chunk)
+                {
+                    int& count = offsets[static_cast<size_t>(chunk) * numdigits + digit];
+                    int next = offset + count;
+                    count = offset;
+                    offset = next;
+                }
+            }
+
+            pool.ParallelFor(numchunks, [&](int chunk)
+            {
+                int* next = &offsets[static_cast<size_t>(chunk) * numdigits];
+
+                int end = std::min(numprims, (chunk + 1) * kBinningChunkPrims);
+                for (int i = chunk * kBinningChunkPrims; i < end; ++i)
+                    sorted[next[(prims[i].code >> shift) & (numdigits - 1)]++] = prims[i];
+            });
+
+            prims.swap(sorted);
+        }
+    }
+
+    Bvh::Node* LinearBvh::BuildLinearNode(int first, int numprims, int bit, int level, int index, bbox const* bounds, MortonPrim const* prims)
+    {
+        UpdateHeight(level);
+
+        Node* node = AllocateNode();
+        node->index = index;
+
+        if (numprims <= m_max_leaf_prims)
+        {
+            node->type = kLeaf;
+            node->startidx = first;
+            node->numprims = numprims;
+
+            bbox leafbounds;
+            for (int i = first; i < first + numprims; ++i)
+                leafbounds.grow(bounds[prims[i].index]);
+            node->bounds = leafbounds;
+            return node;
+        }
+
+        // The codes are sorted, so the highest bit that differs between the first and
+        // the last one is the highest that differs in the range. Its zeros come first
+        uint32_t diff = prims[first].code ^ prims[first + numprims - 1].code;
+        while (bit >= 0 && ((diff >> bit) & 1) == 0)
+            --bit;
+
+        int splitidx;
+        if (bit < 0)
+        {
+            // Equal codes, split in the middle
+            splitidx = first + (numprims >> 1);
+        }
+        else
+        {
+            MortonPrim const* split = std::partition_point(prims + first, prims + first + numprims,
+                [bit](MortonPrim const& prim) { return ((prim.code >> bit) & 1) == 0; });
+            splitidx = static_cast<int>(split - prims);
+        }
+
+        node->type = kInternal;
+
+        // Children work on their own ranges, so large ones are built concurrently
+        int leftcount = splitidx - first;
+        if (numprims >= kMinTaskPrims)
+        {
+            GLSLPT::TaskPool& pool = GLSLPT::TaskPool::Instance();
+            GLSLPT::TaskPool::Group group;
+            pool.Spawn(group, [&]() { node->rc = BuildLinearNode(splitidx, numprims - leftcount, bit - 1, level + 1, (index << 1) + 1, bounds, prims); });
+            node->lc = BuildLinearNode(first, leftcount, bit - 1, level + 1, index << 1, bounds, prims);
+            pool.Wait(group);
+        }
+        else
+        {
+            node->lc = BuildLinearNode(first, leftcount, bit - 1, level + 1, index << 1, bounds, prims);
+            node->rc = BuildLinearNode(splitidx, numprims - leftcount, bit - 1, level + 1, (index << 1) + 1, bounds, prims);
+        }
+
+        node->bounds = bboxunion(node->lc->bounds, node->rc->bounds);
+        return node;
+    }
+
+    Bvh::Node* LinearBvh::BuildClusterNode(Cluster* clusters, int numclusters, int level, int index, bbox const* bounds, MortonPrim const* prims)
+    {
+        if (numclusters == 1)
+        {
+            int bit = 3 * kMortonAxisBits - kClusterBits - 1;
+            return BuildLinearNode(clusters[0].first, clusters[0].numprims, bit, level, index, bounds, prims);
+        }
+
+        UpdateHeight(level);
+
+        Node* node = AllocateNode();
+        node->index = index;
+        node->type = kInternal;
+
+        bbox nodebounds, centroid_bounds;
+        int numprims = 0;
+        for (int i = 0; i < numclusters; ++i)
+        {
+            nodebounds.grow(clusters[i].bounds);
+            centroid_bounds.grow(clusters[i].bounds.center());
+            numprims += clusters[i].numprims;
+        }
+        node->bounds = nodebounds;
+
+        // Binned SAH over the cluster centroids, a cluster costs like one primitive
+        int splitidx = -1;
+        Vec3 centroid_extents = centroid_bounds.extents();
+        if (Vec3::Dot(centroid_extents, centroid_extents) > 0.f)
+        {
+            SahBins bins;
+            bins.init(m_num_bins, centroid_bounds);
+            for (int i = 0; i < numclusters; ++i)
+            {
+                SimdBox box = SimdBox::Load(clusters[i].bounds);
+                bins.add(box.center(), box);
+            }
+
+            SimdBox leftboxes[kMaxSahBins];
+            SimdBox rightboxes[kMaxSahBins];
+            alignas(16) float sahs[kMaxSahBins];
+            float invarea = 1.f / nodebounds.surface_area();
+            float sah = std::numeric_limits<float>::max();
+            int axis = 0;
+            int bin = -1;
+            for (int dim = 0; dim < 3; ++dim)
+            {
+                if (centroid_extents[dim] == 0.f) continue;
+
+                bins.evaluate(dim, numclusters, m_traversal_cost, invarea, sahs, leftboxes, rightboxes);
+                for (int i = 0; i < m_num_bins - 1; ++i)
+                {
+                    if (sahs[i] < sah)
+                    {
+                        sah = sahs[i];
+                        axis = dim;
+                        bin = i;
+                    }
+                }
+            }
+
+            if (bin != -1)
+            {
+                float border = centroid_bounds.pmin[axis] + (bin + 1) * (centroid_extents[axis] / m_num_bins);
+                Cluster* split = std::partition(clusters, clusters + numclusters,
+                    [axis, border](Cluster const& cluster) { return cluster.bounds.center()[axis] < border; });
+                splitidx = static_cast<int>(split - clusters);
+            }
+        }
+
+        if (splitidx <= 0 || splitidx >= numclusters)
+            splitidx = numclusters >> 1;
+
+        if (numprims >= kMinTaskPrims)
+        {
+            GLSLPT::TaskPool& pool = GLSLPT::TaskPool::Instance();
+            GLSLPT::TaskPool::Group group;
+            pool.Spawn(group, [&]() { node->rc = BuildClusterNode(clusters + splitidx, numclusters - splitidx, level + 1, (index << 1) + 1, bounds, prims); });
+            node->lc = BuildClusterNode(clusters, splitidx, level + 1, index << 1, bounds, prims);
+            pool.Wait(group);
+        }
+        else
+        {
+            node->lc = BuildClusterNode(clusters, splitidx, level + 1, index << 1, bounds, prims);
+            node->rc = BuildClusterNode(clusters + splitidx, numclusters - splitidx, level + 1, (index << 1) + 1, bounds, prims);
+        }
+
+        return node;
+    }
+
+    void LinearBvh::PrintStatistics(std::ostream& os) const
+    {
+        os << "Class name: " << "LinearBvh\n";
+        os << "SAH clusters: " << (m_usesah ? "enabled\n" : "disabled\n");
+        os << "Max primitives per leaf: " << m_max_leaf_prims << "\n";
+        os << "Number of triangles: " << m_indices.size() << "\n";
+        os << "Number of nodes: " << m_nodecnt << "\n";
+        os << "Tree height: " << GetHeight() << "\n";
+    }
+
+    std::string LinearBvh::GetBuildParams() const
+    {
+        return "LinearBvh " + std::to_string(m_traversal_cost) + " " + std::to_string(m_max_leaf_prims) + " " + std::to_string(m_usesah);
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <cstdint>
+
+#include "bvh.h"
+
+namespace RadeonRays
+{
+    // Linear BVH (LBVH). Primitives are ordered along a 30 bit Morton curve through
+    // their centroids by a parallel radix sort, then every range is split where the
+    // highest bit that differs inside it changes. The build is a sort and a pass over
+    // the sorted codes, which makes it fast enough for interactive rebuilds.
+    //
+    // With usesah the codes are first cut into clusters that share their top
+    // kClusterBits bits, each cluster gets its own LBVH and binned SAH joins the
+    // cluster roots (HLBVH). This recovers most of the tree quality plain LBVH
+    // loses near the root, where a split in the middle of the space is worst
+    class LinearBvh : public Bvh
+    {
+    public:
+        // Leaves get at most max_leaf_prims primitives, a TLAS needs 1
+        LinearBvh(float traversal_cost, int max_leaf_prims, bool usesah)
+            : Bvh(traversal_cost, 16, usesah)
+            , m_max_leaf_prims(max_leaf_prims > 1 ? max_leaf_prims : 1)
+        {
+        }
+
+        ~LinearBvh() = default;
+
+    protected:
+        // Morton code of a primitive's centroid and the primitive
+        struct MortonPrim
+        {
+            uint32_t code;
+            int index;
+        };
+
+        // Primitives of the sorted order whose codes share their top kClusterBits bits
+        struct Cluster
+        {
+            int first;
+            int numprims;
+            bbox bounds;
+        };
+
+        // Build function
+        void BuildImpl(bbox const* bounds, int numbounds) override;
+
+        // Sorts prims by code, stable so equal codes stay in primitive order
+        void SortMortonPrims(std::vector<MortonPrim>& prims) const;
+
+        // LBVH of the sorted primitives first to first + numprims - 1, splitting on
+        // the code bits from bit downwards
+        Node* BuildLinearNode(int first, int numprims, int bit, int level, int index, bbox const* bounds, MortonPrim const* prims);
+
+        // Binned SAH tree over the clusters, each cluster becomes the LBVH of its primitives
+        Node* BuildClusterNode(Cluster* clusters, int numclusters, int level, int index, bbox const* bounds, MortonPrim const* prims);
+
+        // Print BVH statistics
+        void PrintStatistics(std::ostream& os) const override;
+
+        std::string GetBuildParams() const override;
+
+    private:
+        // Bits per axis of the Morton codes and how many of the top bits of a code
+        // pick its HLBVH cluster
+        static int constexpr kMortonAxisBits = 10;
+        static int constexpr kClusterBits = 12;
+        // Bits sorted per radix sort pass
+        static int constexpr kRadixBits = 10;
+
+        int m_max_leaf_prims;
+
+        LinearBvh(LinearBvh const&) = delete;
+        LinearBvh& operator = (LinearBvh const&) = delete;
+    };
+}
@@ -0,0 +1,232 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <emmintrin.h>
+#include <algorithm>
+#include <limits>
+
+#include "bbox.h"
+
+namespace RadeonRays
+{
+    // Most bins an object split search can use, bins are kept on the stack
+    static int constexpr kMaxSahBins = 64;
+
+    // Box with its corners in SSE registers, the w lanes are unused. Growing picks
+    // the same values bbox::grow does, so converted boxes match the scalar ones bit
+    // for bit. Left uninitialized on construction so arrays of them cost nothing
+    struct SimdBox
+    {
+        __m128 pmin;
+        __m128 pmax;
+
+        static SimdBox Empty()
+        {
+            SimdBox box;
+            box.pmin = _mm_set1_ps(std::numeric_limits<float>::max());
+            box.pmax = _mm_set1_ps(-std::numeric_limits<float>::max());
+            return box;
+        }
+
+        // Reads only the 24 bytes of b, so the last box of an array is safe to load
+        static SimdBox Load(bbox const& b)
+        {
+            SimdBox box;
+            box.pmin = _mm_loadu_ps(&b.pmin.x);
+            __m128 v = _mm_loadu_ps(&b.pmin.z);
+            box.pmax = _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 3, 2, 1));
+            return box;
+        }
+
+        void grow(SimdBox const& b)
+        {
+            // In this order ties keep the current value like std::min and std::max
+            pmin = _mm_min_ps(b.pmin, pmin);
+            pmax = _mm_max_ps(b.pmax, pmax);
+        }
+
+        __m128 center() const
+        {
+            return _mm_mul_ps(_mm_add_ps(pmax, pmin), _mm_set1_ps(0.5f));
+        }
+
+        bbox tobbox() const
+        {
+            alignas(16) float mn[4];
+            alignas(16) float mx[4];
+            _mm_store_ps(mn, pmin);
+            _mm_store_ps(mx, pmax);
+
+            bbox b;
+            b.pmin = Vec3(mn[0], mn[1], mn[2]);
+            b.pmax = Vec3(mx[0], mx[1], mx[2]);
+            return b;
+        }
+    };
+
+    // Surface areas of boxes[first] to boxes[first + 3], computed like bbox::surface_area.
+    // Indices past last repeat the last box
+    inline __m128 SurfaceArea4(SimdBox const* boxes, int first, int last)
+    {
+        __m128 x = _mm_sub_ps(boxes[first].pmax, boxes[first].pmin);
+        __m128 y = _mm_sub_ps(boxes[std::min(first + 1, last)].pmax, boxes[std::min(first + 1, last)].pmin);
+        __m128 z = _mm_sub_ps(boxes[std::min(first + 2, last)].pmax, boxes[std::min(first + 2, last)].pmin);
+        __m128 w = _mm_sub_ps(boxes[std::min(first + 3, last)].pmax, boxes[std::min(first + 3, last)].pmin);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+
+        __m128 area = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, y), _mm_mul_ps(x, z)), _mm_mul_ps(y, z));
+        return _mm_mul_ps(_mm_set1_ps(2.f), area);
+    }
+
+    // Boxes and their surface areas on both sides of the numbins - 1 borders between
+    // bins, border i lies between bin i and bin i + 1. The area arrays need room for
+    // the number of borders rounded up to a multiple of 4
+    inline void SweepBins(SimdBox const* bins, int numbins, SimdBox* leftboxes, SimdBox* rightboxes, float* leftareas, float* rightareas)
+    {
+        int numborders = numbins - 1;
+
+        SimdBox box = SimdBox::Empty();
+        for (int i = 0; i < numborders; ++i)
+        {
+            box.grow(bins[i]);
+            leftboxes[i] = box;
+        }
+
+        box = SimdBox::Empty();
+        for (int i = numborders; i > 0; --i)
+        {
+            box.grow(bins[i]);
+            rightboxes[i - 1] = box;
+        }
+
+        for (int i = 0; i < numborders; i += 4)
+        {
+            _mm_storeu_ps(leftareas + i, SurfaceArea4(leftboxes, i, numborders - 1));
+            _mm_storeu_ps(rightareas + i, SurfaceArea4(rightboxes, i, numborders - 1));
+        }
+    }
+
+    // Centroid histogram of an object split search, one row of bins per axis
+    struct SahBins
+    {
+        // Empties the bins and spreads the centroids in centroid_bounds over numbins
+        // bins per axis. Degenerate axes put everything in their first bin
+        void init(int num_bins, bbox const& centroid_bounds)
+        {
+            numbins = num_bins;
+
+            Vec3 extents = centroid_bounds.extents();
+            alignas(16) float inv[4] = { 0.f, 0.f, 0.f, 0.f };
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                if (extents[axis] != 0.f)
+                    inv[axis] = 1.f / extents[axis];
+            }
+
+            origin = _mm_setr_ps(centroid_bounds.pmin.x, centroid_bounds.pmin.y, centroid_bounds.pmin.z, 0.f);
+            invextents = _mm_load_ps(inv);
+            scale = _mm_set1_ps(static_cast<float>(numbins));
+            lastbin = _mm_set1_ps(static_cast<float>(numbins - 1));
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                for (int i = 0; i < numbins; ++i)
+                {
+                    boxes[axis][i] = SimdBox::Empty();
+                    counts[axis][i] = 0;
+                }
+            }
+        }
+
+        // Bins a primitive on all axes at once
+        void add(__m128 center, SimdBox const& box)
+        {
+            // Same operations as the scalar search, clamping NaN and negative values to bin 0
+            __m128 pos = _mm_mul_ps(scale, _mm_mul_ps(_mm_sub_ps(center, origin), invextents));
+            pos = _mm_min_ps(lastbin, _mm_max_ps(pos, _mm_setzero_ps()));
+
+            alignas(16) int binidx[4];
+            _mm_store_si128((__m128i*)binidx, _mm_cvttps_epi32(pos));
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                boxes[axis][binidx[axis]].grow(box);
+                ++counts[axis][binidx[axis]];
+            }
+        }
+
+        void merge(SahBins const& other)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                for (int i = 0; i < numbins; ++i)
+                {
+                    boxes[axis][i].grow(other.boxes[axis][i]);
+                    counts[axis][i] += other.counts[axis][i];
+                }
+            }
+        }
+
+        // SAH of the borders of an axis. The boxes on both sides are kept for the
+        // callers that need more than the cost
+        void evaluate(int axis, int numprims, float traversal_cost, float invarea, float* sah, SimdBox* leftboxes, SimdBox* rightboxes) const
+        {
+            alignas(16) float leftareas[kMaxSahBins];
+            alignas(16) float rightareas[kMaxSahBins];
+            alignas(16) int leftcounts[kMaxSahBins];
+
+            SweepBins(boxes[axis], numbins, leftboxes, rightboxes, leftareas, rightareas);
+
+            // Counts past the last border only pad the last group of 4
+            int numborders = numbins - 1;
+            int leftcount = 0;
+            for (int i = 0; i < ((numborders + 3) & ~3); ++i)
+            {
+                leftcount += i < numborders ? counts[axis][i] : 0;
+                leftcounts[i] = leftcount;
+            }
+
+            __m128 cost = _mm_set1_ps(traversal_cost);
+            __m128 inv = _mm_set1_ps(invarea);
+            __m128i total = _mm_set1_epi32(numprims);
+            for (int i = 0; i < numborders; i += 4)
+            {
+                __m128i left = _mm_load_si128((__m128i const*)(leftcounts + i));
+                __m128 leftsah = _mm_mul_ps(_mm_cvtepi32_ps(left), _mm_load_ps(leftareas + i));
+                __m128 rightsah = _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(total, left)), _mm_load_ps(rightareas + i));
+                _mm_storeu_ps(sah + i, _mm_add_ps(cost, _mm_mul_ps(_mm_add_ps(leftsah, rightsah), inv)));
+            }
+        }
+
+        int numbins;
+        __m128 origin;
+        __m128 invextents;
+        __m128 scale;
+        __m128 lastbin;
+
+        SimdBox boxes[3][kMaxSahBins];
+        int counts[3][kMaxSahBins];
+    };
+}
@@ -1,4 +1,6 @@
 #include "split_bvh.h"
+#include "TaskPool.h"
+#include "sah_bins.h"
 #include <algorithm>
 #include <cassert>
 #include <cmath>
@@ -10,20 +12,29 @@ namespace RadeonRays
 {
     void SplitBvh::BuildImpl(bbox const* bounds, int numbounds)
     {
-        // Initialize prim refs structures
-        PrimRefArray primrefs(numbounds);
-
-        // Keep centroids to speed up partitioning
-        std::vector<Vec3> centroids(numbounds);
-        bbox centroid_bounds;
+        GLSLPT::TaskPool& pool = GLSLPT::TaskPool::Instance();
 
-        for (auto i = 0; i < numbounds; ++i)
+        // Initialize prim refs structures
+        m_ref_arrays.clear();
+        m_ref_arrays.emplace_back(numbounds);
+        PrimRefArray& primrefs = m_ref_arrays[0];
+
+        // Calc centroid bounds, chunks are merged in order
+        int numchunks = (numbounds + kBinningChunkPrims - 1) / kBinningChunkPrims;
+        std::vector<bbox> chunkbounds(numchunks);
+        pool.ParallelFor(numchunks, [&](int chunk)
         {
-            primrefs[i] = PrimRef{ bounds[i], bounds[i].center(), i };
+            int end = std::min(numbounds, (chunk + 1) * kBinningChunkPrims);
+            for (int i = chunk * kBinningChunkPrims; i < end; ++i)
+            {
+                primrefs[i] = PrimRef{ bounds[i], bounds[i].center(), i };
+                chunkbounds[chunk].grow(primrefs[i].center);
+            }
+        });
 
-            auto c = bounds[i].center();
-            centroid_bounds.grow(c);
-        }
+        bbox centroid_bounds;
+        for (int chunk = 0; chunk < numchunks; ++chunk)
+            centroid_bounds.grow(chunkbounds[chunk]);
 
         m_num_nodes_for_regular = (2 * numbounds - 1);
         m_num_nodes_required = (int)(m_num_nodes_for_regular * (1.f + m_extra_refs_budget));
@@ -32,29 +43,87 @@ namespace RadeonRays
 
         SplitRequest init = { 0, numbounds, nullptr, m_bounds, centroid_bounds, 0 };
 
-        // Start from the top
-        BuildNode(init, primrefs);
+        // Start from the top, then build the subtrees below the spatial split levels
+        m_deferred.clear();
+        m_split_level_indices.clear();
+        BuildNode(init, primrefs, 0);
+
+        pool.ParallelFor((int)m_deferred.size(), [this](int i)
+        {
+            BuildNode(m_deferred[i], m_ref_arrays[i + 1], i + 1);
+        });
+
+        m_packed_indices.clear();
+        PackLeaves(m_root);
+
+        m_ref_arrays.clear();
+        m_deferred.clear();
+        m_split_level_indices.clear();
     }
 
-    void SplitBvh::BuildNode(SplitRequest& req, PrimRefArray& primrefs)
+    void SplitBvh::PackLeaves(Node* node)
     {
+        if (node->type == kLeaf)
+        {
+            int startidx = (int)m_packed_indices.size();
+            for (int i = node->startidx; i < node->startidx + node->numprims; ++i)
+            {
+                m_packed_indices.push_back(node->refarray < 0 ? m_split_level_indices[i] : m_ref_arrays[node->refarray][i].idx);
+            }
+            node->startidx = startidx;
+        }
+        else
+        {
+            PackLeaves(node->rc);
+            PackLeaves(node->lc);
+        }
+    }
+
+    void SplitBvh::BuildNode(SplitRequest& req, PrimRefArray& primrefs, int refarray)
+    {
+        // Nothing below the spatial split levels adds prim refs, so the subtree only
+        // needs its own range. It is copied out before spatial splits of its siblings
+        // overwrite it and built once all the split levels are done. The copy keeps the
+        // parity of startidx, partitioning depends on it
+        bool splitlevel = req.level < m_max_split_depth;
+        if (!splitlevel && m_max_split_depth > 0 && refarray == 0)
+        {
+            int offset = req.startidx & 0x1;
+            m_ref_arrays.emplace_back(offset + req.numprims);
+            std::copy(primrefs.begin() + req.startidx, primrefs.begin() + req.startidx + req.numprims, m_ref_arrays.back().begin() + offset);
+            m_deferred.push_back(req);
+            m_deferred.back().startidx = offset;
+            return;
+        }
+
         // Update current height
-        m_height = std::max(m_height, req.level);
+        UpdateHeight(req.level);
 
         // Allocate new node
         Node* node = AllocateNode();
         node->bounds = req.bounds;
 
-        // Create leaf node if we have enough prims
+        // Create leaf node if we have enough prims. The prim refs of leaves on the
+        // split levels are saved right away, the others stay where they are until
+        // the tree is done
         if (req.numprims < 4)
         {
             node->type = kLeaf;
-            node->startidx = (int)m_packed_indices.size();
             node->numprims = req.numprims;
 
-            for (int i = req.startidx; i < req.startidx + req.numprims; ++i)
+            if (splitlevel)
+            {
+                node->refarray = -1;
+                node->startidx = (int)m_split_level_indices.size();
+                for (int i = req.startidx; i < req.startidx + req.numprims; ++i)
+                {
+                    m_split_level_indices.push_back(primrefs[i].idx);
+                }
+            }
+            else
             {
-                m_packed_indices.push_back(primrefs[i].idx);
+                node->refarray = refarray;
+                node->startidx = req.startidx;
             }
         }
         else
@@ -181,14 +250,21 @@ namespace RadeonRays
             SplitRequest rightrequest = { splitidx, req.numprims - (splitidx - req.startidx), &node->rc, rightbounds, rightcentroid_bounds, req.level + 1 };
 
 
-            // The order is very important here since right node uses the space at the end of the array to partition
+            // The order is very important on the split levels since right node uses the space at the end
+            // of the array to partition. Below them children work on their own ranges and large ones are
+            // built concurrently
+            if (!splitlevel && req.numprims >= kMinTaskPrims)
             {
-                BuildNode(rightrequest, primrefs);
+                GLSLPT::TaskPool& pool = GLSLPT::TaskPool::Instance();
+                GLSLPT::TaskPool::Group group;
+                pool.Spawn(group, [&]() { BuildNode(rightrequest, primrefs, refarray); });
+                BuildNode(leftrequest, primrefs, refarray);
+                pool.Wait(group);
             }
-
+            else
             {
-                // Put those to stack
-                BuildNode(leftrequest, primrefs);
+                BuildNode(rightrequest, primrefs, refarray);
+                BuildNode(leftrequest, primrefs, refarray);
             }
         }
 
@@ -219,89 +295,71 @@ namespace RadeonRays
             return split;
         }
 
-        // Bin has bbox and occurence count
-        struct Bin
-        {
-            bbox bounds;
-            int count;
-        };
-
-        // Keep bins for each dimension
-        std::vector<Bin> bins[3];
-        bins[0].resize(m_num_bins);
-        bins[1].resize(m_num_bins);
-        bins[2].resize(m_num_bins);
-
         // Precompute inverse parent area
         auto invarea = 1.f / req.bounds.surface_area();
         // Precompute min point
         auto rootmin = req.centroid_bounds.pmin;
 
-        // Evaluate all dimensions
-        for (int axis = 0; axis < 3; ++axis)
+        // Calc primitive refs histogram of all dimensions at once, large nodes in
+        // chunks that are merged in order. Merging only takes mins, maxs and sums
+        int numchunks = req.numprims >= kMinParallelBinningPrims ? (req.numprims + kBinningChunkPrims - 1) / kBinningChunkPrims : 1;
+        SahBins bins;
+        std::vector<SahBins> chunkbins(numchunks - 1);
+
+        auto binchunk = [&](int chunk)
         {
-            float rootminc = rootmin[axis];
-            // Range for histogram
-            auto centroid_rng = centroid_extents[axis];
-            auto invcentroid_rng = 1.f / centroid_rng;
+            SahBins& chunkb = chunk == 0 ? bins : chunkbins[chunk - 1];
+            chunkb.init(m_num_bins, req.centroid_bounds);
 
-            // If the box is degenerate in that dimension skip it
-            if (centroid_rng == 0.f) continue;
+            // The w lane of a loaded center holds the index, keep it out of the math
+            __m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
 
-            // Initialize bins
-            for (int i = 0; i < m_num_bins; ++i)
+            int begin = req.startidx + chunk * kBinningChunkPrims;
+            int end = numchunks == 1 ? req.startidx + req.numprims : std::min(begin + kBinningChunkPrims, req.startidx + req.numprims);
+            for (int i = begin; i < end; ++i)
             {
-                bins[axis][i].count = 0;
-                bins[axis][i].bounds = bbox();
-            }
-
-            // Calc primitive refs histogram
-            for (int i = req.startidx; i < req.startidx + req.numprims; ++i)
-            {
-                auto idx = i;
-                auto binidx = (int)std::min<float>(static_cast<float>(m_num_bins) * ((refs[idx].center[axis] - rootminc) * invcentroid_rng), static_cast<float>(m_num_bins - 1));
-
-                ++bins[axis][binidx].count;
-                bins[axis][binidx].bounds.grow(refs[idx].bounds);
+                chunkb.add(_mm_and_ps(_mm_loadu_ps(&refs[i].center.x), xyz), SimdBox::Load(refs[i].bounds));
             }
+        };
 
-            std::vector<bbox> rightbounds(m_num_bins - 1);
+        if (numchunks > 1)
+            GLSLPT::TaskPool::Instance().ParallelFor(numchunks, binchunk);
+        else
+            binchunk(0);
 
-            // Start with 1-bin right box
-            bbox rightbox = bbox();
-            for (int i = m_num_bins - 1; i > 0; --i)
-            {
-                rightbox.grow(bins[axis][i].bounds);
-                rightbounds[i - 1] = rightbox;
-            }
+        for (int chunk = 1; chunk < numchunks; ++chunk)
+            bins.merge(chunkbins[chunk - 1]);
 
-            bbox leftbox = bbox();
-            int  leftcount = 0;
-            int  rightcount = req.numprims;
+        // Evaluate all dimensions
+        SimdBox leftboxes[kMaxSahBins];
+        SimdBox rightboxes[kMaxSahBins];
+        alignas(16) float sahs[kMaxSahBins];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            // If the box is degenerate in that dimension skip it
+            if (centroid_extents[axis] == 0.f) continue;
 
-            // Start best SAH search
             // i is current split candidate (split between i and i + 1)
-            float sahtmp = 0.f;
+            bins.evaluate(axis, req.numprims, m_traversal_cost, invarea, sahs, leftboxes, rightboxes);
+            int best = -1;
             for (int i = 0; i < m_num_bins - 1; ++i)
             {
-                leftbox.grow(bins[axis][i].bounds);
-                leftcount += bins[axis][i].count;
-                rightcount -= bins[axis][i].count;
-
-                // Compute SAH
-                sahtmp = m_traversal_cost + (leftcount * leftbox.surface_area() + rightcount * rightbounds[i].surface_area()) * invarea;
-
                 // Check if it is better than what we found so far
-                if (sahtmp < sah)
+                if (sahs[i] < sah)
                 {
-                    split.dim = axis;
-                    splitidx = i;
-                    sah = sahtmp;
-
-                    // Calculate percentage of overlap 
-                    split.overlap = intersection(leftbox, rightbounds[i]).surface_area() * invarea;
+                    best = i;
+                    sah = sahs[i];
                 }
             }
+
+            if (best != -1)
+            {
+                split.dim = axis;
+                splitidx = best;
+
+                // Calculate percentage of overlap
+                split.overlap = intersection(leftboxes[best].tobbox(), rightboxes[best].tobbox()).surface_area() * invarea;
+            }
         }
 
         // Choose split plane
@@ -338,15 +396,10 @@ namespace RadeonRays
             return split;
         }
 
-        // Bin has start and exit counts + bounds
-        struct Bin
-        {
-            bbox bounds;
-            int enter;
-            int exit;
-        };
-
-        Bin bins[3][kNumBins];
+        // Bins have bounds and start and exit counts
+        SimdBox binbounds[3][kNumBins];
+        int enter[3][kNumBins];
+        int exit[3][kNumBins];
 
         // Prepcompute some useful stuff
         Vec3 origin = req.bounds.pmin;
@@ -358,9 +411,9 @@ namespace RadeonRays
         {
             for (int i = 0; i < kNumBins; ++i)
             {
-                bins[axis][i].bounds = bbox();
-                bins[axis][i].enter = 0;
-                bins[axis][i].exit = 0;
+                binbounds[axis][i] = SimdBox::Empty();
+                enter[axis][i] = 0;
+                exit[axis][i] = 0;
             }
         }
 
@@ -388,21 +441,24 @@ namespace RadeonRays
                     if (SplitPrimRef(tempref, axis, splitval, leftref, rightref))
                     {
                         // Add left one
-                        bins[axis][j].bounds.grow(leftref.bounds);
+                        binbounds[axis][j].grow(SimdBox::Load(leftref.bounds));
                         // Save right to add part of it into the next bin
                         tempref = rightref;
                     }
                 }
                 // Add the last piece into the last bin
-                bins[axis][(int)lastbin[axis]].bounds.grow(tempref.bounds);
+                binbounds[axis][(int)lastbin[axis]].grow(SimdBox::Load(tempref.bounds));
                 // Adjust enter & exit counters
-                bins[axis][(int)firstbin[axis]].enter++;
-                bins[axis][(int)lastbin[axis]].exit++;
+                enter[axis][(int)firstbin[axis]]++;
+                exit[axis][(int)lastbin[axis]]++;
             }
         }
 
         // Prepare moving window data
-        bbox rightbounds[kNumBins - 1];
+        SimdBox leftboxes[kNumBins];
+        SimdBox rightboxes[kNumBins];
+        alignas(16) float leftareas[kNumBins];
+        alignas(16) float rightareas[kNumBins];
         split.sah = std::numeric_limits<float>::max();
 
         // Iterate over axis
@@ -412,30 +468,22 @@ namespace RadeonRays
             if (extents[axis] == 0.f)
                 continue;
 
-            // Start with 1-bin right box
-            bbox rightbox = bbox();
-            for (int i = kNumBins - 1; i > 0; --i)
-            {
-                rightbox = bboxunion(rightbox, bins[axis][i].bounds);
-                rightbounds[i - 1] = rightbox;
-            }
+            // Boxes and areas on both sides of each border
+            SweepBins(binbounds[axis], kNumBins, leftboxes, rightboxes, leftareas, rightareas);
 
-            bbox leftbox = bbox();
             int  leftcount = 0;
             int  rightcount = req.numprims;
 
             // Start moving border to the right
             for (int i = 1; i < kNumBins; ++i)
             {
-                // New left box
-                leftbox.grow(bins[axis][i - 1].bounds);
                 // New left box count
-                leftcount += bins[axis][i - 1].enter;
+                leftcount += enter[axis][i - 1];
                 // Adjust right box
-                rightcount -= bins[axis][i - 1].exit;
+                rightcount -= exit[axis][i - 1];
                 // Calc SAH
-                float sah = m_traversal_cost + (leftbox.surface_area() *
-                    +rightbounds[i - 1].surface_area() * rightcount)  * invarea;
+                float sah = m_traversal_cost + (leftareas[i - 1] *
+                    +rightareas[i - 1] * rightcount)  * invarea;
 
                 // Update SAH if it is needed
                 if (sah < split.sah)
@@ -498,19 +546,27 @@ namespace RadeonRays
 
     SplitBvh::Node* SplitBvh::AllocateNode()
     {
-        if (m_nodecnt - m_num_nodes_archived >= m_num_nodes_for_regular)
+        int index = m_nodecnt++;
+        if (index < (int)m_nodes.size())
         {
-            m_node_archive.push_back(std::move(m_nodes));
-            m_num_nodes_archived += m_num_nodes_for_regular;
-            m_nodes = std::vector<Node>(m_num_nodes_for_regular);
+            return &m_nodes[index];
         }
 
-        return &m_nodes[m_nodecnt++ - m_num_nodes_archived];
+        // Spatial splits went past the node budget
+        std::lock_guard<std::mutex> lock(m_node_archive_mutex);
+        if (m_node_archive.empty() || m_num_archive_nodes_used == m_num_nodes_for_regular)
+        {
+            m_node_archive.push_back(std::vector<Node>(m_num_nodes_for_regular));
+            m_num_archive_nodes_used = 0;
+        }
+
+        return &m_node_archive.back()[m_num_archive_nodes_used++];
     }
 
     void SplitBvh::InitNodeAllocator(size_t maxnum)
     {
         m_node_archive.clear();
+        m_num_archive_nodes_used = 0;
         m_nodecnt = 0;
         m_nodes.resize(maxnum);
 
@@ -535,5 +591,11 @@ namespace RadeonRays
         os << "Node overhead: " << ((float)(m_nodecnt - m_num_nodes_for_regular) / m_num_nodes_for_regular) * 100.f << "%\n";
         os << "Tree height: " << GetHeight() << "\n";
     }
+
+    std::string SplitBvh::GetBuildParams() const
+    {
+        return "SplitBvh " + Bvh::GetBuildParams() + " " + std::to_string(m_max_split_depth) + " " +
+            std::to_string(m_min_overlap) + " " + std::to_string(m_extra_refs_budget);
+    }
 }
 
@@ -21,6 +21,9 @@
  ********************************************************************/
 #pragma once
 
+#include <deque>
+#include <mutex>
+
 #include "bvh.h"
 
 namespace RadeonRays
@@ -39,7 +42,7 @@ namespace RadeonRays
         , m_extra_refs_budget(extra_refs_budget)
         , m_num_nodes_required(0)
         , m_num_nodes_for_regular(0)
-        , m_num_nodes_archived(0)
+        , m_num_archive_nodes_used(0)
         {
         }
 
@@ -57,7 +60,11 @@ namespace RadeonRays
 
         // Build function
         void BuildImpl(bbox const* bounds, int numbounds) override;
-        void BuildNode(SplitRequest& req, PrimRefArray& primrefs);
+        // Leaves keep their prim refs in primrefs, which is m_ref_arrays[refarray]
+        void BuildNode(SplitRequest& req, PrimRefArray& primrefs, int refarray);
+        // Copies the primitives of the leaves to m_packed_indices in the order a
+        // serial build writes them, right subtrees first
+        void PackLeaves(Node* node);
         
         SahSplit FindObjectSahSplit(SplitRequest const& req, PrimRefArray const& refs) const;
         SahSplit FindSpatialSahSplit(SplitRequest const& req, PrimRefArray const& refs) const;
@@ -68,6 +75,8 @@ namespace RadeonRays
         // Print BVH statistics
         void PrintStatistics(std::ostream& os) const override;
 
+        std::string GetBuildParams() const override;
+
     protected:
         Node* AllocateNode() override;
         void  InitNodeAllocator(size_t maxnum) override;
@@ -80,14 +89,21 @@ namespace RadeonRays
         int m_num_nodes_required;
         int m_num_nodes_for_regular;
 
-        // Node archive for memory management
-        // As m_nodes fills up we archive it into m_node_archive
-        // allocate new chunk and work there.
-
-        // How many nodes have been archived so far
-        int m_num_nodes_archived;
-        // Container for archived chunks
+        // Nodes past the size of m_nodes come from chunks allocated on demand
+        // How many nodes of the last chunk are taken
+        int m_num_archive_nodes_used;
+        // Container for the chunks
         std::list<std::vector<Node>> m_node_archive;
+        std::mutex m_node_archive_mutex;
+
+        // Build state. Spatial splits append prim refs, so the levels that may split
+        // spatially are built serially first. The subtrees below them get their own copy
+        // of their prim refs, index 1 and up in m_ref_arrays, and are built concurrently
+        // after that. Index 0 is the array of the whole tree
+        std::deque<PrimRefArray> m_ref_arrays;
+        std::vector<SplitRequest> m_deferred;
+        // Primitives of leaves on the spatial split levels, which may be overwritten later
+        std::vector<int> m_split_level_indices;
 
         SplitBvh(SplitBvh const&) = delete;
         SplitBvh& operator = (SplitBvh const&) = delete;
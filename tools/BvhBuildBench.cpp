@@ -0,0 +1,163 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// Thread scaling benchmark for the BVH builders. Builds each of them over the same
+// random boxes with the task pool set to 1, 2, 4 ... 64 threads and prints the best
+// time of a few runs, so builder changes can be compared on any machine. Fails if a
+// build differs from the single threaded one.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "bvh.h"
+#include "split_bvh.h"
+#include "linear_bvh.h"
+#include "TaskPool.h"
+#include "Hash.h"
+
+using namespace RadeonRays;
+
+// Boxes of triangle size scattered over a flattened volume, seeded so every run sees the same input
+static std::vector<bbox> RandomBoxes(int count)
+{
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> position(0.0f, 100.0f);
+    std::uniform_real_distribution<float> offset(-0.5f, 0.5f);
+
+    std::vector<bbox> boxes(count);
+    for (int i = 0; i < count; i++)
+    {
+        Vec3 p(position(rng), position(rng) * 0.2f, position(rng));
+        bbox box(p);
+        box.grow(p + Vec3(offset(rng), offset(rng), offset(rng)));
+        box.grow(p + Vec3(offset(rng), offset(rng), offset(rng)));
+        boxes[i] = box;
+    }
+    return boxes;
+}
+
+// The builders the renderer creates for meshes, see CreateBvh
+static Bvh *CreateBuilder(int builder)
+{
+    switch (builder)
+    {
+    case 0: return new Bvh(2.0f, 64, false);
+    case 1: return new SplitBvh(2.0f, 64, 0, 0.001f, 0);
+    case 2: return new LinearBvh(2.0f, 4, false);
+    default: return new LinearBvh(2.0f, 4, true);
+    }
+}
+
+// Hash of the flattened nodes and the primitive indices, which is everything the
+// renderer keeps of a build
+static uint64_t HashBuild(const Bvh *bvh)
+{
+    std::vector<Bvh::FlatNode> nodes(bvh->GetNodeCount());
+    bvh->Flatten(&nodes[0], 0, 0);
+
+    uint64_t hash = GLSLPT::Hash::Bytes(&nodes[0], nodes.size() * sizeof(Bvh::FlatNode));
+    return GLSLPT::Hash::Bytes(bvh->GetIndices(), bvh->GetNumIndices() * sizeof(int), hash);
+}
+
+static const char *kBuilderNames[] = { "Bvh", "SplitBvh", "LBVH", "HLBVH" };
+static const int kNumBuilders = 4;
+
+int main(int argc, char **argv)
+{
+    if (argc > 3)
+    {
+        printf("Usage: bvh-build-bench [boxes] [runs]\n");
+        return 1;
+    }
+
+    int numBoxes = argc > 1 ? atoi(argv[1]) : 1000000;
+    int numRuns = argc > 2 ? atoi(argv[2]) : 3;
+    if (numBoxes < 1 || numRuns < 1)
+    {
+        printf("Usage: bvh-build-bench [boxes] [runs]\n");
+        return 1;
+    }
+
+    std::vector<bbox> boxes = RandomBoxes(numBoxes);
+    printf("%d boxes, best of %d runs, %d hardware threads\n\n", numBoxes, numRuns, (int)std::thread::hardware_concurrency());
+    printf("%-8s", "threads");
+    for (int b = 0; b < kNumBuilders; b++)
+        printf("%14s%9s", kBuilderNames[b], "speedup");
+    printf("\n");
+
+    double singleThreaded[kNumBuilders] = {};
+    int nodes[kNumBuilders] = {};
+    uint64_t singleThreadedHash[kNumBuilders] = {};
+    bool deterministic = true;
+
+    for (int numThreads = 1; numThreads <= 64; numThreads *= 2)
+    {
+        GLSLPT::TaskPool::Instance().SetNumThreads(numThreads);
+        printf("%-8d", numThreads);
+
+        for (int b = 0; b < kNumBuilders; b++)
+        {
+            double best = 0.0;
+            for (int run = 0; run < numRuns; run++)
+            {
+                Bvh *bvh = CreateBuilder(b);
+
+                auto start = std::chrono::high_resolution_clock::now();
+                bvh->Build(&boxes[0], numBoxes);
+                auto end = std::chrono::high_resolution_clock::now();
+
+                double ms = std::chrono::duration<double, std::milli>(end - start).count();
+                best = run == 0 ? ms : std::min(best, ms);
+                nodes[b] = bvh->GetNodeCount();
+
+                uint64_t hash = HashBuild(bvh);
+                if (numThreads == 1 && run == 0)
+                    singleThreadedHash[b] = hash;
+                else if (hash != singleThreadedHash[b])
+                {
+                    printf("\n%s with %d threads differs from the single threaded build\n", kBuilderNames[b], numThreads);
+                    deterministic = false;
+                }
+                delete bvh;
+            }
+
+            if (numThreads == 1)
+                singleThreaded[b] = best;
+            printf("%11.1f ms%8.2fx", best, singleThreaded[b] / best);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    printf("\nnodes  ");
+    for (int b = 0; b < kNumBuilders; b++)
+        printf("%14d%9s", nodes[b], "");
+    printf("\n");
+
+    return deterministic ? 0 : 1;
+}
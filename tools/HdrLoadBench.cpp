@@ -0,0 +1,157 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// HDR load benchmark. Writes run length encoded test maps of 1024x512 up to 8192x4096
+// with stb_image_write, then loads each a few times per sampling option and prints
+// the best times. The loader logs how each load splits into decode and sampling data.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "hdrloader.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+static const int kSizes[][2] = { { 1024, 512 }, { 2048, 1024 }, { 4096, 2048 }, { 8192, 4096 } };
+
+// Tiles of constant radiance between noise spanning a few stops, so the file has runs for the
+// encoder to compress and values that exercise the whole exponent range. Seeded so every
+// machine gets the same files
+static bool WriteTestMap(const std::string &filename, int width, int height)
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> noise(0.0f, 10.0f);
+    std::uniform_int_distribution<int> stops(-4, 3);
+
+    std::vector<float> pixels((size_t)width * height * 3);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            float value = (x / 64 + y / 64) % 3 == 0 ? 0.5f : noise(rng);
+            for (int c = 0; c < 3; c++)
+                pixels[((size_t)y * width + x) * 3 + c] = value * (c + 1) * ldexpf(1.0f, stops(rng));
+        }
+    }
+
+    if (!stbi_write_hdr(filename.c_str(), width, height, 3, &pixels[0]))
+    {
+        printf("Unable to write %s\n", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+struct SamplingOption
+{
+    const char *name;
+    HDRLoadOptions options;
+};
+
+int main(int argc, char **argv)
+{
+    if (argc > 3)
+    {
+        printf("Usage: hdr-load-bench [directory for the test maps] [runs]\n");
+        return 1;
+    }
+
+    std::string directory = argc > 1 ? argv[1] : ".";
+    int runs = argc > 2 ? atoi(argv[2]) : 3;
+    if (runs < 1)
+    {
+        printf("Usage: hdr-load-bench [directory for the test maps] [runs]\n");
+        return 1;
+    }
+
+    std::vector<SamplingOption> samplingOptions(4);
+    samplingOptions[0].name = "CDF";
+    samplingOptions[1].name = "half CDF";
+    samplingOptions[1].options.halfDistribution = true;
+    samplingOptions[2].name = "alias";
+    samplingOptions[2].options.aliasTable = true;
+    samplingOptions[3].name = "pyramid";
+    samplingOptions[3].options.pyramidSize = 512;
+
+    const int numSizes = sizeof(kSizes) / sizeof(kSizes[0]);
+    std::vector<double> best(numSizes * samplingOptions.size());
+
+    for (int s = 0; s < numSizes; s++)
+    {
+        int width = kSizes[s][0];
+        int height = kSizes[s][1];
+
+        // Maps left by an earlier run are reused
+        std::string filename = directory + "/hdr_load_bench_" + std::to_string(width) + "x" + std::to_string(height) + ".hdr";
+        FILE *file = fopen(filename.c_str(), "rb");
+        if (file)
+            fclose(file);
+        else if (!WriteTestMap(filename, width, height))
+            return 1;
+
+        for (size_t o = 0; o < samplingOptions.size(); o++)
+        {
+            for (int run = 0; run < runs; run++)
+            {
+                auto start = std::chrono::high_resolution_clock::now();
+                HDRData *hdr = HDRLoader::load(filename.c_str(), samplingOptions[o].options);
+                auto end = std::chrono::high_resolution_clock::now();
+
+                if (hdr == nullptr)
+                {
+                    printf("Unable to load %s\n", filename.c_str());
+                    return 1;
+                }
+                delete hdr;
+
+                double ms = std::chrono::duration<double, std::milli>(end - start).count();
+                double &entry = best[s * samplingOptions.size() + o];
+                entry = run == 0 ? ms : std::min(entry, ms);
+            }
+        }
+    }
+
+    printf("\nBest of %d loads in ms\n%-12s", runs, "size");
+    for (size_t o = 0; o < samplingOptions.size(); o++)
+        printf("%12s", samplingOptions[o].name);
+    printf("\n");
+
+    for (int s = 0; s < numSizes; s++)
+    {
+        printf("%5dx%-6d", kSizes[s][0], kSizes[s][1]);
+        for (size_t o = 0; o < samplingOptions.size(); o++)
+            printf("%12.1f", best[s * samplingOptions.size() + o]);
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// OBJ parse throughput benchmark. Times the native parser against tinyobj on the
+// same file and prints MB/s, taking the best of a few runs so the file is in the
+// page cache. tinyobj is timed without the welding Mesh does after it, so its rate
+// is an upper bound. Can also write a synthetic grid mesh to run it on.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ObjLoader.h"
+
+// Mesh.cpp isn't linked, so tinyobj is built here
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+using namespace GLSLPT;
+
+// A grid x grid mesh of quads with positions, texcoords and normals, in the layout
+// exporters write. The heights are seeded so every run writes the same file
+static bool WriteGridObj(const std::string &filename, int grid)
+{
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (!file)
+    {
+        printf("Unable to write %s\n", filename.c_str());
+        return false;
+    }
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> height(-0.05f, 0.05f);
+
+    int side = grid + 1;
+    fprintf(file, "# %d x %d grid\no grid\n", grid, grid);
+    for (int y = 0; y < side; y++)
+        for (int x = 0; x < side; x++)
+            fprintf(file, "v %.6f %.6f %.6f\n", x / (float)grid, height(rng), y / (float)grid);
+    for (int y = 0; y < side; y++)
+        for (int x = 0; x < side; x++)
+            fprintf(file, "vt %.6f %.6f\n", x / (float)grid, y / (float)grid);
+    for (int y = 0; y < side; y++)
+        for (int x = 0; x < side; x++)
+            fprintf(file, "vn %.6f %.6f %.6f\n", height(rng), 1.0f, height(rng));
+
+    fprintf(file, "usemtl default\ns off\n");
+    for (int y = 0; y < grid; y++)
+    {
+        for (int x = 0; x < grid; x++)
+        {
+            int a = y * side + x + 1;
+            int b = a + 1;
+            int c = a + side + 1;
+            int d = a + side;
+            fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c, d, d, d);
+        }
+    }
+
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+static bool ParseWithTinyObj(const std::string &filename)
+{
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string err;
+    return tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filename.c_str(), 0, true);
+}
+
+static bool ParseWithLoadObjFast(const std::string &filename)
+{
+    std::vector<Vec4> verticesUVX;
+    std::vector<Vec4> normalsUVY;
+    std::vector<int> indices;
+    return LoadObjFast(filename, verticesUVX, normalsUVY, indices);
+}
+
+// Best time of runs parses in ms, or a negative value if the parser rejected the file
+static double TimeParser(bool (*parse)(const std::string &), const std::string &filename, int runs)
+{
+    double best = -1.0;
+    for (int run = 0; run < runs; run++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        if (!parse(filename))
+            return -1.0;
+        auto end = std::chrono::high_resolution_clock::now();
+
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        best = run == 0 ? ms : std::min(best, ms);
+    }
+    return best;
+}
+
+static void PrintUsage()
+{
+    printf("Usage: obj-parse-bench <input.obj> [runs]\n");
+    printf("       obj-parse-bench --generate <output.obj> [grid size]\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    if (strcmp(argv[1], "--generate") == 0)
+    {
+        if (argc < 3 || argc > 4)
+        {
+            PrintUsage();
+            return 1;
+        }
+
+        int grid = argc == 4 ? atoi(argv[3]) : 1000;
+        if (grid < 1 || !WriteGridObj(argv[2], grid))
+            return 1;
+
+        printf("Wrote %s: %d vertices, %d triangles\n", argv[2], (grid + 1) * (grid + 1), 2 * grid * grid);
+        return 0;
+    }
+
+    if (argc > 3)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    std::string input = argv[1];
+    int runs = argc == 3 ? atoi(argv[2]) : 5;
+
+    FILE *file = fopen(input.c_str(), "rb");
+    if (!file || runs < 1)
+    {
+        if (file)
+            fclose(file);
+        PrintUsage();
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    double mb = ftell(file) / (1024.0 * 1024.0);
+    fclose(file);
+
+    double fastMs = TimeParser(ParseWithLoadObjFast, input, runs);
+    double tinyMs = TimeParser(ParseWithTinyObj, input, runs);
+
+    printf("\n%s: %.2f MB, best of %d runs\n", input.c_str(), mb, runs);
+    if (fastMs < 0.0)
+        printf("LoadObjFast  rejected the file, meshes like it fall back to tinyobj\n");
+    else
+        printf("LoadObjFast  %9.2f ms %8.1f MB/s\n", fastMs, mb * 1000.0 / fastMs);
+    if (tinyMs < 0.0)
+        printf("tinyobj      failed to parse the file\n");
+    else
+        printf("tinyobj      %9.2f ms %8.1f MB/s\n", tinyMs, mb * 1000.0 / tinyMs);
+    if (fastMs > 0.0 && tinyMs > 0.0)
+        printf("Speedup      %9.2fx\n", tinyMs / fastMs);
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// Offline converter from OBJ, PLY or glTF meshes to precompiled .ptmesh files.
+// The BLAS is built once here with the same settings the renderer uses, so
+// loading the result only has to map the file.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "Mesh.h"
+#include "PtMeshLoader.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+using namespace GLSLPT;
+
+static std::string DefaultOutput(const std::string &input)
+{
+    size_t dot = input.find_last_of('.');
+    size_t slash = input.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return input + ".ptmesh";
+    return input.substr(0, dot) + ".ptmesh";
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        printf("Usage: ptmesh-convert <input.obj|input.ply> [output.ptmesh]\n");
+        return 1;
+    }
+
+    std::string input = argv[1];
+    std::string output = argc == 3 ? argv[2] : DefaultOutput(input);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    Mesh mesh;
+    if (!mesh.LoadFromFile(input))
+        return 1;
+
+    auto loaded = std::chrono::high_resolution_clock::now();
+
+    mesh.BuildBVH();
+
+    auto built = std::chrono::high_resolution_clock::now();
+
+    if (!SavePtMesh(output, mesh))
+        return 1;
+
+    auto saved = std::chrono::high_resolution_clock::now();
+
+    printf("%s: %d vertices, %d triangles, %d BVH nodes\n", output.c_str(),
+        (int)mesh.verticesUVX.size(), (int)mesh.indices.size() / 3, mesh.bvh->GetNodeCount());
+    printf("Load %.2f ms, BVH %.2f ms, write %.2f ms\n",
+        std::chrono::duration<double, std::milli>(loaded - start).count(),
+        std::chrono::duration<double, std::milli>(built - loaded).count(),
+        std::chrono::duration<double, std::milli>(saved - built).count());
+
+    return 0;
+}
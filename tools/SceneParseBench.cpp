@@ -0,0 +1,264 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// Scene file parse benchmark. Loads a scene a few times and prints the parse rate in
+// blocks/s the loader logs, next to the time of the whole load. Can also write a
+// synthetic scene of many small blocks to run it on.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+#include "Loader.h"
+#include "Scene.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+using namespace GLSLPT;
+
+static const char *kMeshFile = "scene_parse_bench.obj";
+
+// Blocks the last load reported parsing and how long that took
+static int parsedBlocks = 0;
+static double parseMs = 0.0;
+
+// Picks the parse rate out of the loader's log and drops everything else
+static int CaptureLog(const char *format, ...)
+{
+    char line[1024];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    sscanf(line, "Parsed %d blocks in %lf ms", &parsedBlocks, &parseMs);
+    return length;
+}
+
+// A scene of numBlocks blocks split like large exported scenes, 60% materials and
+// 20% each of lights and meshes. All meshes share one small OBJ written next to the
+// scene so loading it adds little to the parse. Seeded so every run writes the same file
+static bool WriteScene(const std::string &filename, int numBlocks)
+{
+    std::string path = filename.substr(0, filename.find_last_of("/\\") + 1);
+    FILE *obj = fopen((path + kMeshFile).c_str(), "wb");
+    if (!obj)
+    {
+        printf("Unable to write %s%s\n", path.c_str(), kMeshFile);
+        return false;
+    }
+    fprintf(obj, "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nvn 0 0 1\nf 1//1 2//1 3//1 4//1\n");
+    fclose(obj);
+
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (!file)
+    {
+        printf("Unable to write %s\n", filename.c_str());
+        return false;
+    }
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+
+    fprintf(file, "Renderer\n{\n\tresolution 800 800\n\tmaxDepth 2\n}\n\n");
+    fprintf(file, "Camera\n{\n\tposition 0 0 100\n\tlookAt 0 0 0\n\tfov 45\n}\n\n");
+
+    int numMaterials = std::max(numBlocks * 3 / 5, 1);
+    int numLights = numBlocks / 5;
+    int numMeshes = numBlocks - numMaterials - numLights;
+
+    for (int i = 0; i < numMaterials; i++)
+    {
+        fprintf(file, "material mat%d\n{\n", i);
+        fprintf(file, "\tcolor %.4f %.4f %.4f\n", unit(rng), unit(rng), unit(rng));
+        fprintf(file, "\troughness %.4f\n\tmetallic %.4f\n", unit(rng), unit(rng));
+        if (i % 4 == 0)
+            fprintf(file, "\tclearcoat %.4f\n\tclearcoatGloss %.4f\n", unit(rng), unit(rng));
+        fprintf(file, "}\n\n");
+    }
+
+    for (int i = 0; i < numLights; i++)
+    {
+        float x = position(rng), y = position(rng), z = position(rng);
+        if (i % 2 == 0)
+        {
+            fprintf(file, "light\n{\n\ttype Quad\n\tposition %.4f %.4f %.4f\n", x, y, z);
+            fprintf(file, "\tv1 %.4f %.4f %.4f\n\tv2 %.4f %.4f %.4f\n", x + 1.0f, y, z, x, y, z + 1.0f);
+        }
+        else
+            fprintf(file, "light\n{\n\ttype Sphere\n\tposition %.4f %.4f %.4f\n\tradius %.4f\n", x, y, z, unit(rng));
+        fprintf(file, "\temission %.2f %.2f %.2f\n}\n\n", 10.0f * unit(rng), 10.0f * unit(rng), 10.0f * unit(rng));
+    }
+
+    for (int i = 0; i < numMeshes; i++)
+    {
+        fprintf(file, "mesh\n{\n\tfile %s\n\tmaterial mat%d\n", kMeshFile, i % numMaterials);
+        fprintf(file, "\tposition %.4f %.4f %.4f\n\tscale 0.5 0.5 0.5\n}\n\n", position(rng), position(rng), position(rng));
+    }
+
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+// Copies the scene next to the original so relative asset paths still resolve. Refuses
+// to overwrite an existing file
+static bool CopyScene(const std::string &from, const std::string &to)
+{
+    FILE *existing = fopen(to.c_str(), "rb");
+    if (existing)
+    {
+        fclose(existing);
+        printf("%s already exists, remove it to run the benchmark\n", to.c_str());
+        return false;
+    }
+
+    FILE *in = fopen(from.c_str(), "rb");
+    if (!in)
+    {
+        printf("Unable to open %s\n", from.c_str());
+        return false;
+    }
+
+    FILE *out = fopen(to.c_str(), "wb");
+    if (!out)
+    {
+        printf("Unable to write %s\n", to.c_str());
+        fclose(in);
+        return false;
+    }
+
+    char buffer[64 * 1024];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        fwrite(buffer, 1, size, out);
+
+    bool ok = ferror(in) == 0 && ferror(out) == 0;
+    fclose(in);
+    fclose(out);
+    return ok;
+}
+
+static void PrintUsage()
+{
+    printf("Usage: scene-parse-bench <input.scene> [runs]\n");
+    printf("       scene-parse-bench --generate <output.scene> [blocks]\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    if (strcmp(argv[1], "--generate") == 0)
+    {
+        if (argc < 3 || argc > 4)
+        {
+            PrintUsage();
+            return 1;
+        }
+
+        int numBlocks = argc == 4 ? atoi(argv[3]) : 100000;
+        if (numBlocks < 1 || !WriteScene(argv[2], numBlocks))
+            return 1;
+
+        printf("Wrote %s: %d blocks\n", argv[2], numBlocks);
+        return 0;
+    }
+
+    if (argc > 3)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    std::string input = argv[1];
+    int runs = argc == 3 ? atoi(argv[2]) : 5;
+    if (runs < 1)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    // Loads run on a copy, so the scene cache each run removes is the benchmark's own
+    // and not the one the renderer keeps next to the input
+    std::string copy = input + ".parse_bench.scene";
+    std::string cache = copy + ".cache";
+    if (!CopyScene(input, copy))
+        return 1;
+
+    Log = CaptureLog;
+
+    double bestParseMs = 0.0;
+    double bestLoadMs = 0.0;
+    int numBlocks = 0;
+    bool ok = true;
+
+    for (int run = 0; run < runs && ok; run++)
+    {
+        // Every run parses the file and builds the scene instead of restoring it
+        remove(cache.c_str());
+        parsedBlocks = 0;
+
+        Scene *scene = new Scene();
+        RenderOptions renderOptions;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        bool loaded = LoadSceneFromFile(copy, scene, renderOptions);
+        auto end = std::chrono::high_resolution_clock::now();
+        delete scene;
+
+        if (!loaded || parsedBlocks == 0)
+        {
+            printf("Unable to load %s\n", input.c_str());
+            ok = false;
+            break;
+        }
+
+        double loadMs = std::chrono::duration<double, std::milli>(end - start).count();
+        bestParseMs = run == 0 ? parseMs : std::min(bestParseMs, parseMs);
+        bestLoadMs = run == 0 ? loadMs : std::min(bestLoadMs, loadMs);
+        numBlocks = parsedBlocks;
+    }
+    remove(cache.c_str());
+    remove(copy.c_str());
+
+    if (!ok)
+        return 1;
+
+    printf("%s: %d blocks, best of %d runs\n", input.c_str(), numBlocks, runs);
+    printf("Parse  %9.2f ms %10.0f blocks/s\n", bestParseMs, bestParseMs > 0.0 ? numBlocks * 1000.0 / bestParseMs : 0.0);
+    printf("Load   %9.2f ms\n", bestLoadMs);
+
+    return 0;
+}